@@ -25,6 +25,7 @@
 #include <linux/cdev.h>
 #include <linux/clk.h>
 #include <linux/ctype.h>
+#include <linux/delay.h>
 #include <linux/device.h>
 #include <linux/fs.h>
 #include <linux/gpio.h>
@@ -106,6 +107,47 @@ ov5640_proc_read( struct seq_file * m, void * v )
     return 0;
 }
 
+// the pulse runs under drv->sem; keep a typo from holding the device for hours
+static int
+ov5640_gpio_pulse_check( const struct ov5640_gpio_pulse * pulse )
+{
+    if ( pulse->low_us > OV5640_GPIO_PULSE_MAX_US
+         || pulse->high_us > OV5640_GPIO_PULSE_MAX_US
+         || pulse->settle_timeout_us > OV5640_GPIO_PULSE_MAX_US )
+        return -EINVAL;
+    return 0;
+}
+
+static int
+ov5640_gpio_pulse( struct ov5640_gpio_driver * drv, struct ov5640_gpio_pulse * pulse )
+{
+    const int active = ( pulse->flags & OV5640_GPIO_PULSE_INVERT ) ? 1 : 0;
+    int ret = 0;
+
+    ktime_t t0 = ktime_get();
+
+    gpiod_set_value( drv->rst_gpio, active );
+    usleep_range( pulse->low_us, pulse->low_us + pulse->low_us / 8 + 10 );
+    gpiod_set_value( drv->rst_gpio, !active );
+
+    if ( pulse->settle_timeout_us ) {
+        ktime_t deadline = ktime_add_us( ktime_get(), pulse->settle_timeout_us );
+        while ( gpiod_get_value( drv->rst_gpio ) == active ) {
+            if ( ktime_after( ktime_get(), deadline ) ) {
+                ret = -ETIMEDOUT;
+                break;
+            }
+            usleep_range( 10, 20 );
+        }
+    }
+
+    if ( ret == 0 && pulse->high_us )
+        usleep_range( pulse->high_us, pulse->high_us + pulse->high_us / 8 + 10 );
+
+    pulse->elapsed_ns = ktime_to_ns( ktime_sub( ktime_get(), t0 ) );
+    return ret;
+}
+
 static ssize_t
 ov5640_proc_write( struct file * filep, const char * user, size_t size, loff_t * f_off )
 {
@@ -124,6 +166,20 @@ ov5640_proc_write( struct file * filep, const char * user, size_t size, loff_t *
         dev_info( &__pdev->dev, "proc_write = %s\n", readbuf );
 
     long value = -1;
+    if ( strncmp( readbuf, "pulse", 5 ) == 0 && ( readbuf[ 5 ] == '\0' || isspace( readbuf[ 5 ] ) ) ) { // "pulse [<low_us>]"
+        struct ov5640_gpio_pulse pulse = { .low_us = 1000, .high_us = 0, .settle_timeout_us = 1000, .flags = 0 };
+        const char * arg = strim( &readbuf[ 5 ] );
+        if ( *arg && kstrtouint( arg, 0, &pulse.low_us ) )
+            return -EINVAL;
+        if ( ov5640_gpio_pulse_check( &pulse ) )
+            return -EINVAL;
+        if ( down_interruptible( &drv->sem ) )
+            return -ERESTARTSYS;
+        int ret = ov5640_gpio_pulse( drv, &pulse );
+        up( &drv->sem );
+        dev_info( &__pdev->dev, "%s: pulse %uus --> %lldns (%d)\n", __func__, pulse.low_us, pulse.elapsed_ns, ret );
+        return size;
+    }
     if ( strncmp( readbuf, "down", 4 ) == 0 ) {
         value = 0;
     } else if ( strncmp(readbuf, "up", 2 ) == 0 ) {
@@ -184,8 +240,35 @@ ov5640_cdev_release( struct inode *inode, struct file *file )
 
 static long ov5640_cdev_ioctl( struct file * file, unsigned int code, unsigned long args )
 {
-    dev_info( &__pdev->dev, "%s: code=%x, args=%lu\n", __func__, code, args );
-    return 0;
+    struct ov5640_gpio_driver * drv = platform_get_drvdata( __pdev );
+    if ( !drv || !drv->rst_gpio )
+        return -ENODEV;
+
+    switch ( code ) {
+    case OV5640_GPIO_IOC_PULSE: {
+        struct ov5640_gpio_pulse pulse;
+        if ( copy_from_user( &pulse, (void __user *)args, sizeof( pulse ) ) )
+            return -EFAULT;
+        if ( ov5640_gpio_pulse_check( &pulse ) )
+            return -EINVAL;
+
+        if ( down_interruptible( &drv->sem ) )
+            return -ERESTARTSYS;
+        int ret = ov5640_gpio_pulse( drv, &pulse );
+        up( &drv->sem );
+
+        if ( __debug_level__ > 0 )
+            dev_info( &__pdev->dev, "%s: pulse low=%uus high=%uus --> %lldns (%d)\n"
+                      , __func__, pulse.low_us, pulse.high_us, pulse.elapsed_ns, ret );
+
+        if ( copy_to_user( (void __user *)args, &pulse, sizeof( pulse ) ) )
+            return -EFAULT;
+        return ret;
+    }
+    default:
+        break;
+    }
+    return -ENOTTY;
 }
 
 static ssize_t ov5640_cdev_read( struct file * file, char __user* data, size_t size, loff_t* f_pos )
@@ -24,8 +24,32 @@
 
 #pragma once
 
+#ifdef __KERNEL__
 #include <linux/version.h>
 #include <linux/cdev.h>
+#endif
+#include <linux/ioctl.h>
+#include <linux/types.h>
 
 #define MODNAME     "ov5640-gpio"
 #define CDEV_NAME   MODNAME
+
+/*
+ * Reset/power pulse generated in the kernel: the line is driven to the
+ * inactive level for 'low_us', restored, optionally polled until it reads
+ * back restored (up to 'settle_timeout_us'), then held for 'high_us' before
+ * the ioctl returns.  'elapsed_ns' is filled in with the whole pulse length.
+ */
+struct ov5640_gpio_pulse {
+    __u32 low_us;
+    __u32 high_us;
+    __u32 settle_timeout_us; // 0: do not wait for readback
+    __u32 flags;             // OV5640_GPIO_PULSE_xxx
+    __s64 elapsed_ns;        // out
+};
+
+#define OV5640_GPIO_PULSE_INVERT   0x0001 // pulse high instead of low
+#define OV5640_GPIO_PULSE_MAX_US   1000000 // per phase; longer requests fail with EINVAL
+
+#define OV5640_GPIO_IOC_MAGIC      'o'
+#define OV5640_GPIO_IOC_PULSE      _IOWR( OV5640_GPIO_IOC_MAGIC, 1, struct ov5640_gpio_pulse )
@@ -27,6 +27,7 @@
 #include <linux/ctype.h>
 #include <linux/delay.h>
 #include <linux/device.h>
+#include <linux/dma-buf.h>
 #include <linux/dma-mapping.h>
 #include <linux/fs.h>
 #include <linux/of_gpio.h>
@@ -36,6 +37,7 @@
 #include <linux/ioctl.h>
 #include <linux/irq.h>
 #include <linux/kernel.h>
+#include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/miscdevice.h>
 #include <linux/proc_fs.h> // create_proc_entry
@@ -44,6 +46,8 @@
 #include <linux/uaccess.h>
 #include <linux/slab.h>
 #include <linux/platform_device.h>
+#include <linux/poll.h>
+#include <linux/spinlock.h>
 #include <linux/time.h>
 
 static char *devname = MODNAME;
@@ -53,13 +57,18 @@ MODULE_DESCRIPTION( "Driver for vdma" );
 MODULE_LICENSE("GPL");
 MODULE_PARM_DESC(devname, MODNAME " param");
 module_param( devname, charp, S_IRUGO );
+#if LINUX_VERSION_CODE >= KERNEL_VERSION( 5, 16, 0 )
+MODULE_IMPORT_NS( DMA_BUF );
+#endif
 
 #define countof(x) (sizeof(x)/sizeof((x)[0]))
+#define VDMA_BANK_STORES 16 // start-address registers per channel; REG_INDEX selects stores 16..31
 
 enum VDMA_OFFSET {
     OFFSET_VDMA_MM2S_CONTROL_REGISTER       = 0x00
     , OFFSET_VDMA_MM2S_STATUS_REGISTER        = 0x04
     , OFFSET_VDMA_MM2S_REG_INDEX              = 0x14
+    , OFFSET_VDMA_MM2S_FRMSTORE               = 0x18
     , OFFSET_PARK_PTR_REG                     = 0x28
     , OFFSET_VERSION                          = 0x2c
     , OFFSET_VDMA_MM2S_VSIZE                  = 0x50
@@ -74,6 +83,7 @@ enum VDMA_OFFSET {
     , OFFSET_VDMA_S2MM_STATUS_REGISTER        = 0x34
     , OFFSET_VDMA_S2MM_IRQ_MASK               = 0x3c
     , OFFSET_VDMA_S2MM_REG_INDEX              = 0x44
+    , OFFSET_VDMA_S2MM_FRMSTORE               = 0x48
     , OFFSET_VDMA_S2MM_VSIZE                  = 0xa0
     , OFFSET_VDMA_S2MM_HSIZE                  = 0xa4
     , OFFSET_VDMA_S2MM_FRMDLY_STRIDE          = 0xa8
@@ -86,13 +96,12 @@ enum VDMA_OFFSET {
 static struct platform_driver __vdma_platform_driver;
 struct platform_device * __pdev;
 
-enum dma_ingress_egress {
-    dma_size      = 0x00100000*5
-};
-
 struct vdma_driver {
     uint32_t irq[ 2 ];
     uint64_t irqCount;
+    u32 sr_counts[ 16 ];  // interrupts that saw S2MM_VDMASR bit n set; written only by handle_interrupt
+    u32 irq_mm2s;         // interrupts raised by the MM2S channel (not enabled by this driver)
+    u32 irq_spurious;     // interrupts with no interrupt bit set on either channel
     void __iomem * iomem;
     wait_queue_head_t queue;
     int queue_condition;
@@ -101,12 +110,29 @@ struct vdma_driver {
     uint32_t readp;  // fpga read phys addr
     dma_addr_t dma_handle[ 32 ];
     uint32_t * dma_vaddr[ 32 ];
+    u32 buffer_count; // number of dma_vaddr[] allocated
+    u32 buffer_size;  // bytes per buffer, page aligned
+    bool cached;      // buffers are from dma_alloc_noncoherent
+    u32 max_buffers;  // S2MM frame stores implemented in the core
+    u32 frame_stores; // frame stores the S2MM channel cycles through (FRMSTORE read back)
+    struct vdma_format fmt;
+    atomic_t mappings; // live mmaps of any buffer; reallocation is refused while non-zero
+    atomic_t exports;  // live dma_bufs exported by VDMA_IOC_EXPBUF, same rule
+    spinlock_t lock;  // protects ring, ring_head and the frame accounting below
+    struct vdma_frame ring[ VDMA_FRAME_RING ];
+    u64 ring_head;    // records ever written; ring[ ring_head & ( VDMA_FRAME_RING - 1 ) ] is next
+    u64 frame_seq;
+    u64 frames_dropped;
+    u32 last_wr;      // PARK_PTR write store at the previous interrupt
+    bool last_wr_valid;
 };
 
 struct vdma_cdev_reader {
     struct vdma_driver * drv;
     u32 minor;
+    bool frames;      // opened through a misc device: read() returns frame records, else the register window
     u32 size;
+    u64 next;         // next ring record to return to this file
 };
 
 enum { dg_data_irq_mask = 2 };
@@ -152,6 +178,22 @@ static void vdma_status_print( struct seq_file * m, u32 status )
     seq_printf(m, "%s", (status & 0x01) ? "halted" : "running" );
 }
 
+// S2MM_VDMASR bits that are R/WC; the internal/slave/decode errors only clear on reset
+enum { sr_w1c_mask = 0x8000 | 0x4000 | 0x2000 | 0x1000 | 0x0800 | 0x0100 | 0x0080 };
+
+static const char * const sr_bit_names[ 16 ] = {
+    [ 4 ] = "vdma-internal-error"
+    , [ 5 ] = "vdma-slave-error"
+    , [ 6 ] = "vdma-decode-error"
+    , [ 7 ] = "start-of-frame-early-error"
+    , [ 8 ] = "end-of-line-early-error"
+    , [ 11 ] = "start-of-frame-late-error"
+    , [ 12 ] = "frame-count-interrupt"
+    , [ 13 ] = "delay-count-interrupt"
+    , [ 14 ] = "error-interrupt"
+    , [ 15 ] = "end-of-line-late-error"
+};
+
 static void vdma_cr_print( struct seq_file * m, u32 value )
 {
     seq_printf(m, "irq-delay-count:%d;", value >> 24 );
@@ -235,7 +277,10 @@ static void vdma_start_triple_buffering( struct vdma_driver * drv )
     vdma_reset( drv );
     while ( vdma_reset_busy( drv ) )
         ;
-    int interrupt_frame_count = 3;
+    if ( drv->buffer_count == 0 )
+        return;
+    drv->last_wr_valid = false; // no drop accounting across a restart
+    int interrupt_frame_count = drv->fmt.irq_frame_count;
     u32* mm2scr = (u32*)drv->iomem + (0x00/sizeof(u32));
     u32* mm2ssr = (u32*)drv->iomem + (0x04/sizeof(u32));
     u32* s2mmcr = (u32*)drv->iomem + (0x30/sizeof(u32));
@@ -262,28 +307,45 @@ static void vdma_start_triple_buffering( struct vdma_driver * drv )
     vdma_write32( drv, 0x14, 0 ); // MM2S Index -> 0
     vdma_write32( drv, 0x44, 0 ); // S2MM Index -> 0
 
-    for ( int i = 0; i < 4; ++ i ) {
-        ((u32*)drv->iomem)[ i + 0x5c / sizeof(u32) ] = drv->dma_handle[ i ];
-        ((u32*)drv->iomem)[ i + 0xac / sizeof(u32) ] = drv->dma_handle[ i ];
+    vdma_write32( drv, OFFSET_VDMA_S2MM_FRMSTORE, drv->buffer_count );
+    vdma_write32( drv, OFFSET_VDMA_MM2S_FRMSTORE, drv->buffer_count );
+    drv->frame_stores = vdma_read32( drv, OFFSET_VDMA_S2MM_FRMSTORE ) & 0x3f; // read-only unless the core allows it
+    if ( drv->frame_stores == 0 || drv->frame_stores > drv->max_buffers )
+        drv->frame_stores = drv->max_buffers;
+
+    // every implemented store gets an address, so a core that ignores FRMSTORE never writes to 0;
+    // stores past the first 16 go through the same registers with REG_INDEX = 1
+    for ( u32 bank = 0; bank * VDMA_BANK_STORES < drv->max_buffers; ++bank ) {
+        vdma_write32( drv, OFFSET_VDMA_MM2S_REG_INDEX, bank );
+        vdma_write32( drv, OFFSET_VDMA_S2MM_REG_INDEX, bank );
+        for ( u32 k = 0; k < VDMA_BANK_STORES && bank * VDMA_BANK_STORES + k < drv->max_buffers; ++k ) {
+            dma_addr_t addr = drv->dma_handle[ ( bank * VDMA_BANK_STORES + k ) % drv->buffer_count ];
+            vdma_write32( drv, OFFSET_VDMA_MM2S_FRAMEBUFFER1 + k * sizeof( u32 ), addr );
+            vdma_write32( drv, OFFSET_VDMA_S2MM_FRAMEBUFFER1 + k * sizeof( u32 ), addr );
+        }
     }
+    vdma_write32( drv, OFFSET_VDMA_MM2S_REG_INDEX, 0 );
+    vdma_write32( drv, OFFSET_VDMA_S2MM_REG_INDEX, 0 );
     ((u32*)drv->iomem)[ OFFSET_PARK_PTR_REG / sizeof(u32) ] = 0; // parc ptr_reg
 
     // int
     // vdma_setup(vdma_handle *handle, unsigned int baseAddr,
     // int width, int height, int pixelLength, unsigned int fb1Addr, unsigned int fb2Addr, unsigned int fb3Addr) {
-    vdma_write32(drv, OFFSET_VDMA_S2MM_FRMDLY_STRIDE, 1920 * 4 );
-    vdma_write32(drv, OFFSET_VDMA_MM2S_FRMDLY_STRIDE, 1920 * 4 );
+    vdma_write32(drv, OFFSET_VDMA_S2MM_FRMDLY_STRIDE, drv->fmt.stride );
+    vdma_write32(drv, OFFSET_VDMA_MM2S_FRMDLY_STRIDE, drv->fmt.stride );
 
     // Write horizontal size (bytes)
-    vdma_write32(drv, OFFSET_VDMA_S2MM_HSIZE, 1920 * 4 );
-    vdma_write32(drv, OFFSET_VDMA_MM2S_HSIZE, 1920 * 4 );
+    vdma_write32(drv, OFFSET_VDMA_S2MM_HSIZE, drv->fmt.width * drv->fmt.bytes_per_pixel );
+    vdma_write32(drv, OFFSET_VDMA_MM2S_HSIZE, drv->fmt.width * drv->fmt.bytes_per_pixel );
 
     // Write vertical size (lines), this actually starts the transfer
-    vdma_write32(drv, OFFSET_VDMA_S2MM_VSIZE, 1080 );
-    vdma_write32(drv, OFFSET_VDMA_MM2S_VSIZE, 1080 );
+    vdma_write32(drv, OFFSET_VDMA_S2MM_VSIZE, drv->fmt.height );
+    vdma_write32(drv, OFFSET_VDMA_MM2S_VSIZE, drv->fmt.height );
 
     *s2mmcr =
         (interrupt_frame_count << 16) |
+        0x4000 | // VDMA_CONTROL_REGISTER_ERR_IRQ_EN |
+        0x1000 | // VDMA_CONTROL_REGISTER_FRMCNT_IRQ_EN |
         0x0080 | // VDMA_CONTROL_REGISTER_INTERNAL_GENLOCK |
         0x0008 | // VDMA_CONTROL_REGISTER_GENLOCK_ENABLE |
         0x0002 | // VDMA_CONTROL_REGISTER_CIRCULAR_PARK);
@@ -297,18 +359,165 @@ static void vdma_start_triple_buffering( struct vdma_driver * drv )
         0x0001 ; // Run/Stop  (1 = RUN)
 
     int counter = 1000;
-    while ( counter-- && ( ((*s2mmcr) & 01) == 0 || ((*s2mmsr) & 01) == 1 ) ) {
-        dev_info( &__pdev->dev, "%s -- waiting for VDMA to start running CR=%x,SR=%x; %d.\n", __func__, *s2mmcr, *s2mmsr, counter );
+    while ( counter-- && ( ((*s2mmcr) & 01) == 0 || ((*s2mmsr) & 01) == 1 ) )
+        cpu_relax();
+    dev_info( &__pdev->dev, "%s -- %s VDMA to start running CR=%x,SR=%x; %d polls left.\n"
+              , __func__, counter >= 0 ? "done" : "timed out waiting for", *s2mmcr, *s2mmsr, counter );
+}
+
+static void vdma_free_buffers( struct vdma_driver * drv )
+{
+    for ( u32 i = 0; i < drv->buffer_count; ++i ) {
+        if ( drv->cached )
+            dma_free_noncoherent( &__pdev->dev, drv->buffer_size, drv->dma_vaddr[ i ], drv->dma_handle[ i ], DMA_BIDIRECTIONAL );
+        else
+            dma_free_coherent( &__pdev->dev, drv->buffer_size, drv->dma_vaddr[ i ], drv->dma_handle[ i ] );
+        drv->dma_vaddr[ i ] = 0;
+    }
+    drv->buffer_count = 0;
+}
+
+// cached buffers are written by S2MM and read back by MM2S, hence DMA_BIDIRECTIONAL
+static int vdma_alloc_buffers( struct vdma_driver * drv, u32 count, u32 size, bool cached )
+{
+    drv->buffer_size = size;
+    drv->cached = cached;
+    for ( u32 i = 0; i < count; ++i ) {
+        if ( cached )
+            drv->dma_vaddr[ i ] = dma_alloc_noncoherent( &__pdev->dev, size, &drv->dma_handle[ i ], DMA_BIDIRECTIONAL, GFP_KERNEL );
+        else
+            drv->dma_vaddr[ i ] = dma_alloc_coherent( &__pdev->dev, size, &drv->dma_handle[ i ], GFP_KERNEL );
+        if ( !drv->dma_vaddr[ i ] ) {
+            dev_err( &__pdev->dev, "failed vdma dma alloc %s %u x %u bytes\n", cached ? "noncoherent" : "coherent", count, size );
+            vdma_free_buffers( drv );
+            return -ENOMEM;
+        }
+        if ( cached ) // nothing of the CPU's may be left in the cache once the device owns it
+            dma_sync_single_for_device( &__pdev->dev, drv->dma_handle[ i ], size, DMA_BIDIRECTIONAL );
+        drv->buffer_count = i + 1;
+    }
+    return 0;
+}
+
+static int vdma_sync( struct vdma_driver * drv, const struct vdma_sync * sync )
+{
+    if ( sync->index >= drv->buffer_count || sync->offset >= drv->buffer_size )
+        return -EINVAL;
+    if ( !drv->cached )
+        return 0;
+
+    u32 length = sync->length ? sync->length : drv->buffer_size - sync->offset;
+    if ( length > drv->buffer_size - sync->offset )
+        return -EINVAL;
+
+    if ( sync->flags & VDMA_SYNC_END ) {
+        dma_sync_single_range_for_device( &__pdev->dev, drv->dma_handle[ sync->index ], sync->offset, length
+                                          , ( sync->flags & VDMA_SYNC_WRITE ) ? DMA_TO_DEVICE : DMA_FROM_DEVICE );
+    } else {
+        dma_sync_single_range_for_cpu( &__pdev->dev, drv->dma_handle[ sync->index ], sync->offset, length, DMA_FROM_DEVICE );
     }
-    dev_info( &__pdev->dev, "%s -- done VDMA to start running CR=%x,SR=%x; %d.\n", __func__, *s2mmcr, *s2mmsr, counter );
+    return 0;
+}
+
+static int vdma_check_format( struct vdma_driver * drv, struct vdma_format * fmt )
+{
+    if ( fmt->width == 0 || fmt->height == 0 || fmt->bytes_per_pixel == 0 || fmt->bytes_per_pixel > 8 )
+        return -EINVAL;
+    u32 hsize = fmt->width * fmt->bytes_per_pixel;
+    if ( fmt->stride == 0 )
+        fmt->stride = hsize;
+    // HSIZE and STRIDE are 16 bit, VSIZE is 13 bit
+    if ( hsize > 0xffff || fmt->stride < hsize || fmt->stride > 0xffff || fmt->height > 0x1fff )
+        return -EINVAL;
+    if ( fmt->buffer_count == 0 || fmt->buffer_count > drv->max_buffers )
+        return -EINVAL;
+    if ( fmt->irq_frame_count == 0 || fmt->irq_frame_count > 255 )
+        return -EINVAL;
+    if ( fmt->flags & ~VDMA_FMT_CACHED )
+        return -EINVAL;
+    fmt->frame_size = fmt->stride * fmt->height;
+    fmt->max_buffers = drv->max_buffers;
+    return 0;
+}
+
+// caller holds drv->sem
+static int vdma_set_format( struct vdma_driver * drv, struct vdma_format * fmt )
+{
+    int ret = vdma_check_format( drv, fmt );
+    if ( ret )
+        return ret;
+
+    u32 size = PAGE_ALIGN( fmt->frame_size );
+    bool cached = fmt->flags & VDMA_FMT_CACHED;
+    if ( size != drv->buffer_size || fmt->buffer_count != drv->buffer_count || cached != drv->cached ) {
+        if ( atomic_read( &drv->mappings ) || atomic_read( &drv->exports ) )
+            return -EBUSY;
+        vdma_reset( drv );
+        while ( vdma_reset_busy( drv ) )
+            ;
+        vdma_free_buffers( drv );
+        if (( ret = vdma_alloc_buffers( drv, fmt->buffer_count, size, cached ) ))
+            return ret; // channel stays halted without buffers
+    }
+    drv->fmt = *fmt;
+    vdma_start_triple_buffering( drv );
+    return 0;
 }
 
 static irqreturn_t
 handle_interrupt( int irq, void *dev_id )
 {
-    dev_info( &__pdev->dev, "handle_interrupt\n" );
-    struct vdma_driver * driver = dev_id ? platform_get_drvdata( dev_id ) : 0;
-    (void)(driver);
+    ktime_t timestamp = ktime_get();
+    struct vdma_driver * drv = dev_id ? platform_get_drvdata( dev_id ) : 0;
+    if ( !drv )
+        return IRQ_NONE;
+
+    // no logging here: counts only, reported through /proc/vdma
+    u32 status = vdma_read32( drv, OFFSET_VDMA_S2MM_STATUS_REGISTER );
+    vdma_write32( drv, OFFSET_VDMA_S2MM_STATUS_REGISTER, status & sr_w1c_mask );
+
+    drv->irqCount++;
+    if ( ( status & 0x7000 ) == 0 ) {
+        u32 mm2s = vdma_read32( drv, OFFSET_VDMA_MM2S_STATUS_REGISTER );
+        if ( mm2s & 0x7000 ) {
+            vdma_write32( drv, OFFSET_VDMA_MM2S_STATUS_REGISTER, mm2s & sr_w1c_mask );
+            drv->irq_mm2s++;
+            return IRQ_HANDLED;
+        }
+        drv->irq_spurious++;
+        return IRQ_NONE;
+    }
+    for ( u32 bits = status & 0xfff0; bits; bits &= bits - 1 )
+        drv->sr_counts[ __ffs( bits ) ]++;
+
+    if ( ( status & 0x1000 ) && drv->buffer_count ) { // frame-count-interrupt
+        // PARK_PTR[28:24] is the frame store being written; the one before it has just completed
+        u32 wr = ( vdma_read32( drv, OFFSET_PARK_PTR_REG ) >> 24 ) & 0x1f;
+        u32 n = drv->frame_stores ? drv->frame_stores : 1;
+
+        spin_lock( &drv->lock );
+        u32 dropped = 0;
+        if ( drv->last_wr_valid ) {
+            u32 step = ( wr + n - drv->last_wr ) % n;
+            dropped = ( step + n - ( drv->fmt.irq_frame_count % n ) ) % n;
+        }
+        drv->last_wr = wr;
+        drv->last_wr_valid = true;
+        drv->frame_seq += drv->fmt.irq_frame_count + dropped;
+        drv->frames_dropped += dropped;
+
+        struct vdma_frame * rec = &drv->ring[ drv->ring_head & ( VDMA_FRAME_RING - 1 ) ];
+        rec->frame_seq = drv->frame_seq;
+        rec->buffer_index = ( ( wr + n - 1 ) % n ) % drv->buffer_count;
+        rec->status = status & 0xffff;
+        rec->dropped = dropped;
+        rec->timestamp_ns = ktime_to_ns( timestamp );
+        rec->lost = 0;
+        drv->ring_head++;
+        spin_unlock( &drv->lock );
+
+        wake_up_interruptible( &drv->queue );
+    }
     return IRQ_HANDLED;
 }
 
@@ -351,6 +560,19 @@ vdma_proc_read( struct seq_file * m, void * v )
         for ( size_t k = 0; k < 8; ++k ) {
             seq_printf( m, "[%02x] 0x%08x\t", k, vdma_read32( drv, OFFSET_VDMA_MM2S_FRAMEBUFFER1 + (k * sizeof( u32 )) ) );
         }
+        seq_printf( m, "\nformat: %ux%u %u bytes/pixel, stride %u; %u/%u %s buffers of %u bytes, irq every %u frame(s), %d mapping(s)"
+                    , drv->fmt.width, drv->fmt.height, drv->fmt.bytes_per_pixel, drv->fmt.stride
+                    , drv->buffer_count, drv->max_buffers, drv->cached ? "cached" : "coherent"
+                    , drv->buffer_size, drv->fmt.irq_frame_count
+                    , atomic_read( &drv->mappings ) );
+        seq_printf( m, ", %d exported", atomic_read( &drv->exports ) );
+        seq_printf( m, "\nframes: %llu, dropped %llu, ring records %llu"
+                    , drv->frame_seq, drv->frames_dropped, drv->ring_head );
+        seq_printf( m, "\ninterrupts: %llu, mm2s %u, spurious %u", drv->irqCount, drv->irq_mm2s, drv->irq_spurious );
+        for ( size_t i = 0; i < countof( sr_bit_names ); ++i ) {
+            if ( sr_bit_names[ i ] )
+                seq_printf( m, "\n\t%-28s %u", sr_bit_names[ i ], drv->sr_counts[ i ] );
+        }
         seq_printf( m, "\nDMA pages\n" );
         for ( size_t i = 0; i < countof( drv->dma_vaddr ) && drv->dma_vaddr[ i ]; ++i ) {
             seq_printf( m, "[%02d] 0x%08x\t", i, drv->dma_handle[ i ] );
@@ -379,15 +601,28 @@ vdma_proc_write( struct file * filep, const char * user, size_t size, loff_t * f
         vdma_start_triple_buffering( drv );
     } else if ( strncmp( readbuf, "vsize", 5 ) == 0 ) {
         unsigned long vsize;
-        if ( kstrtoul( &readbuf[5], 0, &vsize ) == 0 ) {
+        if ( kstrtoul( skip_spaces( &readbuf[5] ), 0, &vsize ) == 0 ) {
             dev_info( &__pdev->dev, "vsize=%lu\n", vsize );
-            // todo: set value to hardware
+            struct vdma_format fmt = drv->fmt;
+            fmt.height = vsize;
+            if ( down_interruptible( &drv->sem ) == 0 ) {
+                if ( vdma_set_format( drv, &fmt ) )
+                    dev_err( &__pdev->dev, "vsize=%lu rejected\n", vsize );
+                up( &drv->sem );
+            }
         }
     } else if ( strncmp( readbuf, "hsize", 5 ) == 0 ) {
-        unsigned long hsize;
-        if ( kstrtoul( &readbuf[5], 0, &hsize ) == 0 ) {
+        unsigned long hsize; // bytes
+        if ( kstrtoul( skip_spaces( &readbuf[5] ), 0, &hsize ) == 0 ) {
             dev_info( &__pdev->dev, "hsize=%lu\n", hsize );
-            // todo: set value to hardware
+            struct vdma_format fmt = drv->fmt;
+            fmt.width = hsize / fmt.bytes_per_pixel;
+            fmt.stride = 0;
+            if ( down_interruptible( &drv->sem ) == 0 ) {
+                if ( vdma_set_format( drv, &fmt ) )
+                    dev_err( &__pdev->dev, "hsize=%lu rejected\n", hsize );
+                up( &drv->sem );
+            }
         }
     }
     return size;
@@ -411,14 +646,21 @@ static int vdma_cdev_open(struct inode *inode, struct file *file)
 {
     unsigned int minor = MINOR( inode->i_rdev );
     struct vdma_cdev_reader * reader = devm_kzalloc( &__pdev->dev, sizeof( struct vdma_cdev_reader ), GFP_KERNEL );
+    if ( !reader )
+        return -ENOMEM;
     reader->drv = platform_get_drvdata( __pdev );
     reader->minor = minor;
+    // misc_open() leaves the struct miscdevice here; the class cdev leaves NULL.  The
+    // minors of the two overlap, so the node kind cannot be told from the minor
+    reader->frames = file->private_data != NULL;
     file->private_data = reader;
-    if ( minor == 0 ) {
+    if ( reader->drv )
+        reader->next = READ_ONCE( reader->drv->ring_head ); // only frames landing after open
+    if ( !reader->frames ) {
         reader->size = __pdev->resource->end - __pdev->resource->start + 1;
     }
 
-    dev_info( &__pdev->dev, "vdma_cdev_open minor=%d\n", minor );
+    dev_info( &__pdev->dev, "vdma_cdev_open minor=%d %s\n", minor, reader->frames ? "frames" : "registers" );
 
     return 0;
 }
@@ -435,17 +677,286 @@ vdma_cdev_release( struct inode *inode, struct file *file )
     return 0;
 }
 
-static long vdma_cdev_ioctl( struct file * file, unsigned int code, unsigned long args )
+static void vdma_vm_open( struct vm_area_struct * vma )
+{
+    struct vdma_driver * drv = vma->vm_private_data;
+    atomic_inc( &drv->mappings );
+}
+
+static void vdma_vm_close( struct vm_area_struct * vma )
+{
+    struct vdma_driver * drv = vma->vm_private_data;
+    atomic_dec( &drv->mappings );
+}
+
+static const struct vm_operations_struct vdma_vm_ops = {
+    .open  = vdma_vm_open
+    , .close = vdma_vm_close
+};
+
+// vm_pgoff is relative to the start of buffer 'index'
+static int vdma_mmap_buffer( struct vdma_driver * drv, u32 index, struct vm_area_struct * vma )
+{
+    const size_t length = vma->vm_end - vma->vm_start;
+    if ( ( vma->vm_pgoff << PAGE_SHIFT ) + length > drv->buffer_size )
+        return -EINVAL;
+
+    int ret;
+    if ( drv->cached )
+        ret = dma_mmap_pages( &__pdev->dev, vma, drv->buffer_size, virt_to_page( drv->dma_vaddr[ index ] ) );
+    else
+        ret = dma_mmap_coherent( &__pdev->dev, vma, drv->dma_vaddr[ index ], drv->dma_handle[ index ], drv->buffer_size );
+    if ( ret == 0 ) {
+        vma->vm_ops = &vdma_vm_ops;
+        vma->vm_private_data = drv;
+        vdma_vm_open( vma );
+    }
+    return ret;
+}
+
+/*
+ * dma-buf exporter: one dma_buf per frame buffer.  The buffer may not be
+ * reallocated while any exported dma_buf is alive (drv->exports).
+ */
+struct vdma_dmabuf {
+    struct vdma_driver * drv;
+    u32 index;
+};
+
+static struct sg_table *
+vdma_dmabuf_map( struct dma_buf_attachment * attach, enum dma_data_direction dir )
+{
+    struct vdma_dmabuf * priv = attach->dmabuf->priv;
+    struct vdma_driver * drv = priv->drv;
+    struct sg_table * sgt = kzalloc( sizeof( *sgt ), GFP_KERNEL );
+    if ( !sgt )
+        return ERR_PTR( -ENOMEM );
+
+    int ret;
+    if ( drv->cached ) {
+        if (( ret = sg_alloc_table( sgt, 1, GFP_KERNEL ) ) == 0 )
+            sg_set_page( sgt->sgl, virt_to_page( drv->dma_vaddr[ priv->index ] ), drv->buffer_size, 0 );
+    } else {
+        ret = dma_get_sgtable( &__pdev->dev, sgt, drv->dma_vaddr[ priv->index ], drv->dma_handle[ priv->index ], drv->buffer_size );
+    }
+    if ( ret == 0 && ( ret = dma_map_sgtable( attach->dev, sgt, dir, 0 ) ) )
+        sg_free_table( sgt );
+    if ( ret ) {
+        kfree( sgt );
+        return ERR_PTR( ret );
+    }
+    return sgt;
+}
+
+static void
+vdma_dmabuf_unmap( struct dma_buf_attachment * attach, struct sg_table * sgt, enum dma_data_direction dir )
+{
+    dma_unmap_sgtable( attach->dev, sgt, dir, 0 );
+    sg_free_table( sgt );
+    kfree( sgt );
+}
+
+static void
+vdma_dmabuf_release( struct dma_buf * dmabuf )
+{
+    struct vdma_dmabuf * priv = dmabuf->priv;
+    atomic_dec( &priv->drv->exports );
+    kfree( priv );
+}
+
+static int
+vdma_dmabuf_mmap( struct dma_buf * dmabuf, struct vm_area_struct * vma )
+{
+    struct vdma_dmabuf * priv = dmabuf->priv;
+    return vdma_mmap_buffer( priv->drv, priv->index, vma );
+}
+
+static int
+vdma_dmabuf_begin_cpu_access( struct dma_buf * dmabuf, enum dma_data_direction dir )
+{
+    struct vdma_dmabuf * priv = dmabuf->priv;
+    struct vdma_sync sync = { .index = priv->index, .flags = VDMA_SYNC_BEGIN };
+    return vdma_sync( priv->drv, &sync );
+}
+
+static int
+vdma_dmabuf_end_cpu_access( struct dma_buf * dmabuf, enum dma_data_direction dir )
 {
+    struct vdma_dmabuf * priv = dmabuf->priv;
+    struct vdma_sync sync = { .index = priv->index, .flags = VDMA_SYNC_END | ( dir == DMA_FROM_DEVICE ? 0 : VDMA_SYNC_WRITE ) };
+    return vdma_sync( priv->drv, &sync );
+}
+
+static const struct dma_buf_ops vdma_dmabuf_ops = {
+    .map_dma_buf        = vdma_dmabuf_map
+    , .unmap_dma_buf    = vdma_dmabuf_unmap
+    , .release          = vdma_dmabuf_release
+    , .mmap             = vdma_dmabuf_mmap
+    , .begin_cpu_access = vdma_dmabuf_begin_cpu_access
+    , .end_cpu_access   = vdma_dmabuf_end_cpu_access
+};
+
+// caller holds drv->sem
+static int vdma_export( struct vdma_driver * drv, struct vdma_expbuf * exp )
+{
+    if ( exp->index >= drv->buffer_count || ( exp->flags & ~( O_CLOEXEC | O_ACCMODE ) ) )
+        return -EINVAL;
+
+    struct vdma_dmabuf * priv = kzalloc( sizeof( *priv ), GFP_KERNEL );
+    if ( !priv )
+        return -ENOMEM;
+    priv->drv = drv;
+    priv->index = exp->index;
+
+    DEFINE_DMA_BUF_EXPORT_INFO( exp_info );
+    exp_info.ops = &vdma_dmabuf_ops;
+    exp_info.size = drv->buffer_size;
+    exp_info.flags = exp->flags & O_ACCMODE;
+    exp_info.priv = priv;
+
+    struct dma_buf * dmabuf = dma_buf_export( &exp_info );
+    if ( IS_ERR( dmabuf ) ) {
+        kfree( priv );
+        return PTR_ERR( dmabuf );
+    }
+    atomic_inc( &drv->exports ); // dropped in vdma_dmabuf_release
+
+    int fd = dma_buf_fd( dmabuf, exp->flags & O_CLOEXEC );
+    if ( fd < 0 ) {
+        dma_buf_put( dmabuf );
+        return fd;
+    }
+    exp->fd = fd;
     return 0;
 }
 
+// each frame buffer owns a buffer_size window in the mmap offset space
+static inline u64 vdma_buffer_offset( struct vdma_driver * drv, u32 index )
+{
+    return (u64)index * drv->buffer_size;
+}
+
+static long vdma_cdev_ioctl( struct file * file, unsigned int code, unsigned long args )
+{
+    struct vdma_driver * drv = platform_get_drvdata( __pdev );
+    if ( !drv )
+        return -ENODEV;
+
+    long ret = 0;
+    switch ( code ) {
+    case VDMA_IOC_QUERYBUF: {
+        struct vdma_buffer buf;
+        if ( copy_from_user( &buf, (void __user *)args, sizeof( buf ) ) )
+            return -EFAULT;
+        if ( down_interruptible( &drv->sem ) )
+            return -ERESTARTSYS;
+        if ( buf.index < drv->buffer_count ) {
+            buf.length = drv->buffer_size;
+            buf.offset = vdma_buffer_offset( drv, buf.index );
+            buf.dma_addr = drv->dma_handle[ buf.index ];
+        } else {
+            ret = -EINVAL;
+        }
+        up( &drv->sem );
+        if ( ret == 0 && copy_to_user( (void __user *)args, &buf, sizeof( buf ) ) )
+            return -EFAULT;
+        return ret;
+    }
+    case VDMA_IOC_G_FMT:
+        if ( copy_to_user( (void __user *)args, &drv->fmt, sizeof( drv->fmt ) ) )
+            return -EFAULT;
+        return 0;
+    case VDMA_IOC_S_FMT: {
+        struct vdma_format fmt;
+        if ( copy_from_user( &fmt, (void __user *)args, sizeof( fmt ) ) )
+            return -EFAULT;
+        if ( down_interruptible( &drv->sem ) )
+            return -ERESTARTSYS;
+        ret = vdma_set_format( drv, &fmt );
+        up( &drv->sem );
+        if ( ret == 0 && copy_to_user( (void __user *)args, &fmt, sizeof( fmt ) ) )
+            return -EFAULT;
+        return ret;
+    }
+    case VDMA_IOC_EXPBUF: {
+        struct vdma_expbuf exp;
+        if ( copy_from_user( &exp, (void __user *)args, sizeof( exp ) ) )
+            return -EFAULT;
+        if ( down_interruptible( &drv->sem ) )
+            return -ERESTARTSYS;
+        ret = vdma_export( drv, &exp );
+        up( &drv->sem );
+        if ( ret == 0 && copy_to_user( (void __user *)args, &exp, sizeof( exp ) ) )
+            return -EFAULT; // the fd stays installed; nothing sane to undo here
+        return ret;
+    }
+    case VDMA_IOC_SYNC: {
+        struct vdma_sync sync;
+        if ( copy_from_user( &sync, (void __user *)args, sizeof( sync ) ) )
+            return -EFAULT;
+        if ( down_interruptible( &drv->sem ) )
+            return -ERESTARTSYS;
+        ret = vdma_sync( drv, &sync );
+        up( &drv->sem );
+        return ret;
+    }
+    }
+    return -ENOTTY;
+}
+
+static bool vdma_frame_pending( struct vdma_cdev_reader * reader )
+{
+    return READ_ONCE( reader->drv->ring_head ) != reader->next;
+}
+
+static ssize_t vdma_frame_read( struct vdma_cdev_reader * reader, struct file * file, char __user *data, size_t size )
+{
+    struct vdma_driver * drv = reader->drv;
+    struct vdma_frame frame;
+    size_t count = 0;
+
+    if ( !drv )
+        return -ENODEV;
+    if ( size < sizeof( frame ) )
+        return -EINVAL;
+
+    if ( !vdma_frame_pending( reader ) ) {
+        if ( file->f_flags & O_NONBLOCK )
+            return -EAGAIN;
+        if ( wait_event_interruptible( drv->queue, vdma_frame_pending( reader ) ) )
+            return -ERESTARTSYS;
+    }
+
+    while ( ( count + 1 ) * sizeof( frame ) <= size ) {
+        spin_lock_irq( &drv->lock );
+        u64 head = drv->ring_head;
+        if ( head == reader->next ) {
+            spin_unlock_irq( &drv->lock );
+            break;
+        }
+        u32 lost = 0;
+        if ( head - reader->next > VDMA_FRAME_RING ) { // overwritten; resume at the oldest record left
+            lost = head - VDMA_FRAME_RING - reader->next;
+            reader->next = head - VDMA_FRAME_RING;
+        }
+        frame = drv->ring[ reader->next & ( VDMA_FRAME_RING - 1 ) ];
+        frame.lost = lost;
+        reader->next++;
+        spin_unlock_irq( &drv->lock );
+
+        if ( copy_to_user( data + count * sizeof( frame ), &frame, sizeof( frame ) ) )
+            return -EFAULT;
+        ++count;
+    }
+    return count * sizeof( frame );
+}
+
 static ssize_t vdma_cdev_read( struct file * file, char __user *data, size_t size, loff_t *f_pos )
 {
     struct vdma_cdev_reader * reader = 0;
     if (( reader = file->private_data )) {
-        dev_info( &__pdev->dev, "vdma_cdev_read: fpos=%llx, size=%ud\n", *f_pos, size );
-        if ( reader->minor == 0 ) {
+        if ( !reader->frames ) {
+            dev_info( &__pdev->dev, "vdma_cdev_read: fpos=%llx, size=%ud\n", *f_pos, size );
             size_t dsize = reader->size - *f_pos;
             if ( dsize > size )
                 dsize = size;
@@ -454,11 +965,24 @@ static ssize_t vdma_cdev_read( struct file * file, char __user *data, size_t siz
             }
             *f_pos += dsize;
             return dsize;
+        } else {
+            return vdma_frame_read( reader, file, data, size );
         }
     }
     return size;
 }
 
+static __poll_t
+vdma_cdev_poll( struct file * file, struct poll_table_struct * wait )
+{
+    struct vdma_cdev_reader * reader = file->private_data;
+    if ( !reader || !reader->drv )
+        return EPOLLERR;
+
+    poll_wait( file, &reader->drv->queue, wait );
+    return vdma_frame_pending( reader ) ? ( EPOLLIN | EPOLLRDNORM ) : 0;
+}
+
 static ssize_t
 vdma_cdev_write(struct file *file, const char __user *data, size_t size, loff_t *f_pos)
 {
@@ -466,10 +990,28 @@ vdma_cdev_write(struct file *file, const char __user *data, size_t size, loff_t
     return processed;
 }
 
-static ssize_t
+static int
 vdma_cdev_mmap( struct file * file, struct vm_area_struct * vma )
 {
-    return 0; // Success
+    struct vdma_driver * drv = platform_get_drvdata( __pdev );
+    if ( !drv )
+        return -ENODEV;
+
+    if ( down_interruptible( &drv->sem ) )
+        return -ERESTARTSYS;
+
+    int ret = -EINVAL;
+    if ( drv->buffer_count ) {
+        const unsigned long window = drv->buffer_size >> PAGE_SHIFT;
+        const unsigned long index = vma->vm_pgoff / window;
+
+        if ( index < drv->buffer_count ) {
+            vma->vm_pgoff %= window;
+            ret = vdma_mmap_buffer( drv, index, vma );
+        }
+    }
+    up( &drv->sem );
+    return ret;
 }
 
 loff_t
@@ -486,6 +1028,7 @@ static struct file_operations vdma_cdev_fops = {
     , .release = vdma_cdev_release
     , .unlocked_ioctl = vdma_cdev_ioctl
     , .read    = vdma_cdev_read
+    , .poll    = vdma_cdev_poll
     , .write   = vdma_cdev_write
     , .mmap    = vdma_cdev_mmap
 };
@@ -493,13 +1036,13 @@ static struct file_operations vdma_cdev_fops = {
 static struct miscdevice vdma_miscdevice [] = {
     {
         .minor = MISC_DYNAMIC_MINOR
-        , .name = "vdma0"
+        , .name = MODNAME "-frame0"
         , .fops = &vdma_cdev_fops
         , .mode = 0666
     }
     , {
         .minor = MISC_DYNAMIC_MINOR
-        , .name = "vdma1"
+        , .name = MODNAME "-frame1"
         , .fops = &vdma_cdev_fops
         , .mode = 0666
     }
@@ -600,15 +1143,24 @@ vdma_module_probe( struct platform_device * pdev )
     dev_info( &pdev->dev, "vdma probe resource: %x -- %x, map to %p\n"
               , pdev->resource->start, pdev->resource->end, drv->iomem );
     sema_init( &drv->sem, 1 );
-
-    for ( u32 i = 0; i < countof( drv->dma_vaddr ); ++i ) {
-        if (( drv->dma_vaddr[ i ] = dma_alloc_coherent( &pdev->dev, dma_size, &drv->dma_handle[ i ], GFP_KERNEL ) )) {
-            // dev_info( &pdev->dev, "vdma dma alloc_coherent %p\t%x\n", drv->dma_vaddr[ i ], drv->dma_handle[ i ] );
-        } else {
-            dev_err( &pdev->dev, "failed vdma dma alloc_coherent %p\n", drv->dma_vaddr );
-            break;
-        }
-    }
+    init_waitqueue_head( &drv->queue );
+    spin_lock_init( &drv->lock );
+    atomic_set( &drv->mappings, 0 );
+    atomic_set( &drv->exports, 0 );
+
+    drv->max_buffers = vdma_read32( drv, OFFSET_VDMA_S2MM_FRMSTORE ) & 0x3f; // C_NUM_FSTORES after reset
+    if ( drv->max_buffers == 0 || drv->max_buffers > countof( drv->dma_vaddr ) )
+        drv->max_buffers = countof( drv->dma_vaddr );
+
+    drv->fmt = (struct vdma_format){
+        .width = 1920
+        , .height = 1080
+        , .bytes_per_pixel = 4
+        , .buffer_count = min( 4u, drv->max_buffers )
+        , .irq_frame_count = 1 // one interrupt per frame so that every frame wakes the readers
+    };
+    vdma_check_format( drv, &drv->fmt );
+    vdma_alloc_buffers( drv, drv->fmt.buffer_count, PAGE_ALIGN( drv->fmt.frame_size ), false );
 
     for ( int i = 0; i < countof( vdma_miscdevice ); ++i ) {
         misc_register( &vdma_miscdevice[i] );
@@ -640,10 +1192,10 @@ vdma_module_remove( struct platform_device * pdev )
         dev_info( &pdev->dev, "IRQ %d about to be freed\n", drv->irq[ i ] );
         free_irq( drv->irq[ i ], &pdev->dev );
     }
-    for ( u32 i = 0; i < countof( drv->dma_vaddr ) && drv->dma_vaddr[ i ]; ++i ) {
-        dma_free_coherent( &pdev->dev, dma_size, drv->dma_vaddr[ i ], drv->dma_handle[ i ] );
-        // dev_info( &pdev->dev, "dma addr %x about to be freed\n", drv->dma_handle[ i ] );
-    }
+    vdma_reset( drv );
+    while ( vdma_reset_busy( drv ) )
+        ;
+    vdma_free_buffers( drv );
 
     for ( int i = 0; i < countof( vdma_miscdevice ); ++i )
         misc_deregister( &vdma_miscdevice[i] );
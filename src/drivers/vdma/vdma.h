@@ -25,10 +25,108 @@
 #ifndef SOCFPGA_DRIVERS_MSGDMA_H
 #define SOCFPGA_DRIVERS_MSGDMA_H
 
+#ifdef __KERNEL__
 #include <linux/version.h>
 #include <linux/cdev.h>
+#endif
+#include <linux/ioctl.h>
+#include <linux/types.h>
 
 #define MODNAME     "vdma"
 #define CDEV_NAME   MODNAME
 
+/*
+ * Frame buffers are mmap'ed from the cdev; each buffer occupies its own
+ * window in the file offset space, so buffer N is mapped with
+ *   mmap( 0, length, PROT_READ, MAP_SHARED, fd, offset )
+ * using the 'offset' and 'length' returned by VDMA_IOC_QUERYBUF for N.
+ */
+struct vdma_buffer {
+    __u32 index;    // in
+    __u32 length;   // out: bytes mappable
+    __u64 offset;   // out: mmap offset
+    __u64 dma_addr; // out: bus address programmed into the S2MM frame store
+};
+
+/*
+ * Every S2MM frame-count interrupt appends one record to a VDMA_FRAME_RING
+ * entry ring.  read() on a vdma misc device (/dev/vdma-frameN) returns as
+ * many whole records as fit, oldest first, blocking until at least one record
+ * newer than the last one read by this file exists; poll() reports POLLIN
+ * under the same condition.  timestamp_ns is CLOCK_MONOTONIC taken in the interrupt handler.
+ *
+ * 'dropped' is derived from PARK_PTR: the write frame store is expected to
+ * advance by irq_frame_count between interrupts; any extra advance is frames
+ * whose interrupt was never serviced.  A loss of a whole multiple of the
+ * frame store count cannot be seen this way.  'lost' counts records that were
+ * overwritten before this reader got to them.
+ */
+struct vdma_frame {
+    __u64 frame_seq;     // frames completed since start, including dropped ones
+    __u32 buffer_index;  // frame store that was just completed
+    __u16 status;        // S2MM_VDMASR[15:0] at the interrupt
+    __u16 dropped;
+    __s64 timestamp_ns;
+    __u32 lost;
+    __u32 reserved;
+};
+
+#define VDMA_FRAME_RING     256 // power of two
+
+/*
+ * S2MM stream geometry.  VDMA_IOC_S_FMT halts the channel, reallocates the
+ * frame buffers when frame_size or buffer_count changes (-EBUSY while any
+ * buffer is mmap'ed) and restarts it; buffer offsets must be queried again.
+ */
+struct vdma_format {
+    __u32 width;            // pixels
+    __u32 height;           // lines
+    __u32 bytes_per_pixel;
+    __u32 stride;           // bytes; 0: width * bytes_per_pixel
+    __u32 buffer_count;     // frame stores, 1 .. max_buffers
+    __u32 irq_frame_count;  // frames per frame-count interrupt, 1 .. 255
+    __u32 frame_size;       // out: stride * height
+    __u32 max_buffers;      // out: frame stores implemented in the core
+    __u32 flags;            // VDMA_FMT_xxx
+    __u32 reserved;
+};
+
+#define VDMA_FMT_CACHED     0x0001 // cacheable (streaming) buffers; CPU access must be bracketed by VDMA_IOC_SYNC
+
+/*
+ * CPU ownership of a cached buffer range.  VDMA_SYNC_BEGIN invalidates the
+ * range before the CPU reads a completed frame; VDMA_SYNC_END hands it back
+ * to the device, cleaning it first when VDMA_SYNC_WRITE is set.  length 0
+ * means up to the end of the buffer.  No-op on coherent buffers.
+ */
+struct vdma_sync {
+    __u32 index;
+    __u32 flags;            // VDMA_SYNC_xxx
+    __u32 offset;
+    __u32 length;
+};
+
+#define VDMA_SYNC_BEGIN     0x0000
+#define VDMA_SYNC_END       0x0001
+#define VDMA_SYNC_WRITE     0x0002 // CPU wrote into the range
+
+/*
+ * Export buffer 'index' as a dma-buf fd (flags: O_CLOEXEC | O_RDONLY/O_RDWR).
+ * The fd can be mmap'ed, imported by other drivers, or passed to another
+ * process with SCM_RIGHTS.  VDMA_IOC_S_FMT returns -EBUSY while it lives.
+ */
+struct vdma_expbuf {
+    __u32 index;
+    __u32 flags;
+    __s32 fd;               // out
+    __u32 reserved;
+};
+
+#define VDMA_IOC_MAGIC      'v'
+#define VDMA_IOC_QUERYBUF   _IOWR( VDMA_IOC_MAGIC, 1, struct vdma_buffer )
+#define VDMA_IOC_G_FMT      _IOR( VDMA_IOC_MAGIC, 2, struct vdma_format )
+#define VDMA_IOC_S_FMT      _IOWR( VDMA_IOC_MAGIC, 3, struct vdma_format )
+#define VDMA_IOC_SYNC       _IOW( VDMA_IOC_MAGIC, 4, struct vdma_sync )
+#define VDMA_IOC_EXPBUF     _IOWR( VDMA_IOC_MAGIC, 5, struct vdma_expbuf )
+
 #endif
@@ -0,0 +1,549 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "bench.hpp"
+#include "colorconv.hpp"
+#include "csi2rx.hpp"
+#include "d_phyrx.hpp"
+#include "demosaic.hpp"
+#include "frame_buffer.hpp"
+#include "gpio.hpp"
+#include "gpiochip.hpp"
+#include "image_stats.hpp"
+#include "link_test.hpp"
+#include "motion_detector.hpp"
+#include "pyramid.hpp"
+#include "raw10.hpp"
+#include "rx_init.hpp"
+#include "simd.hpp"
+#include "test_pattern.hpp"
+#include "uio.hpp"
+#include "uio_sim.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <vector>
+#include <boost/format.hpp>
+
+namespace {
+
+    template< typename F >
+    double elapsed_ns( size_t replicates, F&& f ) {
+        auto tp = std::chrono::steady_clock::now();
+        for ( size_t i = 0; i < replicates; ++i )
+            f( i );
+        auto dur = std::chrono::steady_clock::now() - tp;
+        return double( std::chrono::duration_cast< std::chrono::nanoseconds >( dur ).count() ) / replicates;
+    }
+
+    void report( const std::string& label, double ns ) {
+        std::cout << boost::format( "%-32s\t%10.1f ns\t%12.0f /s" ) % label % ns % ( 1.0e9 / ns ) << std::endl;
+    }
+
+    // per-frame kernels: throughput and share of a 30 fps frame period
+    void report_frame( const std::string& label, double ns, size_t bytes ) {
+        std::cout << boost::format( "%-32s\t%10.3f ms\t%8.1f MB/s\t%5.1f%% of 33.3 ms" )
+            % label % ( ns / 1.0e6 ) % ( bytes / ns * 1.0e3 ) % ( ns / 333333.3 ) << std::endl;
+    }
+}
+
+void
+bench::uio_read( const uio& dev, const std::string& label, size_t replicates )
+{
+    uint32_t sum(0);
+    report( label + " read(0x10)"
+            , elapsed_ns( replicates, [&](size_t){ if ( auto v = dev.read( 0x10 ) ) sum += *v; } ) );
+
+    std::array< uint32_t, 16 > regs;
+    report( label + " read(16 words)"
+            , elapsed_ns( replicates, [&](size_t){ if ( dev.read( regs.data(), regs.size(), 0 ) ) sum += regs[ 0 ]; } ) );
+
+    if ( dev.simulated() ) { // never toggle CONTROL on real hardware
+        report( label + " write(0x00)"
+                , elapsed_ns( replicates, [&](size_t i){ dev.write( 0x00, uint32_t( i & 0x02 ) ); } ) );
+    }
+
+    if ( sum == 0x5a5a5a5a ) // keep the loops alive
+        std::cout << std::endl;
+}
+
+// the status samplers that run at frame rate or faster
+void
+bench::uio_sample( const csi2rx& csi2, const d_phyrx& dphy, const std::string& label, size_t replicates )
+{
+    test_pattern pattern( 8, 2, test_pattern::raw16 );
+    link_test test( pattern, link_test::options() );
+    report( label + " csi2rx status sample"
+            , elapsed_ns( replicates, [&](size_t){ test.sample( csi2 ); } ) );
+
+    uint32_t sum(0);
+    std::array< uint32_t, 5 > lanes; // CL_STATUS, DL1..4_STATUS
+    report( label + " d_phyrx lane status"
+            , elapsed_ns( replicates, [&](size_t){ if ( dphy.read( lanes.data(), lanes.size(), 0x18 ) ) sum += lanes[ 1 ]; } ) );
+
+    if ( csi2.simulated() && dphy.simulated() ) { // never reset the receivers on real hardware
+        report( label + " init (reset, poll, enable)"
+                , elapsed_ns( std::min( replicates, size_t( 10000 ) ), [&](size_t){ sum += bool( rx_init::run( csi2, dphy ) ); } ) );
+    }
+
+    if ( sum == 0x5a5a5a5a )
+        std::cout << std::endl;
+}
+
+void
+bench::gpio_toggle( const gpiochip& io, size_t replicates )
+{
+    report( io.device() + " set", elapsed_ns( replicates, [&](size_t i){ io << bool( i & 1 ); } ) );
+    report( io.device() + " get", elapsed_ns( replicates, [&](size_t){ io.read(); } ) );
+}
+
+void
+bench::gpio_toggle( gpio& io, size_t replicates )
+{
+    report( "sysfs set", elapsed_ns( replicates, [&](size_t i){ io << bool( i & 1 ); } ) );
+    report( "sysfs get", elapsed_ns( replicates, [&](size_t){ io.read(); } ) );
+}
+
+void
+bench::frame_read( frame_buffer& fb, size_t replicates )
+{
+    auto src = fb.data( 0 );
+    if ( ! src )
+        return;
+    const size_t length = fb[ 0 ].length;
+    std::vector< uint8_t > copy( length );
+    uint64_t sum(0);
+
+    // a cached pool pays for the invalidate on every frame, as a real consumer would
+    auto ns = elapsed_ns( replicates, [&](size_t){
+        fb.begin_cpu_access( 0 );
+        auto p = reinterpret_cast< const uint32_t * >( src );
+        for ( size_t i = 0; i < length / sizeof( uint32_t ); i += 16 ) // one word per cache line
+            sum += p[ i ];
+        fb.end_cpu_access( 0 );
+    });
+    report( fb.device() + " touch/frame", ns );
+    std::cout << boost::format( "\t%.1f MB/s" ) % ( length / ns * 1.0e3 ) << std::endl;
+
+    ns = elapsed_ns( replicates, [&](size_t){
+        fb.begin_cpu_access( 0 );
+        std::memcpy( copy.data(), src, length );
+        fb.end_cpu_access( 0 );
+        sum += copy[ 0 ];
+    });
+    report( fb.device() + " memcpy/frame", ns );
+    std::cout << boost::format( "\t%.1f MB/s" ) % ( length / ns * 1.0e3 ) << std::endl;
+
+    if ( sum == 0x5a5a5a5a ) // keep the loops alive
+        std::cout << std::endl;
+}
+
+void
+bench::raw10_unpack( size_t width, size_t height, size_t replicates )
+{
+    const size_t pixels = width * height;
+    std::vector< uint16_t > reference( pixels ), unpacked( pixels );
+    std::vector< uint8_t > packed( raw10::packed_size( pixels ) );
+
+    std::mt19937 gen( 5640 );
+    std::uniform_int_distribution< int > dist( 0, 1023 );
+    for ( auto& v: reference )
+        v = uint16_t( dist( gen ) );
+    raw10::pack( reference.data(), packed.data(), pixels );
+
+    for ( auto isa: simd::available() ) {
+        std::fill( unpacked.begin(), unpacked.end(), 0xffff );
+        raw10::unpack( packed.data(), raw10::packed_size( width ), unpacked.data(), width, width, height, isa );
+        if ( unpacked != reference ) {
+            std::cerr << "raw10 " << simd::name( isa ) << ": mismatch against the scalar reference" << std::endl;
+            continue;
+        }
+        auto ns = elapsed_ns( replicates, [&](size_t){
+            raw10::unpack( packed.data(), raw10::packed_size( width ), unpacked.data(), width, width, height, isa );
+        });
+        report_frame( ( boost::format( "raw10 %dx%d %s" ) % width % height % simd::name( isa ) ).str(), ns, packed.size() );
+    }
+}
+
+void
+bench::demosaic_frame( size_t width, size_t height, size_t threads, size_t replicates )
+{
+    const size_t pixels = width * height;
+    std::vector< uint16_t > samples( pixels );
+    std::vector< uint8_t > packed( raw10::packed_size( pixels ) );
+    std::mt19937 gen( 5640 );
+    std::uniform_int_distribution< int > dist( 0, 1023 );
+    for ( auto& v: samples )
+        v = uint16_t( dist( gen ) );
+    raw10::pack( samples.data(), packed.data(), pixels );
+
+    thread_pool workers( threads );
+    const demosaic::gains wb{ 400, 256, 320 };
+    for ( auto algorithm: { demosaic::bilinear, demosaic::mhc } ) {
+        for ( auto format: { demosaic::rgb24, demosaic::yuyv } ) {
+            std::vector< uint8_t > expected;
+            for ( auto isa: simd::available() ) {
+                demosaic::options opts;
+                opts.algorithm = algorithm;
+                opts.format = format;
+                opts.isa = isa;
+                demosaic d( width, height, workers, opts );
+                buffer_pool pool( d.output_size(), 2 );
+                auto out = d( packed.data(), raw10::packed_size( width ), demosaic::raw10, pool, wb );
+                if ( ! out )
+                    return;
+                if ( expected.empty() ) {
+                    expected.assign( out.get(), out.get() + d.output_size() );
+                } else if ( ! std::equal( expected.begin(), expected.end(), out.get() ) ) {
+                    std::cerr << "demosaic " << simd::name( isa ) << ": mismatch against the scalar path" << std::endl;
+                    continue;
+                }
+                auto ns = elapsed_ns( replicates, [&](size_t){
+                    d( packed.data(), raw10::packed_size( width ), demosaic::raw10, out.get(), wb );
+                });
+                report_frame( ( boost::format( "demosaic %s %s %s x%d" )
+                                % ( algorithm == demosaic::mhc ? "mhc" : "bilinear" )
+                                % ( format == demosaic::yuyv ? "yuyv" : "rgb24" )
+                                % simd::name( isa ) % workers.size() ).str(), ns, packed.size() );
+            }
+        }
+    }
+}
+
+void
+bench::colorconv_frame( size_t width, size_t height, size_t threads, size_t replicates )
+{
+    const size_t stride = width * 2;
+    std::vector< uint8_t > frame( stride * height );
+    std::mt19937 gen( 5640 );
+    std::uniform_int_distribution< int > dist( 0, 255 );
+    for ( auto& v: frame )
+        v = uint8_t( dist( gen ) );
+
+    struct mode { colorconv::input source; const char * source_name; colorconv::output format; const char * format_name; size_t scale; };
+    const mode modes[] = {
+        { colorconv::uyvy, "uyvy", colorconv::rgb24, "rgb24", 1 }
+        , { colorconv::uyvy, "uyvy", colorconv::rgba32, "rgba32", 1 }
+        , { colorconv::uyvy, "uyvy", colorconv::gray8, "gray8", 1 }
+        , { colorconv::uyvy, "uyvy", colorconv::rgb24, "rgb24", 2 }
+        , { colorconv::uyvy, "uyvy", colorconv::rgb24, "rgb24", 4 }
+        , { colorconv::rgb565le, "rgb565le", colorconv::rgb24, "rgb24", 1 }
+        , { colorconv::rgb565le, "rgb565le", colorconv::rgba32, "rgba32", 1 }
+        , { colorconv::rgb565le, "rgb565le", colorconv::gray8, "gray8", 1 }
+        , { colorconv::rgb565le, "rgb565le", colorconv::rgb24, "rgb24", 2 }
+    };
+
+    thread_pool workers( threads );
+    for ( const auto& m: modes ) {
+        std::vector< uint8_t > expected;
+        for ( auto isa: simd::available() ) {
+            colorconv::options opts;
+            opts.source = m.source;
+            opts.format = m.format;
+            opts.scale = m.scale;
+            opts.isa = isa;
+            colorconv c( width, height, workers, opts );
+            buffer_pool pool( c.output_size(), 2 );
+            auto out = c( frame.data(), stride, pool );
+            if ( ! out )
+                return;
+            if ( expected.empty() ) {
+                expected.assign( out.get(), out.get() + c.output_size() );
+            } else if ( ! std::equal( expected.begin(), expected.end(), out.get() ) ) {
+                std::cerr << "colorconv " << simd::name( isa ) << ": mismatch against the scalar path" << std::endl;
+                continue;
+            }
+            auto ns = elapsed_ns( replicates, [&](size_t){
+                c( frame.data(), stride, out.get() );
+            });
+            report_frame( ( boost::format( "%s>%s 1/%d %s x%d" )
+                            % m.source_name % m.format_name % m.scale % simd::name( isa ) % workers.size() ).str(), ns, frame.size() );
+        }
+    }
+}
+
+void
+bench::image_stats_frame( size_t width, size_t height, size_t threads, size_t replicates )
+{
+    const size_t stride = width * 2;
+    std::vector< uint8_t > frame( stride * height );
+    std::mt19937 gen( 5640 );
+    std::uniform_int_distribution< int > dist( 0, 255 );
+    for ( auto& v: frame )
+        v = uint8_t( dist( gen ) );
+
+    thread_pool workers( threads );
+    for ( size_t sampling: { 2, 4, 8 } ) {
+        image_stats::result expected;
+        for ( auto isa: simd::available() ) {
+            image_stats::options opts;
+            opts.format = image_stats::uyvy;
+            opts.stride = sampling;
+            opts.isa = isa;
+            image_stats stats( width, height, workers, opts );
+            image_stats::result res;
+            if ( ! stats( frame.data(), stride, res ) )
+                return;
+            if ( isa == simd::scalar ) {
+                expected = res;
+            } else if ( res.histogram != expected.histogram
+                        || std::memcmp( res.tiles.data(), expected.tiles.data(), res.tiles.size() * sizeof( image_stats::tile ) ) ) {
+                std::cerr << "image_stats " << simd::name( isa ) << ": mismatch against the scalar path" << std::endl;
+                continue;
+            }
+            auto ns = elapsed_ns( replicates, [&](size_t){
+                stats( frame.data(), stride, res );
+            });
+            report_frame( ( boost::format( "stats uyvy 1/%d %s x%d" ) % sampling % simd::name( isa ) % workers.size() ).str(), ns, frame.size() );
+        }
+    }
+}
+
+void
+bench::motion_frame( size_t width, size_t height, size_t threads, size_t replicates )
+{
+    // noise, and a bright block moving across the second half of the frames
+    const size_t stride = width * 2, nframes = 8;
+    std::vector< std::vector< uint8_t > > frames( nframes, std::vector< uint8_t >( stride * height ) );
+    std::mt19937 gen( 5640 );
+    std::uniform_int_distribution< int > dist( 96, 111 );
+    for ( size_t n = 0; n < nframes; ++n ) {
+        for ( auto& v: frames[ n ] )
+            v = uint8_t( dist( gen ) );
+        if ( n >= nframes / 2 )
+            for ( size_t y = height / 4; y < height / 2; ++y )
+                std::memset( frames[ n ].data() + y * stride + n * stride / 16, 0xf0, stride / 8 );
+    }
+
+    thread_pool workers( threads );
+    for ( size_t step: { 2, 4, 8 } ) {
+        std::vector< uint32_t > expected;
+        for ( auto isa: simd::available() ) {
+            motion_detector::options opts;
+            opts.format = motion_detector::uyvy;
+            opts.step = step;
+            opts.isa = isa;
+            motion_detector md( width, height, workers, opts );
+            motion_detector::result res;
+            std::vector< uint32_t > changed;
+            for ( const auto& f: frames ) {
+                if ( ! md( f.data(), stride, 0, 0, res ) )
+                    return;
+                changed.insert( changed.end(), res.changed.begin(), res.changed.end() );
+            }
+            if ( isa == simd::scalar ) {
+                expected = changed;
+            } else if ( changed != expected ) {
+                std::cerr << "motion_detector " << simd::name( isa ) << ": mismatch against the scalar path" << std::endl;
+                continue;
+            }
+            auto ns = elapsed_ns( replicates, [&](size_t i){
+                md( frames[ i % nframes ].data(), stride, i, 0, res );
+            });
+            report_frame( ( boost::format( "motion uyvy 1/%d %s x%d" ) % step % simd::name( isa ) % workers.size() ).str(), ns, stride * height );
+        }
+    }
+}
+
+void
+bench::pyramid_frame( size_t width, size_t height, size_t threads, size_t replicates )
+{
+    struct mode { pyramid::layout format; const char * name; pyramid::filter method; };
+    const mode modes[] = {
+        { pyramid::uyvy, "uyvy", pyramid::box }
+        , { pyramid::uyvy, "uyvy", pyramid::bilinear }
+        , { pyramid::rgba32, "rgba32", pyramid::box }
+        , { pyramid::rgb24, "rgb24", pyramid::box }
+        , { pyramid::gray8, "gray8", pyramid::box }
+    };
+
+    std::mt19937 gen( 5640 );
+    std::uniform_int_distribution< int > dist( 0, 255 );
+    thread_pool workers( threads );
+    for ( const auto& m: modes ) {
+        const size_t stride = width * pyramid::bytes_per_pixel( m.format );
+        std::vector< uint8_t > frame( stride * height );
+        for ( auto& v: frame )
+            v = uint8_t( dist( gen ) );
+        std::vector< uint8_t > expected;
+        for ( auto isa: simd::available() ) {
+            pyramid::options opts;
+            opts.format = m.format;
+            opts.method = m.method;
+            opts.isa = isa;
+            pyramid p( width, height, workers, opts );
+            buffer_pool pool( p.size(), 2 );
+            auto out = p( frame.data(), stride, pool );
+            if ( ! out )
+                return;
+            if ( expected.empty() ) {
+                expected.assign( out.get(), out.get() + p.size() );
+            } else if ( ! std::equal( expected.begin(), expected.end(), out.get() ) ) {
+                std::cerr << "pyramid " << simd::name( isa ) << ": mismatch against the scalar path" << std::endl;
+                continue;
+            }
+            auto ns = elapsed_ns( replicates, [&](size_t){
+                p( frame.data(), stride, out.get() );
+            });
+            report_frame( ( boost::format( "pyramid %s %s 1/2..1/8 %s x%d" )
+                            % m.name % ( m.method == pyramid::box ? "box" : "bilinear" ) % simd::name( isa ) % workers.size() ).str(), ns, frame.size() );
+        }
+    }
+}
+
+// render cost of a synthetic_source frame, i.e. the highest --fps it can keep up
+void
+bench::pattern_frame( size_t width, size_t height, size_t replicates )
+{
+    const std::pair< const char *, test_pattern::layout > layouts[] = {
+        { "raw10", test_pattern::raw10 }, { "uyvy", test_pattern::uyvy }, { "rgb24", test_pattern::rgb24 }
+    };
+    for ( const auto& layout: layouts ) {
+        for ( auto name: { "bar", "bar+rolling", "random" } ) {
+            test_pattern pattern( width, height, layout.second, *test_pattern::parse( name ) );
+            std::vector< uint8_t > frame( pattern.line_size() * height );
+            auto ns = elapsed_ns( replicates, [&](size_t i){
+                pattern.render( frame.data(), pattern.line_size(), i );
+            });
+            report_frame( ( boost::format( "pattern %s %s" ) % name % layout.first ).str(), ns, frame.size() );
+        }
+    }
+}
+
+void
+bench::link_compare( size_t width, size_t height, size_t replicates )
+{
+    test_pattern pattern( width, height, test_pattern::raw10, test_pattern::enable );
+    const size_t line = pattern.line_size();
+    std::vector< uint8_t > frame( line * height );
+    pattern.render( frame.data(), line, 0 );
+    frame[ frame.size() / 2 ] ^= 0x10;
+
+    for ( auto isa: simd::available() ) {
+        link_test::options opts;
+        opts.isa = isa;
+        link_test test( pattern, opts );
+        if ( test.compare( frame.data(), line, 0 ) != 1 || test.statistics().bit_errors != 1 ) {
+            std::cerr << "link_test " << simd::name( isa ) << ": missed the injected error" << std::endl;
+            continue;
+        }
+        auto ns = elapsed_ns( replicates, [&](size_t){
+            test.compare( frame.data(), line, 0 );
+        });
+        report_frame( ( boost::format( "link compare raw10 %s" ) % simd::name( isa ) ).str(), ns, frame.size() );
+    }
+}
+
+bool
+bench::run( const boost::program_options::variables_map& vm )
+{
+    const auto name = vm[ "bench" ].as< std::string >();
+    const auto replicates = vm[ "replicates" ].as< size_t >();
+    const bool simulate = vm.count( "sim" );
+
+    if ( name == "gpio" ) {
+        if ( ! vm.count( "gpiochip" ) ) {
+            std::cerr << "--bench gpio requires --gpiochip (gpio-mockup/gpio-sim chip recommended)" << std::endl;
+            return false;
+        }
+        gpiochip io( vm[ "gpiochip" ].as< std::string >(), { vm[ "gpio-line" ].as< uint32_t >() } );
+        if ( io )
+            gpio_toggle( io, replicates );
+        if ( ! vm[ "gpio-number" ].defaulted() ) { // sysfs comparison only on explicit request
+            gpio sysfs( vm[ "gpio-number" ].as< uint32_t >() );
+            gpio_toggle( sysfs, std::min( replicates, size_t( 1000 ) ) );
+        }
+        return bool( io );
+    }
+
+    if ( name == "uio" ) {
+        if ( simulate ) {
+            csi2rx csi2( csi2rx::simulator() );
+            d_phyrx dphy( d_phyrx::simulator() );
+            uio_read( csi2, "csi2rx(sim)", replicates );
+            uio_read( dphy, "d_phyrx(sim)", replicates );
+            uio_sample( csi2, dphy, "sim", replicates );
+        } else {
+            csi2rx csi2;
+            d_phyrx dphy;
+            uio_read( csi2, "csi2rx", replicates );
+            uio_read( dphy, "d_phyrx", replicates );
+            uio_sample( csi2, dphy, "hw", replicates );
+        }
+        return true;
+    }
+    if ( name == "frame" ) {
+        frame_buffer fb( vm.count( "vdma" ) ? vm[ "vdma" ].as< std::string >() : std::string( frame_buffer::default_device ) );
+        if ( fb )
+            frame_read( fb, std::min( replicates, size_t( 100 ) ) );
+        return bool( fb );
+    }
+
+    if ( name == "raw10" ) {
+        raw10_unpack( 1920, 1080, std::min( replicates, size_t( 100 ) ) );
+        return true;
+    }
+
+    if ( name == "demosaic" ) {
+        demosaic_frame( 1920, 1080, 0, std::min( replicates, size_t( 30 ) ) );
+        return true;
+    }
+
+    if ( name == "convert" ) {
+        colorconv_frame( 1920, 1080, 0, std::min( replicates, size_t( 30 ) ) );
+        return true;
+    }
+
+    if ( name == "stats" ) {
+        image_stats_frame( 1920, 1080, 0, std::min( replicates, size_t( 30 ) ) );
+        return true;
+    }
+
+    if ( name == "pyramid" ) {
+        pyramid_frame( 1920, 1080, 0, std::min( replicates, size_t( 30 ) ) );
+        return true;
+    }
+
+    if ( name == "motion" ) {
+        motion_frame( 1920, 1080, 0, std::min( replicates, size_t( 100 ) ) );
+        return true;
+    }
+
+    if ( name == "pattern" ) {
+        pattern_frame( 1920, 1080, std::min( replicates, size_t( 100 ) ) );
+        return true;
+    }
+
+    if ( name == "link" ) {
+        link_compare( 1920, 1080, std::min( replicates, size_t( 100 ) ) );
+        return true;
+    }
+
+    std::cerr << "unknown benchmark: " << name << std::endl;
+    return false;
+}
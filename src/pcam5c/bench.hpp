@@ -0,0 +1,58 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <boost/program_options/variables_map.hpp>
+
+class uio;
+class csi2rx;
+class d_phyrx;
+class gpio;
+class gpiochip;
+class frame_buffer;
+
+// Host-side micro benchmarks, selected by 'pcam5c --bench <name>'
+
+namespace bench {
+
+    bool run( const boost::program_options::variables_map& );
+
+    void uio_read( const uio&, const std::string& label, size_t replicates );
+    void uio_sample( const csi2rx&, const d_phyrx&, const std::string& label, size_t replicates );
+    void gpio_toggle( const gpiochip&, size_t replicates );
+    void gpio_toggle( gpio&, size_t replicates );
+    void frame_read( frame_buffer&, size_t replicates );
+    void raw10_unpack( size_t width, size_t height, size_t replicates );
+    void demosaic_frame( size_t width, size_t height, size_t threads, size_t replicates );
+    void colorconv_frame( size_t width, size_t height, size_t threads, size_t replicates );
+    void image_stats_frame( size_t width, size_t height, size_t threads, size_t replicates );
+    void pyramid_frame( size_t width, size_t height, size_t threads, size_t replicates );
+    void motion_frame( size_t width, size_t height, size_t threads, size_t replicates );
+    void pattern_frame( size_t width, size_t height, size_t replicates );
+    void link_compare( size_t width, size_t height, size_t replicates );
+
+}
@@ -0,0 +1,89 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "buffer_pool.hpp"
+#include <cstdlib>
+#include <cstdio>
+#include <new>
+#include <thread>
+
+// hands out the control block slot of one buffer; releasing the control block
+// is what returns the buffer to the free list
+template< typename T >
+struct buffer_pool::control_allocator {
+    typedef T value_type;
+
+    buffer_pool * pool;
+    size_t index;
+
+    control_allocator( buffer_pool * pool, size_t index ) : pool( pool ), index( index ) {}
+    template< typename U > control_allocator( const control_allocator< U >& a ) : pool( a.pool ), index( a.index ) {}
+
+    T * allocate( size_t n ) {
+        static_assert( sizeof( T ) <= sizeof( control_block ) && alignof( T ) <= alignof( control_block )
+                       , "shared_ptr control block does not fit the pool slot" );
+        if ( n != 1 )
+            throw std::bad_alloc();
+        return reinterpret_cast< T * >( pool->controls_[ index ].bytes );
+    }
+    void deallocate( T *, size_t ) {
+        // the free list never holds more than count buffers, but a push can still see
+        // the cell of a pop that is in flight on another thread; retry rather than lose it
+        while ( ! pool->free_.push( pool->memory_ + index * pool->size_ ) )
+            std::this_thread::yield();
+    }
+
+    template< typename U > bool operator == ( const control_allocator< U >& a ) const { return pool == a.pool && index == a.index; }
+    template< typename U > bool operator != ( const control_allocator< U >& a ) const { return ! ( *this == a ); }
+};
+
+buffer_pool::buffer_pool( size_t size
+                          , size_t count
+                          , size_t alignment ) : size_( ( size + alignment - 1 ) / alignment * alignment )
+                                               , count_( count )
+                                               , memory_( static_cast< uint8_t * >( std::aligned_alloc( alignment, size_ * count ) ) )
+                                               , controls_( std::make_unique< control_block[] >( count ) )
+                                               , free_( count )
+                                               , exhausted_( 0 )
+{
+    if ( ! memory_ ) {
+        ::perror( "buffer_pool" );
+        count_ = 0;
+    }
+    for ( size_t i = 0; i < count_; ++i )
+        free_.push( memory_ + i * size_ );
+}
+
+buffer_pool::~buffer_pool()
+{
+    std::free( memory_ );
+}
+
+std::shared_ptr< uint8_t >
+buffer_pool::acquire()
+{
+    if ( auto p = free_.pop() )
+        return std::shared_ptr< uint8_t >( *p, []( uint8_t * ){}, control_allocator< uint8_t >( this, size_t( *p - memory_ ) / size_ ) );
+    exhausted_.fetch_add( 1, std::memory_order_relaxed );
+    return nullptr;
+}
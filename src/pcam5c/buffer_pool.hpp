@@ -0,0 +1,63 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "mpmc_queue.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Preallocated output buffers for pixel stages (demosaic, conversion, ...).
+// acquire() never allocates: it hands out a free buffer as a shared_ptr whose
+// control block lives in a slot reserved for that buffer, or nullptr when all
+// are in use so that the stage can drop the frame instead of stalling capture.
+// The buffer goes back to the pool when its control block is released, i.e.
+// after the last shared (and weak) reference.  Buffers must not outlive the pool.
+
+class buffer_pool {
+public:
+    buffer_pool( size_t size, size_t count, size_t alignment = 64 );
+    ~buffer_pool();
+
+    buffer_pool( const buffer_pool& ) = delete;
+    buffer_pool& operator = ( const buffer_pool& ) = delete;
+
+    std::shared_ptr< uint8_t > acquire(); // any thread
+
+    inline size_t size() const { return size_; }   // bytes per buffer
+    inline size_t count() const { return count_; }
+    inline size_t available() const { return free_.size(); }
+    inline uint64_t exhausted() const { return exhausted_.load( std::memory_order_relaxed ); }
+
+private:
+    struct alignas( 64 ) control_block { unsigned char bytes[ 64 ]; }; // one shared_ptr control block
+    template< typename T > struct control_allocator;
+
+    size_t size_;
+    size_t count_;
+    uint8_t * memory_;
+    std::unique_ptr< control_block[] > controls_;
+    mpmc_queue< uint8_t * > free_;
+    std::atomic< uint64_t > exhausted_;
+};
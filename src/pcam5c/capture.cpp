@@ -0,0 +1,346 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "capture.hpp"
+#include <algorithm>
+#include <iostream>
+#include <boost/format.hpp>
+
+frame_ref::frame_ref() : owner_( nullptr )
+                       , frame_{ 0, 0, 0, 0, -1, 0 }
+                       , data_( nullptr )
+                       , length_( 0 )
+{
+}
+
+frame_ref::frame_ref( capture * owner
+                      , const frame_source::frame& f
+                      , const uint8_t * data
+                      , size_t length ) : owner_( owner )
+                                        , frame_( f )
+                                        , data_( data )
+                                        , length_( length )
+{
+    owner_->retain( frame_.index );
+}
+
+frame_ref::~frame_ref()
+{
+    reset();
+}
+
+frame_ref::frame_ref( const frame_ref& t ) : owner_( t.owner_ )
+                                           , frame_( t.frame_ )
+                                           , data_( t.data_ )
+                                           , length_( t.length_ )
+{
+    if ( owner_ )
+        owner_->retain( frame_.index );
+}
+
+frame_ref::frame_ref( frame_ref&& t ) noexcept : owner_( t.owner_ )
+                                                , frame_( t.frame_ )
+                                                , data_( t.data_ )
+                                                , length_( t.length_ )
+{
+    t.owner_ = nullptr;
+}
+
+frame_ref&
+frame_ref::operator = ( const frame_ref& t )
+{
+    if ( this != &t ) {
+        if ( t.owner_ )
+            t.owner_->retain( t.frame_.index );
+        reset();
+        owner_ = t.owner_;
+        frame_ = t.frame_;
+        data_ = t.data_;
+        length_ = t.length_;
+    }
+    return *this;
+}
+
+frame_ref&
+frame_ref::operator = ( frame_ref&& t ) noexcept
+{
+    if ( this != &t ) {
+        reset();
+        owner_ = t.owner_;
+        frame_ = t.frame_;
+        data_ = t.data_;
+        length_ = t.length_;
+        t.owner_ = nullptr;
+    }
+    return *this;
+}
+
+void
+frame_ref::reset()
+{
+    if ( owner_ )
+        owner_->release( frame_.index );
+    owner_ = nullptr;
+}
+
+bool
+frame_ref::valid() const
+{
+    return owner_ && owner_->slots_[ frame_.index ].generation.load( std::memory_order_acquire ) == frame_.seq;
+}
+
+////////////////////////////////////////
+
+capture::subscription::subscription( drop_policy policy, size_t depth ) : policy_( policy )
+                                                                        , closed_( false )
+                                                                        , delivered_( 0 )
+                                                                        , dropped_( 0 )
+                                                                        , max_depth_( 0 )
+{
+    if ( policy == block )
+        spsc_ = std::make_unique< spsc_queue< frame_ref > >( depth );
+    else
+        mpmc_ = std::make_unique< mpmc_queue< frame_ref > >( policy == latest_wins ? 1 : depth );
+}
+
+size_t
+capture::subscription::depth() const
+{
+    return spsc_ ? spsc_->size() : mpmc_->size();
+}
+
+std::optional< frame_ref >
+capture::subscription::try_pop()
+{
+    return spsc_ ? spsc_->pop() : mpmc_->pop();
+}
+
+std::optional< frame_ref >
+capture::subscription::pop( std::chrono::milliseconds timeout )
+{
+    if ( auto ref = try_pop() )
+        return ref;
+    std::unique_lock< std::mutex > lock( mutex_ );
+    cv_.wait_for( lock, timeout, [&]{ return depth() > 0 || closed_; } );
+    lock.unlock();
+    return try_pop();
+}
+
+void
+capture::subscription::deliver( const frame_ref& ref, const std::atomic< bool >& stop )
+{
+    if ( spsc_ ) {
+        while ( ! spsc_->push( ref ) ) {
+            if ( stop || closed_ ) {
+                ++dropped_;
+                return;
+            }
+            std::this_thread::sleep_for( std::chrono::microseconds( 100 ) );
+        }
+    } else {
+        if ( policy_ == latest_wins ) {
+            while ( mpmc_->pop() ) // consumers may be popping concurrently; either way only ref remains
+                ++dropped_;
+        }
+        while ( ! mpmc_->push( ref ) ) {
+            if ( mpmc_->pop() )
+                ++dropped_;
+        }
+    }
+    ++delivered_;
+    size_t d = depth();
+    if ( d > max_depth_ )
+        max_depth_ = d;
+    { std::lock_guard< std::mutex > lock( mutex_ ); } // a consumer between its check and its wait sees the frame
+    cv_.notify_all();
+}
+
+void
+capture::subscription::close()
+{
+    closed_ = true;
+    { std::lock_guard< std::mutex > lock( mutex_ ); }
+    cv_.notify_all();
+}
+
+capture::subscription_stats
+capture::subscription::stats() const
+{
+    return { delivered_, dropped_, depth(), max_depth_ };
+}
+
+////////////////////////////////////////
+
+capture::capture( std::shared_ptr< frame_source > source ) : source_( source )
+                                                           , nslots_( source ? source->size() : 0 )
+                                                           , subscribers_( std::make_shared< subscribers >() )
+                                                           , stop_( false )
+                                                           , frames_( 0 )
+                                                           , source_dropped_( 0 )
+                                                           , overwritten_( 0 )
+                                                           , unsubscribed_( 0 )
+{
+    slots_ = std::make_unique< slot[] >( nslots_ );
+    for ( size_t i = 0; i < nslots_; ++i ) {
+        slots_[ i ].refs = 0;
+        slots_[ i ].generation = 0;
+    }
+}
+
+capture::~capture()
+{
+    stop();
+    for ( auto& sub: *std::atomic_load( &subscribers_ ) ) { // queued handles must not outlive us
+        sub->close();
+        while ( sub->try_pop() )
+            ;
+    }
+}
+
+std::shared_ptr< capture::subscription >
+capture::subscribe( drop_policy policy, size_t depth )
+{
+    auto sub = std::make_shared< subscription >( policy, std::max( depth, size_t( 1 ) ) );
+    std::lock_guard< std::mutex > lock( subscribe_mutex_ );
+    auto list = std::make_shared< subscribers >( *std::atomic_load( &subscribers_ ) );
+    list->emplace_back( sub );
+    std::atomic_store( &subscribers_, std::shared_ptr< const subscribers >( list ) );
+    return sub;
+}
+
+void
+capture::unsubscribe( const std::shared_ptr< subscription >& sub )
+{
+    std::lock_guard< std::mutex > lock( subscribe_mutex_ );
+    auto list = std::make_shared< subscribers >( *std::atomic_load( &subscribers_ ) );
+    list->erase( std::remove( list->begin(), list->end(), sub ), list->end() );
+    std::atomic_store( &subscribers_, std::shared_ptr< const subscribers >( list ) );
+    sub->close();
+}
+
+void
+capture::retain( uint32_t index )
+{
+    slots_[ index ].refs.fetch_add( 1, std::memory_order_relaxed );
+}
+
+void
+capture::release( uint32_t index )
+{
+    if ( slots_[ index ].refs.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+        source_->release( index );
+}
+
+int
+capture::poll( std::chrono::milliseconds timeout )
+{
+    frame_source::frame f;
+    int rc = source_->next( f, timeout );
+    if ( rc <= 0 )
+        return rc;
+    if ( f.index >= nslots_ )
+        return -1;
+
+    ++frames_;
+    source_dropped_ += f.dropped;
+    if ( f.overwriting >= 0 && size_t( f.overwriting ) < nslots_ ) {
+        auto& s = slots_[ f.overwriting ];
+        s.generation.store( 0, std::memory_order_release );
+        if ( s.refs.load( std::memory_order_acquire ) > 0 )
+            ++overwritten_;
+    }
+    slots_[ f.index ].generation.store( f.seq, std::memory_order_release );
+
+    frame_ref ref( this, f, source_->data( f.index ), f.length ? f.length : source_->length( f.index ) );
+    auto list = std::atomic_load( &subscribers_ );
+    if ( list->empty() )
+        ++unsubscribed_;
+    for ( auto& sub: *list )
+        sub->deliver( ref, stop_ );
+    return 1; // ref goes out of scope; the buffer returns to the source once every consumer is done
+}
+
+bool
+capture::start()
+{
+    if ( ! source_ || nslots_ == 0 || thread_.joinable() )
+        return false;
+    stop_ = false;
+    for ( auto& sub: *std::atomic_load( &subscribers_ ) )
+        sub->closed_ = false;
+    thread_ = std::thread( [this]{
+        while ( ! stop_ ) {
+            if ( poll( std::chrono::milliseconds( 100 ) ) < 0 ) {
+                std::cerr << "capture: frame source failed" << std::endl;
+                break;
+            }
+        }
+        for ( auto& sub: *std::atomic_load( &subscribers_ ) )
+            sub->close();
+    });
+    return true;
+}
+
+void
+capture::stop()
+{
+    stop_ = true;
+    if ( thread_.joinable() )
+        thread_.join();
+}
+
+capture::stats
+capture::statistics() const
+{
+    size_t held = 0;
+    for ( size_t i = 0; i < nslots_; ++i )
+        if ( slots_[ i ].refs.load( std::memory_order_relaxed ) > 0 )
+            ++held;
+    return { frames_, source_dropped_, overwritten_, unsubscribed_, held };
+}
+
+const char *
+capture::policy_name( drop_policy policy )
+{
+    switch ( policy ) {
+    case latest_wins: return "latest-wins";
+    case block:       return "block";
+    case drop_oldest: return "drop-oldest";
+    }
+    return "";
+}
+
+void
+capture::report( std::ostream& o ) const
+{
+    auto st = statistics();
+    o << boost::format( "capture: frames=%d source-dropped=%d overwritten-while-held=%d unsubscribed=%d held=%d/%d\n" )
+        % st.frames % st.source_dropped % st.overwritten_while_held % st.unsubscribed % st.held % nslots_;
+    size_t i = 0;
+    for ( auto& sub: *std::atomic_load( &subscribers_ ) ) {
+        auto s = sub->stats();
+        o << boost::format( "\t[%d] %-12s delivered=%d dropped=%d depth=%d max-depth=%d\n" )
+            % i++ % policy_name( sub->policy() ) % s.delivered % s.dropped % s.depth % s.max_depth;
+    }
+}
@@ -0,0 +1,174 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "frame_source.hpp"
+#include "mpmc_queue.hpp"
+#include "spsc_queue.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+// Frame grabber: one capture thread pulls completed frames from a frame_source
+// and fans them out as refcounted frame_ref handles to any number of
+// subscriptions.  A buffer is given back to the source when the last handle
+// referring to it is destroyed.  frame_ref handles must not outlive the capture.
+//
+// (A global class rather than pcam5c::capture: 'pcam5c' is already the sensor class.)
+
+class capture;
+
+class frame_ref {
+public:
+    frame_ref();
+    ~frame_ref();
+    frame_ref( const frame_ref& );
+    frame_ref( frame_ref&& ) noexcept;
+    frame_ref& operator = ( const frame_ref& );
+    frame_ref& operator = ( frame_ref&& ) noexcept;
+
+    inline explicit operator bool () const { return owner_ != nullptr; }
+
+    inline uint64_t seq() const { return frame_.seq; }
+    inline uint32_t index() const { return frame_.index; }
+    inline int64_t timestamp_ns() const { return frame_.timestamp_ns; }
+    inline uint32_t dropped() const { return frame_.dropped; }
+    inline const uint8_t * data() const { return data_; }
+    inline size_t length() const { return length_; }
+
+    // false once the writer has started on this buffer again (VDMA cannot be held off);
+    // check after processing to know whether the result is from an intact frame
+    bool valid() const;
+
+private:
+    friend class capture;
+    frame_ref( capture *, const frame_source::frame&, const uint8_t *, size_t );
+    void reset();
+
+    capture * owner_;
+    frame_source::frame frame_;
+    const uint8_t * data_;
+    size_t length_;
+};
+
+class capture {
+public:
+    enum drop_policy {
+        latest_wins   // queue holds only the newest frame; older queued frames are dropped
+        , block       // capture thread waits for space (stalls every subscriber); single consumer thread
+        , drop_oldest // oldest queued frame is dropped to make room
+    };
+
+    struct subscription_stats {
+        uint64_t delivered;
+        uint64_t dropped;
+        size_t depth;
+        size_t max_depth;
+    };
+
+    class subscription {
+    public:
+        subscription( drop_policy, size_t depth );
+
+        // blocks up to 'timeout'; empty on timeout or after the capture stopped and the queue drained
+        std::optional< frame_ref > pop( std::chrono::milliseconds timeout );
+        std::optional< frame_ref > try_pop();
+
+        inline drop_policy policy() const { return policy_; }
+        subscription_stats stats() const;
+
+    private:
+        friend class capture;
+        void deliver( const frame_ref&, const std::atomic< bool >& stop );
+        void close();
+        size_t depth() const;
+
+        drop_policy policy_;
+        std::unique_ptr< spsc_queue< frame_ref > > spsc_; // block
+        std::unique_ptr< mpmc_queue< frame_ref > > mpmc_; // latest_wins, drop_oldest
+        std::mutex mutex_;                                 // sleeping only, never held around the queue
+        std::condition_variable cv_;
+        std::atomic< bool > closed_;
+        std::atomic< uint64_t > delivered_, dropped_;
+        std::atomic< size_t > max_depth_;
+    };
+
+    struct stats {
+        uint64_t frames;
+        uint64_t source_dropped;         // reported by the source (driver drops, ring overruns)
+        uint64_t overwritten_while_held; // writer reached a buffer a consumer still held
+        uint64_t unsubscribed;           // frames nobody was subscribed to
+        size_t held;                     // buffers currently referenced
+    };
+
+    capture( std::shared_ptr< frame_source > );
+    ~capture();
+
+    capture( const capture& ) = delete;
+    capture& operator = ( const capture& ) = delete;
+
+    std::shared_ptr< subscription > subscribe( drop_policy, size_t depth = 4 );
+    void unsubscribe( const std::shared_ptr< subscription >& );
+
+    bool start();
+    void stop();
+    inline bool running() const { return thread_.joinable() && ! stop_; }
+
+    // one capture-thread iteration on the calling thread; for sources driven without start()
+    int poll( std::chrono::milliseconds timeout );
+
+    inline frame_source& source() { return *source_; }
+    stats statistics() const;
+    void report( std::ostream& ) const;
+
+    static const char * policy_name( drop_policy );
+
+private:
+    friend class frame_ref;
+    struct slot {
+        std::atomic< int > refs;
+        std::atomic< uint64_t > generation; // seq of the frame the buffer holds, 0 while being overwritten
+    };
+    void retain( uint32_t index );
+    void release( uint32_t index );
+
+    typedef std::vector< std::shared_ptr< subscription > > subscribers;
+
+    std::shared_ptr< frame_source > source_;
+    std::unique_ptr< slot[] > slots_;
+    size_t nslots_;
+    std::shared_ptr< const subscribers > subscribers_; // replaced as a whole, read with std::atomic_load
+    std::mutex subscribe_mutex_;
+    std::atomic< bool > stop_;
+    std::thread thread_;
+    std::atomic< uint64_t > frames_, source_dropped_, overwritten_, unsubscribed_;
+};
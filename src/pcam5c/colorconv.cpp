@@ -0,0 +1,424 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "colorconv.hpp"
+#include "simd_vec.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+    constexpr size_t max_lanes = 16;   // 16-bit lanes of the widest register (AVX2)
+
+    // M 16-bit lanes per register; the output stage handles 2M pixels at a time so
+    // that narrowing to bytes fills one register
+    template< size_t M > struct vec {
+        typedef uint16_t u16 __attribute__(( vector_size( M * 2 ) ));
+        typedef uint16_t w16 __attribute__(( vector_size( M * 4 ) ));
+        typedef int16_t s16 __attribute__(( vector_size( M * 4 ) ));
+        typedef uint8_t u8 __attribute__(( vector_size( M * 2 ) ));
+    };
+
+    using simd::load;
+    using simd::store;
+    using simd::make_mask;
+    using simd::even_lanes;
+    using simd::odd_lanes;
+    using simd::dup_lanes;
+
+    // RGB24: output register K of three, from r|g then (rg)|b
+    template< size_t N, size_t K > struct rgb24_rg {
+        static constexpr size_t at( size_t j ) { return ( K * N + j ) % 3 == 1 ? N + ( K * N + j ) / 3 : ( K * N + j ) / 3; }
+    };
+    template< size_t N, size_t K > struct rgb24_b {
+        static constexpr size_t at( size_t j ) { return ( K * N + j ) % 3 == 2 ? N + ( K * N + j ) / 3 : j; }
+    };
+    // RGBA32: output register K of four, from r|g and b|a
+    template< size_t N, size_t K > struct rgba_lo {
+        static constexpr size_t at( size_t j ) { return ( K * N + j ) / 4 + ( ( K * N + j ) % 2 ? N : 0 ); }
+    };
+    template< size_t N > struct rgba_sel {
+        static constexpr size_t at( size_t j ) { return j % 4 < 2 ? j : N + j; }
+    };
+
+    template< size_t M, size_t K >
+    __attribute__(( always_inline )) inline void
+    put_rgb24( uint8_t * d, typename vec< M >::u8 r, typename vec< M >::u8 g, typename vec< M >::u8 b )
+    {
+        typedef typename vec< M >::u8 u8;
+        constexpr u8 rg = make_mask< u8, rgb24_rg< 2 * M, K > >();
+        constexpr u8 sel = make_mask< u8, rgb24_b< 2 * M, K > >();
+        store( d + K * 2 * M, __builtin_shuffle( __builtin_shuffle( r, g, rg ), b, sel ) );
+    }
+
+    template< size_t M, size_t K >
+    __attribute__(( always_inline )) inline void
+    put_rgba32( uint8_t * d, typename vec< M >::u8 r, typename vec< M >::u8 g, typename vec< M >::u8 b )
+    {
+        typedef typename vec< M >::u8 u8;
+        constexpr u8 lo = make_mask< u8, rgba_lo< 2 * M, K > >();
+        constexpr u8 sel = make_mask< u8, rgba_sel< 2 * M > >();
+        const u8 a = u8{} + 0xff;
+        store( d + K * 2 * M, __builtin_shuffle( __builtin_shuffle( r, g, lo ), __builtin_shuffle( b, a, lo ), sel ) );
+    }
+
+    template< size_t M >
+    __attribute__(( always_inline )) inline void
+    put( uint8_t * d, typename vec< M >::u8 r, typename vec< M >::u8 g, typename vec< M >::u8 b, colorconv::output format )
+    {
+        if ( format == colorconv::rgb24 ) {
+            put_rgb24< M, 0 >( d, r, g, b );
+            put_rgb24< M, 1 >( d, r, g, b );
+            put_rgb24< M, 2 >( d, r, g, b );
+        } else {
+            put_rgba32< M, 0 >( d, r, g, b );
+            put_rgba32< M, 1 >( d, r, g, b );
+            put_rgba32< M, 2 >( d, r, g, b );
+            put_rgba32< M, 3 >( d, r, g, b );
+        }
+    }
+
+    template< typename V >
+    __attribute__(( always_inline )) inline V sat8( V v )
+    {
+        v = v < 0 ? V{} : v;
+        return v > 255 ? V{} + 255 : v;
+    }
+
+    // one source line ('n' pixels) to Y (n), U and V (n / 2) planes
+    template< size_t M >
+    __attribute__(( always_inline )) inline void
+    decode_yuv( const uint8_t * src, size_t n, bool uyvy, uint16_t * y, uint16_t * u, uint16_t * v )
+    {
+        typedef typename vec< M >::u16 u16;
+        constexpr u16 even = make_mask< u16, even_lanes >();
+        constexpr u16 odd = make_mask< u16, odd_lanes >();
+        const int ys = uyvy ? 8 : 0, cs = uyvy ? 0 : 8;
+        for ( size_t i = 0; i < n; i += 2 * M ) {
+            const u16 a = load< u16 >( src + 2 * i ), b = load< u16 >( src + 2 * i + 2 * M );
+            store( y + i, ( a >> ys ) & 0xff );
+            store( y + i + M, ( b >> ys ) & 0xff );
+            const u16 ca = ( a >> cs ) & 0xff, cb = ( b >> cs ) & 0xff;
+            store( u + i / 2, __builtin_shuffle( ca, cb, even ) );
+            store( v + i / 2, __builtin_shuffle( ca, cb, odd ) );
+        }
+    }
+
+    // one source line to 8-bit R, G, B planes (5/6 bit fields widened by bit replication)
+    template< size_t M >
+    __attribute__(( always_inline )) inline void
+    decode_565( const uint8_t * src, size_t n, bool be, uint16_t * r, uint16_t * g, uint16_t * b )
+    {
+        typedef typename vec< M >::u16 u16;
+        for ( size_t i = 0; i < n; i += M ) {
+            u16 w = load< u16 >( src + 2 * i );
+            if ( be )
+                w = ( w << 8 ) | ( w >> 8 );
+            const u16 r5 = w >> 11, g6 = ( w >> 5 ) & 0x3f, b5 = w & 0x1f;
+            store( r + i, ( r5 << 3 ) | ( r5 >> 2 ) );
+            store( g + i, ( g6 << 2 ) | ( g6 >> 4 ) );
+            store( b + i, ( b5 << 3 ) | ( b5 >> 2 ) );
+        }
+    }
+
+    template< size_t M >
+    __attribute__(( always_inline )) inline void
+    accumulate( uint16_t * p, const uint16_t * q, size_t n )
+    {
+        typedef typename vec< M >::u16 u16;
+        for ( size_t i = 0; i < n; i += M )
+            store( p + i, load< u16 >( p + i ) + load< u16 >( q + i ) );
+    }
+
+    // p[ j ] = p[ 2j ] + p[ 2j + 1 ], in place; 'n' (input length) a multiple of 2M
+    template< size_t M >
+    __attribute__(( always_inline )) inline void
+    fold( uint16_t * p, size_t n )
+    {
+        typedef typename vec< M >::u16 u16;
+        constexpr u16 even = make_mask< u16, even_lanes >();
+        constexpr u16 odd = make_mask< u16, odd_lanes >();
+        for ( size_t j = 0; j < n / 2; j += M ) {
+            const u16 a = load< u16 >( p + 2 * j ), b = load< u16 >( p + 2 * j + M );
+            store( p + j, __builtin_shuffle( a, b, even ) + __builtin_shuffle( a, b, odd ) );
+        }
+    }
+
+    template< size_t M >
+    __attribute__(( always_inline )) inline void
+    rescale( uint16_t * p, size_t n, int shift )
+    {
+        typedef typename vec< M >::u16 u16;
+        const uint16_t half = uint16_t( 1 << ( shift - 1 ) );
+        for ( size_t i = 0; i < n; i += M )
+            store( p + i, ( load< u16 >( p + i ) + half ) >> shift );
+    }
+
+    template< size_t M >
+    __attribute__(( always_inline )) inline void
+    emit_yuv( const uint16_t * y, const uint16_t * u, const uint16_t * v, size_t n, uint8_t * d, colorconv::output format )
+    {
+        typedef typename vec< M >::w16 w16;
+        typedef typename vec< M >::s16 s16;
+        typedef typename vec< M >::u8 u8;
+        constexpr w16 dup = make_mask< w16, dup_lanes >();
+        const size_t bpp = colorconv::bytes_per_pixel( format );
+        for ( size_t i = 0; i < n; i += 2 * M ) {
+            const s16 Y = s16( load< w16 >( y + i ) );
+            if ( format == colorconv::gray8 ) {
+                store( d + i, __builtin_convertvector( Y, u8 ) );
+                continue;
+            }
+            const s16 U = s16( __builtin_shuffle( load< w16 >( u + i / 2 ), dup ) ) - 128;
+            const s16 V = s16( __builtin_shuffle( load< w16 >( v + i / 2 ), dup ) ) - 128;
+            const s16 R = sat8( Y + ( ( V * 179 + 64 ) >> 7 ) );
+            const s16 G = sat8( Y - ( ( U * 44 + V * 91 + 64 ) >> 7 ) );
+            const s16 B = sat8( Y + ( ( U * 227 + 64 ) >> 7 ) );
+            put< M >( d + i * bpp, __builtin_convertvector( R, u8 ), __builtin_convertvector( G, u8 ), __builtin_convertvector( B, u8 ), format );
+        }
+    }
+
+    template< size_t M >
+    __attribute__(( always_inline )) inline void
+    emit_rgb( const uint16_t * r, const uint16_t * g, const uint16_t * b, size_t n, uint8_t * d, colorconv::output format )
+    {
+        typedef typename vec< M >::w16 w16;
+        typedef typename vec< M >::u8 u8;
+        const size_t bpp = colorconv::bytes_per_pixel( format );
+        for ( size_t i = 0; i < n; i += 2 * M ) {
+            const w16 R = load< w16 >( r + i ), G = load< w16 >( g + i ), B = load< w16 >( b + i );
+            if ( format == colorconv::gray8 )
+                store( d + i, __builtin_convertvector( ( R * 77 + G * 150 + B * 29 + 128 ) >> 8, u8 ) );
+            else
+                put< M >( d + i * bpp, __builtin_convertvector( R, u8 ), __builtin_convertvector( G, u8 ), __builtin_convertvector( B, u8 ), format );
+        }
+    }
+
+    // one output line from 'scale' source lines of 'n' pixels (n a multiple of 2M x scale);
+    // p[ 0..5 ] are planes of at least n + 4M elements
+    template< size_t M >
+    __attribute__(( always_inline )) inline void
+    line( const uint8_t * const * rows, size_t scale, size_t n
+          , colorconv::input in, colorconv::output format
+          , uint16_t * const * p, uint8_t * d )
+    {
+        const bool yuv = in == colorconv::yuyv || in == colorconv::uyvy;
+        for ( size_t k = 0; k < scale; ++k ) {
+            uint16_t * const * q = k == 0 ? p : p + 3;
+            if ( yuv )
+                decode_yuv< M >( rows[ k ], n, in == colorconv::uyvy, q[ 0 ], q[ 1 ], q[ 2 ] );
+            else
+                decode_565< M >( rows[ k ], n, in == colorconv::rgb565be, q[ 0 ], q[ 1 ], q[ 2 ] );
+            if ( k ) {
+                accumulate< M >( p[ 0 ], q[ 0 ], n );
+                accumulate< M >( p[ 1 ], q[ 1 ], yuv ? n / 2 : n );
+                accumulate< M >( p[ 2 ], q[ 2 ], yuv ? n / 2 : n );
+            }
+        }
+        int shift = 0;
+        for ( size_t s = scale, w = n; s > 1; s /= 2, w /= 2, shift += 2 ) {
+            fold< M >( p[ 0 ], w );
+            fold< M >( p[ 1 ], yuv ? w / 2 : w );
+            fold< M >( p[ 2 ], yuv ? w / 2 : w );
+        }
+        const size_t w = n / scale;
+        if ( shift ) {
+            rescale< M >( p[ 0 ], w, shift );
+            rescale< M >( p[ 1 ], yuv ? w / 2 : w, shift );
+            rescale< M >( p[ 2 ], yuv ? w / 2 : w, shift );
+        }
+        if ( yuv )
+            emit_yuv< M >( p[ 0 ], p[ 1 ], p[ 2 ], w, d, format );
+        else
+            emit_rgb< M >( p[ 0 ], p[ 1 ], p[ 2 ], w, d, format );
+    }
+
+    typedef void ( *line_function )( const uint8_t * const *, size_t, size_t, colorconv::input, colorconv::output, uint16_t * const *, uint8_t * );
+
+    struct line_kernel {
+        template< size_t M > __attribute__(( always_inline )) static void
+        run( const uint8_t * const * rows, size_t scale, size_t n, colorconv::input in, colorconv::output format, uint16_t * const * p, uint8_t * d )
+        {
+            line< M >( rows, scale, n, in, format, p, d );
+        }
+    };
+
+    inline uint8_t clip8( int v ) { return uint8_t( v < 0 ? 0 : v > 255 ? 255 : v ); }
+
+    // reference: one output line of 'w' pixels straight from the source rows
+    void
+    line_scalar( const uint8_t * const * rows, size_t scale, size_t w
+                 , colorconv::input in, colorconv::output format, uint8_t * d )
+    {
+        const int shift = scale == 8 ? 6 : scale == 4 ? 4 : scale == 2 ? 2 : 0;
+        const int half = shift ? 1 << ( shift - 1 ) : 0;
+        const size_t bpp = colorconv::bytes_per_pixel( format );
+        for ( size_t x = 0; x < w; ++x, d += bpp ) {
+            int r, g, b;
+            if ( in == colorconv::yuyv || in == colorconv::uyvy ) {
+                const size_t yo = in == colorconv::uyvy ? 1 : 0, uo = in == colorconv::uyvy ? 0 : 1;
+                int ys = 0, us = 0, vs = 0;
+                for ( size_t k = 0; k < scale; ++k ) {
+                    for ( size_t j = 0; j < scale; ++j ) {
+                        ys += rows[ k ][ 2 * ( x * scale + j ) + yo ];
+                        us += rows[ k ][ 4 * ( x / 2 * scale + j ) + uo ];
+                        vs += rows[ k ][ 4 * ( x / 2 * scale + j ) + uo + 2 ];
+                    }
+                }
+                const int y = ( ys + half ) >> shift;
+                if ( format == colorconv::gray8 ) {
+                    d[ 0 ] = uint8_t( y );
+                    continue;
+                }
+                const int u = ( ( us + half ) >> shift ) - 128, v = ( ( vs + half ) >> shift ) - 128;
+                r = clip8( y + ( ( v * 179 + 64 ) >> 7 ) );
+                g = clip8( y - ( ( u * 44 + v * 91 + 64 ) >> 7 ) );
+                b = clip8( y + ( ( u * 227 + 64 ) >> 7 ) );
+            } else {
+                int rs = 0, gs = 0, bs = 0;
+                for ( size_t k = 0; k < scale; ++k ) {
+                    for ( size_t j = 0; j < scale; ++j ) {
+                        const uint8_t * s = rows[ k ] + 2 * ( x * scale + j );
+                        const int v = in == colorconv::rgb565be ? s[ 0 ] << 8 | s[ 1 ] : s[ 1 ] << 8 | s[ 0 ];
+                        const int r5 = v >> 11, g6 = v >> 5 & 0x3f, b5 = v & 0x1f;
+                        rs += r5 << 3 | r5 >> 2;
+                        gs += g6 << 2 | g6 >> 4;
+                        bs += b5 << 3 | b5 >> 2;
+                    }
+                }
+                r = ( rs + half ) >> shift;
+                g = ( gs + half ) >> shift;
+                b = ( bs + half ) >> shift;
+                if ( format == colorconv::gray8 ) {
+                    d[ 0 ] = uint8_t( ( r * 77 + g * 150 + b * 29 + 128 ) >> 8 );
+                    continue;
+                }
+            }
+            d[ 0 ] = uint8_t( r );
+            d[ 1 ] = uint8_t( g );
+            d[ 2 ] = uint8_t( b );
+            if ( format == colorconv::rgba32 )
+                d[ 3 ] = 0xff;
+        }
+    }
+}
+
+struct colorconv::scratch {
+    std::vector< uint8_t > lines;       // padded copies of the source lines, when the width needs them
+    std::vector< uint16_t > planes;     // 6 planes: accumulators and the current line
+    std::vector< uint8_t > out;         // padded output line
+};
+
+size_t
+colorconv::bytes_per_pixel( output format )
+{
+    return format == rgb24 ? 3 : format == rgba32 ? 4 : 1;
+}
+
+colorconv::colorconv( size_t width
+                      , size_t height
+                      , thread_pool& pool
+                      , const options& opts ) : width_( width )
+                                              , height_( height )
+                                              , pool_( pool )
+                                              , options_( opts )
+{
+    if ( options_.scale != 2 && options_.scale != 4 && options_.scale != 8 )
+        options_.scale = 1;
+    options_.tile_rows = std::max( size_t( 1 ), options_.tile_rows );
+    const size_t step = 2 * max_lanes * options_.scale;
+    padded_ = ( width_ + step - 1 ) / step * step;
+    for ( size_t i = 0; i < pool_.size(); ++i ) {
+        auto s = std::make_unique< scratch >();
+        if ( padded_ != width_ )
+            s->lines.assign( options_.scale * padded_ * 2, 0 );
+        s->planes.assign( 6 * ( padded_ + 4 * max_lanes ), 0 );
+        s->out.assign( padded_ / options_.scale * bytes_per_pixel( options_.format ), 0 );
+        scratch_.emplace_back( std::move( s ) );
+    }
+}
+
+colorconv::~colorconv()
+{
+}
+
+void
+colorconv::tile( size_t index, scratch& s, const uint8_t * src, size_t src_stride, uint8_t * dst ) const
+{
+    const size_t scale = options_.scale;
+    const size_t w = output_width();
+    const size_t line_bytes = w * bytes_per_pixel( options_.format );
+    const size_t y_begin = index * options_.tile_rows;
+    const size_t y_end = std::min( output_height(), y_begin + options_.tile_rows );
+
+    uint16_t * planes[ 6 ];
+    for ( size_t k = 0; k < 6; ++k )
+        planes[ k ] = s.planes.data() + k * ( padded_ + 4 * max_lanes );
+
+    const uint8_t * rows[ 8 ];
+    for ( size_t y = y_begin; y < y_end; ++y ) {
+        uint8_t * d = dst + y * line_bytes;
+        for ( size_t k = 0; k < scale; ++k )
+            rows[ k ] = src + ( y * scale + k ) * src_stride;
+
+        if ( options_.isa == simd::scalar ) {
+            line_scalar( rows, scale, w, options_.source, options_.format, d );
+            continue;
+        }
+        if ( ! s.lines.empty() ) { // vector loads run to the padded width
+            for ( size_t k = 0; k < scale; ++k ) {
+                uint8_t * copy = s.lines.data() + k * padded_ * 2;
+                std::memcpy( copy, rows[ k ], width_ * 2 );
+                rows[ k ] = copy;
+            }
+        }
+        uint8_t * out = padded_ == width_ ? d : s.out.data();
+        line_function f = simd::kernel< line_kernel, 8, line_function >( options_.isa );
+        f( rows, scale, padded_, options_.source, options_.format, planes, out );
+        if ( out != d )
+            std::memcpy( d, out, line_bytes );
+    }
+}
+
+bool
+colorconv::operator()( const uint8_t * src, size_t src_stride, uint8_t * dst )
+{
+    if ( ! src || ! dst || width_ < 2 * options_.scale || ( width_ % ( 2 * options_.scale ) ) || height_ < options_.scale )
+        return false;
+    const size_t tiles = ( output_height() + options_.tile_rows - 1 ) / options_.tile_rows;
+    pool_.run( tiles, [&]( size_t t, size_t worker ){
+        tile( t, *scratch_[ worker ], src, src_stride, dst );
+    });
+    return true;
+}
+
+std::shared_ptr< uint8_t >
+colorconv::operator()( const uint8_t * src, size_t src_stride, buffer_pool& pool )
+{
+    if ( pool.size() < output_size() )
+        return nullptr;
+    auto buffer = pool.acquire();
+    if ( buffer && ! ( *this )( src, src_stride, buffer.get() ) )
+        return nullptr;
+    return buffer;
+}
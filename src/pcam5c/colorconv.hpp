@@ -0,0 +1,94 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "buffer_pool.hpp"
+#include "simd.hpp"
+#include "thread_pool.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// ISP output modes to RGB/gray, with an optional box downscale folded into the
+// same pass.  Input byte orders follow FORMAT CONTROL 00 (0x4300):
+//
+//   yuyv       0x30, 0x501f=0x00
+//   uyvy       0x3f, 0x501f=0x00 (the init tables)
+//   rgb565le   0x6f, 0x501f=0x01 ({g[2:0],b[4:0]}, {r[4:0],g[5:3]})
+//   rgb565be   0x61, 0x501f=0x01
+//
+// YUV is taken as BT.601 full range, the inverse of demosaic::yuyv.  Each output
+// line is decoded into 16-bit planes, summed over 'scale' x 'scale' source
+// pixels, converted and interleaved straight into the destination; the vector
+// path (GCC vector extensions: NEON on the target, SSSE3 or AVX2 on the host)
+// produces the same bytes as the scalar one.
+
+class colorconv {
+public:
+    enum input {
+        yuyv
+        , uyvy
+        , rgb565le
+        , rgb565be
+    };
+    enum output {
+        rgb24
+        , rgba32
+        , gray8
+    };
+
+    struct options {
+        input source = uyvy;
+        output format = rgb24;
+        size_t scale = 1;           // 1, 2, 4 or 8
+        size_t tile_rows = 16;      // output rows per task
+        simd::isa isa = simd::best();
+    };
+
+    colorconv( size_t width, size_t height, thread_pool&, const options& );
+    ~colorconv();
+
+    static size_t bytes_per_pixel( output );
+    inline size_t output_width() const { return width_ / options_.scale; }
+    inline size_t output_height() const { return height_ / options_.scale; }
+    inline size_t output_size() const { return output_width() * output_height() * bytes_per_pixel( options_.format ); }
+    inline const options& settings() const { return options_; }
+
+    // width multiple of 2 x scale, height multiple of scale; 'dst' holds output_size() bytes
+    bool operator()( const uint8_t * src, size_t src_stride, uint8_t * dst );
+
+    // into a buffer from 'pool' (buffers of at least output_size()); nullptr when the pool is exhausted
+    std::shared_ptr< uint8_t > operator()( const uint8_t * src, size_t src_stride, buffer_pool& );
+
+private:
+    struct scratch;
+    void tile( size_t index, scratch&, const uint8_t * src, size_t src_stride, uint8_t * dst ) const;
+
+    size_t width_, height_;
+    size_t padded_;                 // plane length, a multiple of the vector step
+    thread_pool& pool_;
+    options options_;
+    std::vector< std::unique_ptr< scratch > > scratch_; // per worker
+};
@@ -24,6 +24,7 @@
 
 #include "csi2rx.hpp"
 #include "uio.hpp"
+#include "uio_sim.hpp"
 #include <cstdint>
 #include <fstream>
 #include <iostream>
@@ -119,6 +120,24 @@ csi2rx::csi2rx( const std::string& device ) : uio( device )
 {
 }
 
+csi2rx::csi2rx( std::shared_ptr< uio_sim > sim ) : uio( sim )
+{
+}
+
+// static
+std::shared_ptr< uio_sim >
+csi2rx::simulator( size_t reset_reads )
+{
+    auto sim = std::make_shared< uio_sim >( 0x100 );
+    sim->poke( 0x0004, 0x00000003 ); // Protocol Configuration: 4 active lanes
+    sim->poke( 0x0060, 0x0438002b ); // VC0 image info 1: line count 1080, RAW10
+    sim->self_clearing( 0x0000, 0x01, reset_reads ); // soft reset
+    sim->counter( 0x0010, 16, 16 );  // Core Status: packet count [31:16]
+    for ( uint32_t lane = 0; lane < 4; ++lane )
+        sim->poke( 0x0040 + lane * 4, 0x00000020 ); // Lane info: stop state
+    return sim;
+}
+
 
 void
 csi2rx::dump() const
@@ -34,5 +34,8 @@ class csi2rx : public uio {
 public:
     ~csi2rx();
     csi2rx( const std::string& device = "/dev/csi2rx0" );
+    csi2rx( std::shared_ptr< uio_sim > );
     void dump() const;
+
+    static std::shared_ptr< uio_sim > simulator( size_t reset_reads = 3 );
 };
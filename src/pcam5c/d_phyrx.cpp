@@ -24,6 +24,7 @@
 
 #include "d_phyrx.hpp"
 #include "uio.hpp"
+#include "uio_sim.hpp"
 #include <cstdint>
 #include <fstream>
 #include <iostream>
@@ -63,6 +64,28 @@ d_phyrx::d_phyrx( const std::string& device ) : uio( device )
 {
 }
 
+d_phyrx::d_phyrx( std::shared_ptr< uio_sim > sim ) : uio( sim )
+{
+}
+
+// static
+std::shared_ptr< uio_sim >
+d_phyrx::simulator( size_t reset_reads )
+{
+    auto sim = std::make_shared< uio_sim >( 0x100 );
+    sim->poke( 0x0008, 100000 );     // INIT_VAL (ns)
+    sim->poke( 0x0010, 0x00010005 ); // HS_TIMEOUT
+    sim->poke( 0x0014, 0x00000064 ); // ESC_TIMEOUT
+    sim->poke( 0x0018, 0x00000008 ); // CL_STATUS: init done
+    sim->poke( 0x0030, 0x0000000e ); // HS_SETTLE
+    sim->self_clearing( 0x0000, 0x01, reset_reads ); // CONTROL.SRST
+    for ( uint32_t lane = 0; lane < 4; ++lane ) {
+        sim->poke( 0x001c + lane * 4, 0x00000048 ); // DLn_STATUS: init done, stop state
+        sim->counter( 0x001c + lane * 4, 16, 16 );  // packet count [31:16]
+    }
+    return sim;
+}
+
 void
 d_phyrx::dump() const
 {
@@ -33,5 +33,8 @@ class d_phyrx : public uio {
 public:
     ~d_phyrx();
     d_phyrx( const std::string& device = "/dev/d_phyrx0" );
+    d_phyrx( std::shared_ptr< uio_sim > );
     void dump() const;
+
+    static std::shared_ptr< uio_sim > simulator( size_t reset_reads = 3 );
 };
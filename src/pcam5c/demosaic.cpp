@@ -0,0 +1,354 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "demosaic.hpp"
+#include "raw10.hpp"
+#include <algorithm>
+#include <cstring>
+#if defined __ARM_NEON
+# include <arm_neon.h>
+#endif
+
+namespace {
+
+    constexpr size_t lanes = 16;
+    constexpr size_t pad = 2;          // mirrored plane columns on each side
+    typedef int16_t vec __attribute__(( vector_size( lanes * sizeof( int16_t ) ) ));
+
+    template< typename T > T load( const int16_t * p );
+    template<> inline int load< int >( const int16_t * p ) { return *p; }
+    template<> inline vec load< vec >( const int16_t * p ) { vec v; std::memcpy( &v, p, sizeof( v ) ); return v; }
+
+    inline void store( int16_t * p, int v ) { *p = int16_t( v ); }
+    inline void store( int16_t * p, vec v ) { std::memcpy( p, &v, sizeof( v ) ); }
+
+    template< typename T > inline T clamp10( T v ) {
+        const T zero = T{}, top = T{} + 1023;
+        v = v < zero ? zero : v;
+        return v > top ? top : v;
+    }
+
+    // One quad column (or 'lanes' of them) of a BGGR row pair.  e[k]/o[k] are the
+    // even/odd column planes of rows y0-2+k (k = 0..5); y0 is a B/G row.  out[] is
+    // { R, G, B } x { row y0, row y0+1 } x { even, odd column }, index ( row * 3 + channel ) * 2 + parity.
+    template< typename T >
+    __attribute__(( always_inline )) inline void
+    bilinear_quad( const int16_t * const * e, const int16_t * const * o, int16_t * const * out, size_t i )
+    {
+        auto E = [&]( int k, int d ){ return load< T >( e[ k ] + i + d ); };
+        auto O = [&]( int k, int d ){ return load< T >( o[ k ] + i + d ); };
+
+        // row y0: B at even, Gb at odd columns
+        store( out[ 0 ] + i, ( O( 1, -1 ) + O( 1, 0 ) + O( 3, -1 ) + O( 3, 0 ) + 2 ) >> 2 );
+        store( out[ 1 ] + i, ( O( 1, 0 ) + O( 3, 0 ) + 1 ) >> 1 );
+        store( out[ 2 ] + i, ( E( 1, 0 ) + E( 3, 0 ) + O( 2, -1 ) + O( 2, 0 ) + 2 ) >> 2 );
+        store( out[ 3 ] + i, O( 2, 0 ) );
+        store( out[ 4 ] + i, E( 2, 0 ) );
+        store( out[ 5 ] + i, ( E( 2, 0 ) + E( 2, 1 ) + 1 ) >> 1 );
+        // row y0+1: Gr at even, R at odd columns
+        store( out[ 6 ] + i, ( O( 3, -1 ) + O( 3, 0 ) + 1 ) >> 1 );
+        store( out[ 7 ] + i, O( 3, 0 ) );
+        store( out[ 8 ] + i, E( 3, 0 ) );
+        store( out[ 9 ] + i, ( O( 2, 0 ) + O( 4, 0 ) + E( 3, 0 ) + E( 3, 1 ) + 2 ) >> 2 );
+        store( out[ 10 ] + i, ( E( 2, 0 ) + E( 4, 0 ) + 1 ) >> 1 );
+        store( out[ 11 ] + i, ( E( 2, 0 ) + E( 2, 1 ) + E( 4, 0 ) + E( 4, 1 ) + 2 ) >> 2 );
+    }
+
+    // Malvar, He, Cutler, "High-quality linear interpolation for demosaicing of
+    // Bayer-patterned color images" (ICASSP 2004); coefficients scaled by 16, all
+    // partial sums fit in int16 for 10-bit input
+    template< typename T >
+    __attribute__(( always_inline )) inline void
+    mhc_quad( const int16_t * const * e, const int16_t * const * o, int16_t * const * out, size_t i )
+    {
+        auto E = [&]( int k, int d ){ return load< T >( e[ k ] + i + d ); };
+        auto O = [&]( int k, int d ){ return load< T >( o[ k ] + i + d ); };
+
+        // B at (y0, even)
+        const T b = E( 2, 0 );
+        const T b_far = E( 0, 0 ) + E( 4, 0 ) + E( 2, -1 ) + E( 2, 1 );
+        store( out[ 0 ] + i, clamp10( ( b * 12 - b_far * 3 + ( O( 1, -1 ) + O( 1, 0 ) + O( 3, -1 ) + O( 3, 0 ) ) * 4 + 8 ) >> 4 ) );
+        store( out[ 2 ] + i, clamp10( ( b * 8 - b_far * 2 + ( E( 1, 0 ) + E( 3, 0 ) + O( 2, -1 ) + O( 2, 0 ) ) * 4 + 8 ) >> 4 ) );
+        store( out[ 4 ] + i, b );
+
+        // Gb at (y0, odd): B left/right, R above/below
+        const T gb = O( 2, 0 );
+        const T gb_diag = E( 1, 0 ) + E( 1, 1 ) + E( 3, 0 ) + E( 3, 1 );
+        const T gb_h2 = O( 2, -1 ) + O( 2, 1 ), gb_v2 = O( 0, 0 ) + O( 4, 0 );
+        store( out[ 1 ] + i, clamp10( ( gb * 10 + ( O( 1, 0 ) + O( 3, 0 ) ) * 8 - gb_v2 * 2 - gb_diag * 2 + gb_h2 + 8 ) >> 4 ) );
+        store( out[ 3 ] + i, gb );
+        store( out[ 5 ] + i, clamp10( ( gb * 10 + ( E( 2, 0 ) + E( 2, 1 ) ) * 8 - gb_h2 * 2 - gb_diag * 2 + gb_v2 + 8 ) >> 4 ) );
+
+        // Gr at (y0+1, even): R left/right, B above/below
+        const T gr = E( 3, 0 );
+        const T gr_diag = O( 2, -1 ) + O( 2, 0 ) + O( 4, -1 ) + O( 4, 0 );
+        const T gr_h2 = E( 3, -1 ) + E( 3, 1 ), gr_v2 = E( 1, 0 ) + E( 5, 0 );
+        store( out[ 6 ] + i, clamp10( ( gr * 10 + ( O( 3, -1 ) + O( 3, 0 ) ) * 8 - gr_h2 * 2 - gr_diag * 2 + gr_v2 + 8 ) >> 4 ) );
+        store( out[ 8 ] + i, gr );
+        store( out[ 10 ] + i, clamp10( ( gr * 10 + ( E( 2, 0 ) + E( 4, 0 ) ) * 8 - gr_v2 * 2 - gr_diag * 2 + gr_h2 + 8 ) >> 4 ) );
+
+        // R at (y0+1, odd)
+        const T r = O( 3, 0 );
+        const T r_far = O( 1, 0 ) + O( 5, 0 ) + O( 3, -1 ) + O( 3, 1 );
+        store( out[ 7 ] + i, r );
+        store( out[ 9 ] + i, clamp10( ( r * 8 - r_far * 2 + ( O( 2, 0 ) + O( 4, 0 ) + E( 3, 0 ) + E( 3, 1 ) ) * 4 + 8 ) >> 4 ) );
+        store( out[ 11 ] + i, clamp10( ( r * 12 - r_far * 3 + ( E( 2, 0 ) + E( 2, 1 ) + E( 4, 0 ) + E( 4, 1 ) ) * 4 + 8 ) >> 4 ) );
+    }
+
+    template< typename T, size_t step >
+    __attribute__(( always_inline )) inline void
+    interpolate( demosaic::method m, const int16_t * const * e, const int16_t * const * o, int16_t * const * out, size_t n )
+    {
+        if ( m == demosaic::mhc ) {
+            for ( size_t i = 0; i < n; i += step )
+                mhc_quad< T >( e, o, out, i );
+        } else {
+            for ( size_t i = 0; i < n; i += step )
+                bilinear_quad< T >( e, o, out, i );
+        }
+    }
+
+    void
+    interpolate_scalar( demosaic::method m, const int16_t * const * e, const int16_t * const * o, int16_t * const * out, size_t n )
+    {
+        interpolate< int, 1 >( m, e, o, out, n );
+    }
+
+    // baseline vector ISA: NEON on the target, SSE2 on x86-64
+    void
+    interpolate_vec( demosaic::method m, const int16_t * const * e, const int16_t * const * o, int16_t * const * out, size_t n )
+    {
+        interpolate< vec, lanes >( m, e, o, out, n );
+    }
+
+#if defined __x86_64__ || defined __i386__
+    __attribute__(( target( "avx2" ) ))
+    void
+    interpolate_avx2( demosaic::method m, const int16_t * const * e, const int16_t * const * o, int16_t * const * out, size_t n )
+    {
+        interpolate< vec, lanes >( m, e, o, out, n );
+    }
+#endif
+
+    inline uint8_t sat8( int v ) { return uint8_t( v < 0 ? 0 : v > 255 ? 255 : v ); }
+
+    // one output line from the even/odd column planes of R, G, B (10 bit); c[ channel * 2 + parity ]
+    void
+    pack_scalar( uint8_t * d, const int16_t * const * c, size_t n, size_t begin, demosaic::output format )
+    {
+        for ( size_t i = begin; i < n; ++i ) {
+            const int r0 = c[ 0 ][ i ] >> 2, r1 = c[ 1 ][ i ] >> 2;
+            const int g0 = c[ 2 ][ i ] >> 2, g1 = c[ 3 ][ i ] >> 2;
+            const int b0 = c[ 4 ][ i ] >> 2, b1 = c[ 5 ][ i ] >> 2;
+            switch ( format ) {
+            case demosaic::rgb24: {
+                uint8_t * p = d + 6 * i;
+                p[ 0 ] = uint8_t( r0 ); p[ 1 ] = uint8_t( g0 ); p[ 2 ] = uint8_t( b0 );
+                p[ 3 ] = uint8_t( r1 ); p[ 4 ] = uint8_t( g1 ); p[ 5 ] = uint8_t( b1 );
+                break; }
+            case demosaic::rgba32: {
+                uint8_t * p = d + 8 * i;
+                p[ 0 ] = uint8_t( r0 ); p[ 1 ] = uint8_t( g0 ); p[ 2 ] = uint8_t( b0 ); p[ 3 ] = 0xff;
+                p[ 4 ] = uint8_t( r1 ); p[ 5 ] = uint8_t( g1 ); p[ 6 ] = uint8_t( b1 ); p[ 7 ] = 0xff;
+                break; }
+            case demosaic::yuyv: {
+                // chroma of the pair average; (x + 128) >> 8 rounding throughout
+                const int r = ( r0 + r1 + 1 ) >> 1, g = ( g0 + g1 + 1 ) >> 1, b = ( b0 + b1 + 1 ) >> 1;
+                uint8_t * p = d + 4 * i;
+                p[ 0 ] = uint8_t( ( 77 * r0 + 150 * g0 + 29 * b0 + 128 ) >> 8 );
+                p[ 1 ] = sat8( ( ( -43 * r - 85 * g + 128 * b + 128 ) >> 8 ) + 128 );
+                p[ 2 ] = uint8_t( ( 77 * r1 + 150 * g1 + 29 * b1 + 128 ) >> 8 );
+                p[ 3 ] = sat8( ( ( 128 * r - 107 * g - 21 * b + 128 ) >> 8 ) + 128 );
+                break; }
+            }
+        }
+    }
+
+#if defined __ARM_NEON
+    // vst3/vst4 interleave on store; same arithmetic as pack_scalar
+    void
+    pack_neon( uint8_t * d, const int16_t * const * c, size_t n, demosaic::output format )
+    {
+        auto ld = [&]( int k, size_t i ){ return vshrn_n_u16( vreinterpretq_u16_s16( vld1q_s16( c[ k ] + i ) ), 2 ); };
+        size_t i = 0;
+        for ( ; i + 8 <= n; i += 8 ) {
+            const uint8x8_t r0 = ld( 0, i ), r1 = ld( 1, i ), g0 = ld( 2, i ), g1 = ld( 3, i ), b0 = ld( 4, i ), b1 = ld( 5, i );
+            if ( format == demosaic::yuyv ) {
+                const uint8x8_t y0 = vrshrn_n_u16( vmlal_u8( vmlal_u8( vmull_u8( r0, vdup_n_u8( 77 ) ), g0, vdup_n_u8( 150 ) ), b0, vdup_n_u8( 29 ) ), 8 );
+                const uint8x8_t y1 = vrshrn_n_u16( vmlal_u8( vmlal_u8( vmull_u8( r1, vdup_n_u8( 77 ) ), g1, vdup_n_u8( 150 ) ), b1, vdup_n_u8( 29 ) ), 8 );
+                const int16x8_t r = vreinterpretq_s16_u16( vmovl_u8( vrhadd_u8( r0, r1 ) ) );
+                const int16x8_t g = vreinterpretq_s16_u16( vmovl_u8( vrhadd_u8( g0, g1 ) ) );
+                const int16x8_t b = vreinterpretq_s16_u16( vmovl_u8( vrhadd_u8( b0, b1 ) ) );
+                const int16x8_t u = vmlsq_n_s16( vmlsq_n_s16( vmulq_n_s16( b, 128 ), r, 43 ), g, 85 );
+                const int16x8_t v = vmlsq_n_s16( vmlsq_n_s16( vmulq_n_s16( r, 128 ), g, 107 ), b, 21 );
+                const uint8x8x4_t q = { { y0
+                                          , vqmovun_s16( vaddq_s16( vrshrq_n_s16( u, 8 ), vdupq_n_s16( 128 ) ) )
+                                          , y1
+                                          , vqmovun_s16( vaddq_s16( vrshrq_n_s16( v, 8 ), vdupq_n_s16( 128 ) ) ) } };
+                vst4_u8( d + 4 * i, q );
+            } else {
+                const uint8x8x2_t r = vzip_u8( r0, r1 ), g = vzip_u8( g0, g1 ), b = vzip_u8( b0, b1 );
+                if ( format == demosaic::rgb24 ) {
+                    vst3_u8( d + 6 * i, ( uint8x8x3_t{ { r.val[ 0 ], g.val[ 0 ], b.val[ 0 ] } } ) );
+                    vst3_u8( d + 6 * i + 24, ( uint8x8x3_t{ { r.val[ 1 ], g.val[ 1 ], b.val[ 1 ] } } ) );
+                } else {
+                    const uint8x8_t a = vdup_n_u8( 0xff );
+                    vst4_u8( d + 8 * i, ( uint8x8x4_t{ { r.val[ 0 ], g.val[ 0 ], b.val[ 0 ], a } } ) );
+                    vst4_u8( d + 8 * i + 32, ( uint8x8x4_t{ { r.val[ 1 ], g.val[ 1 ], b.val[ 1 ], a } } ) );
+                }
+            }
+        }
+        pack_scalar( d, c, n, i, format );
+    }
+#endif
+}
+
+struct demosaic::scratch {
+    size_t stride;                    // int16 per plane row
+    std::vector< int16_t > planes;    // ( tile_rows + 4 ) rows x { even, odd }
+    std::vector< uint16_t > line;     // unpacked raw10 source line
+    std::vector< int16_t > out;       // 12 output planes
+    size_t out_stride;
+};
+
+size_t
+demosaic::bytes_per_pixel( output format )
+{
+    return format == rgb24 ? 3 : format == rgba32 ? 4 : 2;
+}
+
+demosaic::demosaic( size_t width
+                    , size_t height
+                    , thread_pool& pool
+                    , const options& opts ) : width_( width )
+                                            , height_( height )
+                                            , pool_( pool )
+                                            , options_( opts )
+{
+    options_.tile_rows = std::max( size_t( 2 ), options_.tile_rows & ~size_t( 1 ) );
+    const size_t n = width_ / 2;
+    for ( size_t i = 0; i < pool_.size(); ++i ) {
+        auto s = std::make_unique< scratch >();
+        s->stride = pad + ( n + lanes - 1 ) / lanes * lanes + lanes;
+        s->planes.assign( ( options_.tile_rows + 4 ) * 2 * s->stride, 0 );
+        s->line.assign( width_, 0 );
+        s->out_stride = ( n + lanes - 1 ) / lanes * lanes;
+        s->out.assign( 12 * s->out_stride, 0 );
+        scratch_.emplace_back( std::move( s ) );
+    }
+}
+
+demosaic::~demosaic()
+{
+}
+
+void
+demosaic::tile( size_t index
+                , scratch& s
+                , const uint8_t * src, size_t src_stride, input in
+                , uint8_t * dst
+                , const gains& wb ) const
+{
+    const size_t n = width_ / 2;
+    const long y_begin = long( index * options_.tile_rows );
+    const long y_end = std::min( long( height_ ), y_begin + long( options_.tile_rows ) );
+    const long h = long( height_ );
+
+    // source lines y_begin-2 .. y_end+1, mirrored at the frame edges (keeps the Bayer phase)
+    auto plane = [&]( long row, int parity ){ return s.planes.data() + ( size_t( row - ( y_begin - 2 ) ) * 2 + parity ) * s.stride + pad; };
+    for ( long y = y_begin - 2; y < y_end + 2; ++y ) {
+        const long sy = y < 0 ? -y : y >= h ? 2 * ( h - 1 ) - y : y;
+        const uint16_t * line;
+        if ( in == raw10 ) {
+            raw10::unpack( src + size_t( sy ) * src_stride, s.line.data(), width_, options_.isa );
+            line = s.line.data();
+        } else {
+            line = reinterpret_cast< const uint16_t * >( src + size_t( sy ) * src_stride );
+        }
+        const uint32_t ge = ( sy & 1 ) ? wb.g : wb.b;
+        const uint32_t go = ( sy & 1 ) ? wb.r : wb.g;
+        int16_t * e = plane( y, 0 );
+        int16_t * o = plane( y, 1 );
+        for ( size_t i = 0; i < n; ++i ) { // white balance fused into the even/odd split
+            e[ i ] = int16_t( std::min( 1023u, ( line[ 2 * i ] * ge + 128 ) >> 8 ) );
+            o[ i ] = int16_t( std::min( 1023u, ( line[ 2 * i + 1 ] * go + 128 ) >> 8 ) );
+        }
+        e[ -1 ] = e[ 1 ];  e[ -2 ] = e[ 2 ];
+        o[ -1 ] = o[ 0 ];  o[ -2 ] = o[ 1 ];
+        e[ n ] = e[ n - 1 ];  e[ n + 1 ] = e[ n - 2 ];
+        o[ n ] = o[ n - 2 ];  o[ n + 1 ] = o[ n - 3 ];
+    }
+
+    int16_t * out[ 12 ];
+    for ( size_t k = 0; k < 12; ++k )
+        out[ k ] = s.out.data() + k * s.out_stride;
+    const size_t line_bytes = width_ * bytes_per_pixel( options_.format );
+
+    for ( long y0 = y_begin; y0 < y_end; y0 += 2 ) {
+        const int16_t * e[ 6 ], * o[ 6 ];
+        for ( int k = 0; k < 6; ++k ) {
+            e[ k ] = plane( y0 - 2 + k, 0 );
+            o[ k ] = plane( y0 - 2 + k, 1 );
+        }
+        switch ( options_.isa ) {
+        case simd::scalar: interpolate_scalar( options_.algorithm, e, o, out, n ); break;
+#if defined __x86_64__ || defined __i386__
+        case simd::avx2:   interpolate_avx2( options_.algorithm, e, o, out, n ); break;
+#endif
+        default:           interpolate_vec( options_.algorithm, e, o, out, n ); break;
+        }
+        for ( int row = 0; row < 2; ++row ) {
+            uint8_t * d = dst + size_t( y0 + row ) * line_bytes;
+#if defined __ARM_NEON
+            if ( options_.isa == simd::neon ) {
+                pack_neon( d, out + row * 6, n, options_.format );
+                continue;
+            }
+#endif
+            pack_scalar( d, out + row * 6, n, 0, options_.format );
+        }
+    }
+}
+
+bool
+demosaic::operator()( const uint8_t * src, size_t src_stride, input in, uint8_t * dst, const gains& wb )
+{
+    if ( ! src || ! dst || width_ < 8 || ( width_ % ( in == raw10 ? 4 : 2 ) ) || ( height_ % 2 ) || height_ < 4 )
+        return false;
+    const size_t tiles = ( height_ + options_.tile_rows - 1 ) / options_.tile_rows;
+    pool_.run( tiles, [&]( size_t t, size_t worker ){
+        tile( t, *scratch_[ worker ], src, src_stride, in, dst, wb );
+    });
+    return true;
+}
+
+std::shared_ptr< uint8_t >
+demosaic::operator()( const uint8_t * src, size_t src_stride, input in, buffer_pool& pool, const gains& wb )
+{
+    if ( pool.size() < output_size() )
+        return nullptr;
+    auto buffer = pool.acquire();
+    if ( buffer && ! ( *this )( src, src_stride, in, buffer.get(), wb ) )
+        return nullptr;
+    return buffer;
+}
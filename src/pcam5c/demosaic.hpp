@@ -0,0 +1,94 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "buffer_pool.hpp"
+#include "simd.hpp"
+#include "thread_pool.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// BGGR Bayer to RGB/YUV for the RAW capture mode (0x4300=0x00, BGBG/GRGR).
+//
+// Each row tile is handled by one thread_pool worker: source lines (packed RAW10
+// or 16-bit samples) are unpacked, white-balance gains applied and split into
+// even/odd column planes, so that the interpolation runs as plain vector
+// arithmetic over a whole plane row (GCC vector extensions: NEON on the target,
+// SSE2 or AVX2 on the host).  Borders are mirrored by two pixels, which keeps the
+// Bayer phase.  Output lines go straight into the destination (a pool buffer).
+// The scalar path is the reference and produces identical bytes.
+
+class demosaic {
+public:
+    enum method {
+        bilinear
+        , mhc         // Malvar-He-Cutler gradient-corrected 5x5
+    };
+    enum input {
+        raw10         // MIPI packed, 4 pixels in 5 bytes
+        , raw16       // 10-bit samples in uint16_t
+    };
+    enum output {
+        rgb24
+        , rgba32
+        , yuyv        // YUV 4:2:2, BT.601 full range
+    };
+
+    struct gains {    // Q8, 256 == 1.0, applied to the raw samples (clipped at 1023)
+        uint16_t r = 256;
+        uint16_t g = 256;
+        uint16_t b = 256;
+    };
+
+    struct options {
+        method algorithm = mhc;
+        output format = rgb24;
+        size_t tile_rows = 32;      // even
+        simd::isa isa = simd::best();
+    };
+
+    demosaic( size_t width, size_t height, thread_pool&, const options& );
+    ~demosaic();
+
+    static size_t bytes_per_pixel( output );
+    inline size_t output_size() const { return width_ * height_ * bytes_per_pixel( options_.format ); }
+    inline const options& settings() const { return options_; }
+
+    // width multiple of 4 (raw10) or 2 (raw16), height even; 'dst' holds output_size() bytes
+    bool operator()( const uint8_t * src, size_t src_stride, input, uint8_t * dst, const gains& );
+
+    // into a buffer from 'pool' (buffers of at least output_size()); nullptr when the pool is exhausted
+    std::shared_ptr< uint8_t > operator()( const uint8_t * src, size_t src_stride, input, buffer_pool&, const gains& );
+
+private:
+    struct scratch;
+    void tile( size_t index, scratch&, const uint8_t * src, size_t src_stride, input, uint8_t * dst, const gains& ) const;
+
+    size_t width_, height_;
+    thread_pool& pool_;
+    options options_;
+    std::vector< std::unique_ptr< scratch > > scratch_; // per worker
+};
@@ -0,0 +1,343 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "exposure_control.hpp"
+#include "i2c.hpp"
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <time.h>
+
+namespace {
+
+    enum {
+        SRM_GROUP_ACCESS   = 0x3212
+        , AEC_PK_EXPOSURE  = 0x3500     // 0x3500-0x3502, lines x16
+        , AEC_PK_MANUAL    = 0x3503
+        , AEC_PK_REAL_GAIN = 0x350a     // 0x350a-0x350b
+        , AEC_PK_VTS       = 0x350c     // 0x350c-0x350d
+        , TIMING_VTS       = 0x380e     // 0x380e-0x380f
+    };
+
+    constexpr uint8_t group = 3;
+    constexpr uint8_t group_hold = 0x00 | group;
+    constexpr uint8_t group_end = 0x10 | group;
+    constexpr uint8_t group_launch = 0xa0 | group;
+    constexpr uint32_t vts_margin = 4;  // exposure lines short of the frame length
+
+    // AEC stable range (WPT, BPT, WPT2, BPT2, high/low VPT): covering every level
+    // keeps the internal loop still even if 0x3503 gets switched back to auto
+    const std::pair< uint16_t, uint8_t > aec_range[] = {
+        { 0x3a0f, 0xff }, { 0x3a10, 0x00 }, { 0x3a1b, 0xff }, { 0x3a1e, 0x00 }, { 0x3a11, 0xff }, { 0x3a1f, 0x00 }
+    };
+
+    int64_t
+    now_ns()
+    {
+        struct timespec ts;
+        ::clock_gettime( CLOCK_MONOTONIC, &ts );
+        return int64_t( ts.tv_sec ) * 1000000000 + ts.tv_nsec;
+    }
+
+    std::array< std::pair< uint16_t, uint8_t >, 7 >
+    encode( const exposure_control::settings& s )
+    {
+        const uint32_t e = s.exposure << 4;
+        return {{ { AEC_PK_EXPOSURE, uint8_t( e >> 16 & 0x0f ) }
+                , { AEC_PK_EXPOSURE + 1, uint8_t( e >> 8 ) }
+                , { AEC_PK_EXPOSURE + 2, uint8_t( e ) }
+                , { AEC_PK_REAL_GAIN, uint8_t( s.gain >> 8 & 0x03 ) }
+                , { AEC_PK_REAL_GAIN + 1, uint8_t( s.gain ) }
+                , { AEC_PK_VTS, uint8_t( s.extra_lines >> 8 ) }
+                , { AEC_PK_VTS + 1, uint8_t( s.extra_lines ) } }};
+    }
+
+    inline bool operator == ( const exposure_control::settings& a, const exposure_control::settings& b ) {
+        return a.exposure == b.exposure && a.gain == b.gain && a.extra_lines == b.extra_lines;
+    }
+}
+
+exposure_control::exposure_control( i2c_linux::i2c& i2c
+                                    , const options& opts ) : i2c_( i2c )
+                                                            , options_( opts )
+                                                            , engaged_( false )
+                                                            , vts_( 0 )
+                                                            , resend_( false )
+                                                            , settle_( 0 )
+                                                            , frame_( 0 )
+                                                            , disturbed_at_( 0 )
+                                                            , history_count_( 0 )
+{
+    options_.damping = std::min( 1.0, std::max( 0.05, options_.damping ) );
+    options_.tolerance = std::max( 0.001, options_.tolerance );
+    options_.min_exposure = std::max( uint32_t( 1 ), options_.min_exposure );
+    options_.max_gain = std::min( uint16_t( 0x3ff ), std::max( uint16_t( 16 ), options_.max_gain ) );
+}
+
+exposure_control::~exposure_control()
+{
+    if ( engaged_ )
+        release();
+}
+
+bool
+exposure_control::read_reg( uint16_t reg, uint8_t& value ) const
+{
+    if ( auto v = i2c_.read_reg( reg ) ) {
+        value = *v;
+        return true;
+    }
+    return false;
+}
+
+bool
+exposure_control::write_reg( uint16_t reg, uint8_t value ) const
+{
+    return i2c_.write_reg( reg, value );
+}
+
+bool
+exposure_control::engage()
+{
+    if ( engaged_ )
+        return true;
+
+    const uint16_t regs[] = { TIMING_VTS, TIMING_VTS + 1
+                              , AEC_PK_EXPOSURE, AEC_PK_EXPOSURE + 1, AEC_PK_EXPOSURE + 2
+                              , AEC_PK_REAL_GAIN, AEC_PK_REAL_GAIN + 1, AEC_PK_VTS, AEC_PK_VTS + 1 };
+    uint8_t v[ sizeof( regs ) / sizeof( regs[ 0 ] ) ];
+    for ( size_t i = 0; i < sizeof( regs ) / sizeof( regs[ 0 ] ); ++i ) {
+        if ( ! read_reg( regs[ i ], v[ i ] ) )
+            return false;
+    }
+    vts_ = uint32_t( v[ 0 ] ) << 8 | v[ 1 ];
+    if ( vts_ <= vts_margin + options_.min_exposure ) {
+        std::cerr << "exposure_control: implausible VTS " << vts_ << std::endl;
+        return false;
+    }
+    current_.exposure = ( uint32_t( v[ 2 ] & 0x0f ) << 16 | uint32_t( v[ 3 ] ) << 8 | v[ 4 ] ) >> 4;
+    current_.gain = uint16_t( ( v[ 5 ] & 0x03 ) << 8 | v[ 6 ] );
+    current_.extra_lines = uint16_t( v[ 7 ] << 8 | v[ 8 ] );
+    written_ = current_;
+    resend_ = false;
+
+    saved_.clear();
+    for ( const auto& r: aec_range ) {
+        uint8_t value;
+        if ( ! read_reg( r.first, value ) )
+            return false;
+        saved_.emplace_back( r.first, value );
+    }
+    uint8_t manual;
+    if ( ! read_reg( AEC_PK_MANUAL, manual ) )
+        return false;
+    saved_.emplace_back( AEC_PK_MANUAL, manual ); // restored last
+
+    if ( ! write_reg( AEC_PK_MANUAL, manual | 0x03 ) ) // [1] AGC manual, [0] AEC manual
+        return false;
+    for ( const auto& r: aec_range ) {
+        if ( ! write_reg( r.first, r.second ) )
+            return false;
+    }
+
+    // start from a valid point inside the limits
+    const auto start = solve( std::max( current_.ev(), double( options_.min_exposure ) ) );
+    engaged_ = true;
+    settle_ = 0;
+    disturbed_at_ = int64_t( frame_ );
+    telemetry_.converged = false;
+    telemetry_.frames_to_converge = -1;
+    if ( ! ( start == current_ ) && write( start ) )
+        current_ = start;
+    return true;
+}
+
+bool
+exposure_control::release()
+{
+    if ( ! engaged_ )
+        return true;
+    bool ok = true;
+    for ( const auto& r: saved_ )
+        ok &= write_reg( r.first, r.second );
+    engaged_ = false;
+    return ok;
+}
+
+double
+exposure_control::meter( const image_stats::result& res ) const
+{
+    const size_t gx = res.grid_x, gy = res.grid_y;
+    if ( options_.policy == average || res.tiles.size() != gx * gy || res.tiles.empty() )
+        return res.frame.mean[ image_stats::Y ] / 256.0;
+
+    double sum = 0, norm = 0;
+    for ( size_t ty = 0; ty < gy; ++ty ) {
+        for ( size_t tx = 0; tx < gx; ++tx ) {
+            const double cx = ( tx + 0.5 ) / gx * 2 - 1, cy = ( ty + 0.5 ) / gy * 2 - 1; // tile centre in [-1, 1]
+            double w = 1;
+            switch ( options_.policy ) {
+            case center: w = 1 / ( 1 + 4 * ( cx * cx + cy * cy ) ); break;
+            case spot:   w = ( std::abs( cx ) < 0.25 + 1e-9 && std::abs( cy ) < 0.25 + 1e-9 ) ? 1 : 0; break;
+            case custom: w = options_.weights.size() == gx * gy ? options_.weights[ ty * gx + tx ] : 1; break;
+            default: break;
+            }
+            const auto& t = res.at( tx, ty );
+            sum += w * t.samples * ( t.mean[ image_stats::Y ] / 256.0 );
+            norm += w * t.samples;
+        }
+    }
+    return norm > 0 ? sum / norm : res.frame.mean[ image_stats::Y ] / 256.0;
+}
+
+exposure_control::settings
+exposure_control::solve( double ev ) const
+{
+    const uint32_t max_lines = vts_ - vts_margin + options_.max_extra_lines;
+    settings s;
+    s.exposure = uint32_t( std::min( double( max_lines ), std::max( double( options_.min_exposure ), std::floor( ev ) ) ) );
+    s.gain = uint16_t( std::min( double( options_.max_gain ), std::max( 16.0, std::round( ev * 16 / s.exposure ) ) ) );
+    s.extra_lines = uint16_t( s.exposure + vts_margin > vts_ ? s.exposure + vts_margin - vts_ : 0 );
+    return s;
+}
+
+bool
+exposure_control::write( const settings& s )
+{
+    const auto next = encode( s ), prev = encode( written_ );
+    bool ok = write_reg( SRM_GROUP_ACCESS, group_hold );
+    for ( size_t i = 0; ok && i < next.size(); ++i ) {
+        if ( resend_ || next[ i ].second != prev[ i ].second )
+            ok = write_reg( next[ i ].first, next[ i ].second );
+    }
+    ok = write_reg( SRM_GROUP_ACCESS, group_end ) && ok;
+    if ( ok && write_reg( SRM_GROUP_ACCESS, group_launch ) ) {
+        written_ = s;
+        resend_ = false;
+        return true;
+    }
+    resend_ = true; // a part of the group may be pending in the sensor
+    return false;
+}
+
+bool
+exposure_control::operator()( const image_stats::result& res, int64_t timestamp_ns )
+{
+    ++telemetry_.frames;
+    const uint64_t frame = frame_++;
+    if ( ! engaged_ )
+        return false;
+
+    const int64_t t0 = now_ns();
+    if ( settle_ ) {
+        --settle_;
+        ++telemetry_.settling;
+        return false;
+    }
+    if ( options_.budget_ns && timestamp_ns && t0 - timestamp_ns > options_.budget_ns ) {
+        ++telemetry_.late;
+        return false;
+    }
+
+    const double measured = meter( res );
+    double err = std::log2( options_.target / std::max( measured, 0.5 ) );
+    if ( measured >= options_.saturated ) // how far over is unknown; step at least 2 EV down
+        err = std::min( err, -2.0 / options_.damping );
+    const double clipped = res.frame.samples ? double( res.frame.clipped ) / res.frame.samples : 0;
+    telemetry_.error( err );
+
+    step st{ frame, float( measured ), float( err ), current_, 0, false };
+    auto record = [&]{ history_[ history_count_++ % history_.size() ] = st; };
+
+    // within the band, or darker than the target but already clipping: hold
+    if ( std::abs( err ) <= std::log2( 1 + options_.tolerance ) || ( err > 0 && clipped > options_.clip_limit ) ) {
+        if ( ! telemetry_.converged ) {
+            telemetry_.converged = true;
+            telemetry_.frames_to_converge = int64_t( frame ) - disturbed_at_;
+            telemetry_.max_frames_to_converge = std::max( telemetry_.max_frames_to_converge, telemetry_.frames_to_converge );
+        }
+        telemetry_.compute_ns( double( now_ns() - t0 ) );
+        record();
+        return false;
+    }
+    if ( telemetry_.converged ) {
+        telemetry_.converged = false;
+        telemetry_.frames_to_converge = -1;
+        ++telemetry_.disturbances;
+        disturbed_at_ = int64_t( frame );
+    }
+
+    const auto next = solve( current_.ev() * std::exp2( options_.damping * err ) );
+    telemetry_.compute_ns( double( now_ns() - t0 ) );
+    if ( next == current_ ) { // at a limit
+        record();
+        return false;
+    }
+
+    const int64_t t1 = now_ns();
+    const bool ok = write( next );
+    const int64_t t2 = now_ns();
+    telemetry_.write_ns( double( t2 - t1 ) );
+    if ( ! ok ) {
+        ++telemetry_.write_errors;
+        record();
+        return false;
+    }
+    current_ = next;
+    ++telemetry_.updates;
+    settle_ = options_.settle_frames;
+    if ( options_.budget_ns && timestamp_ns && t2 - timestamp_ns > options_.budget_ns )
+        ++telemetry_.overruns;
+
+    st.applied = current_;
+    st.written = true;
+    st.latency_us = timestamp_ns ? uint32_t( std::max( int64_t( 0 ), t2 - timestamp_ns ) / 1000 ) : 0;
+    record();
+    return true;
+}
+
+std::vector< exposure_control::step >
+exposure_control::history() const
+{
+    std::vector< step > h;
+    const size_t n = std::min( history_count_, history_.size() );
+    for ( size_t i = history_count_ - n; i < history_count_; ++i )
+        h.emplace_back( history_[ i % history_.size() ] );
+    return h;
+}
+
+void
+exposure_control::report( std::ostream& o ) const
+{
+    const auto& t = telemetry_;
+    o << boost::format( "ae: %d frames, %d updates, %d settling, %d late, %d overruns, %d write errors" )
+        % t.frames % t.updates % t.settling % t.late % t.overruns % t.write_errors << std::endl;
+    o << boost::format( "ae: %s, frames to converge %d (max %d), %d disturbances, error %.3f EV (sd %.3f)" )
+        % ( t.converged ? "converged" : "converging" ) % t.frames_to_converge % t.max_frames_to_converge
+        % t.disturbances % t.error.mean % t.error.stddev() << std::endl;
+    o << boost::format( "ae: compute %.1f us (max %.1f), group write %.1f us (max %.1f)" )
+        % ( t.compute_ns.mean / 1000 ) % ( t.compute_ns.max / 1000 ) % ( t.write_ns.mean / 1000 ) % ( t.write_ns.max / 1000 ) << std::endl;
+    o << boost::format( "ae: exposure %d lines (VTS %d + %d), gain %.2fx" )
+        % current_.exposure % vts_ % current_.extra_lines % ( current_.gain / 16.0 ) << std::endl;
+}
@@ -0,0 +1,146 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "image_stats.hpp"
+#include "running_stats.hpp"
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace i2c_linux { class i2c; }
+
+// Host-side AE/AGC: meters each frame's image_stats, steers exposure x gain
+// toward the target in log (EV) steps and writes the new exposure, real gain
+// and extra VTS as one SCCB group (0x3212 group 3: hold, write, launch), so the
+// sensor applies them on the same frame boundary.  engage() takes the sensor
+// out of its own AEC/AGC (0x3503 manual, 0x3a0f-0x3a1f stable range covering
+// every level) and release() restores what it found.
+//
+// Exposure is in lines (0x3500-0x3502 hold it x16), real gain in 1/16 steps
+// (0x350a-0x350b), extra VTS in lines (0x350c-0x350d, added to 0x380e-0x380f
+// when the exposure needs a longer frame).  Updates are deterministic for a
+// given sequence of statistics; only the latency budget looks at the clock.
+
+class exposure_control {
+public:
+    typedef running_stats interval;
+
+    enum metering {
+        average
+        , center            // tiles weighted by distance from the centre
+        , spot              // centre tile(s) only
+        , custom            // options::weights
+    };
+
+    struct options {
+        double target = 110;                // metered Y, 8 bit
+        double tolerance = 0.05;            // converged within +/- this fraction of the target
+        double damping = 0.8;               // fraction of the log error corrected per update, (0, 1]
+        metering policy = center;
+        std::vector< float > weights;       // grid_y rows of grid_x, for 'custom'
+        double clip_limit = 0.01;           // clipped fraction above which exposure only goes down
+        double saturated = 240;             // metered Y treated as blown out
+        uint32_t min_exposure = 1;          // lines
+        uint32_t max_extra_lines = 0;       // lines the frame may be stretched by (lowers the frame rate)
+        uint16_t max_gain = 128;            // 1/16 steps, 8x
+        size_t settle_frames = 2;           // frames to skip after a write while the sensor latches it
+        int64_t budget_ns = 4000000;        // from frame timestamp to group launch; 0: no budget
+    };
+
+    struct settings {
+        uint32_t exposure = 0;              // lines
+        uint16_t gain = 16;                 // 1/16 steps
+        uint16_t extra_lines = 0;
+        inline double ev() const { return double( exposure ) * gain / 16; }
+    };
+
+    struct step {                           // one metered frame, for telemetry
+        uint64_t frame;
+        float measured;                     // metered Y
+        float error;                        // log2( target / measured ), EV
+        settings applied;                   // after this frame
+        uint32_t latency_us;                // frame timestamp to group launch, 0 if not written
+        bool written;
+    };
+
+    struct telemetry {
+        uint64_t frames = 0;                // statistics received
+        uint64_t updates = 0;               // group writes
+        uint64_t settling = 0;              // frames skipped after a write
+        uint64_t late = 0;                  // frames already past the budget on arrival
+        uint64_t overruns = 0;              // group writes that finished past the budget
+        uint64_t write_errors = 0;
+        uint64_t disturbances = 0;          // times the error left the tolerance band
+        bool converged = false;
+        int64_t frames_to_converge = -1;    // from the last disturbance (or engage), -1 while converging
+        int64_t max_frames_to_converge = -1;
+        interval compute_ns;
+        interval write_ns;
+        interval error;                     // EV, metered frames
+    };
+
+    exposure_control( i2c_linux::i2c&, const options& );
+    ~exposure_control();
+
+    exposure_control( const exposure_control& ) = delete;
+    exposure_control& operator = ( const exposure_control& ) = delete;
+
+    bool engage();                          // reads timing and the current exposure, disables the sensor AEC
+    bool release();                         // restores the sensor AEC registers
+    inline bool engaged() const { return engaged_; }
+
+    // one frame; 'timestamp_ns' is its CLOCK_MONOTONIC capture time (0: no budget check).
+    // returns true when a new exposure was written
+    bool operator()( const image_stats::result&, int64_t timestamp_ns = 0 );
+
+    inline const settings& current() const { return current_; }
+    inline const telemetry& statistics() const { return telemetry_; }
+    std::vector< step > history() const;    // most recent last, up to 256
+    void report( std::ostream& ) const;
+
+    double meter( const image_stats::result& ) const;
+    settings solve( double ev ) const;      // exposure first, then gain, within the limits
+
+private:
+    bool write( const settings& );
+    bool read_reg( uint16_t, uint8_t& ) const;
+    bool write_reg( uint16_t, uint8_t ) const;
+
+    i2c_linux::i2c& i2c_;
+    options options_;
+    bool engaged_;
+    uint32_t vts_;                          // 0x380e-0x380f
+    settings current_;
+    settings written_;                      // what the sensor holds; only changed bytes are sent
+    bool resend_;                           // after a failed group: send every byte
+    std::vector< std::pair< uint16_t, uint8_t > > saved_;
+    size_t settle_;
+    uint64_t frame_;
+    int64_t disturbed_at_;
+    telemetry telemetry_;
+    std::array< step, 256 > history_;
+    size_t history_count_;
+};
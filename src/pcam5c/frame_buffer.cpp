@@ -0,0 +1,205 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "frame_buffer.hpp"
+#include <vdma/vdma.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+
+namespace {
+    inline vdma_format to_vdma( const frame_buffer::format& f ) {
+        return { f.width, f.height, f.bytes_per_pixel, f.stride, f.buffer_count, f.irq_frame_count, f.frame_size, f.max_buffers, f.flags, 0 };
+    }
+    inline frame_buffer::format from_vdma( const vdma_format& f ) {
+        return { f.width, f.height, f.bytes_per_pixel, f.stride, f.buffer_count, f.irq_frame_count, f.frame_size, f.max_buffers, f.flags };
+    }
+
+    inline bool sync( int fd, size_t index, size_t offset, size_t length, uint32_t flags ) {
+        vdma_sync arg = { uint32_t( index ), flags, uint32_t( offset ), uint32_t( length ) };
+        return ::ioctl( fd, VDMA_IOC_SYNC, &arg ) == 0;
+    }
+}
+
+frame_buffer::~frame_buffer()
+{
+    unmap();
+    if ( fd_ >= 0 )
+        ::close( fd_ );
+}
+
+frame_buffer::frame_buffer( const std::string& device
+                            , bool writable ) : fd_( ::open( device.c_str(), ( writable ? O_RDWR : O_RDONLY ) | O_CLOEXEC ) )
+                                              , writable_( writable )
+                                              , device_( device )
+{
+    if ( fd_ < 0 ) {
+        perror( device.c_str() );
+        return;
+    }
+    query();
+}
+
+bool
+frame_buffer::query()
+{
+    buffers_.clear();
+    for ( uint32_t index = 0;; ++index ) {
+        vdma_buffer arg = { index };
+        if ( ::ioctl( fd_, VDMA_IOC_QUERYBUF, &arg ) < 0 )
+            break; // EINVAL past the last buffer, ENOTTY on drivers without mmap support
+        buffers_.emplace_back( buffer{ nullptr, arg.length, arg.offset, arg.dma_addr } );
+    }
+    if ( buffers_.empty() )
+        perror( ( device_ + ": VDMA_IOC_QUERYBUF" ).c_str() );
+    return ! buffers_.empty();
+}
+
+void
+frame_buffer::unmap()
+{
+    for ( auto& buf: buffers_ ) {
+        if ( buf.data )
+            ::munmap( buf.data, buf.length );
+        buf.data = nullptr;
+    }
+}
+
+std::optional< frame_buffer::format >
+frame_buffer::get_format() const
+{
+    vdma_format arg;
+    if ( fd_ < 0 || ::ioctl( fd_, VDMA_IOC_G_FMT, &arg ) < 0 )
+        return {};
+    return from_vdma( arg );
+}
+
+bool
+frame_buffer::set_format( format& fmt )
+{
+    if ( fd_ < 0 )
+        return false;
+    unmap(); // the driver refuses to reallocate while any buffer is mapped
+    auto arg = to_vdma( fmt );
+    if ( ::ioctl( fd_, VDMA_IOC_S_FMT, &arg ) < 0 ) {
+        perror( ( device_ + ": VDMA_IOC_S_FMT" ).c_str() );
+        query();
+        return false;
+    }
+    fmt = from_vdma( arg );
+    return query();
+}
+
+const uint8_t *
+frame_buffer::data( size_t index )
+{
+    if ( index >= buffers_.size() )
+        return nullptr;
+
+    auto& buf = buffers_[ index ];
+    if ( buf.data == nullptr ) {
+        void * p = ::mmap( nullptr, buf.length, PROT_READ | ( writable_ ? PROT_WRITE : 0 ), MAP_SHARED, fd_, off_t( buf.offset ) );
+        if ( p == MAP_FAILED ) {
+            perror( ( device_ + ": mmap" ).c_str() );
+            return nullptr;
+        }
+        buf.data = static_cast< uint8_t * >( p );
+    }
+    return buf.data;
+}
+
+uint8_t *
+frame_buffer::mutable_data( size_t index )
+{
+    return writable_ ? const_cast< uint8_t * >( data( index ) ) : nullptr;
+}
+
+bool
+frame_buffer::begin_cpu_access( size_t index, size_t offset, size_t length ) const
+{
+    return sync( fd_, index, offset, length, VDMA_SYNC_BEGIN );
+}
+
+bool
+frame_buffer::end_cpu_access( size_t index, size_t offset, size_t length, bool written ) const
+{
+    return sync( fd_, index, offset, length, VDMA_SYNC_END | ( written ? VDMA_SYNC_WRITE : 0 ) );
+}
+
+int
+frame_buffer::export_dmabuf( size_t index, bool writable ) const
+{
+    vdma_expbuf arg = { uint32_t( index ), uint32_t( O_CLOEXEC | ( writable ? O_RDWR : O_RDONLY ) ), -1 };
+    if ( ::ioctl( fd_, VDMA_IOC_EXPBUF, &arg ) < 0 ) {
+        perror( ( device_ + ": VDMA_IOC_EXPBUF" ).c_str() );
+        return -1;
+    }
+    return arg.fd;
+}
+
+int
+frame_buffer::read_frames( frame_event * events, size_t max_events, int timeout_ms ) const
+{
+    pollfd fds = { fd_, POLLIN, 0 };
+    int rc;
+    while ( ( rc = ::poll( &fds, 1, timeout_ms ) ) < 0 && errno == EINTR )
+        ;
+    if ( rc <= 0 )
+        return rc;
+
+    std::array< vdma_frame, 16 > buf;
+    ssize_t size = ::read( fd_, buf.data(), std::min( max_events, buf.size() ) * sizeof( buf[0] ) );
+    if ( size < 0 ) {
+        perror( ( device_ + ": read" ).c_str() );
+        return -1;
+    }
+    size_t count = size / sizeof( buf[0] );
+    for ( size_t i = 0; i < count; ++i ) {
+        const auto& f = buf[ i ];
+        events[ i ] = { f.frame_seq, f.buffer_index, f.status, f.dropped, f.timestamp_ns, f.lost };
+    }
+    return int( count );
+}
+
+std::optional< frame_buffer::frame_event >
+frame_buffer::wait( std::chrono::milliseconds timeout ) const
+{
+    std::array< frame_event, 16 > events;
+    int count = read_frames( events.data(), events.size(), int( timeout.count() ) );
+    if ( count <= 0 )
+        return {};
+    while ( count == int( events.size() ) ) { // more queued; only the newest is of interest
+        int more = read_frames( events.data(), events.size(), 0 );
+        if ( more <= 0 )
+            break;
+        count = more;
+    }
+    return events[ count - 1 ];
+}
@@ -0,0 +1,119 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Zero-copy access to the VDMA S2MM frame stores through the vdma cdev.
+// Buffers are queried with VDMA_IOC_QUERYBUF and mmap'ed on first use; the
+// mapping stays valid until the frame_buffer is destroyed or set_format() is
+// called.
+
+class frame_buffer {
+public:
+    struct buffer {
+        uint8_t * data;
+        size_t length;
+        uint64_t offset;   // mmap offset on the cdev
+        uint64_t dma_addr; // S2MM frame store address
+    };
+
+    struct frame_event {     // struct vdma_frame
+        uint64_t frame_seq;
+        uint32_t buffer_index;
+        uint16_t status;      // S2MM_VDMASR[15:0]
+        uint16_t dropped;     // frames the interrupt missed (PARK_PTR advanced too far)
+        int64_t timestamp_ns; // CLOCK_MONOTONIC at the frame-count interrupt
+        uint32_t lost;        // records overwritten in the driver ring before this reader got them
+    };
+
+    enum pool { coherent = 0, cached = 0x0001 }; // VDMA_FMT_CACHED
+
+    struct format {          // struct vdma_format
+        uint32_t width;
+        uint32_t height;
+        uint32_t bytes_per_pixel;
+        uint32_t stride = 0;           // 0: width * bytes_per_pixel
+        uint32_t buffer_count = 4;
+        uint32_t irq_frame_count = 1;
+        uint32_t frame_size = 0;       // out
+        uint32_t max_buffers = 0;      // out
+        uint32_t flags = coherent;     // pool
+    };
+
+    // the vdma misc device: frame records on read(); the class device /dev/vdma0 reads registers
+    static constexpr const char * default_device = "/dev/vdma-frame0";
+
+    ~frame_buffer();
+    frame_buffer( const std::string& device = default_device, bool writable = false );
+
+    frame_buffer( const frame_buffer& ) = delete;
+    frame_buffer& operator = ( const frame_buffer& ) = delete;
+
+    inline explicit operator bool () const { return fd_ >= 0 && ! buffers_.empty(); }
+    inline const std::string& device() const { return device_; }
+    inline int fd() const { return fd_; }
+
+    inline size_t size() const { return buffers_.size(); }
+    inline const buffer& operator []( size_t index ) const { return buffers_.at( index ); }
+
+    // maps buffer 'index' if it is not mapped yet; nullptr on failure
+    const uint8_t * data( size_t index );
+    uint8_t * mutable_data( size_t index ); // requires writable
+
+    std::optional< format > get_format() const;
+    // unmaps all buffers, applies the format (the driver may reallocate) and queries the buffers again
+    bool set_format( format& );
+
+    // VDMA_IOC_SYNC on [offset, offset + length); length 0 is up to the end of the buffer.
+    // Cached pools must read a frame between begin and end; no-op for coherent pools.
+    bool begin_cpu_access( size_t index, size_t offset = 0, size_t length = 0 ) const;
+    bool end_cpu_access( size_t index, size_t offset = 0, size_t length = 0, bool written = false ) const;
+
+    // VDMA_IOC_EXPBUF: new dma-buf fd for buffer 'index' owned by the caller, -1 on failure.
+    // Receivers bracket CPU reads with DMA_BUF_IOCTL_SYNC, which maps onto the same cache sync.
+    int export_dmabuf( size_t index, bool writable = false ) const;
+
+    // drains the driver frame ring, oldest first; returns number of records, 0 on timeout, -1 on error
+    int read_frames( frame_event *, size_t max_events, int timeout_ms ) const;
+
+    // sleeps until the driver signals a frame newer than the last one returned and
+    // returns the newest one, skipping any older records; empty on timeout/error
+    std::optional< frame_event > wait( std::chrono::milliseconds timeout ) const;
+
+private:
+    bool query();
+    void unmap();
+
+    int fd_;
+    bool writable_;
+    std::string device_;
+    std::vector< buffer > buffers_;
+};
@@ -0,0 +1,446 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "frame_ring.hpp"
+#include "scm_rights.hpp"
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <boost/format.hpp>
+
+using namespace frame_ring;
+
+namespace {
+
+    bool
+    make_address( const std::string& path, sockaddr_un& addr )
+    {
+        std::memset( &addr, 0, sizeof( addr ) );
+        addr.sun_family = AF_UNIX;
+        if ( path.size() >= sizeof( addr.sun_path ) ) {
+            std::cerr << "frame_ring: socket path too long: " << path << std::endl;
+            return false;
+        }
+        std::strncpy( addr.sun_path, path.c_str(), sizeof( addr.sun_path ) - 1 );
+        return true;
+    }
+
+    void
+    ring( int doorbell )
+    {
+        uint64_t one = 1;
+        if ( ::write( doorbell, &one, sizeof( one ) ) < 0 && errno != EAGAIN )
+            ::perror( "frame_ring::doorbell" );
+    }
+}
+
+publisher::~publisher()
+{
+    if ( header_ ) {
+        header_->alive.store( 0, std::memory_order_release );
+        for ( auto& c: readers_ )
+            ring( c.doorbell );
+    }
+    while ( ! readers_.empty() )
+        detach( readers_.size() - 1 );
+    held_.clear(); // buffers go back to the source
+    for ( auto fd: fds_ )
+        ::close( fd );
+    if ( listen_ >= 0 ) {
+        ::close( listen_ );
+        ::unlink( path_.c_str() );
+    }
+    if ( header_ )
+        ::munmap( header_, sizeof( header ) );
+    if ( control_ >= 0 )
+        ::close( control_ );
+}
+
+publisher::publisher( frame_source& source
+                      , const std::string& path
+                      , size_t hold ) : source_( source )
+                                      , path_( path )
+                                      , listen_( -1 )
+                                      , control_( -1 )
+                                      , header_( nullptr )
+                                      , held_( source.size() )
+                                      , hold_( hold ? hold : source.size() > 2 ? source.size() - 2 : 1 )
+                                      , attached_( 0 )
+{
+    if ( source_.size() == 0 || source_.size() > max_slots ) {
+        std::cerr << "frame_ring: source has " << source_.size() << " buffers, 1.." << max_slots << " supported" << std::endl;
+        return;
+    }
+    hold_ = std::min( hold_, source_.size() );
+
+    for ( size_t i = 0; i < source_.size(); ++i ) {
+        int fd = source_.export_fd( i );
+        if ( fd < 0 ) {
+            std::cerr << "frame_ring: buffer " << i << " cannot be shared" << std::endl;
+            return;
+        }
+        fds_.emplace_back( fd );
+    }
+
+    control_ = ::memfd_create( "pcam5cd", MFD_CLOEXEC | MFD_ALLOW_SEALING );
+    if ( control_ < 0 ) {
+        ::perror( "frame_ring::memfd_create" );
+        return;
+    }
+    if ( ::ftruncate( control_, sizeof( header ) ) < 0
+         || ::fcntl( control_, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL ) < 0 ) {
+        ::perror( "frame_ring::ftruncate" );
+        return;
+    }
+    void * p = ::mmap( nullptr, sizeof( header ), PROT_READ | PROT_WRITE, MAP_SHARED, control_, 0 );
+    if ( p == MAP_FAILED ) {
+        ::perror( "frame_ring::mmap" );
+        return;
+    }
+    header_ = new ( p ) header{}; // memfd pages are zero; placement-new starts the atomics' lifetime
+
+    auto fmt = source_.format();
+    header_->magic = magic;
+    header_->version = version;
+    header_->slot_count = uint32_t( source_.size() );
+    header_->flags = fmt.flags;
+    header_->width = fmt.width;
+    header_->height = fmt.height;
+    header_->bytes_per_pixel = fmt.bytes_per_pixel;
+    header_->stride = fmt.stride ? fmt.stride : fmt.width * fmt.bytes_per_pixel;
+    header_->frame_size = fmt.frame_size;
+    header_->alive.store( 1, std::memory_order_release );
+
+    sockaddr_un addr;
+    if ( ! make_address( path_, addr ) )
+        return;
+    listen_ = ::socket( AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0 );
+    if ( listen_ < 0 ) {
+        ::perror( "frame_ring::socket" );
+        return;
+    }
+    ::unlink( path_.c_str() ); // stale socket of a previous run
+    if ( ::bind( listen_, reinterpret_cast< sockaddr * >( &addr ), sizeof( addr ) ) < 0
+         || ::listen( listen_, 8 ) < 0 ) {
+        ::perror( ( "frame_ring::bind " + path_ ).c_str() );
+        ::close( listen_ );
+        listen_ = -1;
+    }
+}
+
+void
+publisher::retire( uint32_t index )
+{
+    // readers see 0 before the buffer can be handed back to the writer
+    header_->slots[ index ].seq.store( 0, std::memory_order_release );
+    held_[ index ] = frame_ref();
+}
+
+void
+publisher::publish( const frame_ref& ref )
+{
+    if ( ! header_ || ! ref || ref.index() >= held_.size() )
+        return;
+
+    // the VDMA writer cannot be held off: drop frames it already ran over
+    for ( auto it = order_.begin(); it != order_.end(); ) {
+        if ( ! held_[ *it ].valid() || *it == ref.index() ) {
+            retire( *it );
+            it = order_.erase( it );
+        } else {
+            ++it;
+        }
+    }
+
+    auto& s = header_->slots[ ref.index() ];
+    s.timestamp_ns.store( ref.timestamp_ns(), std::memory_order_relaxed );
+    s.length.store( uint32_t( ref.length() ), std::memory_order_relaxed );
+    s.dropped.store( ref.dropped(), std::memory_order_relaxed );
+    s.seq.store( ref.seq(), std::memory_order_release );
+    held_[ ref.index() ] = ref;
+    order_.emplace_back( ref.index() );
+
+    header_->head.store( ref.seq(), std::memory_order_release );
+    header_->published.fetch_add( 1, std::memory_order_relaxed );
+    header_->dropped.fetch_add( ref.dropped(), std::memory_order_relaxed );
+
+    while ( order_.size() > hold_ ) {
+        retire( order_.front() );
+        order_.pop_front();
+    }
+
+    for ( auto& c: readers_ )
+        ring( c.doorbell );
+}
+
+bool
+publisher::attach( int sock )
+{
+    int doorbell = ::eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+    if ( doorbell < 0 ) {
+        ::perror( "frame_ring::eventfd" );
+        return false;
+    }
+    message m{ magic, control, 0, uint32_t( sizeof( header ) ) };
+    bool ok = scm_rights::send( sock, control_, &m, sizeof( m ) );
+    m = message{ magic, frame_ring::doorbell, 0, sizeof( uint64_t ) };
+    ok = ok && scm_rights::send( sock, doorbell, &m, sizeof( m ) );
+    for ( size_t i = 0; ok && i < fds_.size(); ++i ) {
+        m = message{ magic, buffer, uint32_t( i ), uint32_t( source_.length( i ) ) };
+        ok = scm_rights::send( sock, fds_[ i ], &m, sizeof( m ) );
+    }
+    if ( ! ok ) {
+        ::close( doorbell );
+        return false;
+    }
+    readers_.emplace_back( client{ sock, doorbell } );
+    header_->readers.store( uint32_t( readers_.size() ), std::memory_order_relaxed );
+    ++attached_;
+    return true;
+}
+
+void
+publisher::detach( size_t i )
+{
+    ::close( readers_[ i ].sock );
+    ::close( readers_[ i ].doorbell );
+    readers_.erase( readers_.begin() + i );
+    if ( header_ )
+        header_->readers.store( uint32_t( readers_.size() ), std::memory_order_relaxed );
+}
+
+void
+publisher::service( std::chrono::milliseconds timeout )
+{
+    if ( listen_ < 0 )
+        return;
+
+    std::vector< pollfd > fds( 1 + readers_.size() );
+    fds[ 0 ] = { listen_, POLLIN, 0 };
+    for ( size_t i = 0; i < readers_.size(); ++i )
+        fds[ i + 1 ] = { readers_[ i ].sock, POLLIN, 0 };
+
+    if ( ::poll( fds.data(), fds.size(), int( timeout.count() ) ) <= 0 )
+        return;
+
+    // readers have nothing to say; anything readable on their socket is a hang-up or garbage
+    for ( size_t i = readers_.size(); i-- > 0; ) {
+        if ( fds[ i + 1 ].revents )
+            detach( i );
+    }
+    if ( fds[ 0 ].revents & POLLIN ) {
+        int sock = ::accept4( listen_, nullptr, nullptr, SOCK_CLOEXEC );
+        if ( sock < 0 ) {
+            ::perror( "frame_ring::accept" );
+        } else if ( ! attach( sock ) ) {
+            ::close( sock );
+        }
+    }
+}
+
+void
+publisher::report( std::ostream& o ) const
+{
+    if ( ! header_ )
+        return;
+    o << boost::format( "ring: %s, %d slots, hold %d, published %d, source dropped %d, readers %d (attached %d)" )
+        % path_ % header_->slot_count % hold_
+        % header_->published.load() % header_->dropped.load() % readers_.size() % attached_ << std::endl;
+}
+
+reader::~reader()
+{
+    detach();
+}
+
+reader::reader() : sock_( -1 )
+                 , control_( -1 )
+                 , doorbell_( -1 )
+                 , header_( nullptr )
+                 , last_( 0 )
+                 , missed_( 0 )
+{
+}
+
+bool
+reader::attach( const std::string& path )
+{
+    detach();
+
+    sockaddr_un addr;
+    if ( ! make_address( path, addr ) )
+        return false;
+    sock_ = ::socket( AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0 );
+    if ( sock_ < 0 ) {
+        ::perror( "frame_ring::socket" );
+        return false;
+    }
+    if ( ::connect( sock_, reinterpret_cast< sockaddr * >( &addr ), sizeof( addr ) ) < 0 ) {
+        ::perror( ( "frame_ring::connect " + path ).c_str() );
+        detach();
+        return false;
+    }
+
+    message m;
+    control_ = scm_rights::receive( sock_, &m, sizeof( m ) );
+    if ( control_ < 0 || m.magic != magic || m.kind != control || m.length < sizeof( header ) ) {
+        std::cerr << "frame_ring: " << path << ": no control page" << std::endl;
+        detach();
+        return false;
+    }
+    void * p = ::mmap( nullptr, sizeof( header ), PROT_READ, MAP_SHARED, control_, 0 );
+    if ( p == MAP_FAILED ) {
+        ::perror( "frame_ring::mmap" );
+        detach();
+        return false;
+    }
+    header_ = reinterpret_cast< header * >( p );
+    if ( header_->magic != magic || header_->version != version || header_->slot_count > max_slots ) {
+        std::cerr << "frame_ring: " << path << ": version mismatch" << std::endl;
+        detach();
+        return false;
+    }
+
+    doorbell_ = scm_rights::receive( sock_, &m, sizeof( m ) );
+    if ( doorbell_ < 0 || m.kind != frame_ring::doorbell ) {
+        std::cerr << "frame_ring: " << path << ": no doorbell" << std::endl;
+        detach();
+        return false;
+    }
+
+    buffers_.assign( header_->slot_count, mapping{ nullptr, 0 } );
+    for ( size_t i = 0; i < header_->slot_count; ++i ) {
+        int fd = scm_rights::receive( sock_, &m, sizeof( m ) );
+        if ( fd < 0 || m.kind != buffer || m.index >= buffers_.size() ) {
+            std::cerr << "frame_ring: " << path << ": buffer " << i << " missing" << std::endl;
+            if ( fd >= 0 )
+                ::close( fd );
+            detach();
+            return false;
+        }
+        void * data = ::mmap( nullptr, m.length, PROT_READ, MAP_SHARED, fd, 0 );
+        ::close( fd ); // the mapping keeps the buffer alive
+        if ( data == MAP_FAILED ) {
+            ::perror( "frame_ring::mmap buffer" );
+            detach();
+            return false;
+        }
+        buffers_[ m.index ] = mapping{ reinterpret_cast< const uint8_t * >( data ), m.length };
+    }
+    last_ = header_->head.load( std::memory_order_acquire ); // start with the next frame
+    missed_ = 0;
+    return true;
+}
+
+void
+reader::detach()
+{
+    for ( auto& b: buffers_ ) {
+        if ( b.data )
+            ::munmap( const_cast< uint8_t * >( b.data ), b.length );
+    }
+    buffers_.clear();
+    if ( header_ )
+        ::munmap( header_, sizeof( header ) );
+    header_ = nullptr;
+    for ( int * fd: { &doorbell_, &control_, &sock_ } ) {
+        if ( *fd >= 0 )
+            ::close( *fd );
+        *fd = -1;
+    }
+}
+
+bool
+reader::alive() const
+{
+    return header_ && header_->alive.load( std::memory_order_acquire );
+}
+
+std::optional< reader::view >
+reader::find( uint64_t seq ) const
+{
+    for ( size_t i = 0; i < buffers_.size(); ++i ) {
+        const auto& s = header_->slots[ i ];
+        if ( s.seq.load( std::memory_order_acquire ) != seq )
+            continue;
+        view v{ seq
+                , uint32_t( i )
+                , s.timestamp_ns.load( std::memory_order_relaxed )
+                , s.dropped.load( std::memory_order_relaxed )
+                , buffers_[ i ].data
+                , std::min( size_t( s.length.load( std::memory_order_relaxed ) ), buffers_[ i ].length ) };
+        if ( valid( v ) )
+            return v;
+    }
+    return {};
+}
+
+bool
+reader::valid( const view& v ) const
+{
+    std::atomic_thread_fence( std::memory_order_acquire );
+    return header_ && header_->slots[ v.index ].seq.load( std::memory_order_relaxed ) == v.seq;
+}
+
+std::optional< reader::view >
+reader::next( std::chrono::milliseconds timeout )
+{
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while ( alive() ) {
+        uint64_t count;
+        while ( ::read( doorbell_, &count, sizeof( count ) ) == sizeof( count ) ) // drain before looking at head
+            ;
+        const uint64_t head = header_->head.load( std::memory_order_acquire );
+        if ( head > last_ ) {
+            const uint64_t wanted = last_ ? last_ + 1 : head;
+            if ( auto v = find( wanted ) ) {
+                last_ = wanted;
+                return v;
+            }
+            auto v = find( head );
+            missed_ += head - wanted + ( v ? 0 : 1 );
+            last_ = head;
+            if ( v )
+                return v;
+            continue; // newest was rewritten too (VDMA); wait for the next one
+        }
+        auto remaining = std::chrono::duration_cast< std::chrono::milliseconds >( deadline - std::chrono::steady_clock::now() );
+        if ( remaining.count() <= 0 )
+            return {};
+        pollfd fds[] = { { doorbell_, POLLIN, 0 }, { sock_, POLLIN, 0 } }; // socket hang-up: daemon gone
+        if ( ::poll( fds, 2, int( remaining.count() ) ) < 0 && errno != EINTR )
+            return {};
+        if ( fds[ 1 ].revents )
+            return {};
+    }
+    return {};
+}
@@ -0,0 +1,185 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "capture.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Shared-memory frame ring between pcam5cd and independent reader processes.
+//
+// The ring does not copy pixels: its slots are the frame source's own buffers
+// (VDMA dma-bufs, or memfds for the synthetic source), handed to a reader over
+// an AF_UNIX socket together with a read-only control page and a private
+// eventfd doorbell.  Each slot carries the sequence number of the frame the
+// buffer holds and acts as a seqlock: 0 while the buffer is being rewritten.
+// Readers never hold buffers and cannot stall capture; they re-check the slot
+// after processing to know whether the frame stayed intact.  Closing the
+// socket detaches.
+
+namespace frame_ring {
+
+    constexpr uint32_t magic = 0x64356370; // "pc5d"
+    constexpr uint32_t version = 1;
+    constexpr size_t max_slots = 32;       // VDMA frame stores
+
+    struct alignas( 64 ) slot {
+        std::atomic< uint64_t > seq;          // frame in the buffer, 0 while it is being rewritten
+        std::atomic< int64_t > timestamp_ns;  // CLOCK_MONOTONIC
+        std::atomic< uint32_t > length;
+        std::atomic< uint32_t > dropped;      // frames lost by the source before this one
+    };
+
+    struct header {                           // control page, written by the daemon only
+        uint32_t magic;
+        uint32_t version;
+        uint32_t slot_count;
+        uint32_t flags;                       // frame_buffer::pool
+        uint32_t width;
+        uint32_t height;
+        uint32_t bytes_per_pixel;
+        uint32_t stride;
+        uint32_t frame_size;
+        uint32_t reserved[ 7 ];
+        std::atomic< uint64_t > head;         // newest published seq, 0 before the first frame
+        std::atomic< uint64_t > published;
+        std::atomic< uint64_t > dropped;      // reported by the source
+        std::atomic< uint32_t > readers;
+        std::atomic< uint32_t > alive;        // cleared when the daemon shuts down
+        slot slots[ max_slots ];
+    };
+
+    static_assert( std::atomic< uint64_t >::is_always_lock_free, "ring atomics must be address free" );
+
+    enum message_kind : uint32_t { control = 1, doorbell = 2, buffer = 3 };
+
+    struct message {                          // payload of each fd sent on attach, in this order:
+        uint32_t magic;                       // control, doorbell, then one buffer per slot
+        uint32_t kind;
+        uint32_t index;
+        uint32_t length;                      // bytes to mmap
+    };
+
+    // daemon side; single threaded, call publish() and service() from the same thread
+    class publisher {
+    public:
+        ~publisher();
+        // keeps the newest 'hold' frames readable (0: buffers - 2, at least 1)
+        publisher( frame_source&, const std::string& socket_path, size_t hold = 0 );
+
+        publisher( const publisher& ) = delete;
+        publisher& operator = ( const publisher& ) = delete;
+
+        inline explicit operator bool () const { return header_ != nullptr && listen_ >= 0; }
+
+        // makes the frame visible to readers and rings every doorbell
+        void publish( const frame_ref& );
+
+        // accepts new readers and drops those that went away; waits at most 'timeout'
+        void service( std::chrono::milliseconds timeout );
+
+        inline size_t readers() const { return readers_.size(); }
+        void report( std::ostream& ) const;
+
+    private:
+        bool attach( int sock );
+        void detach( size_t );
+        void retire( uint32_t index );
+
+        struct client {
+            int sock;
+            int doorbell;
+        };
+        frame_source& source_;
+        std::string path_;
+        int listen_;
+        int control_;
+        header * header_;
+        std::vector< int > fds_;          // exported buffers
+        std::vector< frame_ref > held_;   // by buffer index
+        std::deque< uint32_t > order_;    // held buffers, oldest first
+        std::vector< client > readers_;
+        size_t hold_;
+        uint64_t attached_;
+    };
+
+    // reader process side
+    class reader {
+    public:
+        struct view {
+            uint64_t seq;
+            uint32_t index;
+            int64_t timestamp_ns;
+            uint32_t dropped;
+            const uint8_t * data;
+            size_t length;
+        };
+
+        ~reader();
+        reader();
+
+        reader( const reader& ) = delete;
+        reader& operator = ( const reader& ) = delete;
+
+        bool attach( const std::string& socket_path );
+        void detach();
+
+        inline explicit operator bool () const { return header_ != nullptr; }
+
+        // the frame after the last one returned, or the newest one if that was already
+        // rewritten (the gap is added to missed()); empty on timeout or once the daemon is gone
+        std::optional< view > next( std::chrono::milliseconds timeout );
+
+        // false once the buffer behind 'v' has been handed back to the writer; check after processing
+        bool valid( const view& ) const;
+
+        bool alive() const;
+        inline const header * info() const { return header_; }
+        inline int doorbell() const { return doorbell_; } // pollable
+        inline uint64_t missed() const { return missed_; }
+
+    private:
+        std::optional< view > find( uint64_t seq ) const;
+
+        struct mapping {
+            const uint8_t * data;
+            size_t length;
+        };
+        int sock_;
+        int control_;
+        int doorbell_;
+        header * header_;
+        std::vector< mapping > buffers_;
+        uint64_t last_;
+        uint64_t missed_;
+    };
+
+}
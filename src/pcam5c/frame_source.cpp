@@ -0,0 +1,89 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "frame_source.hpp"
+
+vdma_source::vdma_source( const std::string& device ) : fb_( device )
+                                                      , format_{ 0, 0, 0 }
+{
+    if ( auto fmt = fb_.get_format() )
+        format_ = *fmt;
+    for ( size_t i = 0; i < fb_.size(); ++i )
+        fb_.data( i ); // map everything up front, not on the capture thread
+}
+
+size_t
+vdma_source::size() const
+{
+    return fb_.size();
+}
+
+const uint8_t *
+vdma_source::data( size_t index )
+{
+    return fb_.data( index );
+}
+
+size_t
+vdma_source::length( size_t index ) const
+{
+    return index < fb_.size() ? fb_[ index ].length : 0;
+}
+
+frame_buffer::format
+vdma_source::format() const
+{
+    return format_;
+}
+
+int
+vdma_source::next( frame& f, std::chrono::milliseconds timeout )
+{
+    frame_buffer::frame_event ev;
+    int rc = fb_.read_frames( &ev, 1, int( timeout.count() ) );
+    if ( rc <= 0 )
+        return rc;
+    if ( format_.flags & frame_buffer::cached )
+        fb_.begin_cpu_access( ev.buffer_index, 0, format_.frame_size );
+    f = frame{ ev.frame_seq
+               , ev.buffer_index
+               , ev.timestamp_ns
+               , uint32_t( ev.dropped ) + ev.lost
+               , int32_t( ( ev.buffer_index + 1 ) % fb_.size() )
+               , 0 };
+    return 1;
+}
+
+void
+vdma_source::release( size_t index )
+{
+    if ( format_.flags & frame_buffer::cached )
+        fb_.end_cpu_access( index, 0, format_.frame_size );
+}
+
+int
+vdma_source::export_fd( size_t index ) const
+{
+    return fb_.export_dmabuf( index );
+}
@@ -0,0 +1,88 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "frame_buffer.hpp"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Producer side of the capture pipeline: a fixed set of buffers and a stream of
+// completed-frame notifications.  A buffer handed out by next() belongs to the
+// consumers until release() is called for it; sources that can steer the writer
+// (synthetic ones) never write into such a buffer, VDMA in circular park mode
+// cannot be steered and reports the store it started overwriting instead.
+
+class frame_source {
+public:
+    struct frame {
+        uint64_t seq;
+        uint32_t index;        // buffer
+        int64_t timestamp_ns;  // CLOCK_MONOTONIC
+        uint32_t dropped;      // frames lost by the source before this one
+        int32_t overwriting;   // buffer the writer moved on to, -1 if it never writes a held buffer
+        uint32_t length;       // valid bytes from the start of the buffer, 0: all of it
+    };
+
+    virtual ~frame_source() {}
+
+    virtual size_t size() const = 0;                   // number of buffers
+    virtual const uint8_t * data( size_t index ) = 0;  // mapped; nullptr on failure
+    virtual size_t length( size_t index ) const = 0;
+    virtual frame_buffer::format format() const = 0;
+
+    // waits for the next completed frame; 1 on success, 0 on timeout, -1 on error
+    virtual int next( frame&, std::chrono::milliseconds timeout ) = 0;
+
+    // last consumer let go of the buffer; may be called from any thread
+    virtual void release( size_t index ) = 0;
+
+    // new fd owned by the caller that another process can mmap to see buffer 'index', -1 if unsupported
+    virtual int export_fd( size_t ) const { return -1; }
+};
+
+// VDMA S2MM through the vdma cdev; cached pools are invalidated before the
+// frame is handed out and returned to the device on release.
+
+class vdma_source : public frame_source {
+public:
+    vdma_source( const std::string& device = frame_buffer::default_device );
+
+    inline explicit operator bool () const { return bool( fb_ ); }
+
+    size_t size() const override;
+    const uint8_t * data( size_t index ) override;
+    size_t length( size_t index ) const override;
+    frame_buffer::format format() const override;
+    int next( frame&, std::chrono::milliseconds timeout ) override;
+    void release( size_t index ) override;
+    int export_fd( size_t index ) const override; // dma-buf
+
+private:
+    frame_buffer fb_;
+    frame_buffer::format format_;
+};
@@ -0,0 +1,99 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "frame_stats.hpp"
+#include <array>
+#include <time.h>
+#include <boost/format.hpp>
+
+namespace {
+    // S2MM_VDMASR: internal/slave/decode error, SOF/EOL early and late
+    constexpr uint16_t error_mask = 0x0010 | 0x0020 | 0x0040 | 0x0080 | 0x0100 | 0x0800 | 0x8000;
+}
+
+frame_stats::frame_stats() : records( 0 )
+                           , dropped( 0 )
+                           , lost( 0 )
+                           , errors( 0 )
+                           , seq_gaps( 0 )
+                           , last_seq_( 0 )
+                           , last_timestamp_( 0 )
+                           , expected_step_( 0 )
+{
+}
+
+int64_t
+frame_stats::now_ns()
+{
+    timespec ts;
+    ::clock_gettime( CLOCK_MONOTONIC, &ts );
+    return int64_t( ts.tv_sec ) * 1000000000 + ts.tv_nsec;
+}
+
+void
+frame_stats::operator()( const frame_buffer::frame_event& ev, int64_t received_ns )
+{
+    dropped += ev.dropped;
+    lost += ev.lost;
+    if ( ev.status & error_mask )
+        ++errors;
+
+    latency( double( received_ns - ev.timestamp_ns ) );
+
+    if ( records++ && ev.lost == 0 ) { // intervals across lost records are meaningless
+        uint64_t step = ev.frame_seq - last_seq_ - ev.dropped; // frames per interrupt
+        if ( expected_step_ == 0 )
+            expected_step_ = step;
+        else if ( step != expected_step_ )
+            ++seq_gaps;
+        if ( ev.dropped == 0 )
+            period( double( ev.timestamp_ns - last_timestamp_ ) );
+    }
+    last_seq_ = ev.frame_seq;
+    last_timestamp_ = ev.timestamp_ns;
+}
+
+bool
+frame_stats::run( const frame_buffer& fb, size_t max_frames, std::chrono::milliseconds timeout )
+{
+    std::array< frame_buffer::frame_event, 16 > events;
+    while ( records < max_frames ) {
+        int count = fb.read_frames( events.data(), events.size(), int( timeout.count() ) );
+        if ( count <= 0 )
+            return count == 0 && records > 0; // timeout after at least one frame is a normal end
+        auto received = now_ns();
+        for ( int i = 0; i < count; ++i )
+            ( *this )( events[ i ], received );
+    }
+    return true;
+}
+
+void
+frame_stats::report( std::ostream& o ) const
+{
+    o << boost::format( "frames: records=%d last_seq=%d dropped=%d lost(ring)=%d errors=%d seq-gaps=%d\n" )
+        % records % last_seq_ % dropped % lost % errors % seq_gaps;
+    period.report( o, "period" );
+    latency.report( o, "latency" );
+}
@@ -0,0 +1,63 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "frame_buffer.hpp"
+#include "running_stats.hpp"
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+// Frame interval jitter, drops and interrupt-to-user latency from the vdma
+// frame ring.  Latency is CLOCK_MONOTONIC at the time the record reached
+// userspace minus the kernel timestamp of the frame-count interrupt.
+
+class frame_stats {
+public:
+    typedef running_stats interval;
+
+    frame_stats();
+
+    void operator()( const frame_buffer::frame_event&, int64_t received_ns );
+
+    // reads until 'max_frames' records were seen or 'timeout' passes without a frame
+    bool run( const frame_buffer&, size_t max_frames, std::chrono::milliseconds timeout );
+    void report( std::ostream& ) const;
+
+    static int64_t now_ns(); // CLOCK_MONOTONIC
+
+    size_t records;
+    uint64_t dropped;   // detected by the driver from PARK_PTR
+    uint64_t lost;      // driver ring overruns for this reader
+    uint64_t errors;    // records with S2MM error bits set
+    uint64_t seq_gaps;  // frame_seq jumps not explained by dropped
+    interval period;    // ns between frame-count interrupts
+    interval latency;   // ns from interrupt to userspace
+
+private:
+    uint64_t last_seq_;
+    int64_t last_timestamp_;
+    uint64_t expected_step_;
+};
@@ -0,0 +1,128 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "gpio_watch.hpp"
+#include "spsc_queue.hpp"
+#include <array>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <boost/format.hpp>
+
+gpio_watch::gpio_watch( const std::string& device
+                        , const std::vector< uint32_t >& offsets
+                        , size_t ring_size ) : chip_( device, offsets, gpiochip::edges, "pcam5c-watch" )
+                                             , ring_size_( ring_size )
+                                             , overruns_( 0 )
+{
+}
+
+void
+gpio_watch::account( const gpio_event& ev )
+{
+    auto& st = stats_[ ev.offset ];
+    if ( st.last_line_seqno && ev.line_seqno != st.last_line_seqno + 1 )
+        st.missed += ev.line_seqno - st.last_line_seqno - 1; // kernel kfifo overflow
+    st.last_line_seqno = ev.line_seqno;
+
+    if ( ev.id == gpiochip::rising_edge ) {
+        ++st.rising;
+        if ( st.last_rise )
+            st.rise_period( double( ev.timestamp_ns - st.last_rise ) );
+        if ( st.last_fall )
+            st.low_width( double( ev.timestamp_ns - st.last_fall ) );
+        st.last_rise = ev.timestamp_ns;
+    } else {
+        ++st.falling;
+        if ( st.last_fall )
+            st.fall_period( double( ev.timestamp_ns - st.last_fall ) );
+        if ( st.last_rise )
+            st.high_width( double( ev.timestamp_ns - st.last_rise ) );
+        st.last_fall = ev.timestamp_ns;
+    }
+}
+
+bool
+gpio_watch::run( size_t max_events, std::chrono::milliseconds timeout, const std::string& trace )
+{
+    if ( ! chip_ )
+        return false;
+
+    std::ofstream of;
+    if ( ! trace.empty() ) {
+        of.open( trace, std::ios::binary | std::ios::trunc );
+        if ( ! of ) {
+            std::cerr << "gpio_watch: " << trace << " could not be opened" << std::endl;
+            return false;
+        }
+        trace_header header = { "GPIOEVT", 1, sizeof( gpio_event ) };
+        of.write( reinterpret_cast< const char * >( &header ), sizeof( header ) );
+    }
+
+    spsc_queue< gpio_event > ring( ring_size_ );
+    std::atomic< bool > done( false );
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    std::thread reader( [&]{
+        std::array< gpio_event, 16 > events;
+        size_t received( 0 );
+        while ( received < max_events && std::chrono::steady_clock::now() < deadline ) {
+            int n = chip_.read_events( events.data(), events.size(), 100 );
+            if ( n < 0 )
+                break;
+            for ( int i = 0; i < n; ++i ) {
+                if ( ! ring.push( events[ i ] ) )
+                    ++overruns_;
+            }
+            received += n;
+        }
+        done = true;
+    });
+
+    while ( ! done || ! ring.empty() ) {
+        if ( auto ev = ring.pop() ) {
+            account( *ev );
+            if ( of )
+                of.write( reinterpret_cast< const char * >( &*ev ), sizeof( gpio_event ) );
+        } else {
+            std::this_thread::sleep_for( std::chrono::microseconds( 200 ) );
+        }
+    }
+    reader.join();
+    return ! of.fail();
+}
+
+void
+gpio_watch::report( std::ostream& o ) const
+{
+    for ( const auto& [ offset, st ]: stats_ ) {
+        o << boost::format( "line %d: rising=%d falling=%d missed(kernel)=%d\n" ) % offset % st.rising % st.falling % st.missed;
+        st.rise_period.report( o, "rise-period" );
+        st.fall_period.report( o, "fall-period" );
+        st.high_width.report( o, "high-width" );
+        st.low_width.report( o, "low-width" );
+    }
+    if ( overruns_ )
+        o << "ring overruns: " << overruns_ << std::endl;
+}
@@ -0,0 +1,77 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include "gpiochip.hpp"
+#include "running_stats.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Kernel-timestamped edge capture on gpiochip lines (strobe, FREX, VSYNC ...).
+// A reader thread drains the line request into an spsc_queue; the calling
+// thread writes the binary trace and accumulates interval statistics.
+//
+// Trace file: 'trace_header' followed by gpio_event records in arrival order.
+
+class gpio_watch {
+public:
+    struct trace_header {
+        char magic[ 8 ];       // "GPIOEVT"
+        uint32_t version;      // 1
+        uint32_t record_size;  // sizeof( gpio_event )
+    };
+
+    typedef running_stats interval; // ns
+
+    struct line_stat {
+        size_t rising = 0, falling = 0, missed = 0;
+        interval rise_period, fall_period, high_width, low_width;
+        uint64_t last_rise = 0, last_fall = 0;
+        uint32_t last_line_seqno = 0;
+    };
+
+    gpio_watch( const std::string& device, const std::vector< uint32_t >& offsets, size_t ring_size = 4096 );
+
+    inline explicit operator bool () const { return bool( chip_ ); }
+
+    // returns false if the line request could not be made or the trace could not be written
+    bool run( size_t max_events, std::chrono::milliseconds timeout, const std::string& trace = {} );
+    void report( std::ostream& ) const;
+
+    inline size_t overruns() const { return overruns_; }
+    inline const std::map< uint32_t, line_stat >& stats() const { return stats_; }
+
+private:
+    gpiochip chip_;
+    size_t ring_size_;
+    size_t overruns_;
+    std::map< uint32_t, line_stat > stats_;
+    void account( const gpio_event& );
+};
@@ -0,0 +1,184 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "gpiochip.hpp"
+#include <fcntl.h>
+#include <linux/gpio.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace {
+    struct chip_fd {
+        int fd;
+        chip_fd( const std::string& device ) : fd( ::open( device.c_str(), O_RDWR | O_CLOEXEC ) ) {}
+        ~chip_fd() { if ( fd >= 0 ) ::close( fd ); }
+    };
+
+    inline uint64_t all_lines( size_t n ) {
+        return n >= 64 ? ~uint64_t(0) : ( uint64_t(1) << n ) - 1;
+    }
+}
+
+gpiochip::~gpiochip()
+{
+    if ( fd_ >= 0 )
+        ::close( fd_ );
+}
+
+gpiochip::gpiochip( const std::string& device
+                    , const std::vector< uint32_t >& offsets
+                    , direction dir
+                    , const std::string& consumer
+                    , bool realtime_clock ) : fd_( -1 )
+                                                    , device_( device )
+                                                    , offsets_( offsets )
+{
+    if ( offsets_.empty() || offsets_.size() > GPIO_V2_LINES_MAX ) {
+        std::cerr << "gpiochip: invalid number of lines: " << offsets_.size() << std::endl;
+        return;
+    }
+
+    chip_fd chip( device );
+    if ( chip.fd < 0 ) {
+        ::perror( ( "gpiochip: " + device ).c_str() );
+        return;
+    }
+
+    struct gpio_v2_line_request req;
+    std::memset( &req, 0, sizeof( req ) );
+    std::copy( offsets_.begin(), offsets_.end(), req.offsets );
+    std::strncpy( req.consumer, consumer.c_str(), sizeof( req.consumer ) - 1 );
+    req.num_lines = offsets_.size();
+    // An output request without initial values drives the lines low, which would
+    // power down the sensor; take the lines as-is and switch direction afterwards.
+    req.config.flags = ( dir == input ) ? GPIO_V2_LINE_FLAG_INPUT : 0;
+    if ( dir == edges ) {
+        req.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+        if ( realtime_clock )
+            req.config.flags |= GPIO_V2_LINE_FLAG_EVENT_CLOCK_REALTIME;
+        req.event_buffer_size = 64 * offsets_.size();
+    }
+
+    if ( ::ioctl( chip.fd, GPIO_V2_GET_LINE_IOCTL, &req ) < 0 ) {
+        ::perror( "gpiochip: GPIO_V2_GET_LINE_IOCTL" );
+        return;
+    }
+    fd_ = req.fd;
+
+    if ( dir == output ) {
+        if ( ! reconfigure( GPIO_V2_LINE_FLAG_OUTPUT, get() ) ) {
+            ::close( fd_ );
+            fd_ = -1;
+        }
+    }
+}
+
+bool
+gpiochip::reconfigure( uint64_t flags, std::optional< uint64_t > values ) const
+{
+    struct gpio_v2_line_config config;
+    std::memset( &config, 0, sizeof( config ) );
+    config.flags = flags;
+    if ( values ) {
+        config.num_attrs = 1;
+        config.attrs[ 0 ].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+        config.attrs[ 0 ].attr.values = *values;
+        config.attrs[ 0 ].mask = all_lines( offsets_.size() );
+    }
+    if ( ::ioctl( fd_, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config ) < 0 ) {
+        ::perror( "gpiochip: GPIO_V2_LINE_SET_CONFIG_IOCTL" );
+        return false;
+    }
+    return true;
+}
+
+bool
+gpiochip::set( uint64_t bits, uint64_t mask ) const
+{
+    struct gpio_v2_line_values values = { bits, mask & all_lines( offsets_.size() ) };
+    if ( fd_ >= 0 && ::ioctl( fd_, GPIO_V2_LINE_SET_VALUES_IOCTL, &values ) == 0 )
+        return true;
+    ::perror( "gpiochip::set" );
+    return false;
+}
+
+std::optional< uint64_t >
+gpiochip::get( uint64_t mask ) const
+{
+    struct gpio_v2_line_values values = { 0, mask & all_lines( offsets_.size() ) };
+    if ( fd_ >= 0 && ::ioctl( fd_, GPIO_V2_LINE_GET_VALUES_IOCTL, &values ) == 0 )
+        return values.bits;
+    return {};
+}
+
+bool
+gpiochip::operator << ( bool flag ) const
+{
+    return set( flag ? ~uint64_t(0) : 0 );
+}
+
+int
+gpiochip::read() const
+{
+    if ( auto bits = get( 1 ) )
+        return int( *bits & 1 );
+    return -1;
+}
+
+int
+gpiochip::read_events( gpio_event * events, size_t max_events, int timeout_ms ) const
+{
+    struct pollfd pfd = { fd_, POLLIN, 0 };
+    int rc = ::poll( &pfd, 1, timeout_ms );
+    if ( rc <= 0 )
+        return rc;
+
+    std::array< struct gpio_v2_line_event, 16 > buf;
+    ssize_t size = ::read( fd_, buf.data(), std::min( max_events, buf.size() ) * sizeof( buf[0] ) );
+    if ( size < 0 ) {
+        ::perror( "gpiochip::read_events" );
+        return -1;
+    }
+    size_t count = size / sizeof( buf[0] );
+    for ( size_t i = 0; i < count; ++i )
+        events[ i ] = { buf[ i ].timestamp_ns, buf[ i ].offset, buf[ i ].id, buf[ i ].seqno, buf[ i ].line_seqno };
+    return int( count );
+}
+
+// static
+std::optional< std::string >
+gpiochip::label( const std::string& device )
+{
+    chip_fd chip( device );
+    struct gpiochip_info info;
+    if ( chip.fd >= 0 && ::ioctl( chip.fd, GPIO_GET_CHIPINFO_IOCTL, &info ) == 0 )
+        return std::string( info.label ) + " (" + info.name + ", " + std::to_string( info.lines ) + " lines)";
+    return {};
+}
@@ -0,0 +1,81 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// GPIO character device (/dev/gpiochipN, v2 uAPI) line request.
+// The request fd is held for the object's lifetime; set()/get() are a single
+// ioctl each, and several lines in the same request switch together.
+// Bits in set()/get() are indices into offsets(), not chip offsets.
+
+struct gpio_event {
+    uint64_t timestamp_ns; // kernel CLOCK_MONOTONIC (or CLOCK_REALTIME when requested)
+    uint32_t offset;       // chip line offset
+    uint32_t id;           // 1: rising, 2: falling
+    uint32_t seqno;        // per request
+    uint32_t line_seqno;   // per line
+};
+
+class gpiochip {
+public:
+    enum direction { as_is, input, output, edges };
+    enum edge_id { rising_edge = 1, falling_edge = 2 };
+
+    ~gpiochip();
+    gpiochip( const std::string& device
+              , const std::vector< uint32_t >& offsets
+              , direction = output
+              , const std::string& consumer = "pcam5c"
+              , bool realtime_clock = false );
+
+    gpiochip( const gpiochip& ) = delete;
+    gpiochip& operator = ( const gpiochip& ) = delete;
+
+    inline explicit operator bool () const { return fd_ >= 0; }
+    inline int fd() const { return fd_; }
+    inline const std::string& device() const { return device_; }
+    inline const std::vector< uint32_t >& offsets() const { return offsets_; }
+
+    bool set( uint64_t bits, uint64_t mask = ~uint64_t(0) ) const;
+    std::optional< uint64_t > get( uint64_t mask = ~uint64_t(0) ) const;
+
+    bool operator << ( bool flag ) const; // all lines in the request
+    int read() const;                     // first line; -1 on error
+
+    // direction 'edges' only; waits up to timeout_ms (-1: forever), returns number of events or -1
+    int read_events( gpio_event *, size_t max_events, int timeout_ms ) const;
+
+    static std::optional< std::string > label( const std::string& device );
+
+private:
+    int fd_;
+    std::string device_;
+    std::vector< uint32_t > offsets_;
+    bool reconfigure( uint64_t flags, std::optional< uint64_t > values ) const;
+};
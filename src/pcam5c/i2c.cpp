@@ -36,6 +36,7 @@ using namespace i2c_linux;
 
 i2c::i2c() : fd_( -1 )
            , address_( 0 )
+           , quiet_( false )
 {
 }
 
@@ -74,7 +75,7 @@ i2c::write( const uint8_t * data, size_t size ) const
 {
     if ( fd_ >= 0 ) {
         auto rcode = ::write( fd_, data, size );
-        if ( rcode < 0 ) {
+        if ( rcode < 0 && ! quiet_ ) {
             ::perror("i2c::write");
         }
         return rcode == size;
@@ -87,7 +88,7 @@ i2c::read( uint8_t * data, size_t size ) const
 {
     if ( fd_ >= 0 ) {
         auto rcode = ::read( fd_, data, size );
-        if ( rcode < 0 ) {
+        if ( rcode < 0 && ! quiet_ ) {
             ::perror("i2c::read");
         }
         return rcode == size;
@@ -22,9 +22,13 @@
  * SOFTWARE.
  */
 
+#pragma once
+
 #include <array>
 #include <cstdint>
 #include <optional>
+#include <string>
+#include <utility>
 
 namespace i2c_linux {
 
@@ -33,6 +37,7 @@ namespace i2c_linux {
         i2c& operator = ( const i2c& ) = delete;
         int fd_;
         int address_;
+        bool quiet_;
         std::string device_;
 
     public:
@@ -47,6 +52,9 @@ namespace i2c_linux {
         inline int address() const { return address_; }
         inline const std::string& device() const { return device_; }
 
+        // suppress perror on NAK (e.g. while polling a sensor coming out of reset); returns previous setting
+        inline bool quiet( bool f ) { std::swap( quiet_, f ); return f; }
+
         bool write( const uint8_t * data, size_t ) const;
         bool read( uint8_t * data, size_t ) const;
 
@@ -0,0 +1,429 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "image_stats.hpp"
+#include "simd_vec.hpp"
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+    constexpr size_t pad = 64;  // plane bytes past the last sample (vector loads at i + 1)
+
+    struct sums {
+        uint64_t sum[ image_stats::channels ];
+        uint64_t energy;
+        uint32_t clipped;
+        uint32_t dark;
+    };
+
+    template< size_t L > struct vec {
+        typedef uint8_t u8 __attribute__(( vector_size( L ) ));
+        typedef uint16_t u16 __attribute__(( vector_size( L * 2 ) ));
+        typedef int16_t s16 __attribute__(( vector_size( L * 2 ) ));
+        typedef int32_t s32 __attribute__(( vector_size( L * 4 ) ));
+        typedef uint32_t u32 __attribute__(( vector_size( L * 4 ) ));
+    };
+
+    using simd::load;
+
+    template< typename V > __attribute__(( always_inline )) inline uint64_t
+    horizontal( const V& v )
+    {
+        uint64_t s = 0;
+        for ( size_t k = 0; k < sizeof( V ) / sizeof( v[ 0 ] ); ++k )
+            s += v[ k ];
+        return s;
+    }
+
+    // p[]: Y, R, G, B and the Y of the previous sampled line, samples [0, n)
+    __attribute__(( always_inline )) inline void
+    reduce_tail( const uint8_t * const * p, size_t i, size_t n, uint8_t hi, uint8_t lo, sums& s )
+    {
+        for ( ; i < n; ++i ) {
+            const int y = p[ 0 ][ i ], r = p[ 1 ][ i ], g = p[ 2 ][ i ], b = p[ 3 ][ i ];
+            s.sum[ 0 ] += y; s.sum[ 1 ] += r; s.sum[ 2 ] += g; s.sum[ 3 ] += b;
+            s.clipped += ( r >= hi || g >= hi || b >= hi );
+            s.dark += ( y <= lo );
+            const int dx = p[ 0 ][ i + 1 ] - y, dy = y - p[ 4 ][ i ];
+            s.energy += uint64_t( dx * dx + dy * dy );
+        }
+    }
+
+    // 16-bit lane sums are flushed every 256 vectors, before they can wrap
+    template< size_t L >
+    __attribute__(( always_inline )) inline void
+    reduce( const uint8_t * const * p, size_t n, uint8_t hi, uint8_t lo, sums& s )
+    {
+        typedef typename vec< L >::u8 u8;
+        typedef typename vec< L >::u16 u16;
+        typedef typename vec< L >::s32 s32;
+        typedef typename vec< L >::u32 u32;
+        size_t i = 0;
+        while ( i + L <= n ) {
+            u16 acc[ image_stats::channels ] = {}, clipped = {}, dark = {};
+            u32 energy = {};
+            for ( size_t k = 0; k < 256 && i + L <= n; ++k, i += L ) {
+                const u8 y = load< u8 >( p[ 0 ] + i ), r = load< u8 >( p[ 1 ] + i ), g = load< u8 >( p[ 2 ] + i ), b = load< u8 >( p[ 3 ] + i );
+                acc[ 0 ] += __builtin_convertvector( y, u16 );
+                acc[ 1 ] += __builtin_convertvector( r, u16 );
+                acc[ 2 ] += __builtin_convertvector( g, u16 );
+                acc[ 3 ] += __builtin_convertvector( b, u16 );
+                clipped += __builtin_convertvector( u8( ( r >= hi ) | ( g >= hi ) | ( b >= hi ) ) & 1, u16 );
+                dark += __builtin_convertvector( u8( y <= lo ) & 1, u16 );
+                const s32 yy = __builtin_convertvector( y, s32 );
+                const s32 dx = __builtin_convertvector( load< u8 >( p[ 0 ] + i + 1 ), s32 ) - yy;
+                const s32 dy = yy - __builtin_convertvector( load< u8 >( p[ 4 ] + i ), s32 );
+                energy += u32( dx * dx + dy * dy );
+            }
+            for ( size_t c = 0; c < image_stats::channels; ++c )
+                s.sum[ c ] += horizontal( acc[ c ] );
+            s.clipped += uint32_t( horizontal( clipped ) );
+            s.dark += uint32_t( horizontal( dark ) );
+            s.energy += horizontal( energy );
+        }
+        reduce_tail( p, i, n, hi, lo, s );
+    }
+
+    typedef void ( *reduce_function )( const uint8_t * const *, size_t, uint8_t, uint8_t, sums& );
+
+    void
+    reduce_scalar( const uint8_t * const * p, size_t n, uint8_t hi, uint8_t lo, sums& s )
+    {
+        reduce_tail( p, 0, n, hi, lo, s );
+    }
+
+    struct reduce_kernel {
+        template< size_t L > __attribute__(( always_inline )) static void
+        run( const uint8_t * const * p, size_t n, uint8_t hi, uint8_t lo, sums& s ) { reduce< L >( p, n, hi, lo, s ); }
+    };
+
+    // Samples are gathered as raw bytes; the per-format arithmetic then runs over
+    // the whole line.  yuv: Y, U, V gathered into Y, R, B;  bayer: B, G, G', R
+    // gathered into B, G, Y, R;  rgb: R, G, B.
+    enum kind { gray, yuv, rgb, bayer };
+
+    template< typename T > __attribute__(( always_inline )) inline T clip8( T v )
+    {
+        const T zero = T{}, top = T{} + 255;
+        v = v < zero ? zero : v;
+        return v > top ? top : v;
+    }
+
+    template< typename T > __attribute__(( always_inline )) inline T luma( T r, T g, T b ) { return ( r * 77 + g * 150 + b * 29 + 128 ) >> 8; }
+
+    // one sample; T is int or a vector of 16-bit lanes
+    template< typename T >
+    __attribute__(( always_inline )) inline void
+    finish( kind k, T& y, T& r, T& g, T& b )
+    {
+        switch ( k ) {
+        case yuv: {
+            const T u = r - 128, v = b - 128;
+            r = clip8( y + ( ( v * 179 + 64 ) >> 7 ) );
+            g = clip8( y - ( ( u * 44 + v * 91 + 64 ) >> 7 ) );
+            b = clip8( y + ( ( u * 227 + 64 ) >> 7 ) );
+            break; }
+        case bayer:
+            g = ( g + y + 1 ) >> 1;
+            y = luma( r, g, b );
+            break;
+        case rgb:
+            y = luma( r, g, b );
+            break;
+        case gray:
+            r = g = b = y;
+            break;
+        }
+    }
+
+    void
+    finish_scalar( kind k, uint8_t * const * p, size_t n )
+    {
+        for ( size_t i = 0; i < n; ++i ) {
+            int y = p[ 0 ][ i ], r = p[ 1 ][ i ], g = p[ 2 ][ i ], b = p[ 3 ][ i ];
+            finish( k, y, r, g, b );
+            p[ 0 ][ i ] = uint8_t( y ); p[ 1 ][ i ] = uint8_t( r ); p[ 2 ][ i ] = uint8_t( g ); p[ 3 ][ i ] = uint8_t( b );
+        }
+    }
+
+    // planes are padded, so the last vector may run past 'n'
+    template< size_t L >
+    __attribute__(( always_inline )) inline void
+    finish_vec( kind k, uint8_t * const * p, size_t n )
+    {
+        typedef typename vec< L >::u8 u8;
+        typedef typename vec< L >::u16 u16;
+        typedef typename vec< L >::s16 s16;
+        auto get = []( const uint8_t * q ){ return __builtin_convertvector( load< u8 >( q ), s16 ); };
+        for ( size_t i = 0; i < n; i += L ) {
+            s16 y = get( p[ 0 ] + i ), r = get( p[ 1 ] + i ), g = get( p[ 2 ] + i ), b = get( p[ 3 ] + i );
+            if ( k == rgb || k == bayer ) { // 77 * 255 + 150 * 255 + ... exceeds int16; luma in unsigned lanes
+                if ( k == bayer )
+                    g = ( g + y + 1 ) >> 1;
+                y = s16( luma< u16 >( u16( r ), u16( g ), u16( b ) ) );
+            } else {
+                finish< s16 >( k, y, r, g, b );
+            }
+            const s16 * v[ 4 ] = { &y, &r, &g, &b };
+            for ( int c = 0; c < 4; ++c ) {
+                const u8 x = __builtin_convertvector( *v[ c ], u8 );
+                std::memcpy( p[ c ] + i, &x, sizeof( x ) );
+            }
+        }
+    }
+
+    typedef void ( *finish_function )( kind, uint8_t * const *, size_t );
+
+    struct finish_kernel {
+        template< size_t L > __attribute__(( always_inline )) static void
+        run( kind k, uint8_t * const * p, size_t n ) { finish_vec< L >( k, p, n ); }
+    };
+}
+
+struct image_stats::accumulator {
+    struct cell {
+        sums s;
+        uint32_t samples;
+    };
+    std::vector< cell > cells;
+    std::vector< uint32_t > histogram;  // [ tile ][ channel ][ bin ]
+    std::vector< uint8_t > planes;      // Y, R, G, B, previous Y
+    size_t plane_stride;
+    bool used;                          // holds counts of the current frame
+};
+
+size_t
+image_stats::bytes_per_pixel( layout format )
+{
+    switch ( format ) {
+    case gray8:  return 1;
+    case rgb24:  return 3;
+    case rgba32: return 4;
+    default:     return 2;    // yuv; raw10 is 1.25
+    }
+}
+
+image_stats::image_stats( size_t width
+                          , size_t height
+                          , thread_pool& pool
+                          , const options& opts ) : width_( width )
+                                                  , height_( height )
+                                                  , pool_( pool )
+                                                  , options_( opts )
+{
+    const bool pairs = options_.format == yuyv || options_.format == uyvy || options_.format == raw10;
+    options_.stride = std::max( size_t( 1 ), options_.stride );
+    if ( pairs )
+        options_.stride = ( options_.stride + 1 ) & ~size_t( 1 );
+    options_.grid_x = std::max( size_t( 1 ), options_.grid_x );
+    options_.grid_y = std::max( size_t( 1 ), options_.grid_y );
+    options_.band_rows = std::max( size_t( 1 ), options_.band_rows );
+    bin_shift_ = 0;
+    while ( bin_shift_ < 8 && ( size_t( 256 ) >> bin_shift_ ) > options_.bins )
+        ++bin_shift_;
+    options_.bins = size_t( 256 ) >> bin_shift_;
+
+    const size_t w = pairs ? 2 : 1, h = options_.format == raw10 ? 2 : 1;
+    nx_ = width_ >= w ? ( width_ - w ) / options_.stride + 1 : 0;
+    ny_ = height_ >= h ? ( height_ - h ) / options_.stride + 1 : 0;
+    options_.grid_x = std::min( options_.grid_x, std::max( size_t( 1 ), nx_ ) );
+    options_.grid_y = std::min( options_.grid_y, std::max( size_t( 1 ), ny_ ) );
+    for ( size_t t = 0; t <= options_.grid_x; ++t )
+        splits_.emplace_back( t * nx_ / options_.grid_x );
+
+    const size_t tiles = options_.grid_x * options_.grid_y;
+    for ( size_t i = 0; i < pool_.size(); ++i ) {
+        auto a = std::make_unique< accumulator >();
+        a->cells.resize( tiles );
+        a->histogram.resize( tiles * channels * options_.bins );
+        a->plane_stride = nx_ + pad;
+        a->planes.assign( 5 * a->plane_stride, 0 );
+        a->used = false;
+        accumulators_.emplace_back( std::move( a ) );
+    }
+}
+
+image_stats::~image_stats()
+{
+}
+
+void
+image_stats::band( size_t index, accumulator& a, const uint8_t * frame, size_t stride ) const
+{
+    if ( ! a.used ) {
+        std::memset( a.cells.data(), 0, a.cells.size() * sizeof( accumulator::cell ) );
+        std::fill( a.histogram.begin(), a.histogram.end(), 0 );
+        a.used = true;
+    }
+    uint8_t * plane[ 5 ];
+    for ( size_t k = 0; k < 5; ++k )
+        plane[ k ] = a.planes.data() + k * a.plane_stride;
+
+    reduce_function reduce = simd::kernel< reduce_kernel, 16, reduce_function >( options_.isa );
+    finish_function finish = simd::kernel< finish_kernel, 16, finish_function >( options_.isa );
+    if ( options_.isa == simd::scalar ) {
+        reduce = reduce_scalar;
+        finish = finish_scalar;
+    }
+
+    const size_t s = options_.stride;
+    auto extract = [&]( size_t sy, uint8_t * y ) {
+        const uint8_t * line = frame + sy * s * stride;
+        uint8_t * r = plane[ 1 ], * g = plane[ 2 ], * b = plane[ 3 ];
+        kind k = gray;
+        switch ( options_.format ) {
+        case gray8:
+            for ( size_t i = 0; i < nx_; ++i )
+                y[ i ] = line[ i * s ];
+            break;
+        case rgb24:
+        case rgba32: {
+            const size_t bpp = bytes_per_pixel( options_.format );
+            for ( size_t i = 0; i < nx_; ++i ) {
+                const uint8_t * q = line + i * s * bpp;
+                r[ i ] = q[ 0 ]; g[ i ] = q[ 1 ]; b[ i ] = q[ 2 ];
+            }
+            k = rgb;
+            break; }
+        case yuyv:
+        case uyvy: {
+            const size_t yo = options_.format == uyvy ? 1 : 0, uo = options_.format == uyvy ? 0 : 1;
+            for ( size_t i = 0; i < nx_; ++i ) {
+                const uint8_t * q = line + 2 * i * s;
+                y[ i ] = q[ yo ]; r[ i ] = q[ uo ]; b[ i ] = q[ uo + 2 ];
+            }
+            k = yuv;
+            break; }
+        case raw10:   // B G / G R quad at each sample, MSB bytes only
+            for ( size_t i = 0; i < nx_; ++i ) {
+                const size_t x = i * s;
+                const uint8_t * q = line + x / 4 * 5 + x % 4;
+                b[ i ] = q[ 0 ]; g[ i ] = q[ 1 ]; y[ i ] = q[ stride ]; r[ i ] = q[ stride + 1 ];
+            }
+            k = bayer;
+            break;
+        }
+        uint8_t * const p[ 4 ] = { y, r, g, b };
+        finish( k, p, nx_ );
+        y[ nx_ ] = y[ nx_ - 1 ];  // no gradient to the right of the last sample
+    };
+
+    const size_t begin = index * options_.band_rows;
+    const size_t end = std::min( ny_, begin + options_.band_rows );
+    uint8_t * y = plane[ 0 ], * prev = plane[ 4 ];
+    if ( begin > 0 )
+        extract( begin - 1, prev );
+    const size_t bins = options_.bins;
+
+    for ( size_t sy = begin; sy < end; ++sy ) {
+        extract( sy, y );
+        if ( sy == 0 )
+            std::memcpy( prev, y, nx_ + 1 );
+        const uint8_t * p[ 5 ] = { y, plane[ 1 ], plane[ 2 ], plane[ 3 ], prev };
+        const size_t ty = sy * options_.grid_y / ny_;
+        for ( size_t tx = 0; tx < options_.grid_x; ++tx ) {
+            const size_t t = ty * options_.grid_x + tx;
+            const size_t c0 = splits_[ tx ], c1 = splits_[ tx + 1 ];
+            const uint8_t * q[ 5 ] = { p[ 0 ] + c0, p[ 1 ] + c0, p[ 2 ] + c0, p[ 3 ] + c0, p[ 4 ] + c0 };
+            auto& cell = a.cells[ t ];
+            reduce( q, c1 - c0, options_.clip_high, options_.clip_low, cell.s );
+            cell.samples += uint32_t( c1 - c0 );
+            uint32_t * h = a.histogram.data() + t * channels * bins;
+            for ( size_t c = 0; c < channels; ++c ) {
+                uint32_t * hc = h + c * bins;
+                for ( size_t i = c0; i < c1; ++i )
+                    ++hc[ p[ c ][ i ] >> bin_shift_ ];
+            }
+        }
+        std::swap( y, prev );
+    }
+}
+
+bool
+image_stats::operator()( const uint8_t * frame, size_t stride, result& res ) const
+{
+    if ( ! frame || nx_ == 0 || ny_ == 0 )
+        return false;
+    const size_t tasks = ( ny_ + options_.band_rows - 1 ) / options_.band_rows;
+    pool_.run( tasks, [&]( size_t t, size_t worker ){
+        band( t, *accumulators_[ worker ], frame, stride );
+    });
+
+    const size_t tiles = options_.grid_x * options_.grid_y, bins = options_.bins;
+    res.grid_x = uint32_t( options_.grid_x );
+    res.grid_y = uint32_t( options_.grid_y );
+    res.bins = uint32_t( bins );
+    res.tiles.resize( tiles );
+    res.histogram.assign( ( tiles + 1 ) * channels * bins, 0 );
+
+    std::vector< accumulator::cell > cells( tiles + 1, accumulator::cell{} );
+    for ( auto& a: accumulators_ ) {
+        if ( ! a->used )
+            continue;
+        for ( size_t t = 0; t < tiles; ++t ) {
+            for ( auto * c: { &cells[ t ], &cells[ tiles ] } ) {
+                for ( size_t k = 0; k < channels; ++k )
+                    c->s.sum[ k ] += a->cells[ t ].s.sum[ k ];
+                c->s.energy += a->cells[ t ].s.energy;
+                c->s.clipped += a->cells[ t ].s.clipped;
+                c->s.dark += a->cells[ t ].s.dark;
+                c->samples += a->cells[ t ].samples;
+            }
+        }
+        for ( size_t i = 0; i < tiles * channels * bins; ++i ) {
+            res.histogram[ i ] += a->histogram[ i ];
+            res.histogram[ tiles * channels * bins + i % ( channels * bins ) ] += a->histogram[ i ];
+        }
+        a->used = false;
+    }
+
+    for ( size_t t = 0; t <= tiles; ++t ) {
+        const auto& c = cells[ t ];
+        tile& r = t < tiles ? res.tiles[ t ] : res.frame;
+        r.samples = c.samples;
+        r.clipped = c.s.clipped;
+        r.dark = c.s.dark;
+        for ( size_t k = 0; k < channels; ++k )
+            r.mean[ k ] = c.samples ? uint16_t( std::min( uint64_t( 0xffff ), ( c.s.sum[ k ] * 256 + c.samples / 2 ) / c.samples ) ) : 0;
+        r.sharpness = c.samples ? uint32_t( c.s.energy / c.samples ) : 0;
+    }
+    return true;
+}
+
+void
+image_stats::report( std::ostream& o, const result& res )
+{
+    const auto& f = res.frame;
+    const double n = f.samples ? f.samples : 1;
+    o << boost::format( "samples %d, Y %.1f R %.1f G %.1f B %.1f, clipped %.2f%%, dark %.2f%%, sharpness %d" )
+        % f.samples % ( f.mean[ Y ] / 256.0 ) % ( f.mean[ R ] / 256.0 ) % ( f.mean[ G ] / 256.0 ) % ( f.mean[ B ] / 256.0 )
+        % ( 100.0 * f.clipped / n ) % ( 100.0 * f.dark / n ) % f.sharpness << std::endl;
+    for ( size_t ty = 0; ty < res.grid_y; ++ty ) {
+        o << "\tY";
+        for ( size_t tx = 0; tx < res.grid_x; ++tx )
+            o << boost::format( " %5.1f" ) % ( res.at( tx, ty ).mean[ Y ] / 256.0 );
+        o << std::endl;
+    }
+}
@@ -0,0 +1,108 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "simd.hpp"
+#include "thread_pool.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+// Per-tile exposure, colour and focus measurements for host-side AE/AWB and
+// quality monitoring.  Pixels are sampled on a 'stride' grid straight from the
+// frame (a VDMA mmap, a frame_ring slot, ...) without copying it; each sample
+// gives Y, R, G, B (YUV by BT.601 full range, Bayer quads by their 8 MSBs).
+// Bands of sampled lines go to thread_pool workers with private accumulators
+// that are merged at the end.  Gathering the samples and the histograms are
+// scalar; colour conversion, sums, clip counts and gradient energy run as
+// vector code over each sampled line.  One call at a time.
+
+class image_stats {
+public:
+    enum layout {
+        gray8
+        , yuyv
+        , uyvy
+        , rgb24
+        , rgba32
+        , raw10          // MIPI packed BGGR
+    };
+    enum channel { Y, R, G, B, channels };
+
+    struct options {
+        layout format = uyvy;
+        size_t stride = 4;          // sample every n-th pixel and line; even for yuv and raw10
+        size_t grid_x = 8;
+        size_t grid_y = 8;
+        size_t bins = 64;           // histogram bins per channel, a power of two up to 256
+        uint8_t clip_high = 250;    // R, G or B at or above: clipped
+        uint8_t clip_low = 5;       // Y at or below: dark
+        size_t band_rows = 16;      // sampled lines per task
+        simd::isa isa = simd::best();
+    };
+
+    struct tile {                   // 24 bytes
+        uint32_t samples;
+        uint32_t clipped;
+        uint32_t dark;
+        uint16_t mean[ channels ];  // 8.8 fixed point
+        uint32_t sharpness;         // mean ( dx^2 + dy^2 ) of Y between neighbouring samples
+    };
+
+    struct result {
+        uint32_t grid_x, grid_y, bins;
+        tile frame;
+        std::vector< tile > tiles;             // grid_y rows of grid_x
+        std::vector< uint32_t > histogram;     // [ tile ][ channel ][ bin ], the frame after the tiles
+
+        inline const tile& at( size_t x, size_t y ) const { return tiles[ y * grid_x + x ]; }
+        inline const uint32_t * bins_of( size_t tile, channel c ) const { return histogram.data() + ( tile * channels + c ) * bins; }
+        inline const uint32_t * bins_of( channel c ) const { return bins_of( tiles.size(), c ); }
+    };
+
+    image_stats( size_t width, size_t height, thread_pool&, const options& );
+    ~image_stats();
+
+    inline const options& settings() const { return options_; }
+    static size_t bytes_per_pixel( layout );
+
+    // 'stride' in bytes; 'result' is reused from frame to frame without reallocating
+    bool operator()( const uint8_t * frame, size_t stride, result& ) const;
+
+    static void report( std::ostream&, const result& );
+
+private:
+    struct accumulator;
+    void band( size_t index, accumulator&, const uint8_t * frame, size_t stride ) const;
+
+    size_t width_, height_;
+    size_t nx_, ny_;                // samples per line, sampled lines
+    size_t bin_shift_;
+    std::vector< size_t > splits_;  // sample index where each tile column starts, and nx_
+    thread_pool& pool_;
+    options options_;
+    std::vector< std::unique_ptr< accumulator > > accumulators_; // per worker
+};
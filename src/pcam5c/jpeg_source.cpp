@@ -0,0 +1,178 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "jpeg_source.hpp"
+#include <algorithm>
+#include <cstring>
+#include <boost/format.hpp>
+
+namespace {
+    constexpr uint8_t SOI = 0xd8;
+    constexpr uint8_t EOI = 0xd9;
+    constexpr uint8_t SOS = 0xda;
+    constexpr uint8_t TEM = 0x01;
+    inline bool rst( uint8_t m ) { return m >= 0xd0 && m <= 0xd7; }
+}
+
+size_t
+jpeg::length( const uint8_t * p, size_t size )
+{
+    if ( size < 4 || p[ 0 ] != 0xff || p[ 1 ] != SOI )
+        return 0;
+
+    size_t i = 2;
+    while ( i + 2 <= size ) {
+        if ( p[ i ] != 0xff )
+            return 0;
+        const uint8_t m = p[ i + 1 ];
+        if ( m == 0xff ) {   // fill byte
+            ++i;
+            continue;
+        }
+        if ( m == EOI )
+            return i + 2;
+        if ( m == TEM || rst( m ) || m == SOI ) {
+            i += 2;
+            continue;
+        }
+        if ( i + 4 > size )
+            return 0;
+        const size_t len = size_t( p[ i + 2 ] ) << 8 | p[ i + 3 ];
+        if ( len < 2 )
+            return 0;
+        i += 2 + len;
+        if ( m != SOS )
+            continue;
+        // entropy-coded segment: up to the first FF that is neither stuffing nor RSTn
+        while ( i < size ) {
+            auto q = static_cast< const uint8_t * >( std::memchr( p + i, 0xff, size - i ) );
+            if ( ! q || size_t( q - p ) + 1 >= size )
+                return 0;
+            i = size_t( q - p );
+            const uint8_t n = p[ i + 1 ];
+            if ( n == 0x00 || rst( n ) )
+                i += 2;
+            else if ( n == 0xff )
+                ++i;
+            else
+                break;
+        }
+    }
+    return 0;
+}
+
+jpeg_source::jpeg_source( std::shared_ptr< frame_source > source ) : source_( source )
+                                                                   , dropped_( 0 )
+                                                                   , frames_( 0 )
+                                                                   , corrupt_( 0 )
+                                                                   , bytes_( 0 )
+                                                                   , min_length_( 0 )
+                                                                   , max_length_( 0 )
+{
+}
+
+size_t
+jpeg_source::size() const
+{
+    return source_->size();
+}
+
+const uint8_t *
+jpeg_source::data( size_t index )
+{
+    return source_->data( index );
+}
+
+size_t
+jpeg_source::length( size_t index ) const
+{
+    return source_->length( index );
+}
+
+frame_buffer::format
+jpeg_source::format() const
+{
+    return source_->format();
+}
+
+int
+jpeg_source::next( frame& f, std::chrono::milliseconds timeout )
+{
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    for ( ;; ) {
+        auto remaining = std::chrono::duration_cast< std::chrono::milliseconds >( deadline - std::chrono::steady_clock::now() );
+        int rc = source_->next( f, std::max( remaining, std::chrono::milliseconds( 0 ) ) );
+        if ( rc <= 0 )
+            return rc;
+
+        const uint8_t * p = source_->data( f.index );
+        const size_t valid = p ? jpeg::length( p, f.length ? f.length : source_->length( f.index ) ) : 0;
+        if ( valid == 0 ) {
+            ++corrupt_;
+            dropped_ += 1 + f.dropped;
+            source_->release( f.index );
+            continue;
+        }
+        f.length = uint32_t( valid );
+        f.dropped += dropped_;
+        dropped_ = 0;
+
+        ++frames_;
+        bytes_ += valid;
+        if ( min_length_ == 0 || valid < min_length_ )
+            min_length_ = valid;
+        if ( valid > max_length_ )
+            max_length_ = valid;
+        return 1;
+    }
+}
+
+void
+jpeg_source::release( size_t index )
+{
+    source_->release( index );
+}
+
+int
+jpeg_source::export_fd( size_t index ) const
+{
+    return source_->export_fd( index );
+}
+
+jpeg_source::stats
+jpeg_source::statistics() const
+{
+    return stats{ frames_, corrupt_, bytes_, min_length_, max_length_ };
+}
+
+void
+jpeg_source::report( std::ostream& o ) const
+{
+    const auto s = statistics();
+    const auto fmt = source_->format();
+    const double mean = s.frames ? double( s.bytes ) / double( s.frames ) : 0.0;
+    o << boost::format( "jpeg: %d frames, %d corrupt; %d..%d bytes, mean %.0f (%.1f%% of the %d byte buffer)" )
+        % s.frames % s.corrupt % s.min_length % s.max_length % mean
+        % ( fmt.frame_size ? 100.0 * mean / fmt.frame_size : 0.0 ) % fmt.frame_size << std::endl;
+}
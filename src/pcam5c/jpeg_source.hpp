@@ -0,0 +1,82 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "frame_source.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+
+// Hardware JPEG capture (ov5640::setting_jpeg, mode 1): the VDMA still writes
+// fixed-size frames, the compressed stream starts at the first byte and the
+// rest of the buffer is padding (or what an earlier, longer frame left).
+// jpeg_source wraps the VDMA source and hands out each frame with
+// frame::length set to the bytes from SOI through EOI, so capture/recorder/
+// frame_ring consumers only touch the valid part.  Buffers without a complete
+// stream are given back at once and counted as corrupt (and as dropped in the
+// next frame delivered).
+
+namespace jpeg {
+
+    // bytes from SOI through EOI of the stream at the start of 'data'; 0 if there
+    // is none or it is cut short.  Marker segments are skipped by their length,
+    // entropy-coded data is searched for the next marker (FF 00 stuffing and RSTn
+    // do not end it), so an EOI inside a table or the padding is never taken.
+    size_t length( const uint8_t * data, size_t size );
+
+}
+
+class jpeg_source : public frame_source {
+public:
+    struct stats {
+        uint64_t frames;
+        uint64_t corrupt;      // no complete SOI..EOI in the buffer
+        uint64_t bytes;        // valid bytes delivered
+        size_t min_length;
+        size_t max_length;
+    };
+
+    jpeg_source( std::shared_ptr< frame_source > );
+
+    inline frame_source& source() { return *source_; }
+
+    size_t size() const override;
+    const uint8_t * data( size_t index ) override;
+    size_t length( size_t index ) const override;
+    frame_buffer::format format() const override;
+    int next( frame&, std::chrono::milliseconds timeout ) override;
+    void release( size_t index ) override;
+    int export_fd( size_t index ) const override;
+
+    stats statistics() const;
+    void report( std::ostream& ) const;
+
+private:
+    std::shared_ptr< frame_source > source_;
+    uint32_t dropped_;     // corrupt frames not reported yet
+    std::atomic< uint64_t > frames_, corrupt_, bytes_;
+    std::atomic< size_t > min_length_, max_length_;
+};
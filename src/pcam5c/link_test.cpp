@@ -0,0 +1,297 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "link_test.hpp"
+#include "frame_source.hpp"
+#include "uio.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <boost/format.hpp>
+#if defined __x86_64__ || defined __i386__
+# include <immintrin.h>
+#endif
+#if defined __ARM_NEON
+# include <arm_neon.h>
+#endif
+
+namespace {
+
+    // CSI-2 RX subsystem registers (PG232)
+    constexpr uint32_t core_status = 0x10;   // [31:16] packet count
+    constexpr uint32_t isr = 0x24;           // Interrupt Status, write 1 to clear
+    constexpr uint32_t vc0_image_info1 = 0x60; // [31:16] line count
+
+    // all but frame received, stop state and the short packet FIFO flags
+    constexpr uint32_t isr_errors = 0x10693fff;
+    const char * const isr_names[ 32 ] = {
+        "VC0 frame level", "VC0 frame sync", "VC1 frame level", "VC1 frame sync"
+        , "VC2 frame level", "VC2 frame sync", "VC3 frame level", "VC3 frame sync"
+        , "unsupported data ID", "CRC", "ECC 1-bit", "ECC 2-bit"
+        , "SoT sync", "SoT", nullptr, "stop state"
+        , "stream line buffer full", "short packet FIFO not empty", "short packet FIFO full", "incorrect lane config"
+        , nullptr, "word count corruption", "VCX frame", nullptr
+        , nullptr, nullptr, nullptr, nullptr
+        , "YUV420 word count", nullptr, nullptr, "frame received"
+    };
+
+    size_t
+    diff_bits_scalar( const uint8_t * a, const uint8_t * b, size_t bytes )
+    {
+        size_t bits = 0, i = 0;
+        for ( ; i + 8 <= bytes; i += 8 ) {
+            uint64_t x, y;
+            std::memcpy( &x, a + i, 8 );
+            std::memcpy( &y, b + i, 8 );
+            bits += size_t( __builtin_popcountll( x ^ y ) );
+        }
+        for ( ; i < bytes; ++i )
+            bits += size_t( __builtin_popcount( unsigned( a[ i ] ^ b[ i ] ) ) );
+        return bits;
+    }
+
+#if defined __x86_64__ || defined __i386__
+    // nibble lookup popcount, bytes summed by psadbw into 64-bit lanes
+    __attribute__(( target( "ssse3" ) ))
+    size_t
+    diff_bits_ssse3( const uint8_t * a, const uint8_t * b, size_t bytes )
+    {
+        const __m128i lut = _mm_setr_epi8( 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 );
+        const __m128i low = _mm_set1_epi8( 0x0f );
+        __m128i acc = _mm_setzero_si128();
+        size_t i = 0;
+        for ( ; i + 16 <= bytes; i += 16 ) {
+            const __m128i x = _mm_xor_si128( _mm_loadu_si128( reinterpret_cast< const __m128i * >( a + i ) )
+                                             , _mm_loadu_si128( reinterpret_cast< const __m128i * >( b + i ) ) );
+            const __m128i n = _mm_add_epi8( _mm_shuffle_epi8( lut, _mm_and_si128( x, low ) )
+                                            , _mm_shuffle_epi8( lut, _mm_and_si128( _mm_srli_epi16( x, 4 ), low ) ) );
+            acc = _mm_add_epi64( acc, _mm_sad_epu8( n, _mm_setzero_si128() ) );
+        }
+        uint64_t sum[ 2 ];
+        _mm_storeu_si128( reinterpret_cast< __m128i * >( sum ), acc );
+        return size_t( sum[ 0 ] + sum[ 1 ] ) + diff_bits_scalar( a + i, b + i, bytes - i );
+    }
+
+    __attribute__(( target( "avx2" ) ))
+    size_t
+    diff_bits_avx2( const uint8_t * a, const uint8_t * b, size_t bytes )
+    {
+        const __m256i lut = _mm256_setr_epi8( 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
+                                              , 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 );
+        const __m256i low = _mm256_set1_epi8( 0x0f );
+        __m256i acc = _mm256_setzero_si256();
+        size_t i = 0;
+        for ( ; i + 32 <= bytes; i += 32 ) {
+            const __m256i x = _mm256_xor_si256( _mm256_loadu_si256( reinterpret_cast< const __m256i * >( a + i ) )
+                                                , _mm256_loadu_si256( reinterpret_cast< const __m256i * >( b + i ) ) );
+            const __m256i n = _mm256_add_epi8( _mm256_shuffle_epi8( lut, _mm256_and_si256( x, low ) )
+                                               , _mm256_shuffle_epi8( lut, _mm256_and_si256( _mm256_srli_epi16( x, 4 ), low ) ) );
+            acc = _mm256_add_epi64( acc, _mm256_sad_epu8( n, _mm256_setzero_si256() ) );
+        }
+        uint64_t sum[ 4 ];
+        _mm256_storeu_si256( reinterpret_cast< __m256i * >( sum ), acc );
+        return size_t( sum[ 0 ] + sum[ 1 ] + sum[ 2 ] + sum[ 3 ] ) + diff_bits_scalar( a + i, b + i, bytes - i );
+    }
+#endif
+
+#if defined __ARM_NEON
+    size_t
+    diff_bits_neon( const uint8_t * a, const uint8_t * b, size_t bytes )
+    {
+        uint64x2_t acc = vdupq_n_u64( 0 );
+        size_t i = 0;
+        for ( ; i + 16 <= bytes; i += 16 ) {
+            const uint8x16_t n = vcntq_u8( veorq_u8( vld1q_u8( a + i ), vld1q_u8( b + i ) ) );
+            acc = vpadalq_u32( acc, vpaddlq_u16( vpaddlq_u8( n ) ) );
+        }
+        return size_t( vgetq_lane_u64( acc, 0 ) + vgetq_lane_u64( acc, 1 ) ) + diff_bits_scalar( a + i, b + i, bytes - i );
+    }
+#endif
+}
+
+link_test::link_test( const test_pattern& pattern
+                      , const options& opts ) : pattern_( pattern )
+                                              , options_( opts )
+                                              , expected_( pattern.line_size() * pattern.height() )
+                                              , expected_seq_( 0 )
+                                              , packet_count_( 0 )
+{
+    pattern_.render( expected_.data(), pattern_.line_size(), expected_seq_ );
+}
+
+size_t
+link_test::diff_bits( const uint8_t * a, const uint8_t * b, size_t bytes, simd::isa isa )
+{
+    switch ( isa ) {
+#if defined __x86_64__ || defined __i386__
+    case simd::avx2:  return diff_bits_avx2( a, b, bytes );
+    case simd::ssse3: return diff_bits_ssse3( a, b, bytes );
+#endif
+#if defined __ARM_NEON
+    case simd::neon:  return diff_bits_neon( a, b, bytes );
+#endif
+    default:          return diff_bits_scalar( a, b, bytes );
+    }
+}
+
+size_t
+link_test::diff_pixels( const uint8_t * a, const uint8_t * b, size_t width, test_pattern::layout layout )
+{
+    size_t count = 0;
+    switch ( layout ) {
+    case test_pattern::raw10:
+        // the fifth byte of a group holds the two LSBs of each of the four pixels
+        for ( size_t x = 0; x + 4 <= width; x += 4, a += 5, b += 5 ) {
+            const unsigned lsb = unsigned( a[ 4 ] ^ b[ 4 ] );
+            for ( size_t k = 0; k < 4; ++k )
+                count += ( a[ k ] != b[ k ] || ( lsb >> ( 2 * k ) & 3 ) ) ? 1 : 0;
+        }
+        break;
+    case test_pattern::y8:
+        for ( size_t x = 0; x < width; ++x )
+            count += a[ x ] != b[ x ] ? 1 : 0;
+        break;
+    case test_pattern::rgb24:
+        for ( size_t x = 0; x < width; ++x, a += 3, b += 3 )
+            count += ( a[ 0 ] != b[ 0 ] || a[ 1 ] != b[ 1 ] || a[ 2 ] != b[ 2 ] ) ? 1 : 0;
+        break;
+    default: // two bytes a pixel; YUV 4:2:2 chroma is charged to the pixel carrying it
+        for ( size_t x = 0; x < width; ++x, a += 2, b += 2 )
+            count += ( a[ 0 ] != b[ 0 ] || a[ 1 ] != b[ 1 ] ) ? 1 : 0;
+        break;
+    }
+    return count;
+}
+
+size_t
+link_test::compare( const uint8_t * frame, size_t stride, uint64_t seq )
+{
+    const size_t line = pattern_.line_size();
+    if ( pattern_.animated() && seq != expected_seq_ ) {
+        expected_seq_ = seq;
+        pattern_.render( expected_.data(), line, seq );
+    }
+
+    size_t bad_pixels = 0, bad_lines = 0;
+    for ( size_t y = 0; y < pattern_.height(); ++y ) {
+        const uint8_t * received = frame + y * stride;
+        const uint8_t * expected = expected_.data() + y * line;
+        if ( const size_t bits = diff_bits( received, expected, line, options_.isa ) ) {
+            result_.bit_errors += bits;
+            bad_pixels += diff_pixels( received, expected, pattern_.width(), pattern_.format() );
+            ++bad_lines;
+        }
+    }
+    ++result_.frames;
+    result_.lines += pattern_.height();
+    result_.pixels += pattern_.width() * pattern_.height();
+    result_.bits += line * pattern_.height() * 8;
+    result_.bad_lines += bad_lines;
+    result_.bad_pixels += bad_pixels;
+    if ( bad_lines ) {
+        if ( result_.bad_frames++ == 0 )
+            result_.first_bad_frame = int64_t( seq );
+    }
+    return bad_pixels;
+}
+
+void
+link_test::sample( const uio& csi2 )
+{
+    if ( auto status = csi2( isr ) ) {
+        for ( size_t bit = 0; bit < 32; ++bit )
+            result_.isr[ bit ] += *status >> bit & 1;
+        if ( *status )
+            csi2( isr, *status );
+    }
+    if ( auto status = csi2( core_status ) ) {
+        const uint32_t count = *status >> 16;
+        result_.packets += ( count - packet_count_ ) & 0xffff;
+        packet_count_ = count;
+    }
+    if ( auto info = csi2( vc0_image_info1 ) )
+        result_.line_count = *info >> 16;
+}
+
+bool
+link_test::run( frame_source& source, const uio * csi2 )
+{
+    const auto fmt = source.format();
+    if ( fmt.width != pattern_.width() || fmt.height != pattern_.height() || fmt.stride < pattern_.line_size() ) {
+        std::cerr << boost::format( "link_test: source %dx%d stride %d does not hold a %dx%d pattern of %d bytes/line" )
+            % fmt.width % fmt.height % fmt.stride % pattern_.width() % pattern_.height() % pattern_.line_size() << std::endl;
+        return false;
+    }
+    if ( csi2 ) { // start from a clean status
+        if ( auto status = ( *csi2 )( isr ) )
+            ( *csi2 )( isr, *status );
+        if ( auto status = ( *csi2 )( core_status ) )
+            packet_count_ = *status >> 16;
+    }
+
+    while ( result_.frames < options_.frames ) {
+        frame_source::frame f;
+        const int rc = source.next( f, options_.timeout );
+        if ( rc < 0 )
+            return false;
+        if ( rc == 0 ) {
+            if ( ++result_.timeouts >= 3 ) {
+                std::cerr << "link_test: no frames" << std::endl;
+                return false;
+            }
+            continue;
+        }
+        result_.dropped += f.dropped;
+        if ( const uint8_t * data = source.data( f.index ) )
+            compare( data, fmt.stride, f.seq );
+        source.release( f.index );
+        if ( csi2 )
+            sample( *csi2 );
+    }
+    return true;
+}
+
+void
+link_test::report( std::ostream& o ) const
+{
+    const auto& r = result_;
+    o << boost::format( "link test: %dx%d, %d frames (%d bad, %d timeouts, %d dropped)" )
+        % pattern_.width() % pattern_.height() % r.frames % r.bad_frames % r.timeouts % r.dropped << std::endl;
+    o << boost::format( "  lines:  %12d bad of %d" ) % r.bad_lines % r.lines << std::endl;
+    o << boost::format( "  pixels: %12d bad of %d" ) % r.bad_pixels % r.pixels << std::endl;
+    o << boost::format( "  bits:   %12d bad of %d, BER %.3e%s" )
+        % r.bit_errors % r.bits % r.ber() % ( r.bit_errors ? "" : boost::str( boost::format( " (< %.1e at 95%%)" ) % ( r.bits ? 3.0 / double( r.bits ) : 0.0 ) ) )
+      << std::endl;
+    if ( r.first_bad_frame >= 0 )
+        o << "  first bad frame: " << r.first_bad_frame << std::endl;
+
+    const bool csi2 = r.packets || std::any_of( r.isr.begin(), r.isr.end(), []( uint64_t n ){ return n != 0; } );
+    if ( ! csi2 )
+        return;
+    o << boost::format( "  csi2rx: %d packets, VC0 line count %d" ) % r.packets % r.line_count << std::endl;
+    for ( size_t bit = 0; bit < 32; ++bit ) {
+        if ( r.isr[ bit ] && ( isr_errors >> bit & 1 ) )
+            o << boost::format( "  csi2rx: %-24s %d frames" ) % ( isr_names[ bit ] ? isr_names[ bit ] : "reserved" ) % r.isr[ bit ] << std::endl;
+    }
+}
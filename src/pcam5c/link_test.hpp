@@ -0,0 +1,104 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "simd.hpp"
+#include "test_pattern.hpp"
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+class frame_source;
+class uio;
+
+// CSI-2 link qualification: while the sensor sends a pre-ISP test pattern
+// (0x503d), every captured frame is compared bit for bit with test_pattern's
+// rendition of it.  Lines are checked by a vector XOR/popcount pass (SSSE3 or
+// AVX2 on the host, NEON on the target); only lines that differ are walked
+// again to attribute errors to pixels.  The CSI-2 RX Interrupt Status Register
+// is sampled and cleared (write 1 to clear) after each frame, so that ECC, CRC,
+// SoT and frame sync errors are counted per frame next to the pixel errors.
+// On the sensor, only the standard eight bars over RAW10/RAW16 are bit-exact:
+// the gradual, square and rolling geometry and the YUV/RGB arithmetic are
+// test_pattern's own, and random data is not seeded by the VDMA sequence.
+
+class link_test {
+public:
+    struct options {
+        size_t frames = 100;
+        std::chrono::milliseconds timeout = std::chrono::milliseconds( 1000 ); // per frame
+        simd::isa isa = simd::best();
+    };
+
+    struct result {
+        uint64_t frames = 0;
+        uint64_t bad_frames = 0;
+        uint64_t timeouts = 0;
+        uint64_t dropped = 0;         // reported by the source
+        uint64_t lines = 0;
+        uint64_t bad_lines = 0;
+        uint64_t pixels = 0;
+        uint64_t bad_pixels = 0;
+        uint64_t bits = 0;
+        uint64_t bit_errors = 0;
+        int64_t first_bad_frame = -1; // sequence number
+        // CSI-2 RX, when a register window was given
+        uint64_t packets = 0;         // Core Status [31:16], accumulated over wraps
+        std::array< uint64_t, 32 > isr = {{ 0 }}; // frames with each Interrupt Status bit set
+        uint32_t line_count = 0;      // VC0 image info 1 [31:16], last frame
+        inline double ber() const { return bits ? double( bit_errors ) / double( bits ) : 0.0; }
+    };
+
+    link_test( const test_pattern&, const options& );
+
+    // compares one frame (the pattern as rendered for 'seq' when animated) and adds
+    // to the result; returns the number of erroneous pixels
+    size_t compare( const uint8_t * frame, size_t stride, uint64_t seq );
+
+    // options.frames frames from 'source'; 'csi2' may be nullptr
+    bool run( frame_source&, const uio * csi2 );
+
+    // one CSI-2 RX status sample, as taken after each frame: Interrupt Status
+    // (counted, then cleared), packet count and VC0 line count
+    void sample( const uio& csi2 );
+
+    inline const result& statistics() const { return result_; }
+    void report( std::ostream& ) const;
+
+    // set bits of a ^ b
+    static size_t diff_bits( const uint8_t * a, const uint8_t * b, size_t bytes, simd::isa = simd::best() );
+    // pixels of a line in 'layout' that differ in any bit
+    static size_t diff_pixels( const uint8_t * a, const uint8_t * b, size_t width, test_pattern::layout );
+
+private:
+    const test_pattern& pattern_;
+    options options_;
+    std::vector< uint8_t > expected_;
+    uint64_t expected_seq_;
+    uint32_t packet_count_;
+    result result_;
+};
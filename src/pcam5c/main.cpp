@@ -23,11 +23,29 @@
  */
 
 #include "gpio.hpp"
+#include "gpiochip.hpp"
+#include "gpio_watch.hpp"
 #include "i2c.hpp"
 #include "pcam5c.hpp"
 #include "csi2rx.hpp"
 #include "d_phyrx.hpp"
+#include "uio_sim.hpp"
+#include "bench.hpp"
+#include "capture.hpp"
+#include "exposure_control.hpp"
+#include "frame_buffer.hpp"
+#include "frame_ring.hpp"
+#include "frame_stats.hpp"
+#include "image_stats.hpp"
+#include "jpeg_source.hpp"
+#include "link_test.hpp"
+#include "motion_detector.hpp"
+#include "recorder.hpp"
+#include "rx_init.hpp"
+#include "synthetic_source.hpp"
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <chrono>
 #include <cstddef>
 #include <cstdint>
@@ -43,14 +61,11 @@
 #include <boost/program_options.hpp>
 
 enum ADDR {
-    CR_OFFSET = 0
-    , VERSION_OFFSET = 0x0c
+    VERSION_OFFSET = 0x0c
 };
 
 enum MASK {
-    CR_ENABLE_MASK = 0x02
-    , CR_RESET_MASK = 0x01
-    , VERSION_MAJOR_MASK = 0xFFFF0000
+    VERSION_MAJOR_MASK = 0xFFFF0000
     , VERSION_MAJOR_SHIFT = 16
     , VERSION_MINOR_MASK = 0x0000FFFF
     , VERSION_MINOR_SHIFT = 0
@@ -76,6 +91,55 @@ public:
     }
 };
 
+namespace {
+    bool
+    init_rx( const csi2rx& csi2, const d_phyrx& dphy )
+    {
+        auto result = rx_init::run( csi2, dphy );
+        if ( __verbose )
+            std::cout << "init: reset cleared after "
+                      << ( result.csi2_reads ? std::to_string( *result.csi2_reads ) : "(timeout)" ) << "/"
+                      << ( result.dphy_reads ? std::to_string( *result.dphy_reads ) : "(timeout)" ) << " reads (csi2rx/d_phyrx)" << std::endl;
+        return result;
+    }
+
+    // --synthetic <width> <height> <bytes/pixel> [buffers] or the --vdma device;
+    // a synthetic source renders --pattern, or 'pattern' when that is not given
+    std::shared_ptr< frame_source >
+    make_source( const boost::program_options::variables_map& vm, const char * pattern = nullptr )
+    {
+        if ( vm.count( "synthetic" ) ) {
+            auto args = vm[ "synthetic" ].as< std::vector< uint32_t > >();
+            if ( args.size() < 3 ) {
+                std::cerr << "--synthetic requires <width> <height> <bytes/pixel>" << std::endl;
+                return nullptr;
+            }
+            frame_buffer::format fmt{ args[ 0 ], args[ 1 ], args[ 2 ] };
+            if ( args.size() > 3 )
+                fmt.buffer_count = args[ 3 ];
+            if ( vm.count( "pattern" ) || pattern ) {
+                auto control = test_pattern::parse( vm.count( "pattern" ) ? vm[ "pattern" ].as< std::string >() : std::string( pattern ) );
+                auto layout = test_pattern::parse_layout( vm[ "pattern-format" ].as< std::string >() );
+                if ( ! control || ! layout ) {
+                    std::cerr << "--pattern: unknown pattern or --pattern-format" << std::endl;
+                    return nullptr;
+                }
+                auto pattern = std::make_shared< const test_pattern >( fmt.width, fmt.height, *layout, *control );
+                auto source = std::make_shared< synthetic_source >( fmt, pattern, vm[ "fps" ].as< double >() );
+                return *source ? source : nullptr;
+            }
+            auto source = std::make_shared< synthetic_source >( fmt, vm[ "fps" ].as< double >() );
+            return *source ? source : nullptr;
+        }
+        auto source = std::make_shared< vdma_source >( vm.count( "vdma" ) ? vm[ "vdma" ].as< std::string >() : std::string( frame_buffer::default_device ) );
+        if ( ! *source )
+            return nullptr;
+        if ( vm.count( "jpeg" ) )
+            return std::make_shared< jpeg_source >( source );
+        return source;
+    }
+}
+
 int
 main( int argc, char **argv )
 {
@@ -90,9 +154,17 @@ main( int argc, char **argv )
             ( "wreg,w",        po::value<std::vector<std::string> >()->multitoken(), "write reg <addr, value>" )
             ( "all,a",         "read all registers" )
             ( "startup",       "initialize pcam-5c" )
+            ( "jpeg",          "--startup: hardware JPEG output (mode 1, 1920 x 256 byte frames); --capture/--record: keep SOI..EOI only" )
             ( "gpio-number,n", po::value< uint32_t >()->default_value( 960 ), "cam_gpio number" ) // 906+54
             ( "gpio",          po::value< std::string >()->default_value("")->implicit_value("read")
               , "gpio set value [0|1]" )
+            ( "gpiochip",      po::value< std::string >()->implicit_value( "/dev/gpiochip0" )
+              , "use gpio character device (v2 uAPI) instead of sysfs" )
+            ( "gpio-line",     po::value< uint32_t >()->default_value( 54 ), "line offset on gpiochip (EMIO 54 == gpio960)" )
+            ( "gpio-watch",    po::value< std::vector< uint32_t > >()->multitoken(), "capture edge events on gpiochip lines" )
+            ( "events",        po::value< size_t >()->default_value( 1000 ), "number of events for --gpio-watch/--frame-events" )
+            ( "timeout",       po::value< double >()->default_value( 10.0 ), "--gpio-watch/--frame-events/--frame-stats/--attach timeout (s)" )
+            ( "trace",         po::value< std::string >(), "binary event trace file for --gpio-watch" )
             ( "off",           "Halt Pcam 5c (gpio down)" )
             ( "on",            "PCam 5c power on" )
             ( "reset",         "PCam 5c power cycle" )
@@ -107,6 +179,47 @@ main( int argc, char **argv )
             ( "csi2rx",        "CSI2 RX register" )
             ( "d_phyrx",       "MIPI D-PHY RX register" )
             ( "init",          "CSI2 RX & MIPI D-PHY RX initialize" )
+            ( "vdma",          po::value< std::string >()->implicit_value( frame_buffer::default_device ), "list VDMA frame buffers" )
+            ( "vdma-format",   po::value< std::vector< uint32_t > >()->multitoken()
+              , "set VDMA geometry: <width> <height> <bytes/pixel> [buffers [frames/irq]]" )
+            ( "vdma-cached",   "allocate cacheable VDMA buffers with --vdma-format (explicit sync)" )
+            ( "frame-events",  "wait for --events VDMA frame interrupts on --vdma and print them" )
+            ( "capture",       "grab --events frames from --vdma (or --synthetic) into --consumers threads and report queue stats" )
+            ( "consumers",     po::value< size_t >()->default_value( 1 ), "--capture consumer threads" )
+            ( "policy",        po::value< std::string >()->default_value( "latest-wins" )
+              , "--capture drop policy [latest-wins|block|drop-oldest]" )
+            ( "frame-stats",   "collect --events VDMA frame records; report interval jitter, drops and latency" )
+            ( "synthetic",     po::value< std::vector< uint32_t > >()->multitoken()
+              , "--capture/--record from a synthetic source: <width> <height> <bytes/pixel> [buffers] (ramp, or --pattern)" )
+            ( "fps",           po::value< double >()->default_value( 30.0 ), "--synthetic frame rate" )
+            ( "pattern",       po::value< std::string >()->implicit_value( "bar" )
+              , "--synthetic OV5640 test pattern (0x503d) [bar|bar-vertical|bar-horizontal|bar-vertical2|square|square-bw|random|black][+rolling] or 0x.." )
+            ( "pattern-format", po::value< std::string >()->default_value( "uyvy" )
+              , "--pattern output [raw10|raw16|yuyv|uyvy|rgb565le|rgb565be|rgb24|y8]" )
+            ( "record",        po::value< std::string >(), "record --events frames from --vdma (or --synthetic) into segment files in <dir>" )
+            ( "segment",       po::value< size_t >()->default_value( 256 ), "--record frames per segment file" )
+            ( "depth",         po::value< size_t >()->default_value( 3 ), "--record writes in flight" )
+            ( "buffered",      "--record through the page cache (write-behind) instead of O_DIRECT" )
+            ( "motion",        po::value< std::string >()->implicit_value( "uyvy" )
+              , "--record only around motion in frames laid out as [gray8|yuyv|uyvy|rgb24|rgba32]" )
+            ( "motion-threshold", po::value< uint32_t >()->default_value( 24 ), "--motion luma difference of a changed sample" )
+            ( "pre-roll",      po::value< size_t >()->default_value( 1 ), "--motion frames recorded ahead of an event (held: fewer than the buffers)" )
+            ( "post-roll",     po::value< size_t >()->default_value( 30 ), "--motion quiet frames that end an event" )
+            ( "attach",        po::value< std::string >()->implicit_value( "/run/pcam5cd.sock" )
+              , "read --events frames from a running pcam5cd; report latency, missed and torn frames" )
+            ( "image-stats",   po::value< std::string >()
+              , "--attach: tile statistics of each frame, laid out as [gray8|yuyv|uyvy|rgb24|rgba32|raw10]" )
+            ( "sample",        po::value< size_t >()->default_value( 4 ), "--image-stats sampling stride (pixels and lines)" )
+            ( "ae",            po::value< double >()->implicit_value( 110 )
+              , "--attach --image-stats: host AE/AGC toward metered Y <target> over SCCB (--device)" )
+            ( "ae-metering",   po::value< std::string >()->default_value( "center" ), "--ae metering [average|center|spot]" )
+            ( "link-test",     po::value< size_t >()->implicit_value( 100 )
+              , "BER test: compare <frames> of the 0x503d --pattern (bar) from --vdma (or --synthetic) bit for bit; count CSI2 RX errors"
+                " (--vdma: standard bars over raw10|raw16 only, raw16 for 2+ bytes/pixel by default)" )
+            ( "inject-ber",    po::value< double >(), "--link-test --synthetic: flip frame bits at this rate" )
+            ( "sim",           "use simulated (memfd) CSI2 RX & D-PHY RX register windows" )
+            ( "bench",         po::value< std::string >(), "run host benchmark [uio|gpio|frame|raw10|demosaic|convert|stats|pyramid|motion|pattern|link]" )
+            ( "replicates",    po::value< size_t >()->default_value( 100000 ), "benchmark replicates" )
             ;
         po::positional_options_description p;
         p.add( "args",  -1 );
@@ -119,6 +232,37 @@ main( int argc, char **argv )
     }
     i2cdev = vm[ "device" ].as< std::string >().c_str();
 
+    if ( vm.count( "gpio-watch" ) ) {
+        auto device = vm.count( "gpiochip" ) ? vm[ "gpiochip" ].as< std::string >() : std::string( "/dev/gpiochip0" );
+        gpio_watch watch( device, vm[ "gpio-watch" ].as< std::vector< uint32_t > >() );
+        auto timeout = std::chrono::milliseconds( int64_t( vm[ "timeout" ].as< double >() * 1000 ) );
+        if ( ! watch.run( vm[ "events" ].as< size_t >(), timeout, vm.count( "trace" ) ? vm[ "trace" ].as< std::string >() : std::string() ) )
+            return 1;
+        watch.report( std::cout );
+        return 0;
+    }
+
+    if ( ! vm[ "gpio" ].as< std::string >().empty() && vm.count( "gpiochip" ) ) {
+        auto device = vm[ "gpiochip" ].as< std::string >();
+        auto line = vm[ "gpio-line" ].as< uint32_t >();
+        auto arg = vm[ "gpio" ].as< std::string >();
+        gpiochip io( device, { line }, arg == "read" ? gpiochip::as_is : gpiochip::output );
+        if ( ! io )
+            return 1;
+        if ( auto label = gpiochip::label( device ) )
+            std::cout << device << ": " << *label << std::endl;
+        if ( arg == "read" ) {
+            std::cout << io.read() << std::endl;
+        } else if ( arg == "1" || arg == "true" ) {
+            if ( io << 1 )
+                std::cout << device << ":" << line << "=" << 1 << std::endl;
+        } else if ( arg == "0" || arg == "false" ) {
+            if ( io << 0 )
+                std::cout << device << ":" << line << "=" << 0 << std::endl;
+        }
+        return 0;
+    }
+
     if ( ! vm[ "gpio" ].as< std::string >().empty() ) {
         auto num = vm[ "gpio-number" ].as< uint32_t >();
         gpio io( num );
@@ -210,7 +354,7 @@ main( int argc, char **argv )
         return 0;
     }
     if ( vm.count( "startup" ) ) {
-        pcam5c().startup( *i2c0::instance() );
+        pcam5c().startup( *i2c0::instance(), vm.count( "jpeg" ) );
     }
     if ( vm.count( "sysclk" ) ) {
         if ( auto sclk = pcam5c().get_sysclk( *i2c0::instance() ) ) {
@@ -226,30 +370,326 @@ main( int argc, char **argv )
             std::cout << "light frequency get failed\n";
     }
 
+    std::shared_ptr< uio_sim > csi2rx_sim, d_phyrx_sim;
+    if ( vm.count( "sim" ) ) {
+        csi2rx_sim = csi2rx::simulator();
+        d_phyrx_sim = d_phyrx::simulator();
+    }
+
     if ( vm.count( "csi2rx" ) ) {
-        csi2rx().dump();
+        if ( csi2rx_sim )
+            csi2rx( csi2rx_sim ).dump();
+        else
+            csi2rx().dump();
     }
     if ( vm.count( "d_phyrx" ) ) {
-        d_phyrx().dump();
+        if ( d_phyrx_sim )
+            d_phyrx( d_phyrx_sim ).dump();
+        else
+            d_phyrx().dump();
     }
 
     if ( vm.count( "init" ) ) {
-        csi2rx()( CR_OFFSET, (CR_RESET_MASK & ~CR_ENABLE_MASK) );
-        d_phyrx()( CR_OFFSET, (CR_RESET_MASK & ~CR_ENABLE_MASK) );
-        // GAMMA_BASE WRITE 3
-
-        // vdma.configureWire
-        // vdma.enable write
-
-        csi2rx()( CR_OFFSET, CR_ENABLE_MASK );
-        d_phyrx()( CR_OFFSET, CR_ENABLE_MASK );
-
-        // vid.reset
-        // vdma.resetRead.
-        // vid.configurewire
-        // vdma.configureRead
-        // vid.enable
-        // vdma.enableRead
+        if ( csi2rx_sim )
+            init_rx( csi2rx( csi2rx_sim ), d_phyrx( d_phyrx_sim ) );
+        else
+            init_rx( csi2rx(), d_phyrx() );
+    }
+
+    if ( vm.count( "link-test" ) ) {
+        auto source = make_source( vm, "bar" );
+        if ( ! source )
+            return 1;
+        const auto fmt = source->format();
+        auto synthetic = std::dynamic_pointer_cast< synthetic_source >( source );
+        std::unique_ptr< test_pattern > sensor_pattern;
+        const test_pattern * pattern = nullptr;
+        std::optional< uint8_t > saved; // PRE ISP TEST SETTING 1 (0x503d)
+        std::unique_ptr< csi2rx > csi2;
+        if ( synthetic ) {
+            pattern = synthetic->pattern();
+            if ( vm.count( "inject-ber" ) )
+                synthetic->inject( vm[ "inject-ber" ].as< double >() );
+        } else {
+            // only the standard bars over RAW are bit-exact: the ISP (gamma, color matrix, AWB) owns
+            // the YUV/RGB encodings, and the animated patterns do not follow the VDMA sequence
+            auto control = test_pattern::parse( vm.count( "pattern" ) ? vm[ "pattern" ].as< std::string >() : std::string( "bar" ) );
+            auto layout = vm[ "pattern-format" ].defaulted()
+                ? std::optional< test_pattern::layout >( fmt.bytes_per_pixel >= 2 ? test_pattern::raw16 : test_pattern::raw10 )
+                : test_pattern::parse_layout( vm[ "pattern-format" ].as< std::string >() );
+            if ( ! control || ! layout ) {
+                std::cerr << "--pattern: unknown pattern or --pattern-format" << std::endl;
+                return 1;
+            }
+            if ( *control != ( test_pattern::enable | test_pattern::bar_standard | test_pattern::color_bar )
+                 || ( *layout != test_pattern::raw10 && *layout != test_pattern::raw16 ) ) {
+                std::cerr << "link-test: on the sensor only --pattern bar with --pattern-format raw10|raw16 is bit-exact" << std::endl;
+                return 1;
+            }
+            sensor_pattern = std::make_unique< test_pattern >( fmt.width, fmt.height, *layout, *control );
+            pattern = sensor_pattern.get();
+            i2c_linux::i2c& iic = *i2c0::instance();
+            saved = iic.read_reg( 0x503d );
+            if ( ! saved || ! iic.write_reg( 0x503d, *control ) ) {
+                std::cerr << "link-test: could not enable the test pattern on " << i2cdev << std::endl;
+                return 1;
+            }
+            frame_source::frame f; // the frames in flight still carry the image
+            for ( size_t i = 0; i < 2 && source->next( f, std::chrono::milliseconds( 1000 ) ) > 0; ++i )
+                source->release( f.index );
+        }
+        if ( csi2rx_sim )
+            csi2 = std::make_unique< csi2rx >( csi2rx_sim );
+        else if ( ! synthetic )
+            csi2 = std::make_unique< csi2rx >();
+
+        link_test::options opts;
+        opts.frames = vm[ "link-test" ].as< size_t >();
+        link_test test( *pattern, opts );
+        bool ok = test.run( *source, csi2.get() );
+        if ( saved )
+            static_cast< i2c_linux::i2c& >( *i2c0::instance() ).write_reg( 0x503d, *saved );
+        test.report( std::cout );
+        if ( synthetic && synthetic->injected() )
+            std::cout << "injected: " << synthetic->injected() << " bit errors" << std::endl;
+        return ok && test.statistics().bit_errors == 0 ? 0 : 1;
+    }
+
+    if ( vm.count( "vdma-format" ) ) {
+        auto args = vm[ "vdma-format" ].as< std::vector< uint32_t > >();
+        if ( args.size() < 3 ) {
+            std::cerr << "--vdma-format requires <width> <height> <bytes/pixel>" << std::endl;
+            return 1;
+        }
+        frame_buffer fb( vm.count( "vdma" ) ? vm[ "vdma" ].as< std::string >() : std::string( frame_buffer::default_device ) );
+        frame_buffer::format fmt{ args[ 0 ], args[ 1 ], args[ 2 ] };
+        if ( args.size() > 3 )
+            fmt.buffer_count = args[ 3 ];
+        if ( args.size() > 4 )
+            fmt.irq_frame_count = args[ 4 ];
+        if ( vm.count( "vdma-cached" ) )
+            fmt.flags = frame_buffer::cached;
+        if ( ! fb.set_format( fmt ) )
+            return 1;
+        std::cout << boost::format( "vdma: %dx%d %d bytes/pixel stride %d, %d/%d %s buffers of %d bytes, irq every %d frame(s)" )
+            % fmt.width % fmt.height % fmt.bytes_per_pixel % fmt.stride
+            % fmt.buffer_count % fmt.max_buffers % ( fmt.flags & frame_buffer::cached ? "cached" : "coherent" )
+            % fmt.frame_size % fmt.irq_frame_count << std::endl;
+    }
+
+    if ( vm.count( "frame-events" ) ) {
+        frame_buffer fb( vm.count( "vdma" ) ? vm[ "vdma" ].as< std::string >() : std::string( frame_buffer::default_device ) );
+        auto timeout = std::chrono::milliseconds( int64_t( vm[ "timeout" ].as< double >() * 1000 ) );
+        int64_t prev(0);
+        frame_buffer::frame_event ev;
+        for ( size_t i = 0; fb && i < vm[ "events" ].as< size_t >(); ++i ) {
+            if ( fb.read_frames( &ev, 1, int( timeout.count() ) ) <= 0 ) {
+                std::cerr << "frame wait timed out" << std::endl;
+                return 1;
+            }
+            std::cout << boost::format( "%8d\t[%02d]\t%d.%09d\t%10.3f ms\tsr=%04x dropped=%d lost=%d" )
+                % ev.frame_seq % ev.buffer_index
+                % ( ev.timestamp_ns / 1000000000 ) % ( ev.timestamp_ns % 1000000000 )
+                % ( prev ? double( ev.timestamp_ns - prev ) / 1.0e6 : 0.0 )
+                % ev.status % ev.dropped % ev.lost << std::endl;
+            prev = ev.timestamp_ns;
+        }
+        return 0;
+    }
+
+    if ( vm.count( "capture" ) ) {
+        auto source = make_source( vm );
+        if ( ! source )
+            return 1;
+        const auto name = vm[ "policy" ].as< std::string >();
+        auto policy = name == "block" ? capture::block : name == "drop-oldest" ? capture::drop_oldest : capture::latest_wins;
+
+        capture cap( source );
+        std::vector< std::thread > consumers;
+        std::atomic< size_t > consumed( 0 ), torn( 0 );
+        const size_t nframes = vm[ "events" ].as< size_t >();
+        for ( size_t i = 0; i < vm[ "consumers" ].as< size_t >(); ++i ) {
+            consumers.emplace_back( [&, sub = cap.subscribe( policy )]{
+                while ( consumed < nframes ) {
+                    if ( auto frame = sub->pop( std::chrono::milliseconds( 100 ) ) ) {
+                        ++consumed;
+                        if ( ! frame->valid() )
+                            ++torn;
+                    } else if ( ! cap.running() ) {
+                        break;
+                    }
+                }
+            });
+        }
+        auto timeout = std::chrono::milliseconds( int64_t( vm[ "timeout" ].as< double >() * 1000 ) );
+        auto tp = std::chrono::steady_clock::now();
+        cap.start();
+        while ( consumed < nframes && std::chrono::steady_clock::now() - tp < timeout )
+            std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+        cap.stop();
+        for ( auto& t: consumers )
+            t.join();
+        cap.report( std::cout );
+        if ( auto jpeg = std::dynamic_pointer_cast< jpeg_source >( source ) )
+            jpeg->report( std::cout );
+        std::cout << "consumed: " << consumed << ", overwritten before release: " << torn << std::endl;
+        return 0;
+    }
+
+    if ( vm.count( "record" ) ) {
+        auto source = make_source( vm );
+        if ( ! source )
+            return 1;
+        recorder::options opts;
+        opts.directory = vm[ "record" ].as< std::string >();
+        opts.segment_frames = vm[ "segment" ].as< size_t >();
+        opts.depth = vm[ "depth" ].as< size_t >();
+        opts.direct = ! vm.count( "buffered" );
+
+        std::unique_ptr< thread_pool > workers;
+        std::unique_ptr< motion_detector > motion;
+        motion_detector::result moved;
+        if ( vm.count( "motion" ) ) {
+            const std::array< const char *, 5 > names = {{ "gray8", "yuyv", "uyvy", "rgb24", "rgba32" }};
+            auto it = std::find( names.begin(), names.end(), vm[ "motion" ].as< std::string >() );
+            const auto fmt = source->format();
+            motion_detector::options mopts;
+            mopts.format = motion_detector::layout( it - names.begin() );
+            if ( it == names.end() || vm.count( "jpeg" ) || motion_detector::bytes_per_pixel( mopts.format ) != fmt.bytes_per_pixel ) {
+                std::cerr << "--motion: layout does not match the frames" << std::endl;
+                return 1;
+            }
+            mopts.threshold = uint8_t( std::min( vm[ "motion-threshold" ].as< uint32_t >(), uint32_t( 255 ) ) );
+            mopts.hold = vm[ "post-roll" ].as< size_t >();
+            workers = std::make_unique< thread_pool >();
+            motion = std::make_unique< motion_detector >( fmt.width, fmt.height, *workers, mopts );
+            const size_t stride = fmt.stride ? fmt.stride : fmt.width * fmt.bytes_per_pixel;
+            opts.pre_roll = vm[ "pre-roll" ].as< size_t >();
+            opts.gate = [&, stride]( const frame_ref& f ){
+                if ( ! ( *motion )( f.data(), stride, f.seq(), f.timestamp_ns(), moved ) )
+                    return false;
+                if ( moved.event != motion_detector::none )
+                    std::cout << boost::format( "motion: %s at seq %d, %d tiles" )
+                        % ( moved.event == motion_detector::begin ? "begin" : "end" ) % moved.seq % moved.tiles << std::endl;
+                return moved.active;
+            };
+        }
+
+        capture cap( source );
+        recorder rec( source->format(), opts );
+        const size_t nframes = vm[ "events" ].as< size_t >();
+        auto timeout = std::chrono::milliseconds( int64_t( vm[ "timeout" ].as< double >() * 1000 ) );
+        auto tp = std::chrono::steady_clock::now();
+        rec.start( cap );
+        cap.start();
+        while ( cap.statistics().frames < nframes && std::chrono::steady_clock::now() - tp < timeout )
+            std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+        cap.stop();
+        rec.stop();
+        cap.report( std::cout );
+        if ( auto jpeg = std::dynamic_pointer_cast< jpeg_source >( source ) )
+            jpeg->report( std::cout );
+        rec.report( std::cout );
+        if ( motion )
+            motion->report( std::cout );
+        return rec.statistics().errors ? 1 : 0;
+    }
+
+    if ( vm.count( "frame-stats" ) ) {
+        frame_buffer fb( vm.count( "vdma" ) ? vm[ "vdma" ].as< std::string >() : std::string( frame_buffer::default_device ) );
+        auto timeout = std::chrono::milliseconds( int64_t( vm[ "timeout" ].as< double >() * 1000 ) );
+        frame_stats stats;
+        bool ok = fb && stats.run( fb, vm[ "events" ].as< size_t >(), timeout );
+        stats.report( std::cout );
+        return ok ? 0 : 1;
+    }
+
+    if ( vm.count( "attach" ) ) {
+        frame_ring::reader ring;
+        if ( ! ring.attach( vm[ "attach" ].as< std::string >() ) )
+            return 1;
+        auto info = ring.info();
+        std::cout << boost::format( "attached: %dx%d %d bytes/pixel, %d slots, %d readers" )
+            % info->width % info->height % info->bytes_per_pixel % info->slot_count % info->readers.load() << std::endl;
+
+        std::unique_ptr< thread_pool > workers;
+        std::unique_ptr< image_stats > stats;
+        image_stats::result measured;
+        frame_stats::interval elapsed;
+        if ( vm.count( "image-stats" ) ) {
+            const std::array< const char *, 6 > names = {{ "gray8", "yuyv", "uyvy", "rgb24", "rgba32", "raw10" }};
+            auto it = std::find( names.begin(), names.end(), vm[ "image-stats" ].as< std::string >() );
+            if ( it == names.end() ) {
+                std::cerr << "unknown layout: " << vm[ "image-stats" ].as< std::string >() << std::endl;
+                return 1;
+            }
+            image_stats::options opts;
+            opts.format = image_stats::layout( it - names.begin() );
+            opts.stride = vm[ "sample" ].as< size_t >();
+            workers = std::make_unique< thread_pool >();
+            stats = std::make_unique< image_stats >( info->width, info->height, *workers, opts );
+        }
+        std::unique_ptr< exposure_control > ae;
+        if ( stats && vm.count( "ae" ) ) {
+            exposure_control::options opts;
+            opts.target = vm[ "ae" ].as< double >();
+            const auto policy = vm[ "ae-metering" ].as< std::string >();
+            opts.policy = policy == "average" ? exposure_control::average : policy == "spot" ? exposure_control::spot : exposure_control::center;
+            ae = std::make_unique< exposure_control >( *i2c0::instance(), opts );
+            if ( ! ae->engage() ) {
+                std::cerr << "ae: could not take over exposure on " << i2cdev << std::endl;
+                return 1;
+            }
+        }
+
+        auto timeout = std::chrono::milliseconds( int64_t( vm[ "timeout" ].as< double >() * 1000 ) );
+        frame_stats::interval latency;
+        size_t frames = 0, torn = 0;
+        uint64_t checksum = 0;
+        while ( frames < vm[ "events" ].as< size_t >() ) {
+            auto v = ring.next( timeout );
+            if ( ! v )
+                break;
+            latency( double( frame_stats::now_ns() - v->timestamp_ns ) );
+            if ( stats ) { // in place, on the shared mapping
+                const int64_t t0 = frame_stats::now_ns();
+                ( *stats )( v->data, info->stride, measured );
+                elapsed( double( frame_stats::now_ns() - t0 ) );
+            } else {
+                for ( size_t i = 0; i < v->length; i += 4096 ) // touch every page
+                    checksum += v->data[ i ];
+            }
+            ++frames;
+            if ( ! ring.valid( *v ) ) {
+                ++torn; // the writer got to the slot while it was read; do not steer on it
+                continue;
+            }
+            if ( ae )
+                ( *ae )( measured, v->timestamp_ns );
+        }
+        std::cout << boost::format( "frames: %d, missed: %d, torn: %d, latency mean %.1f us (min %.1f, max %.1f), checksum %x%s" )
+            % frames % ring.missed() % torn % ( latency.mean / 1000 ) % ( latency.min / 1000 ) % ( latency.max / 1000 ) % checksum
+            % ( ring.alive() ? "" : ", daemon gone" ) << std::endl;
+        if ( stats && frames ) {
+            std::cout << boost::format( "image stats: %.2f ms per frame (max %.2f), last frame:" ) % ( elapsed.mean / 1.0e6 ) % ( elapsed.max / 1.0e6 ) << std::endl;
+            image_stats::report( std::cout, measured );
+        }
+        if ( ae ) {
+            ae->report( std::cout );
+            ae->release();
+        }
+        return 0;
+    }
+
+    if ( vm.count( "vdma" ) && ! vm.count( "bench" ) ) {
+        frame_buffer fb( vm[ "vdma" ].as< std::string >() );
+        for ( size_t i = 0; i < fb.size(); ++i )
+            std::cout << boost::format( "[%02d]\t0x%08x\t%8d bytes\toffset 0x%08x" )
+                % i % fb[ i ].dma_addr % fb[ i ].length % fb[ i ].offset << std::endl;
+    }
+
+    if ( vm.count( "bench" ) ) {
+        bench::run( vm );
     }
 
     return 0;
@@ -0,0 +1,298 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "motion_detector.hpp"
+#include "simd_vec.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <boost/format.hpp>
+
+namespace {
+
+    constexpr size_t max_lanes = 32;   // 8-bit lanes of the widest register (AVX2)
+
+    using simd::load;
+    using simd::store;
+
+    // N samples per step: 8-bit frame, previous frame and changed mask; 16-bit background and counts
+    template< size_t N > struct vec {
+        typedef uint8_t u8 __attribute__(( vector_size( N ) ));
+        typedef uint16_t w16 __attribute__(( vector_size( N * 2 ) ));
+    };
+
+    // one sampled line against the model: counts the changed samples per column,
+    // then moves the previous line and the background on to this one
+    template< size_t N >
+    __attribute__(( always_inline )) inline void
+    compare( const uint8_t * y, uint8_t * previous, uint16_t * background, uint16_t * counts, size_t n, uint8_t threshold, int shift )
+    {
+        typedef typename vec< N >::u8 u8;
+        typedef typename vec< N >::w16 w16;
+        for ( size_t i = 0; i < n; i += N ) {
+            const u8 c = load< u8 >( y + i ), p = load< u8 >( previous + i );
+            const w16 b = load< w16 >( background + i );
+            const u8 bg = __builtin_convertvector( b >> 8, u8 );
+            const u8 d1 = c > p ? c - p : p - c;
+            const u8 d2 = c > bg ? c - bg : bg - c;
+            const u8 changed = u8( ( d1 > threshold ) & ( d2 > threshold ) ) & 1;
+            store( counts + i, load< w16 >( counts + i ) + __builtin_convertvector( changed, w16 ) );
+            store( background + i, b - ( b >> shift ) + ( __builtin_convertvector( c, w16 ) << ( 8 - shift ) ) );
+            store( previous + i, c );
+        }
+    }
+
+    typedef void ( *compare_function )( const uint8_t *, uint8_t *, uint16_t *, uint16_t *, size_t, uint8_t, int );
+
+    struct compare_kernel {
+        template< size_t N > __attribute__(( always_inline )) static void
+        run( const uint8_t * y, uint8_t * previous, uint16_t * background, uint16_t * counts, size_t n, uint8_t threshold, int shift )
+        {
+            compare< N >( y, previous, background, counts, n, threshold, shift );
+        }
+    };
+
+    // reference
+    void
+    compare_scalar( const uint8_t * y, uint8_t * previous, uint16_t * background, uint16_t * counts, size_t n, uint8_t threshold, int shift )
+    {
+        for ( size_t i = 0; i < n; ++i ) {
+            const int c = y[ i ], p = previous[ i ], bg = background[ i ] >> 8;
+            if ( std::abs( c - p ) > threshold && std::abs( c - bg ) > threshold )
+                ++counts[ i ];
+            background[ i ] = uint16_t( background[ i ] - ( background[ i ] >> shift ) + ( c << ( 8 - shift ) ) );
+            previous[ i ] = uint8_t( c );
+        }
+    }
+
+    // every 'step'-th luma sample of a line
+    void
+    gather( const uint8_t * line, size_t n, size_t step, motion_detector::layout format, uint8_t * y )
+    {
+        switch ( format ) {
+        case motion_detector::gray8:
+            for ( size_t x = 0; x < n; ++x )
+                y[ x ] = line[ x * step ];
+            break;
+        case motion_detector::yuyv:
+        case motion_detector::uyvy: {
+            const uint8_t * s = line + ( format == motion_detector::uyvy ? 1 : 0 );
+            for ( size_t x = 0; x < n; ++x )
+                y[ x ] = s[ 2 * x * step ];
+        }
+            break;
+        case motion_detector::rgb24:
+        case motion_detector::rgba32: {
+            const size_t bpp = motion_detector::bytes_per_pixel( format );
+            for ( size_t x = 0; x < n; ++x ) {
+                const uint8_t * p = line + x * step * bpp;
+                y[ x ] = uint8_t( ( p[ 0 ] * 77 + p[ 1 ] * 150 + p[ 2 ] * 29 + 128 ) >> 8 );
+            }
+        }
+            break;
+        }
+    }
+}
+
+struct motion_detector::scratch {
+    std::vector< uint8_t > line;        // sampled luma, padded
+    std::vector< uint16_t > counts;     // changed samples per column over a tile row
+};
+
+size_t
+motion_detector::bytes_per_pixel( layout format )
+{
+    return format == gray8 ? 1 : format == rgb24 ? 3 : format == rgba32 ? 4 : 2;
+}
+
+motion_detector::motion_detector( size_t width
+                                  , size_t height
+                                  , thread_pool& pool
+                                  , const options& opts ) : width_( width )
+                                                          , height_( height )
+                                                          , primed_( false )
+                                                          , active_( false )
+                                                          , run_( 0 )
+                                                          , quiet_( 0 )
+                                                          , stats_{}
+                                                          , pool_( pool )
+                                                          , options_( opts )
+{
+    options_.step = std::max( size_t( 1 ), options_.step );
+    options_.learning_shift = std::min( 8, std::max( 1, options_.learning_shift ) );
+    options_.trigger = std::max( size_t( 1 ), options_.trigger );
+    nx_ = width_ ? ( width_ - 1 ) / options_.step + 1 : 0;
+    ny_ = height_ ? ( height_ - 1 ) / options_.step + 1 : 0;
+    padded_ = ( nx_ + max_lanes - 1 ) / max_lanes * max_lanes;
+    options_.grid_x = std::min( std::max( size_t( 1 ), options_.grid_x ), std::max( size_t( 1 ), nx_ ) );
+    options_.grid_y = std::min( std::max( size_t( 1 ), options_.grid_y ), std::max( size_t( 1 ), ny_ ) );
+    for ( size_t t = 0; t <= options_.grid_x; ++t )
+        splits_x_.emplace_back( t * nx_ / options_.grid_x );
+    for ( size_t t = 0; t <= options_.grid_y; ++t )
+        splits_y_.emplace_back( t * ny_ / options_.grid_y );
+    for ( size_t ty = 0; ty < options_.grid_y; ++ty ) {
+        for ( size_t tx = 0; tx < options_.grid_x; ++tx ) {
+            const size_t samples = ( splits_x_[ tx + 1 ] - splits_x_[ tx ] ) * ( splits_y_[ ty + 1 ] - splits_y_[ ty ] );
+            needed_.emplace_back( uint32_t( std::max( 1.0, std::ceil( options_.tile_fraction * samples ) ) ) );
+        }
+    }
+    previous_.assign( ny_ * padded_, 0 );
+    background_.assign( ny_ * padded_, 0 );
+    for ( size_t i = 0; i < pool_.size(); ++i ) {
+        auto s = std::make_unique< scratch >();
+        s->line.assign( padded_, 0 );
+        s->counts.assign( padded_, 0 );
+        scratch_.emplace_back( std::move( s ) );
+    }
+}
+
+motion_detector::~motion_detector()
+{
+}
+
+void
+motion_detector::reset()
+{
+    primed_ = false;
+    active_ = false;
+    run_ = quiet_ = 0;
+}
+
+void
+motion_detector::band( size_t index, scratch& s, const uint8_t * frame, size_t stride, uint32_t * changed )
+{
+    compare_function f = simd::kernel< compare_kernel, 16, compare_function >( options_.isa );
+    if ( options_.isa == simd::scalar )
+        f = compare_scalar;
+
+    // previous_ and background_ rows belong to one tile row, so tasks never share them
+    std::fill( s.counts.begin(), s.counts.end(), 0 );
+    for ( size_t y = splits_y_[ index ]; y < splits_y_[ index + 1 ]; ++y ) {
+        uint8_t * previous = previous_.data() + y * padded_;
+        uint16_t * background = background_.data() + y * padded_;
+        gather( frame + y * options_.step * stride, nx_, options_.step, options_.format, s.line.data() );
+        if ( primed_ ) {
+            f( s.line.data(), previous, background, s.counts.data(), padded_, options_.threshold, options_.learning_shift );
+        } else {
+            for ( size_t x = 0; x < padded_; ++x ) {
+                previous[ x ] = s.line[ x ];
+                background[ x ] = uint16_t( s.line[ x ] << 8 );
+            }
+        }
+    }
+    for ( size_t tx = 0; tx < options_.grid_x; ++tx ) {
+        uint32_t n = 0;
+        for ( size_t x = splits_x_[ tx ]; x < splits_x_[ tx + 1 ]; ++x )
+            n += s.counts[ x ];
+        changed[ index * options_.grid_x + tx ] = n;
+    }
+}
+
+bool
+motion_detector::operator()( const uint8_t * frame, size_t stride, uint64_t seq, int64_t timestamp_ns, result& res )
+{
+    if ( ! frame || ! nx_ || ! ny_ )
+        return false;
+    const size_t tiles = options_.grid_x * options_.grid_y;
+    res.seq = seq;
+    res.timestamp_ns = timestamp_ns;
+    res.grid_x = uint32_t( options_.grid_x );
+    res.grid_y = uint32_t( options_.grid_y );
+    res.changed.resize( tiles );
+    res.samples.resize( tiles );
+    for ( size_t ty = 0; ty < options_.grid_y; ++ty )
+        for ( size_t tx = 0; tx < options_.grid_x; ++tx )
+            res.samples[ ty * options_.grid_x + tx ] = uint32_t( ( splits_x_[ tx + 1 ] - splits_x_[ tx ] ) * ( splits_y_[ ty + 1 ] - splits_y_[ ty ] ) );
+
+    pool_.run( options_.grid_y, [&]( size_t t, size_t worker ){
+        band( t, *scratch_[ worker ], frame, stride, res.changed.data() );
+    });
+
+    ++stats_.frames;
+    res.tiles = 0;
+    res.motion = res.relearnt = false;
+    res.event = none;
+    if ( ! primed_ ) {
+        primed_ = true;
+        res.active = active_;
+        return true;
+    }
+
+    for ( size_t t = 0; t < tiles; ++t )
+        if ( res.changed[ t ] >= needed_[ t ] )
+            ++res.tiles;
+    if ( options_.global_fraction < 1.0 && res.tiles > options_.global_fraction * tiles ) {
+        for ( size_t i = 0; i < previous_.size(); ++i )
+            background_[ i ] = uint16_t( previous_[ i ] << 8 );
+        res.relearnt = true;
+        ++stats_.relearnt;
+    } else {
+        res.motion = res.tiles >= std::max( size_t( 1 ), options_.min_tiles );
+    }
+
+    if ( res.motion ) {
+        ++stats_.motion;
+        quiet_ = 0;
+        if ( ++run_ >= options_.trigger && ! active_ ) {
+            active_ = true;
+            res.event = begin;
+            ++stats_.events;
+        }
+    } else {
+        run_ = 0;
+        if ( active_ && ++quiet_ > options_.hold ) {
+            active_ = false;
+            quiet_ = 0;
+            res.event = end;
+        }
+    }
+    if ( active_ )
+        ++stats_.active;
+    res.active = active_;
+    return true;
+}
+
+void
+motion_detector::report( std::ostream& o, const result& res )
+{
+    o << boost::format( "motion: seq %d, %d/%d tiles%s%s%s" )
+        % res.seq % res.tiles % res.changed.size()
+        % ( res.motion ? ", motion" : "" ) % ( res.relearnt ? ", relearnt" : "" )
+        % ( res.event == begin ? ", begin" : res.event == end ? ", end" : "" ) << std::endl;
+    for ( size_t ty = 0; ty < res.grid_y; ++ty ) {
+        o << "\t%";
+        for ( size_t tx = 0; tx < res.grid_x; ++tx ) {
+            const size_t t = ty * res.grid_x + tx;
+            o << boost::format( " %3d" ) % ( res.samples[ t ] ? 100 * res.changed[ t ] / res.samples[ t ] : 0 );
+        }
+        o << std::endl;
+    }
+}
+
+void
+motion_detector::report( std::ostream& o ) const
+{
+    const auto& s = stats_;
+    o << boost::format( "motion: %d frames, %d with motion, %d within %d event(s) (%.1f%%), background relearnt %d time(s)" )
+        % s.frames % s.motion % s.active % s.events % ( s.frames ? 100.0 * s.active / s.frames : 0 ) % s.relearnt << std::endl;
+}
@@ -0,0 +1,139 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "simd.hpp"
+#include "thread_pool.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+// Motion detection on a subsampled luma grid, for gating the recorder.  Every
+// 'step'-th pixel of every 'step'-th line is taken as Y (YUV), the BT.601 luma
+// of R, G, B, or the gray value, and compared against both the previous frame
+// and a running background (an exponential average in 8.8 fixed point, 2^-n
+// per frame).  A sample has changed when it differs from both by more than
+// 'threshold': the frame difference alone leaves a ghost where an object was,
+// the background alone lags a lighting change.  A tile is active when enough of
+// its samples changed, a frame has motion when enough tiles are.  When nearly
+// every tile changes at once (lights, an AE step) the background is relearnt
+// from the frame instead.  Consecutive motion frames open an event, a run of
+// quiet ones closes it.
+//
+// Gathering the samples is scalar; the differences, the background update and
+// the per-column counts run as vector code (GCC vector extensions: NEON on the
+// target, SSSE3 or AVX2 on the host), one tile row per thread_pool task.  The
+// scalar path gives the same counts.  One call at a time.
+
+class motion_detector {
+public:
+    enum layout {
+        gray8
+        , yuyv
+        , uyvy
+        , rgb24
+        , rgba32
+    };
+    enum transition {
+        none
+        , begin                     // the first frame of an event
+        , end                       // the first frame after it
+    };
+
+    struct options {
+        layout format = uyvy;
+        size_t step = 4;            // sample every n-th pixel and line
+        size_t grid_x = 16;
+        size_t grid_y = 12;
+        uint8_t threshold = 24;     // luma difference of a changed sample
+        double tile_fraction = 0.05;     // changed samples of an active tile
+        size_t min_tiles = 1;            // active tiles of a motion frame
+        double global_fraction = 0.75;   // active tiles beyond which the background is relearnt; 1 never
+        int learning_shift = 5;     // background follows the frame by 2^-n per frame
+        size_t trigger = 2;         // consecutive motion frames that open an event
+        size_t hold = 30;           // quiet frames that close it
+        simd::isa isa = simd::best();
+    };
+
+    struct result {
+        uint64_t seq;
+        int64_t timestamp_ns;
+        uint32_t grid_x, grid_y;
+        size_t tiles;               // active
+        bool motion;                // this frame
+        bool relearnt;
+        bool active;                // within an event, hold included
+        transition event;
+        std::vector< uint32_t > changed;     // samples per tile, grid_y rows of grid_x
+        std::vector< uint32_t > samples;
+
+        inline uint32_t at( size_t x, size_t y ) const { return changed[ y * grid_x + x ]; }
+    };
+
+    struct stats {
+        uint64_t frames;
+        uint64_t motion;            // frames with motion
+        uint64_t active;            // frames within events
+        uint64_t events;
+        uint64_t relearnt;
+    };
+
+    motion_detector( size_t width, size_t height, thread_pool&, const options& );
+    ~motion_detector();
+
+    inline const options& settings() const { return options_; }
+    static size_t bytes_per_pixel( layout );
+
+    // 'stride' in bytes; the first frame (and the first after reset()) seeds the
+    // model and never has motion; 'result' is reused without reallocating
+    bool operator()( const uint8_t * frame, size_t stride, uint64_t seq, int64_t timestamp_ns, result& );
+
+    void reset();
+    inline bool active() const { return active_; }
+    inline const stats& statistics() const { return stats_; }
+
+    static void report( std::ostream&, const result& );
+    void report( std::ostream& ) const;
+
+private:
+    struct scratch;
+    void band( size_t index, scratch&, const uint8_t * frame, size_t stride, uint32_t * changed );
+
+    size_t width_, height_;
+    size_t nx_, ny_;                // samples per line, sampled lines
+    size_t padded_;                 // row length of the model, a multiple of the vector step
+    std::vector< size_t > splits_x_, splits_y_;  // first sample of each tile column / row, and nx_ / ny_
+    std::vector< uint32_t > needed_;             // changed samples that make each tile active
+    std::vector< uint8_t > previous_;            // ny_ rows of padded_
+    std::vector< uint16_t > background_;         // 8.8
+    bool primed_;
+    bool active_;
+    size_t run_, quiet_;
+    stats stats_;
+    thread_pool& pool_;
+    options options_;
+    std::vector< std::unique_ptr< scratch > > scratch_; // per worker
+};
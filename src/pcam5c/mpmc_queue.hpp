@@ -0,0 +1,115 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+// Bounded multi-producer/multi-consumer ring (Vyukov); capacity is rounded up to a power of two.
+// Each cell carries a sequence number, so push() and pop() are lock-free from any thread.
+
+template< typename T >
+class mpmc_queue {
+    struct cell {
+        std::atomic< size_t > seq;
+        T data;
+    };
+    const size_t mask_;
+    std::unique_ptr< cell[] > cells_;
+    alignas(64) std::atomic< size_t > head_; // next position to pop
+    alignas(64) std::atomic< size_t > tail_; // next position to push
+
+    static size_t round_up( size_t n ) {
+        size_t size = 2;
+        while ( size < n )
+            size <<= 1;
+        return size;
+    }
+
+public:
+    mpmc_queue( size_t capacity ) : mask_( round_up( capacity ) - 1 )
+                                  , cells_( std::make_unique< cell[] >( mask_ + 1 ) )
+                                  , head_( 0 )
+                                  , tail_( 0 ) {
+        for ( size_t i = 0; i <= mask_; ++i )
+            cells_[ i ].seq.store( i, std::memory_order_relaxed );
+    }
+
+    mpmc_queue( const mpmc_queue& ) = delete;
+    mpmc_queue& operator = ( const mpmc_queue& ) = delete;
+
+    inline size_t capacity() const { return mask_ + 1; }
+
+    // approximate while other threads are pushing or popping
+    inline size_t size() const {
+        size_t tail = tail_.load( std::memory_order_acquire );
+        size_t head = head_.load( std::memory_order_acquire );
+        return tail > head ? tail - head : 0;
+    }
+
+    inline bool empty() const { return size() == 0; }
+
+    bool push( const T& t ) {
+        size_t pos = tail_.load( std::memory_order_relaxed );
+        for ( ;; ) {
+            cell& c = cells_[ pos & mask_ ];
+            intptr_t dif = intptr_t( c.seq.load( std::memory_order_acquire ) ) - intptr_t( pos );
+            if ( dif == 0 ) {
+                if ( tail_.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) ) {
+                    c.data = t;
+                    c.seq.store( pos + 1, std::memory_order_release );
+                    return true;
+                }
+            } else if ( dif < 0 ) {
+                return false; // full
+            } else {
+                pos = tail_.load( std::memory_order_relaxed );
+            }
+        }
+    }
+
+    std::optional< T > pop() {
+        size_t pos = head_.load( std::memory_order_relaxed );
+        for ( ;; ) {
+            cell& c = cells_[ pos & mask_ ];
+            intptr_t dif = intptr_t( c.seq.load( std::memory_order_acquire ) ) - intptr_t( pos + 1 );
+            if ( dif == 0 ) {
+                if ( head_.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) ) {
+                    T t = std::move( c.data );
+                    c.data = T();
+                    c.seq.store( pos + mask_ + 1, std::memory_order_release );
+                    return t;
+                }
+            } else if ( dif < 0 ) {
+                return {}; // empty
+            } else {
+                pos = head_.load( std::memory_order_relaxed );
+            }
+        }
+    }
+};
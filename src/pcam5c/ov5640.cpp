@@ -849,6 +849,21 @@ namespace {
         {0x4005, 0x1a, 0, 0},
     };
 
+    // hardware JPEG on top of a YUV mode; entries with a mask only change those bits.
+    // Mode 1 emits fixed frames of VFIFO X x Y bytes (1920 x 256 here, padded after
+    // EOI), so the VDMA keeps a constant geometry: --vdma-format 1920 256 1
+    const std::vector< reg_value > __ov5640_setting_jpeg = {
+        {0x4300, 0x30, 0, 0},          // FORMAT CONTROL 00: YUYV into the compressor
+        {0x501f, 0x00, 0, 0},          // FORMAT MUX CONTROL: ISP YUV
+        {0x3821, 0x20, 0x20, 0},       // TIMING TC REG21: [5] JPEG enable
+        {0x3002, 0x00, 0x1c, 0},       // SYSTEM RESET02: JFIFO, SFIFO, JPG out of reset
+        {0x3006, 0x28, 0x28, 0},       // CLOCK ENABLE02: JPEG2x, PEG clocks on
+        {0x4713, 0x01, 0, 0},          // JPG MODE SELECT: mode 1
+        {0x4602, ( 1920 >> 8 ) & 0x0f, 0, 0}, {0x4603, 1920 & 0xff, 0, 0}, // VFIFO X SIZE
+        {0x4604, ( 256 >> 8 ) & 0x0f, 0, 0},  {0x4605, 256 & 0xff, 0, 0},  // VFIFO Y SIZE
+        {0x4407, 0x04, 0, 0},          // JPEG CTRL07: [5:0] quantization scale
+    };
+
 }
 
 const std::vector< std::pair< const uint16_t, object > >&
@@ -880,3 +895,9 @@ ov5640::init_setting_30fps_VGA()
 {
     return __ov5640_init_setting_30fps_VGA;
 }
+
+const std::vector< reg_value >&
+ov5640::setting_jpeg()
+{
+    return __ov5640_setting_jpeg;
+}
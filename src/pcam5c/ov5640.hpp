@@ -33,6 +33,14 @@
 namespace i2c_linux { class i2c; }
 constexpr static std::pair< uint8_t, uint8_t > ov5640_chipid_t = { 0x56, 0x40 };
 
+// SYSTEM CTRL0, shared by the register scripts and the power sequencer
+enum OV5640_SYS_CTRL0 {
+    OV5640_REG_SYS_CTRL0                =	0x3008
+    , OV5640_REG_SYS_CTRL0_SOFT_RESET   =	0x80 // b7; clears itself when the reset is done
+    , OV5640_REG_SYS_CTRL0_SW_PWDN      =	0x42
+    , OV5640_REG_SYS_CTRL0_SW_PWUP      =	0x02
+};
+
 struct reg_value {
 	uint16_t reg_addr;
 	uint8_t val;
@@ -49,6 +57,7 @@ public:
 
     static const std::vector< reg_value >& setting_1080P_1920_1080();
     static const std::vector< reg_value >& init_setting_30fps_VGA();
+    static const std::vector< reg_value >& setting_jpeg();
 
     std::optional< std::pair<uint8_t, uint8_t> > chipid( i2c_linux::i2c& ) const;
     bool reset( i2c_linux::i2c& ) const;
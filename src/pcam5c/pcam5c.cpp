@@ -25,6 +25,7 @@
 #include "i2c.hpp"
 #include "pcam5c.hpp"
 #include "ov5640.hpp"
+#include "power_sequencer.hpp"
 #include <boost/format.hpp>
 #include <algorithm>
 #include <array>
@@ -42,9 +43,6 @@ namespace {
     enum OV5640_REG {
         OV5640_REG_SYS_RESET02          =	0x3002
         , OV5640_REG_SYS_CLOCK_ENABLE02	=	0x3006
-        , OV5640_REG_SYS_CTRL0          =	0x3008
-        , OV5640_REG_SYS_CTRL0_SW_PWDN	=	0x42
-        , OV5640_REG_SYS_CTRL0_SW_PWUP	=	0x02
         , OV5640_REG_CHIP_ID            =	0x300a
         , OV5640_REG_IO_MIPI_CTRL00     =	0x300e
         , OV5640_REG_PAD_OUTPUT_ENABLE01=	0x3017
@@ -210,43 +208,50 @@ pcam5c::write_reg( i2c_linux::i2c& iic, const std::pair<uint16_t, uint8_t>& r, b
 }
 
 bool
-pcam5c::startup( i2c_linux::i2c& iic )
+pcam5c::startup( i2c_linux::i2c& iic, bool jpeg )
 {
-    using namespace std::chrono_literals;
+    power_sequencer power;
+    if ( ! power.power_up( iic ) ) {
+        power.report( std::cerr );
+        std::cerr << "power-up sequence failed" << std::endl;
+        return false;
+    }
+    if ( __verbose )
+        power.report( std::cout );
 
-    if ( auto chipid = ov5640().chipid( iic ) ) {
-        std::cout << "chipid: "
-                  << std::hex << unsigned(chipid->first)
-                  << ", " << unsigned(chipid->second)
-                  << "\t" << std::boolalpha << bool( *chipid == ov5640_chipid_t ) << std::endl;
-        if ( *chipid != ov5640_chipid_t ) {
-            std::cerr << "chipid does not match." << std::endl;
-            return false;
+    // for ( const auto& r: ov5640::cfg_init() )
+    //     write_reg( iic, r, __verbose );
+    for ( const auto& reg: ov5640::init_setting_30fps_VGA() ) {
+        write_reg( iic, { reg.reg_addr, reg.val }, __verbose );
+        if ( reg.reg_addr == OV5640_REG_SYS_CTRL0 && ( reg.val & OV5640_REG_SYS_CTRL0_SOFT_RESET ) ) { // software reset, wait until it clears
+            if ( ! power_sequencer::wait_soft_reset( iic ) )
+                std::cerr << "software reset did not clear" << std::endl;
         }
     }
-    if ( gpio_reset() ) {
-        write_reg( iic, {0x3103, 0x11}, __verbose ); // ??? something wrong
-        write_reg( iic, {0x3008, 0x82}, __verbose ); // software reset (b7 = 1)
 
-        std::this_thread::sleep_for(5ms);
+    // for ( const auto& r: ov5640::cfg_1080p_30fps() )
+    for ( const auto& reg: ov5640::setting_1080P_1920_1080() ) {
+        write_reg( iic, { reg.reg_addr, reg.val }, __verbose );
+    }
 
-        // for ( const auto& r: ov5640::cfg_init() )
-        //     write_reg( iic, r, __verbose );
-        for ( const auto& reg: ov5640::init_setting_30fps_VGA() ) {
-            write_reg( iic, { reg.reg_addr, reg.val }, __verbose );
+    if ( jpeg ) {
+        for ( const auto& reg: ov5640::setting_jpeg() ) {
+            uint8_t value = reg.val;
+            if ( reg.mask ) {
+                auto current = iic.read_reg( reg.reg_addr );
+                if ( ! current ) {
+                    std::cerr << boost::format( "jpeg: could not read 0x%04x" ) % reg.reg_addr << std::endl;
+                    return false;
+                }
+                value = uint8_t( ( *current & ~reg.mask ) | ( reg.val & reg.mask ) );
+            }
+            write_reg( iic, { reg.reg_addr, value }, __verbose );
         }
+    }
 
-        // for ( const auto& r: ov5640::cfg_1080p_30fps() )
-        for ( const auto& reg: ov5640::setting_1080P_1920_1080() ) {
-            write_reg( iic, { reg.reg_addr, reg.val }, __verbose );
-        }
+    iic.write_reg( OV5640_REG_IO_MIPI_CTRL00, 0x45 ); // on (0x40 for off)
+    iic.write_reg( OV5640_REG_FRAME_CTRL01,   0x00 ); // on (0x0f for off)
 
-        iic.write_reg( OV5640_REG_IO_MIPI_CTRL00, 0x45 ); // on (0x40 for off)
-        iic.write_reg( OV5640_REG_FRAME_CTRL01,   0x00 ); // on (0x0f for off)
-    } else {
-        std::cerr << "gpio reset failed" << std::endl;
-        return false;
-    }
     return true;
 }
 
@@ -273,16 +278,10 @@ pcam5c::gpio_value( bool value ) const
 bool
 pcam5c::gpio_reset( std::chrono::milliseconds twait ) const
 {
-    if ( gpio_value( false ) ) {
-        std::this_thread::sleep_for( twait );
-
-        gpio_value( true );
-        if ( gpio_state() )
-            std::this_thread::sleep_for( twait );
-
-        return true;
-    }
-    return false;
+    power_timings t;
+    t.power_down = twait;
+    t.power_up = twait;
+    return power_sequencer().power_cycle( t );
 }
 
 std::optional< uint32_t >
@@ -40,7 +40,7 @@ class pcam5c {
     void  pprint( std::ostream&,  uint16_t reg, uint8_t value ) const;
 public:
     bool read_all( i2c_linux::i2c& );
-    bool startup( i2c_linux::i2c& );
+    bool startup( i2c_linux::i2c&, bool jpeg = false ); // jpeg: ov5640::setting_jpeg() on top of 1080p
     void read_regs( i2c_linux::i2c&, const std::vector< std::string >& );
     //bool write_reg( i2c_linux::i2c&, uint16_t reg, uint8_t val, bool verbose = true ) const;
     bool write_reg( i2c_linux::i2c&, const std::pair<uint16_t,uint8_t>&, bool verbose = true ) const;
@@ -0,0 +1,201 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "power_sequencer.hpp"
+#include "i2c.hpp"
+#include "ov5640.hpp"
+#include <ov5640-gpio/ov5640-gpio.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+#include <boost/format.hpp>
+
+namespace {
+
+    inline timespec now() {
+        timespec ts;
+        clock_gettime( CLOCK_MONOTONIC, &ts );
+        return ts;
+    }
+
+    inline timespec operator + ( timespec ts, std::chrono::nanoseconds d ) {
+        auto ns = ts.tv_nsec + d.count();
+        ts.tv_sec += ns / 1000000000;
+        ts.tv_nsec = ns % 1000000000;
+        return ts;
+    }
+
+    inline std::chrono::nanoseconds operator - ( const timespec& a, const timespec& b ) {
+        return std::chrono::nanoseconds( ( int64_t( a.tv_sec ) - b.tv_sec ) * 1000000000 + ( a.tv_nsec - b.tv_nsec ) );
+    }
+
+    inline void sleep_until( const timespec& ts ) {
+        while ( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr ) == EINTR )
+            ;
+    }
+
+    // poll 'ready' every 'interval' until it returns true or 'timeout' elapses
+    template< typename F >
+    std::optional< size_t > poll_until( F ready, std::chrono::nanoseconds timeout, std::chrono::nanoseconds interval ) {
+        const auto start = now();
+        const auto deadline = start + timeout;
+        auto next = start;
+        for ( size_t polls = 1; ; ++polls ) {
+            if ( ready() )
+                return polls;
+            if ( ( deadline - now() ).count() <= 0 )
+                return {};
+            next = next + interval;
+            sleep_until( next );
+        }
+    }
+}
+
+power_sequencer::~power_sequencer()
+{
+    if ( fd_ >= 0 )
+        ::close( fd_ );
+}
+
+power_sequencer::power_sequencer( const std::string& device ) : fd_( ::open( device.c_str(), O_RDWR | O_CLOEXEC ) )
+                                                              , device_( device )
+{
+    if ( fd_ < 0 )
+        ::perror( ( "power_sequencer: " + device ).c_str() );
+}
+
+bool
+power_sequencer::set( bool value ) const
+{
+    const uint8_t d8 = value;
+    return fd_ >= 0 && ::pwrite( fd_, &d8, 1, 0 ) == 1;
+}
+
+std::optional< bool >
+power_sequencer::state() const
+{
+    uint8_t d8;
+    if ( fd_ >= 0 && ::pread( fd_, &d8, 1, 0 ) == 1 )
+        return d8 != 0;
+    return {};
+}
+
+std::optional< std::chrono::nanoseconds >
+power_sequencer::pulse( std::chrono::microseconds low
+                        , std::chrono::microseconds high
+                        , std::chrono::microseconds settle_timeout ) const
+{
+    struct ov5640_gpio_pulse arg = { uint32_t( low.count() ), uint32_t( high.count() ), uint32_t( settle_timeout.count() ), 0, 0 };
+    // older drivers accept any ioctl and return 0 without doing anything; elapsed_ns stays 0 then
+    if ( fd_ >= 0 && ::ioctl( fd_, OV5640_GPIO_IOC_PULSE, &arg ) == 0 && arg.elapsed_ns > 0 )
+        return std::chrono::nanoseconds( arg.elapsed_ns );
+    return {};
+}
+
+bool
+power_sequencer::power_cycle( const timings& t )
+{
+    phases_.clear();
+
+    if ( auto elapsed = pulse( t.power_down, t.power_up ) ) {
+        phases_.emplace_back( phase{ "pulse(kernel)", *elapsed, 0 } );
+        return state().value_or( false );
+    }
+
+    auto t0 = now();
+    if ( ! set( false ) )
+        return false;
+    sleep_until( t0 + t.power_down );
+
+    auto t1 = now();
+    phases_.emplace_back( phase{ "power-down", t1 - t0, 0 } );
+
+    if ( ! set( true ) )
+        return false;
+    sleep_until( t1 + t.power_up );
+
+    auto t2 = now();
+    phases_.emplace_back( phase{ "power-up", t2 - t1, 0 } );
+
+    return state().value_or( false );
+}
+
+bool
+power_sequencer::power_up( i2c_linux::i2c& iic, const timings& t )
+{
+    if ( ! power_cycle( t ) ) {
+        std::cerr << "power_sequencer: " << device_ << " did not come up" << std::endl;
+        return false;
+    }
+
+    const bool quiet = iic.quiet( true ); // NAKs are expected until the sensor is ready
+
+    auto t0 = now();
+    auto polls = poll_until( [&]{ return ov5640().chipid( iic ) == ov5640_chipid_t; }, t.chipid_timeout, t.poll_interval );
+    auto t1 = now();
+    phases_.emplace_back( phase{ "chip-id", t1 - t0, polls.value_or( 0 ) } );
+
+    if ( polls ) {
+        iic.write_reg( 0x3103, 0x11 ); // system clock from pad
+        iic.write_reg( OV5640_REG_SYS_CTRL0, OV5640_REG_SYS_CTRL0_SOFT_RESET | OV5640_REG_SYS_CTRL0_SW_PWUP );
+        polls = wait_soft_reset( iic, t );
+        phases_.emplace_back( phase{ "soft-reset", now() - t1, polls.value_or( 0 ) } );
+    }
+
+    iic.quiet( quiet );
+
+    if ( ! polls )
+        std::cerr << "power_sequencer: " << phases_.back().name << " timed out" << std::endl;
+    return bool( polls );
+}
+
+// static
+std::optional< size_t >
+power_sequencer::wait_soft_reset( i2c_linux::i2c& iic, const timings& t )
+{
+    const bool quiet = iic.quiet( true );
+    auto polls = poll_until( [&]{
+            auto value = iic.read_reg( OV5640_REG_SYS_CTRL0 );
+            return value && ( *value & OV5640_REG_SYS_CTRL0_SOFT_RESET ) == 0; }, t.reset_timeout, t.poll_interval );
+    iic.quiet( quiet );
+    return polls;
+}
+
+void
+power_sequencer::report( std::ostream& o ) const
+{
+    std::chrono::nanoseconds total( 0 );
+    for ( const auto& p: phases_ ) {
+        o << boost::format( "%-12s\t%10.3f ms" ) % p.name % ( p.duration.count() / 1.0e6 );
+        if ( p.polls )
+            o << "\tpolls=" << p.polls;
+        o << std::endl;
+        total += p.duration;
+    }
+    o << boost::format( "%-12s\t%10.3f ms" ) % "total" % ( total.count() / 1.0e6 ) << std::endl;
+}
@@ -0,0 +1,88 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace i2c_linux { class i2c; }
+
+// OV5640 power-up through /dev/ov5640-gpio0 with a single persistent fd.
+// Fixed datasheet minimums are slept with clock_nanosleep(TIMER_ABSTIME);
+// readiness (chip-id readback, 0x3008[7] soft-reset clear) is polled with a
+// bounded loop instead of fixed margins.
+
+struct power_timings {
+    std::chrono::microseconds power_down      = std::chrono::microseconds( 1000 );  // line held low
+    std::chrono::microseconds power_up        = std::chrono::microseconds( 1000 );  // minimum before first SCCB access
+    std::chrono::microseconds chipid_timeout  = std::chrono::microseconds( 50000 );
+    std::chrono::microseconds reset_timeout   = std::chrono::microseconds( 20000 );
+    std::chrono::microseconds poll_interval   = std::chrono::microseconds( 100 );
+};
+
+class power_sequencer {
+public:
+    typedef power_timings timings;
+
+    struct phase {
+        std::string name;
+        std::chrono::nanoseconds duration;
+        size_t polls;
+    };
+
+    ~power_sequencer();
+    power_sequencer( const std::string& device = "/dev/ov5640-gpio0" );
+
+    power_sequencer( const power_sequencer& ) = delete;
+    power_sequencer& operator = ( const power_sequencer& ) = delete;
+
+    inline explicit operator bool () const { return fd_ >= 0; }
+
+    bool set( bool ) const;
+    std::optional< bool > state() const;
+
+    // OV5640_GPIO_IOC_PULSE: the whole low/high pulse is timed in the driver; returns its length
+    std::optional< std::chrono::nanoseconds > pulse( std::chrono::microseconds low
+                                                     , std::chrono::microseconds high
+                                                     , std::chrono::microseconds settle_timeout = std::chrono::microseconds( 1000 ) ) const;
+
+    bool power_cycle( const timings& = timings() );                // gpio only
+    bool power_up( i2c_linux::i2c&, const timings& = timings() );  // gpio, chip-id, soft reset
+
+    // after writing 0x3008[7]=1; returns number of polls until the bit reads back clear
+    static std::optional< size_t > wait_soft_reset( i2c_linux::i2c&, const timings& = timings() );
+
+    inline const std::vector< phase >& phases() const { return phases_; }
+    void report( std::ostream& ) const;
+
+private:
+    int fd_;
+    std::string device_;
+    std::vector< phase > phases_;
+};
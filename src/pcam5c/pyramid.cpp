@@ -0,0 +1,473 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pyramid.hpp"
+#include "simd_vec.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+    constexpr size_t max_lanes = 16;   // 16-bit lanes of the widest register (AVX2)
+
+    // M 16-bit lanes per register; byte stages handle 2M pixels at a time so that
+    // one register of bytes is filled
+    template< size_t M > struct vec {
+        typedef uint16_t u16 __attribute__(( vector_size( M * 2 ) ));
+        typedef uint16_t w16 __attribute__(( vector_size( M * 4 ) ));
+        typedef uint8_t u8 __attribute__(( vector_size( M * 2 ) ));
+    };
+
+    using simd::load;
+    using simd::store;
+    using simd::make_mask;
+    using simd::even_lanes;
+    using simd::odd_lanes;
+
+    // the middle half of every P lanes: {1,2} of 4, {2,3,4,5} of 8
+    template< size_t P > struct middle_lanes {
+        static constexpr size_t at( size_t i ) { return i / ( P / 2 ) * P + P / 4 + i % ( P / 2 ); }
+    };
+    // a0 b0 a1 b1 ...
+    template< size_t N > struct zip_lanes {
+        static constexpr size_t at( size_t i ) { return i % 2 ? N + i / 2 : i / 2; }
+    };
+
+    // RGB24 channel K out of three registers: from (v0|v1) then (..|v2)
+    template< size_t N, size_t K > struct rgb24_lo {
+        static constexpr size_t at( size_t j ) { return 3 * j + K < 2 * N ? 3 * j + K : j; }
+    };
+    template< size_t N, size_t K > struct rgb24_hi {
+        static constexpr size_t at( size_t j ) { return 3 * j + K < 2 * N ? j : 3 * j + K - N; }
+    };
+    // and back: output register K of three, from r|g then (rg)|b
+    template< size_t N, size_t K > struct rgb24_rg {
+        static constexpr size_t at( size_t j ) { return ( K * N + j ) % 3 == 1 ? N + ( K * N + j ) / 3 : ( K * N + j ) / 3; }
+    };
+    template< size_t N, size_t K > struct rgb24_b {
+        static constexpr size_t at( size_t j ) { return ( K * N + j ) % 3 == 2 ? N + ( K * N + j ) / 3 : j; }
+    };
+    // RGBA32: output register K of four, from r|g and b|a
+    template< size_t N, size_t K > struct rgba_lo {
+        static constexpr size_t at( size_t j ) { return ( K * N + j ) / 4 + ( ( K * N + j ) % 2 ? N : 0 ); }
+    };
+    template< size_t N > struct rgba_sel {
+        static constexpr size_t at( size_t j ) { return j % 4 < 2 ? j : N + j; }
+    };
+
+    inline size_t channels( pyramid::layout f ) { return f == pyramid::gray8 ? 1 : f == pyramid::rgba32 ? 4 : 3; }
+    inline bool chroma( pyramid::layout f, size_t k ) { return k && ( f == pyramid::yuyv || f == pyramid::uyvy ); }
+
+    // one source line ('n' pixels) to its planes
+    template< size_t M >
+    __attribute__(( always_inline )) inline void
+    decode( const uint8_t * src, size_t n, pyramid::layout format, uint16_t * const * p )
+    {
+        typedef typename vec< M >::u16 u16;
+        typedef typename vec< M >::w16 w16;
+        typedef typename vec< M >::u8 u8;
+        constexpr u16 even = make_mask< u16, even_lanes >();
+        constexpr u16 odd = make_mask< u16, odd_lanes >();
+        switch ( format ) {
+        case pyramid::gray8:
+            for ( size_t i = 0; i < n; i += 2 * M )
+                store( p[ 0 ] + i, __builtin_convertvector( load< u8 >( src + i ), w16 ) );
+            break;
+        case pyramid::yuyv:
+        case pyramid::uyvy: {
+            const int ys = format == pyramid::uyvy ? 8 : 0, cs = 8 - ys;
+            for ( size_t i = 0; i < n; i += 2 * M ) {
+                const u16 a = load< u16 >( src + 2 * i ), b = load< u16 >( src + 2 * i + 2 * M );
+                store( p[ 0 ] + i, ( a >> ys ) & 0xff );
+                store( p[ 0 ] + i + M, ( b >> ys ) & 0xff );
+                const u16 ca = ( a >> cs ) & 0xff, cb = ( b >> cs ) & 0xff;
+                store( p[ 1 ] + i / 2, __builtin_shuffle( ca, cb, even ) );
+                store( p[ 2 ] + i / 2, __builtin_shuffle( ca, cb, odd ) );
+            }
+        }
+            break;
+        case pyramid::rgb24: {
+            constexpr u8 lo0 = make_mask< u8, rgb24_lo< 2 * M, 0 > >(), hi0 = make_mask< u8, rgb24_hi< 2 * M, 0 > >();
+            constexpr u8 lo1 = make_mask< u8, rgb24_lo< 2 * M, 1 > >(), hi1 = make_mask< u8, rgb24_hi< 2 * M, 1 > >();
+            constexpr u8 lo2 = make_mask< u8, rgb24_lo< 2 * M, 2 > >(), hi2 = make_mask< u8, rgb24_hi< 2 * M, 2 > >();
+            for ( size_t i = 0; i < n; i += 2 * M ) {
+                const u8 v0 = load< u8 >( src + 3 * i ), v1 = load< u8 >( src + 3 * i + 2 * M ), v2 = load< u8 >( src + 3 * i + 4 * M );
+                store( p[ 0 ] + i, __builtin_convertvector( __builtin_shuffle( __builtin_shuffle( v0, v1, lo0 ), v2, hi0 ), w16 ) );
+                store( p[ 1 ] + i, __builtin_convertvector( __builtin_shuffle( __builtin_shuffle( v0, v1, lo1 ), v2, hi1 ), w16 ) );
+                store( p[ 2 ] + i, __builtin_convertvector( __builtin_shuffle( __builtin_shuffle( v0, v1, lo2 ), v2, hi2 ), w16 ) );
+            }
+        }
+            break;
+        case pyramid::rgba32:
+            for ( size_t i = 0; i < n; i += M ) {
+                const u16 a = load< u16 >( src + 4 * i ), b = load< u16 >( src + 4 * i + 2 * M );
+                const u16 rg = __builtin_shuffle( a, b, even ), ba = __builtin_shuffle( a, b, odd );
+                store( p[ 0 ] + i, rg & 0xff );
+                store( p[ 1 ] + i, rg >> 8 );
+                store( p[ 2 ] + i, ba & 0xff );
+                store( p[ 3 ] + i, ba >> 8 );
+            }
+            break;
+        }
+    }
+
+    // p = a + b; then the P-lane centre pick for bilinear (P = 4, 8), the pairwise
+    // fold and the rounded / 4: 'n' input samples to n / 2, n / 4 or n / 8
+    template< size_t M >
+    __attribute__(( always_inline )) inline void
+    reduce( uint16_t * p, const uint16_t * a, const uint16_t * b, size_t n, size_t P )
+    {
+        typedef typename vec< M >::u16 u16;
+        constexpr u16 even = make_mask< u16, even_lanes >();
+        constexpr u16 odd = make_mask< u16, odd_lanes >();
+        constexpr u16 mid4 = make_mask< u16, middle_lanes< 4 > >();
+        constexpr u16 mid8 = make_mask< u16, middle_lanes< 8 > >();
+        for ( size_t i = 0; i < n; i += M )
+            store( p + i, load< u16 >( a + i ) + load< u16 >( b + i ) );
+        if ( P == 8 ) {
+            for ( size_t j = 0; j < n / 2; j += M )
+                store( p + j, __builtin_shuffle( load< u16 >( p + 2 * j ), load< u16 >( p + 2 * j + M ), mid8 ) );
+            n /= 2;
+        }
+        if ( P >= 4 ) {
+            for ( size_t j = 0; j < n / 2; j += M )
+                store( p + j, __builtin_shuffle( load< u16 >( p + 2 * j ), load< u16 >( p + 2 * j + M ), mid4 ) );
+            n /= 2;
+        }
+        for ( size_t j = 0; j < n / 2; j += M ) {
+            const u16 x = load< u16 >( p + 2 * j ), y = load< u16 >( p + 2 * j + M );
+            store( p + j, ( __builtin_shuffle( x, y, even ) + __builtin_shuffle( x, y, odd ) + 2 ) >> 2 );
+        }
+    }
+
+    template< size_t M, size_t K >
+    __attribute__(( always_inline )) inline void
+    put_rgb24( uint8_t * d, typename vec< M >::u8 r, typename vec< M >::u8 g, typename vec< M >::u8 b )
+    {
+        typedef typename vec< M >::u8 u8;
+        constexpr u8 rg = make_mask< u8, rgb24_rg< 2 * M, K > >();
+        constexpr u8 sel = make_mask< u8, rgb24_b< 2 * M, K > >();
+        store( d + K * 2 * M, __builtin_shuffle( __builtin_shuffle( r, g, rg ), b, sel ) );
+    }
+
+    template< size_t M, size_t K >
+    __attribute__(( always_inline )) inline void
+    put_rgba32( uint8_t * d, typename vec< M >::u8 r, typename vec< M >::u8 g, typename vec< M >::u8 b, typename vec< M >::u8 a )
+    {
+        typedef typename vec< M >::u8 u8;
+        constexpr u8 lo = make_mask< u8, rgba_lo< 2 * M, K > >();
+        constexpr u8 sel = make_mask< u8, rgba_sel< 2 * M > >();
+        store( d + K * 2 * M, __builtin_shuffle( __builtin_shuffle( r, g, lo ), __builtin_shuffle( b, a, lo ), sel ) );
+    }
+
+    // planes of one output line ('w' pixels) back to the layout
+    template< size_t M >
+    __attribute__(( always_inline )) inline void
+    emit( const uint16_t * const * p, size_t w, pyramid::layout format, uint8_t * d )
+    {
+        typedef typename vec< M >::u16 u16;
+        typedef typename vec< M >::w16 w16;
+        typedef typename vec< M >::u8 u8;
+        constexpr u16 zip = make_mask< u16, zip_lanes< M > >();
+        switch ( format ) {
+        case pyramid::gray8:
+            for ( size_t i = 0; i < w; i += 2 * M )
+                store( d + i, __builtin_convertvector( load< w16 >( p[ 0 ] + i ), u8 ) );
+            break;
+        case pyramid::yuyv:
+        case pyramid::uyvy:
+            for ( size_t i = 0; i < w; i += M ) {
+                const u16 y = load< u16 >( p[ 0 ] + i );
+                const u16 c = __builtin_shuffle( load< u16 >( p[ 1 ] + i / 2 ), load< u16 >( p[ 2 ] + i / 2 ), zip );
+                store( d + 2 * i, format == pyramid::uyvy ? u16( c | ( y << 8 ) ) : u16( y | ( c << 8 ) ) );
+            }
+            break;
+        case pyramid::rgb24:
+            for ( size_t i = 0; i < w; i += 2 * M ) {
+                const u8 r = __builtin_convertvector( load< w16 >( p[ 0 ] + i ), u8 );
+                const u8 g = __builtin_convertvector( load< w16 >( p[ 1 ] + i ), u8 );
+                const u8 b = __builtin_convertvector( load< w16 >( p[ 2 ] + i ), u8 );
+                put_rgb24< M, 0 >( d + 3 * i, r, g, b );
+                put_rgb24< M, 1 >( d + 3 * i, r, g, b );
+                put_rgb24< M, 2 >( d + 3 * i, r, g, b );
+            }
+            break;
+        case pyramid::rgba32:
+            for ( size_t i = 0; i < w; i += 2 * M ) {
+                const u8 r = __builtin_convertvector( load< w16 >( p[ 0 ] + i ), u8 );
+                const u8 g = __builtin_convertvector( load< w16 >( p[ 1 ] + i ), u8 );
+                const u8 b = __builtin_convertvector( load< w16 >( p[ 2 ] + i ), u8 );
+                const u8 a = __builtin_convertvector( load< w16 >( p[ 3 ] + i ), u8 );
+                put_rgba32< M, 0 >( d + 4 * i, r, g, b, a );
+                put_rgba32< M, 1 >( d + 4 * i, r, g, b, a );
+                put_rgba32< M, 2 >( d + 4 * i, r, g, b, a );
+                put_rgba32< M, 3 >( d + 4 * i, r, g, b, a );
+            }
+            break;
+        }
+    }
+
+    // eight source lines and where their 4 + 2 + 1 output lines go
+    struct group_args {
+        const uint8_t * rows[ 8 ];
+        size_t width;                                   // source pixels
+        pyramid::layout format;
+        pyramid::filter method;
+        size_t levels;
+        uint16_t * planes;                              // 15 sets of channels() planes: 8 source, 4 + 2 + 1 output lines
+        size_t plane;                                   // plane length
+        uint8_t * out[ pyramid::max_levels + 1 ];       // first output line per level, [ 1 .. levels ]
+        size_t stride[ pyramid::max_levels + 1 ];
+        uint8_t * spill;                                // padded line for levels whose width is not a vector multiple
+    };
+
+    template< size_t M >
+    __attribute__(( always_inline )) inline void
+    output( const group_args& g, size_t set, size_t level, size_t row )
+    {
+        const size_t c = channels( g.format );
+        const uint16_t * p[ 4 ];
+        for ( size_t k = 0; k < c; ++k )
+            p[ k ] = g.planes + ( set * c + k ) * g.plane;
+        const size_t w = g.width >> level;
+        uint8_t * d = g.out[ level ] + row * g.stride[ level ];
+        if ( w % ( 2 * max_lanes ) ) {
+            emit< M >( p, w, g.format, g.spill );
+            std::memcpy( d, g.spill, g.stride[ level ] );
+        } else {
+            emit< M >( p, w, g.format, d );
+        }
+    }
+
+    // output set 'to' from source or output sets 'a', 'b' of 'n' pixels
+    template< size_t M >
+    __attribute__(( always_inline )) inline void
+    level( const group_args& g, size_t to, size_t a, size_t b, size_t n, size_t P )
+    {
+        const size_t c = channels( g.format );
+        for ( size_t k = 0; k < c; ++k ) {
+            const size_t m = chroma( g.format, k ) ? n / 2 : n;
+            reduce< M >( g.planes + ( to * c + k ) * g.plane, g.planes + ( a * c + k ) * g.plane, g.planes + ( b * c + k ) * g.plane, m, P );
+        }
+    }
+
+    template< size_t M >
+    __attribute__(( always_inline )) inline void
+    group( const group_args& g )
+    {
+        const size_t c = channels( g.format );
+        const size_t n = g.width;
+        for ( size_t r = 0; r < 8; ++r ) {
+            uint16_t * p[ 4 ];
+            for ( size_t k = 0; k < c; ++k )
+                p[ k ] = g.planes + ( r * c + k ) * g.plane;
+            decode< M >( g.rows[ r ], n, g.format, p );
+        }
+        for ( size_t r = 0; r < 4; ++r ) {
+            level< M >( g, 8 + r, 2 * r, 2 * r + 1, n, 2 );
+            output< M >( g, 8 + r, 1, r );
+        }
+        if ( g.levels < 2 )
+            return;
+        for ( size_t r = 0; r < 2; ++r ) {
+            if ( g.method == pyramid::box )
+                level< M >( g, 12 + r, 8 + 2 * r, 9 + 2 * r, n / 2, 2 );
+            else
+                level< M >( g, 12 + r, 4 * r + 1, 4 * r + 2, n, 4 );
+            output< M >( g, 12 + r, 2, r );
+        }
+        if ( g.levels < 3 )
+            return;
+        if ( g.method == pyramid::box )
+            level< M >( g, 14, 12, 13, n / 4, 2 );
+        else
+            level< M >( g, 14, 3, 4, n, 8 );
+        output< M >( g, 14, 3, 0 );
+    }
+
+    typedef void ( *group_function )( const group_args& );
+
+    struct group_kernel {
+        template< size_t M > __attribute__(( always_inline )) static void run( const group_args& g ) { group< M >( g ); }
+    };
+
+    // byte offset of sample 'i' of plane 'k' within a line
+    inline size_t
+    sample( pyramid::layout format, size_t k, size_t i )
+    {
+        switch ( format ) {
+        case pyramid::gray8:  return i;
+        case pyramid::yuyv:   return k == 0 ? 2 * i : 4 * i + 2 * k - 1;
+        case pyramid::uyvy:   return k == 0 ? 2 * i + 1 : 4 * i + 2 * k - 2;
+        case pyramid::rgb24:  return 3 * i + k;
+        case pyramid::rgba32: return 4 * i + k;
+        }
+        return 0;
+    }
+
+    // reference: one output line of 'w' pixels, the rounded mean of samples
+    // s x - 1 + s / 2 and s x + s / 2 of lines 'a' and 'b'
+    void
+    line_scalar( const uint8_t * a, const uint8_t * b, size_t s, size_t w, pyramid::layout format, uint8_t * d )
+    {
+        for ( size_t k = 0; k < channels( format ); ++k ) {
+            const size_t m = chroma( format, k ) ? w / 2 : w;
+            for ( size_t x = 0; x < m; ++x ) {
+                const size_t i0 = sample( format, k, s * x + s / 2 - 1 ), i1 = sample( format, k, s * x + s / 2 );
+                d[ sample( format, k, x ) ] = uint8_t( ( a[ i0 ] + a[ i1 ] + b[ i0 ] + b[ i1 ] + 2 ) >> 2 );
+            }
+        }
+    }
+
+    void
+    group_scalar( const group_args& g )
+    {
+        const size_t n = g.width;
+        for ( size_t r = 0; r < 4; ++r )
+            line_scalar( g.rows[ 2 * r ], g.rows[ 2 * r + 1 ], 2, n / 2, g.format, g.out[ 1 ] + r * g.stride[ 1 ] );
+        if ( g.levels < 2 )
+            return;
+        for ( size_t r = 0; r < 2; ++r ) {
+            uint8_t * d = g.out[ 2 ] + r * g.stride[ 2 ];
+            if ( g.method == pyramid::box )
+                line_scalar( g.out[ 1 ] + 2 * r * g.stride[ 1 ], g.out[ 1 ] + ( 2 * r + 1 ) * g.stride[ 1 ], 2, n / 4, g.format, d );
+            else
+                line_scalar( g.rows[ 4 * r + 1 ], g.rows[ 4 * r + 2 ], 4, n / 4, g.format, d );
+        }
+        if ( g.levels < 3 )
+            return;
+        if ( g.method == pyramid::box )
+            line_scalar( g.out[ 2 ], g.out[ 2 ] + g.stride[ 2 ], 2, n / 8, g.format, g.out[ 3 ] );
+        else
+            line_scalar( g.rows[ 3 ], g.rows[ 4 ], 8, n / 8, g.format, g.out[ 3 ] );
+    }
+}
+
+struct pyramid::scratch {
+    std::vector< uint8_t > lines;       // padded copies of the source lines, when the width needs them
+    std::vector< uint16_t > planes;     // 15 line sets
+    std::vector< uint8_t > out;         // padded output line
+};
+
+size_t
+pyramid::bytes_per_pixel( layout format )
+{
+    return format == gray8 ? 1 : format == rgb24 ? 3 : format == rgba32 ? 4 : 2;
+}
+
+pyramid::pyramid( size_t width
+                  , size_t height
+                  , thread_pool& pool
+                  , const options& opts ) : width_( width )
+                                          , height_( height )
+                                          , pool_( pool )
+                                          , options_( opts )
+{
+    options_.levels = std::min( max_levels, std::max( size_t( 1 ), options_.levels ) );
+    options_.band_rows = std::max( size_t( 8 ), options_.band_rows / 8 * 8 );
+    const size_t step = 2 * max_lanes;
+    padded_ = ( width_ + step - 1 ) / step * step;
+    plane_ = padded_ + 4 * max_lanes;
+    const size_t bpp = bytes_per_pixel( options_.format );
+    for ( size_t i = 0; i < pool_.size(); ++i ) {
+        auto s = std::make_unique< scratch >();
+        if ( padded_ != width_ )
+            s->lines.assign( 8 * padded_ * bpp, 0 );
+        s->planes.assign( 15 * channels( options_.format ) * plane_, 0 );
+        s->out.assign( ( padded_ / 2 + step ) * bpp, 0 );
+        scratch_.emplace_back( std::move( s ) );
+    }
+}
+
+pyramid::~pyramid()
+{
+}
+
+size_t
+pyramid::offset( size_t level ) const
+{
+    size_t bytes = 0;
+    for ( size_t l = 1; l < level; ++l )
+        bytes += size( l );
+    return bytes;
+}
+
+void
+pyramid::band( size_t index, scratch& s, const uint8_t * src, size_t src_stride, uint8_t * dst ) const
+{
+    const size_t bpp = bytes_per_pixel( options_.format );
+    const size_t y_begin = index * options_.band_rows;
+    const size_t y_end = std::min( height_, y_begin + options_.band_rows );
+
+    group_args g;
+    g.width = width_;
+    g.format = options_.format;
+    g.method = options_.method;
+    g.levels = options_.levels;
+    g.planes = s.planes.data();
+    g.plane = plane_;
+    g.spill = s.out.data();
+    for ( size_t l = 1; l <= options_.levels; ++l )
+        g.stride[ l ] = stride( l );
+
+    group_function f = simd::kernel< group_kernel, 8, group_function >( options_.isa );
+    if ( options_.isa == simd::scalar )
+        f = group_scalar;
+
+    for ( size_t y = y_begin; y < y_end; y += 8 ) {
+        for ( size_t r = 0; r < 8; ++r ) {
+            g.rows[ r ] = src + ( y + r ) * src_stride;
+            if ( ! s.lines.empty() && options_.isa != simd::scalar ) { // vector loads run to the padded width
+                uint8_t * copy = s.lines.data() + r * padded_ * bpp;
+                std::memcpy( copy, g.rows[ r ], width_ * bpp );
+                g.rows[ r ] = copy;
+            }
+        }
+        for ( size_t l = 1; l <= options_.levels; ++l )
+            g.out[ l ] = dst + offset( l ) + ( y >> l ) * stride( l );
+        f( g );
+    }
+}
+
+bool
+pyramid::operator()( const uint8_t * src, size_t src_stride, uint8_t * dst )
+{
+    if ( ! src || ! dst || width_ < 16 || ( width_ % 16 ) || height_ < 8 || ( height_ % 8 ) )
+        return false;
+    const size_t bands = ( height_ + options_.band_rows - 1 ) / options_.band_rows;
+    pool_.run( bands, [&]( size_t t, size_t worker ){
+        band( t, *scratch_[ worker ], src, src_stride, dst );
+    });
+    return true;
+}
+
+std::shared_ptr< uint8_t >
+pyramid::operator()( const uint8_t * src, size_t src_stride, buffer_pool& pool )
+{
+    if ( pool.size() < size() )
+        return nullptr;
+    auto buffer = pool.acquire();
+    if ( buffer && ! ( *this )( src, src_stride, buffer.get() ) )
+        return nullptr;
+    return buffer;
+}
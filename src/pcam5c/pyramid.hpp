@@ -0,0 +1,103 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "buffer_pool.hpp"
+#include "simd.hpp"
+#include "thread_pool.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// 1/2, 1/4 and 1/8 copies of a frame for thumbnails, preview streams and coarse
+// analytics, made in one pass over the full-resolution buffer.  Each band of
+// eight source lines is decoded once into 16-bit planes (Y, U, V at half width,
+// or R, G, B[, A]); the 1/2 lines come from those, and the 1/4 and 1/8 lines from
+// the smaller ones while they are still in cache, so the full frame is read once
+// whatever the number of levels.  All levels share one output buffer, in the
+// source layout.
+//
+//   box        2x2 mean of the previous level (a 4x4 / 8x8 box, rounded per level)
+//   bilinear   centre 2x2 of each 2^n x 2^n source block, i.e. a half-pixel
+//              phase bilinear sample; sharper, and aliases
+//
+// Level 1 is the same for both.  The vector path (GCC vector extensions: NEON on
+// the target, SSSE3 or AVX2 on the host) produces the same bytes as the scalar
+// one.
+
+class pyramid {
+public:
+    enum layout {
+        gray8
+        , yuyv
+        , uyvy
+        , rgb24
+        , rgba32
+    };
+    enum filter {
+        box
+        , bilinear
+    };
+
+    static constexpr size_t max_levels = 3;
+
+    struct options {
+        layout format = uyvy;
+        filter method = box;
+        size_t levels = max_levels;   // 1 (1/2 only) to 3 (1/2, 1/4, 1/8)
+        size_t band_rows = 16;        // source lines per task, a multiple of 8
+        simd::isa isa = simd::best();
+    };
+
+    pyramid( size_t width, size_t height, thread_pool&, const options& );
+    ~pyramid();
+
+    static size_t bytes_per_pixel( layout );
+    inline size_t levels() const { return options_.levels; }
+    inline size_t width( size_t level ) const { return width_ >> level; }   // level 1 .. levels()
+    inline size_t height( size_t level ) const { return height_ >> level; }
+    inline size_t stride( size_t level ) const { return width( level ) * bytes_per_pixel( options_.format ); }
+    inline size_t size( size_t level ) const { return stride( level ) * height( level ); }
+    size_t offset( size_t level ) const;                // of a level in the output buffer
+    inline size_t size() const { return offset( levels() + 1 ); }
+    inline const options& settings() const { return options_; }
+
+    // width multiple of 16, height multiple of 8; 'dst' holds size() bytes, levels at offset()
+    bool operator()( const uint8_t * src, size_t src_stride, uint8_t * dst );
+
+    // into a buffer from 'pool' (buffers of at least size()); nullptr when the pool is exhausted
+    std::shared_ptr< uint8_t > operator()( const uint8_t * src, size_t src_stride, buffer_pool& );
+
+private:
+    struct scratch;
+    void band( size_t index, scratch&, const uint8_t * src, size_t src_stride, uint8_t * dst ) const;
+
+    size_t width_, height_;
+    size_t padded_;                 // source line length for the vector loads
+    size_t plane_;                  // plane length, with room for the last vector
+    thread_pool& pool_;
+    options options_;
+    std::vector< std::unique_ptr< scratch > > scratch_; // per worker
+};
@@ -0,0 +1,153 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "raw10.hpp"
+#if defined __x86_64__ || defined __i386__
+# include <immintrin.h>
+#endif
+#if defined __ARM_NEON
+# include <arm_neon.h>
+#endif
+
+namespace {
+
+    void
+    unpack_scalar( const uint8_t * src, uint16_t * dst, size_t pixels )
+    {
+        for ( size_t i = 0; i < pixels; i += 4, src += 5, dst += 4 ) {
+            const uint8_t lsb = src[ 4 ];
+            dst[ 0 ] = uint16_t( src[ 0 ] << 2 | ( lsb & 3 ) );
+            dst[ 1 ] = uint16_t( src[ 1 ] << 2 | ( lsb >> 2 & 3 ) );
+            dst[ 2 ] = uint16_t( src[ 2 ] << 2 | ( lsb >> 4 & 3 ) );
+            dst[ 3 ] = uint16_t( src[ 3 ] << 2 | ( lsb >> 6 ) );
+        }
+    }
+
+#if defined __x86_64__ || defined __i386__
+    // 8 pixels from the 10 bytes at the start of each 128-bit lane: the MSB bytes
+    // are spread to 16-bit lanes and shifted up; the LSB byte is broadcast to its
+    // four lanes and multiplied so that each pixel's two bits land at [7:6]
+    __attribute__(( target( "ssse3" ) ))
+    void
+    unpack_ssse3( const uint8_t * src, uint16_t * dst, size_t pixels )
+    {
+        const __m128i msb = _mm_setr_epi8( 0, -1, 1, -1, 2, -1, 3, -1, 5, -1, 6, -1, 7, -1, 8, -1 );
+        const __m128i lsb = _mm_setr_epi8( 4, -1, 4, -1, 4, -1, 4, -1, 9, -1, 9, -1, 9, -1, 9, -1 );
+        const __m128i mul = _mm_setr_epi16( 64, 16, 4, 1, 64, 16, 4, 1 );
+        const __m128i three = _mm_set1_epi16( 3 );
+
+        size_t i = 0;
+        for ( ; i + 16 <= pixels; i += 8, src += 10, dst += 8 ) { // 16-byte loads stay inside the line
+            const __m128i v = _mm_loadu_si128( reinterpret_cast< const __m128i * >( src ) );
+            const __m128i hi = _mm_slli_epi16( _mm_shuffle_epi8( v, msb ), 2 );
+            const __m128i lo = _mm_and_si128( _mm_srli_epi16( _mm_mullo_epi16( _mm_shuffle_epi8( v, lsb ), mul ), 6 ), three );
+            _mm_storeu_si128( reinterpret_cast< __m128i * >( dst ), _mm_or_si128( hi, lo ) );
+        }
+        unpack_scalar( src, dst, pixels - i );
+    }
+
+    __attribute__(( target( "avx2" ) ))
+    void
+    unpack_avx2( const uint8_t * src, uint16_t * dst, size_t pixels )
+    {
+        const __m256i msb = _mm256_setr_epi8( 0, -1, 1, -1, 2, -1, 3, -1, 5, -1, 6, -1, 7, -1, 8, -1
+                                              , 0, -1, 1, -1, 2, -1, 3, -1, 5, -1, 6, -1, 7, -1, 8, -1 );
+        const __m256i lsb = _mm256_setr_epi8( 4, -1, 4, -1, 4, -1, 4, -1, 9, -1, 9, -1, 9, -1, 9, -1
+                                              , 4, -1, 4, -1, 4, -1, 4, -1, 9, -1, 9, -1, 9, -1, 9, -1 );
+        const __m256i mul = _mm256_setr_epi16( 64, 16, 4, 1, 64, 16, 4, 1, 64, 16, 4, 1, 64, 16, 4, 1 );
+        const __m256i three = _mm256_set1_epi16( 3 );
+
+        size_t i = 0;
+        for ( ; i + 24 <= pixels; i += 16, src += 20, dst += 16 ) {
+            const __m256i v = _mm256_inserti128_si256(
+                _mm256_castsi128_si256( _mm_loadu_si128( reinterpret_cast< const __m128i * >( src ) ) )
+                , _mm_loadu_si128( reinterpret_cast< const __m128i * >( src + 10 ) ), 1 );
+            const __m256i hi = _mm256_slli_epi16( _mm256_shuffle_epi8( v, msb ), 2 );
+            const __m256i lo = _mm256_and_si256( _mm256_srli_epi16( _mm256_mullo_epi16( _mm256_shuffle_epi8( v, lsb ), mul ), 6 ), three );
+            _mm256_storeu_si256( reinterpret_cast< __m256i * >( dst ), _mm256_or_si256( hi, lo ) );
+        }
+        unpack_scalar( src, dst, pixels - i );
+    }
+#endif
+
+#if defined __ARM_NEON
+    // ARMv7 has no 128-bit table lookup; vtbl2 picks 8 bytes out of 16
+    void
+    unpack_neon( const uint8_t * src, uint16_t * dst, size_t pixels )
+    {
+        const uint8x8_t msb = { 0, 1, 2, 3, 5, 6, 7, 8 };
+        const uint8x8_t lsb = { 4, 4, 4, 4, 9, 9, 9, 9 };
+        const int8x8_t shift = { 0, -2, -4, -6, 0, -2, -4, -6 };
+        const uint8x8_t three = vdup_n_u8( 3 );
+
+        size_t i = 0;
+        for ( ; i + 24 <= pixels; i += 16, src += 20, dst += 16 ) {
+            const uint8x16_t a = vld1q_u8( src );
+            const uint8x16_t b = vld1q_u8( src + 10 );
+            const uint8x8x2_t ta = { { vget_low_u8( a ), vget_high_u8( a ) } };
+            const uint8x8x2_t tb = { { vget_low_u8( b ), vget_high_u8( b ) } };
+            const uint8x8_t la = vand_u8( vshl_u8( vtbl2_u8( ta, lsb ), shift ), three );
+            const uint8x8_t lb = vand_u8( vshl_u8( vtbl2_u8( tb, lsb ), shift ), three );
+            vst1q_u16( dst, vorrq_u16( vshll_n_u8( vtbl2_u8( ta, msb ), 2 ), vmovl_u8( la ) ) );
+            vst1q_u16( dst + 8, vorrq_u16( vshll_n_u8( vtbl2_u8( tb, msb ), 2 ), vmovl_u8( lb ) ) );
+        }
+        unpack_scalar( src, dst, pixels - i );
+    }
+#endif
+}
+
+void
+raw10::unpack( const uint8_t * src, uint16_t * dst, size_t pixels, simd::isa isa )
+{
+    switch ( isa ) {
+#if defined __x86_64__ || defined __i386__
+    case simd::avx2:  return unpack_avx2( src, dst, pixels );
+    case simd::ssse3: return unpack_ssse3( src, dst, pixels );
+#endif
+#if defined __ARM_NEON
+    case simd::neon:  return unpack_neon( src, dst, pixels );
+#endif
+    default:          return unpack_scalar( src, dst, pixels );
+    }
+}
+
+void
+raw10::unpack( const uint8_t * src, size_t src_stride
+               , uint16_t * dst, size_t dst_stride
+               , size_t width, size_t height, simd::isa isa )
+{
+    for ( size_t y = 0; y < height; ++y )
+        unpack( src + y * src_stride, dst + y * dst_stride, width, isa );
+}
+
+void
+raw10::pack( const uint16_t * src, uint8_t * dst, size_t pixels )
+{
+    for ( size_t i = 0; i < pixels; i += 4, src += 4, dst += 5 ) {
+        dst[ 0 ] = uint8_t( src[ 0 ] >> 2 );
+        dst[ 1 ] = uint8_t( src[ 1 ] >> 2 );
+        dst[ 2 ] = uint8_t( src[ 2 ] >> 2 );
+        dst[ 3 ] = uint8_t( src[ 3 ] >> 2 );
+        dst[ 4 ] = uint8_t( ( src[ 0 ] & 3 ) | ( src[ 1 ] & 3 ) << 2 | ( src[ 2 ] & 3 ) << 4 | ( src[ 3 ] & 3 ) << 6 );
+    }
+}
@@ -0,0 +1,50 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "simd.hpp"
+#include <cstddef>
+#include <cstdint>
+
+// MIPI CSI-2 RAW10 (cfg_1080p_30fps: 0x3034=0x1A, 0x4300=0x00, 0x501f=0x03):
+// every 4 pixels take 5 bytes, the 8 MSBs of pixels 0..3 followed by one byte
+// holding their 2 LSBs, pixel 0 in bits [1:0].  Unpacked samples are 10 bit
+// values in uint16_t.
+
+namespace raw10 {
+
+    constexpr size_t packed_size( size_t pixels ) { return pixels / 4 * 5; }
+
+    // 'pixels' must be a multiple of 4
+    void unpack( const uint8_t * src, uint16_t * dst, size_t pixels, simd::isa = simd::best() );
+
+    // frame of 'height' lines; src_stride in bytes, dst_stride in pixels
+    void unpack( const uint8_t * src, size_t src_stride
+                 , uint16_t * dst, size_t dst_stride
+                 , size_t width, size_t height, simd::isa = simd::best() );
+
+    // reference packer, for synthetic RAW10 frames and round-trip checks
+    void pack( const uint16_t * src, uint8_t * dst, size_t pixels );
+
+}
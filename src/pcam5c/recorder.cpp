@@ -0,0 +1,414 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "recorder.hpp"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <boost/format.hpp>
+
+recorder::recorder( const frame_buffer::format& fmt
+                    , const options& opts ) : format_( fmt )
+                                            , options_( opts )
+                                            , direct_( opts.direct )
+                                            , bounce_only_( false )
+                                            , head_( 0 )
+                                            , tail_( 0 )
+                                            , raw_( -1 )
+                                            , idx_( -1 )
+                                            , slot_( 0 )
+                                            , segment_( 0 )
+                                            , frame_size_( fmt.frame_size ? fmt.frame_size : fmt.height * ( fmt.stride ? fmt.stride : fmt.width * fmt.bytes_per_pixel ) )
+                                            , first_ns_( 0 )
+                                            , last_ns_( 0 )
+                                            , stats_{}
+                                            , capture_( nullptr )
+                                            , stop_( false )
+{
+    options_.depth = std::max( size_t( 1 ), options_.depth );
+    options_.segment_frames = std::max( size_t( 1 ), options_.segment_frames );
+    slot_size_ = uint32_t( ( frame_size_ + alignment - 1 ) & ~( alignment - 1 ) );
+    pending_.resize( options_.depth, pending{ frame_ref(), nullptr, { nullptr, 0 }, { 0, 0, 0 }, 0, 0, 0, true } );
+    if ( options_.uring ) {
+        ring_ = std::make_unique< uring >( unsigned( options_.depth ) );
+        if ( ! *ring_ )
+            std::cerr << "recorder: io_uring unavailable, writing synchronously" << std::endl;
+    }
+}
+
+recorder::~recorder()
+{
+    stop();
+    flush();
+    for ( auto& p: pending_ )
+        std::free( p.bounce );
+}
+
+bool
+recorder::open_segment()
+{
+    const auto base = ( boost::format( "%s/%s-%06d" ) % options_.directory % options_.prefix % segment_ ).str();
+    const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+    raw_ = ::open( ( base + ".raw" ).c_str(), flags | ( direct_ ? O_DIRECT : 0 ), 0644 );
+    if ( raw_ < 0 && direct_ && errno == EINVAL ) {
+        std::cerr << "recorder: " << options_.directory << " does not support O_DIRECT, writing behind the page cache" << std::endl;
+        direct_ = false;
+        raw_ = ::open( ( base + ".raw" ).c_str(), flags, 0644 );
+    }
+    if ( raw_ < 0 ) {
+        ::perror( ( "recorder::open " + base + ".raw" ).c_str() );
+        return false;
+    }
+    // reserve the whole segment up front so the filesystem does not allocate per write
+    if ( int rc = ::posix_fallocate( raw_, 0, off_t( options_.segment_frames ) * slot_size_ ) ) {
+        if ( rc != EOPNOTSUPP && rc != EINVAL ) {
+            std::cerr << "recorder: fallocate: " << std::strerror( rc ) << std::endl;
+            ::close( raw_ );
+            raw_ = -1;
+            return false;
+        }
+    }
+
+    idx_ = ::open( ( base + ".idx" ).c_str(), flags, 0644 );
+    if ( idx_ < 0 ) {
+        ::perror( ( "recorder::open " + base + ".idx" ).c_str() );
+        ::close( raw_ );
+        raw_ = -1;
+        return false;
+    }
+    index_header h = {};
+    h.magic = magic;
+    h.version = 2;
+    h.width = format_.width;
+    h.height = format_.height;
+    h.bytes_per_pixel = format_.bytes_per_pixel;
+    h.stride = format_.stride ? format_.stride : format_.width * format_.bytes_per_pixel;
+    h.frame_size = frame_size_;
+    h.slot_size = slot_size_;
+    if ( ::write( idx_, &h, sizeof( h ) ) != sizeof( h ) ) {
+        ::perror( "recorder::write index" );
+        return false;
+    }
+    slot_ = 0;
+    ++stats_.segments;
+    return true;
+}
+
+bool
+recorder::close_segment()
+{
+    bool ok = true;
+    while ( head_ != tail_ )
+        ok &= retire();
+    if ( raw_ >= 0 ) {
+        // give back the fallocate'd tail of a partial segment
+        if ( ::ftruncate( raw_, off_t( slot_ ) * slot_size_ ) < 0 ) {
+            ::perror( "recorder::ftruncate" );
+            ok = false;
+        }
+        ::close( raw_ );
+        raw_ = -1;
+        ++segment_;
+    }
+    if ( idx_ >= 0 ) {
+        if ( ::fdatasync( idx_ ) < 0 )
+            ok = false;
+        ::close( idx_ );
+        idx_ = -1;
+    }
+    return ok;
+}
+
+bool
+recorder::submit( pending& p )
+{
+    p.submitted_ns = frame_stats::now_ns();
+    if ( ! first_ns_ )
+        first_ns_ = p.submitted_ns;
+    p.done = false;
+    ++tail_;
+    stats_.max_inflight = std::max( stats_.max_inflight, size_t( tail_ - head_ ) );
+
+    if ( uses_uring() ) {
+        const uint64_t tag = ( tail_ - 1 ) % pending_.size();
+        if ( ring_->writev( raw_, &p.iov, 1, p.entry.offset, tag ) && ring_->submit() >= 0 )
+            return true;
+        std::cerr << "recorder: io_uring submission failed, writing synchronously" << std::endl;
+        ring_.reset();
+    }
+    ssize_t rc;
+    while ( ( rc = ::pwrite( raw_, p.iov.iov_base, p.iov.iov_len, off_t( p.entry.offset ) ) ) < 0 && errno == EINTR )
+        ;
+    p.res = rc < 0 ? -errno : int32_t( rc );
+    p.done = true;
+    p.completed_ns = frame_stats::now_ns();
+    return true;
+}
+
+bool
+recorder::write( const frame_ref& ref )
+{
+    if ( ! ref )
+        return false;
+    reap();
+    if ( raw_ >= 0 && slot_ == options_.segment_frames )
+        close_segment();
+    if ( raw_ < 0 && ! open_segment() )
+        return false;
+    if ( tail_ - head_ == pending_.size() && ! retire() )
+        return false;
+
+    auto& p = pending_[ tail_ % pending_.size() ];
+    const size_t valid = std::min( size_t( frame_size_ ), ref.length() );
+    p.entry = index_entry{ ref.seq(), ref.timestamp_ns(), uint64_t( slot_ ) * slot_size_, uint32_t( valid ), 0 };
+    ++slot_;
+
+    const size_t length = direct_ ? slot_size_ : frame_size_;
+    const bool aligned = ( reinterpret_cast< uintptr_t >( ref.data() ) & ( alignment - 1 ) ) == 0;
+    if ( ( ! direct_ || ( aligned && ! bounce_only_ ) ) && ref.length() >= frame_size_ ) {
+        // zero copy: the source mapping is page aligned, so rounding up to the slot stays inside it
+        p.ref = ref;
+        p.iov = { const_cast< uint8_t * >( ref.data() ), length };
+    } else {
+        if ( ! p.bounce && ! ( p.bounce = static_cast< uint8_t * >( std::aligned_alloc( alignment, slot_size_ ) ) ) ) {
+            std::cerr << "recorder: out of memory" << std::endl;
+            return false;
+        }
+        // only the valid bytes go out; the O_DIRECT rounding is zero padded
+        const size_t bytes = direct_ ? ( valid + alignment - 1 ) & ~( alignment - 1 ) : valid;
+        std::memcpy( p.bounce, ref.data(), valid );
+        std::memset( p.bounce + valid, 0, bytes - valid );
+        if ( ! ref.valid() )
+            ++stats_.torn;
+        p.ref = frame_ref();
+        p.iov = { p.bounce, bytes };
+        ++stats_.bounced;
+    }
+    return submit( p );
+}
+
+bool
+recorder::admit( const frame_ref& ref )
+{
+    if ( ! options_.gate )
+        return write( ref );
+    if ( ! options_.gate( ref ) ) {
+        if ( options_.pre_roll ) {
+            if ( pre_roll_.size() == options_.pre_roll ) {
+                pre_roll_.pop_front();
+                ++stats_.gated;
+            }
+            pre_roll_.emplace_back( ref );
+        } else {
+            ++stats_.gated;
+        }
+        return true;
+    }
+    for ( ; ! pre_roll_.empty(); pre_roll_.pop_front() ) {
+        if ( ! pre_roll_.front().valid() ) {
+            ++stats_.torn;
+            ++stats_.gated;
+        } else if ( ! write( pre_roll_.front() ) ) {
+            return false;
+        }
+    }
+    return write( ref );
+}
+
+bool
+recorder::retire()
+{
+    if ( head_ == tail_ )
+        return true;
+    auto& p = pending_[ head_ % pending_.size() ];
+    while ( ! p.done ) {
+        auto c = ring_ ? ring_->wait() : std::nullopt;
+        if ( ! c ) {
+            std::cerr << "recorder: lost io_uring completion" << std::endl;
+            p.res = -EIO;
+            p.done = true;
+            p.completed_ns = frame_stats::now_ns();
+            break;
+        }
+        mark( *c );
+    }
+
+    if ( p.res == -EFAULT && p.ref ) {
+        // the mapping cannot be pinned for O_DIRECT (PFN map); bounce from now on
+        bounce_only_ = true;
+        if ( ! p.bounce )
+            p.bounce = static_cast< uint8_t * >( std::aligned_alloc( alignment, slot_size_ ) );
+        if ( p.bounce ) {
+            std::memcpy( p.bounce, p.ref.data(), p.entry.length );
+            std::memset( p.bounce + p.entry.length, 0, p.iov.iov_len - p.entry.length );
+            if ( ! p.ref.valid() )
+                ++stats_.torn;
+            p.ref = frame_ref();
+            p.iov.iov_base = p.bounce;
+            ++stats_.bounced;
+            ssize_t rc = ::pwrite( raw_, p.iov.iov_base, p.iov.iov_len, off_t( p.entry.offset ) );
+            p.res = rc < 0 ? -errno : int32_t( rc );
+            p.completed_ns = frame_stats::now_ns();
+        }
+    }
+    complete( p );
+    ++head_;
+    return p.res >= 0;
+}
+
+void
+recorder::mark( const uring::completion& c )
+{
+    auto& p = pending_[ c.user_data % pending_.size() ];
+    p.res = c.res;
+    p.done = true;
+    p.completed_ns = frame_stats::now_ns();
+}
+
+void
+recorder::reap()
+{
+    // retire whatever finished in order, giving source buffers back as early as possible
+    if ( ring_ ) {
+        while ( auto c = ring_->peek() )
+            mark( *c );
+    }
+    while ( head_ != tail_ && pending_[ head_ % pending_.size() ].done )
+        retire();
+}
+
+void
+recorder::complete( pending& p )
+{
+    last_ns_ = p.completed_ns;
+    stats_.write_latency( double( p.completed_ns - p.submitted_ns ) );
+
+    if ( p.ref && ! p.ref.valid() )
+        ++stats_.torn; // VDMA overwrote the buffer while it was being written
+    p.ref = frame_ref();
+
+    if ( p.res < 0 || size_t( p.res ) < p.entry.length ) {
+        if ( stats_.errors++ == 0 )
+            std::cerr << "recorder: write failed: " << ( p.res < 0 ? std::strerror( -p.res ) : "short write" ) << std::endl;
+        p.res = p.res < 0 ? p.res : -EIO;
+        return;
+    }
+    if ( ::write( idx_, &p.entry, sizeof( p.entry ) ) != sizeof( p.entry ) )
+        ++stats_.errors;
+    ++stats_.frames;
+    stats_.bytes += p.entry.length;
+    if ( ! direct_ )
+        write_behind( p.entry );
+}
+
+void
+recorder::write_behind( const index_entry& e )
+{
+    // start writeback of this slot, then wait for and drop the one 'depth' slots back
+    ::sync_file_range( raw_, off_t( e.offset ), frame_size_, SYNC_FILE_RANGE_WRITE );
+    const uint64_t behind = uint64_t( pending_.size() ) * slot_size_;
+    if ( e.offset >= behind ) {
+        const off_t offset = off_t( e.offset - behind );
+        ::sync_file_range( raw_, offset, slot_size_
+                           , SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER );
+        ::posix_fadvise( raw_, offset, slot_size_, POSIX_FADV_DONTNEED );
+    }
+}
+
+bool
+recorder::flush()
+{
+    return close_segment();
+}
+
+bool
+recorder::start( capture& cap )
+{
+    if ( thread_.joinable() )
+        return false;
+    capture_ = &cap;
+    sub_ = cap.subscribe( capture::drop_oldest, options_.depth );
+    stop_ = false;
+    thread_ = std::thread( [this]{
+        while ( ! stop_ ) {
+            // poll completions every few ms while writes are in flight
+            if ( auto frame = sub_->pop( std::chrono::milliseconds( head_ != tail_ ? 2 : 100 ) ) ) {
+                if ( ! admit( *frame ) )
+                    break;
+            } else if ( head_ != tail_ ) {
+                reap();
+            } else if ( ! capture_->running() ) {
+                break;
+            }
+        }
+        while ( auto frame = sub_->try_pop() ) // frames already captured
+            admit( *frame );
+        stats_.gated += pre_roll_.size();
+        pre_roll_.clear();
+        flush();
+    });
+    return true;
+}
+
+void
+recorder::stop()
+{
+    stop_ = true;
+    if ( thread_.joinable() )
+        thread_.join();
+    if ( sub_ ) {
+        stats_.dropped = sub_->stats().dropped;
+        capture_->unsubscribe( sub_ );
+        sub_.reset();
+    }
+}
+
+recorder::stats
+recorder::statistics() const
+{
+    auto s = stats_;
+    s.seconds = last_ns_ > first_ns_ ? double( last_ns_ - first_ns_ ) * 1.0e-9 : 0;
+    return s;
+}
+
+void
+recorder::report( std::ostream& o ) const
+{
+    auto s = statistics();
+    o << boost::format( "record: %d frames, %.1f MB in %.3f s (%.1f MB/s, %.1f fps), %d segment(s), %s%s, depth %d" )
+        % s.frames % ( s.bytes / 1.0e6 ) % s.seconds
+        % ( s.seconds > 0 ? s.bytes / 1.0e6 / s.seconds : 0 ) % ( s.seconds > 0 ? s.frames / s.seconds : 0 )
+        % s.segments % ( direct_ ? "O_DIRECT" : "buffered" ) % ( uses_uring() ? " io_uring" : " pwrite" ) % pending_.size() << std::endl;
+    o << boost::format( "\tdropped %d, torn %d, bounced %d, errors %d, max in flight %d, write latency %.2f ms (sd %.2f, max %.2f)" )
+        % s.dropped % s.torn % s.bounced % s.errors % s.max_inflight
+        % ( s.write_latency.mean / 1.0e6 ) % ( s.write_latency.stddev() / 1.0e6 ) % ( s.write_latency.max / 1.0e6 ) << std::endl;
+    if ( options_.gate )
+        o << boost::format( "\tgated %d frame(s), pre-roll %d" ) % s.gated % options_.pre_roll << std::endl;
+}
@@ -0,0 +1,175 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "capture.hpp"
+#include "frame_stats.hpp"
+#include "uring.hpp"
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Streams captured frames to segment files: <prefix>-NNNNNN.raw holds
+// 'segment_frames' fixed-size slots (fallocate'd when the segment is opened,
+// trimmed when it is closed) and <prefix>-NNNNNN.idx holds an index_header
+// followed by one index_entry per frame in capture order.  Frames shorter than
+// the slot (JPEG trimmed to SOI..EOI) are written up to their length rounded to
+// the O_DIRECT alignment, zero padded; the rest of the slot is left unwritten
+// and reads back as zeros.
+//
+// Writes bypass the page cache (O_DIRECT) and up to 'depth' of them are kept in
+// flight through io_uring, so capture of frame n+1 overlaps the write of frame n.
+// A frame is written straight from the source mapping when the kernel can pin
+// it (memfd); VDMA mappings are PFN maps that O_DIRECT cannot pin, so those go
+// through an aligned bounce buffer.  Without io_uring the writes are synchronous
+// pwrite; on filesystems without O_DIRECT they are buffered and written behind
+// with sync_file_range + POSIX_FADV_DONTNEED to keep the page cache flat.
+//
+// With a 'gate' (a motion_detector, ...) only frames it passes are written; the
+// last 'pre_roll' frames it turned down are held and written ahead of the first
+// one it passes.  They are held as frame_refs, so pre_roll must stay below the
+// number of source buffers, and held frames the writer reached are not written.
+
+class recorder {
+public:
+    struct options {
+        std::string directory = ".";
+        std::string prefix = "pcam5c";
+        size_t segment_frames = 256;
+        size_t depth = 3;          // writes in flight, and queued frames
+        bool direct = true;        // O_DIRECT
+        bool uring = true;         // io_uring, else pwrite
+        std::function< bool( const frame_ref& ) > gate; // on the writer thread, every frame in order
+        size_t pre_roll = 0;
+    };
+
+    struct index_header {          // 64 bytes at the start of every .idx
+        uint32_t magic;            // "p5ix"
+        uint32_t version;
+        uint32_t width;
+        uint32_t height;
+        uint32_t bytes_per_pixel;
+        uint32_t stride;
+        uint32_t frame_size;       // valid bytes per slot
+        uint32_t slot_size;        // frame_size rounded up to the O_DIRECT alignment
+        uint32_t reserved[ 8 ];
+    };
+
+    struct index_entry {
+        uint64_t seq;
+        int64_t timestamp_ns;      // CLOCK_MONOTONIC
+        uint64_t offset;           // in the .raw of the same segment
+        uint32_t length;           // valid bytes at offset (version 2)
+        uint32_t reserved;
+    };
+
+    struct stats {
+        uint64_t frames;
+        uint64_t bytes;
+        uint64_t dropped;          // queue overflow: storage fell behind
+        uint64_t torn;             // writer reached the buffer before it was copied/written
+        uint64_t gated;            // turned down by the gate
+        uint64_t bounced;          // written through a bounce buffer
+        uint64_t errors;
+        uint64_t segments;
+        size_t max_inflight;
+        double seconds;            // first submission to last completion
+        frame_stats::interval write_latency; // ns, submission to completion
+    };
+
+    static constexpr uint32_t magic = 0x78693570;
+    static constexpr size_t alignment = 4096;
+
+    recorder( const frame_buffer::format&, const options& );
+    ~recorder();
+
+    recorder( const recorder& ) = delete;
+    recorder& operator = ( const recorder& ) = delete;
+
+    // records frames from 'cap' on a writer thread until stop(); the subscription
+    // drops its oldest frame when storage falls behind
+    bool start( capture& );
+    void stop();
+
+    // what the writer thread does per frame; usable directly without start()
+    bool write( const frame_ref& );
+    // write() behind the gate and the pre-roll
+    bool admit( const frame_ref& );
+    // waits for every write in flight and closes the segment
+    bool flush();
+
+    // consistent once stop() or flush() returned
+    stats statistics() const;
+    void report( std::ostream& ) const;
+
+    inline bool direct() const { return direct_; }
+    inline bool uses_uring() const { return ring_ && bool( *ring_ ); }
+
+private:
+    struct pending {
+        frame_ref ref;             // held while the write reads from the source mapping
+        uint8_t * bounce;
+        iovec iov;
+        index_entry entry;
+        int64_t submitted_ns;
+        int64_t completed_ns;
+        int32_t res;
+        bool done;
+    };
+    bool open_segment();
+    bool close_segment();
+    bool submit( pending& );
+    bool retire();                 // completes the oldest write, waiting for it if needed
+    void reap();                   // completes finished writes without waiting
+    void mark( const uring::completion& );
+    void complete( pending& );
+    void write_behind( const index_entry& );
+
+    frame_buffer::format format_;
+    options options_;
+    bool direct_;
+    bool bounce_only_;
+    std::unique_ptr< uring > ring_;
+    std::vector< pending > pending_;
+    std::deque< frame_ref > pre_roll_;
+    uint64_t head_, tail_;         // pending_[ n % depth ] for head_ <= n < tail_
+    int raw_, idx_;
+    size_t slot_;                  // next slot in the segment
+    size_t segment_;
+    uint32_t frame_size_;
+    uint32_t slot_size_;
+    int64_t first_ns_, last_ns_;
+    stats stats_;
+
+    capture * capture_;
+    std::shared_ptr< capture::subscription > sub_;
+    std::atomic< bool > stop_;
+    std::thread thread_;
+};
@@ -0,0 +1,59 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <ostream>
+#include <boost/format.hpp>
+
+// Running count, mean, standard deviation (Welford) and range of a series of
+// samples: edge periods, frame intervals, latencies, control errors.
+
+struct running_stats {
+    size_t count = 0;
+    double mean = 0, m2 = 0, min = 0, max = 0;
+
+    inline void operator()( double x ) {
+        if ( count++ == 0 ) {
+            min = max = x;
+        } else {
+            min = std::min( min, x );
+            max = std::max( max, x );
+        }
+        double delta = x - mean;
+        mean += delta / count;
+        m2 += delta * ( x - mean );
+    }
+
+    inline double stddev() const { return count > 1 ? std::sqrt( m2 / ( count - 1 ) ) : 0; }
+
+    // one tab-indented line of ns samples in us; nothing when empty
+    inline void report( std::ostream& o, const char * label ) const {
+        if ( count )
+            o << boost::format( "\t%-12s n=%-6d mean=%12.3fus sd=%10.3fus min=%12.3fus max=%12.3fus jitter(p-p)=%10.3fus\n" )
+                % label % count % ( mean / 1e3 ) % ( stddev() / 1e3 ) % ( min / 1e3 ) % ( max / 1e3 ) % ( ( max - min ) / 1e3 );
+    }
+};
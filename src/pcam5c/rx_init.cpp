@@ -0,0 +1,53 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "rx_init.hpp"
+#include "csi2rx.hpp"
+#include "d_phyrx.hpp"
+
+// static
+rx_init
+rx_init::run( const csi2rx& csi2, const d_phyrx& dphy, size_t max_reads )
+{
+    csi2( control, control_srst );
+    dphy( control, control_srst );
+
+    rx_init result;
+    result.csi2_reads = csi2.wait_clear( control, control_srst, max_reads );
+    result.dphy_reads = dphy.wait_clear( control, control_srst, max_reads );
+    // GAMMA_BASE WRITE 3
+
+    // vdma.configureWire
+    // vdma.enable write
+
+    csi2( control, control_enable );
+    dphy( control, control_enable );
+
+    // vid.reset
+    // vdma.resetRead.
+    // vid.configurewire
+    // vdma.configureRead
+    // vid.enable
+    // vdma.enableRead
+    return result;
+}
@@ -0,0 +1,45 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <cstddef>
+#include <optional>
+
+class csi2rx;
+class d_phyrx;
+
+// CSI2 RX & MIPI D-PHY RX bring-up ('pcam5c --init'): soft reset both cores,
+// poll (bounded) until CONTROL.SRST clears, then enable them.  Works the same
+// against the hardware and against csi2rx::simulator() / d_phyrx::simulator().
+
+struct rx_init {
+    enum { control = 0x00, control_srst = 0x01, control_enable = 0x02 };
+
+    std::optional< size_t > csi2_reads; // reads until SRST cleared; empty on timeout
+    std::optional< size_t > dphy_reads;
+
+    inline operator bool () const { return csi2_reads && dphy_reads; }
+
+    static rx_init run( const csi2rx&, const d_phyrx&, size_t max_reads = 100 );
+};
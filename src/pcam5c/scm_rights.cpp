@@ -0,0 +1,88 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "scm_rights.hpp"
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+bool
+scm_rights::send( int sock, int fd, const void * data, size_t size )
+{
+    char dummy = 0;
+    iovec iov = { data && size ? const_cast< void * >( data ) : &dummy, data && size ? size : 1 };
+
+    alignas( cmsghdr ) char control[ CMSG_SPACE( sizeof( int ) ) ] = { 0 };
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof( control );
+
+    cmsghdr * cmsg = CMSG_FIRSTHDR( &msg );
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN( sizeof( int ) );
+    std::memcpy( CMSG_DATA( cmsg ), &fd, sizeof( int ) );
+
+    ssize_t rc;
+    while ( ( rc = ::sendmsg( sock, &msg, MSG_NOSIGNAL ) ) < 0 && errno == EINTR )
+        ;
+    if ( rc < 0 ) {
+        perror( "scm_rights::send" );
+        return false;
+    }
+    return true;
+}
+
+int
+scm_rights::receive( int sock, void * data, size_t size )
+{
+    char dummy;
+    iovec iov = { data && size ? data : &dummy, data && size ? size : 1 };
+
+    alignas( cmsghdr ) char control[ CMSG_SPACE( sizeof( int ) ) ] = { 0 };
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof( control );
+
+    ssize_t rc;
+    while ( ( rc = ::recvmsg( sock, &msg, MSG_CMSG_CLOEXEC ) ) < 0 && errno == EINTR )
+        ;
+    if ( rc <= 0 )
+        return -1;
+
+    for ( cmsghdr * cmsg = CMSG_FIRSTHDR( &msg ); cmsg; cmsg = CMSG_NXTHDR( &msg, cmsg ) ) {
+        if ( cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS ) {
+            int fd;
+            std::memcpy( &fd, CMSG_DATA( cmsg ), sizeof( int ) );
+            return fd;
+        }
+    }
+    return -1;
+}
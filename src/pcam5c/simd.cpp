@@ -0,0 +1,81 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "simd.hpp"
+
+bool
+simd::supported( isa i )
+{
+    switch ( i ) {
+    case scalar:
+        return true;
+#if defined __x86_64__ || defined __i386__
+    case ssse3:
+        return __builtin_cpu_supports( "ssse3" );
+    case avx2:
+        return __builtin_cpu_supports( "avx2" );
+#endif
+#if defined __ARM_NEON
+    case neon:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+simd::isa
+simd::best()
+{
+    static const isa __best = []{
+        for ( auto i: { neon, avx2, ssse3 } ) {
+            if ( supported( i ) )
+                return i;
+        }
+        return scalar;
+    }();
+    return __best;
+}
+
+std::vector< simd::isa >
+simd::available()
+{
+    std::vector< isa > a;
+    for ( auto i: { scalar, ssse3, avx2, neon } ) {
+        if ( supported( i ) )
+            a.emplace_back( i );
+    }
+    return a;
+}
+
+const char *
+simd::name( isa i )
+{
+    switch ( i ) {
+    case scalar: return "scalar";
+    case ssse3:  return "ssse3";
+    case avx2:   return "avx2";
+    case neon:   return "neon";
+    }
+    return "?";
+}
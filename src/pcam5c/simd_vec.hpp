@@ -0,0 +1,84 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "simd.hpp"
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+// Helpers shared by the GCC vector-extension kernels (colorconv, image_stats,
+// pyramid, motion_detector).  Vector types stay inside always_inline code; only
+// the per-ISA entry points below are real calls, and they take plain pointers.
+
+namespace simd {
+
+    template< typename V > __attribute__(( always_inline )) inline V load( const void * p ) { V v; std::memcpy( &v, p, sizeof( v ) ); return v; }
+    template< typename V > __attribute__(( always_inline )) inline void store( void * p, const V& v ) { std::memcpy( p, &v, sizeof( v ) ); }
+
+    // __builtin_shuffle masks; lane i takes element F::at( i ) of the (concatenated) inputs
+    template< typename V, typename F, size_t... I >
+    constexpr V make_mask( std::index_sequence< I... > )
+    {
+        typedef std::remove_cv_t< std::remove_reference_t< decltype( V{}[ 0 ] ) > > T;
+        return V{ T( F::at( I ) )... };
+    }
+    template< typename V, typename F >
+    constexpr V make_mask() { return make_mask< V, F >( std::make_index_sequence< sizeof( V ) / sizeof( V{}[ 0 ] ) >() ); }
+
+    struct even_lanes { static constexpr size_t at( size_t i ) { return 2 * i; } };
+    struct odd_lanes  { static constexpr size_t at( size_t i ) { return 2 * i + 1; } };
+    struct dup_lanes  { static constexpr size_t at( size_t i ) { return i / 2; } };
+
+    // K::run< M >( args... ) behind a function pointer of type F, compiled once per
+    // instruction set: the baseline vector ISA (NEON on the target, SSE2 on x86-64)
+    // and SSSE3 at M lanes, AVX2 at 2M
+    template< typename K, size_t M, typename F > struct entry;
+
+    template< typename K, size_t M, typename... A >
+    struct entry< K, M, void ( * )( A... ) > {
+        static void run_vec( A... a ) { K::template run< M >( a... ); }
+#if defined __x86_64__ || defined __i386__
+        __attribute__(( target( "ssse3" ) )) static void run_ssse3( A... a ) { K::template run< M >( a... ); }
+        __attribute__(( target( "avx2" ) )) static void run_avx2( A... a ) { K::template run< 2 * M >( a... ); }
+#endif
+    };
+
+    // scalar and NEON intrinsics paths are left to the caller
+    template< typename K, size_t M, typename F >
+    F
+    kernel( isa i )
+    {
+#if defined __x86_64__ || defined __i386__
+        if ( i == avx2 )
+            return entry< K, M, F >::run_avx2;
+        if ( i == ssse3 )
+            return entry< K, M, F >::run_ssse3;
+#endif
+        (void)i;
+        return entry< K, M, F >::run_vec;
+    }
+
+}
@@ -0,0 +1,84 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <optional>
+
+// Bounded single-producer/single-consumer ring; capacity is rounded up to a power of two.
+// push() is called only from the producer thread, pop() only from the consumer thread.
+
+template< typename T >
+class spsc_queue {
+    const size_t mask_;
+    std::unique_ptr< T[] > data_;
+    alignas(64) std::atomic< size_t > head_; // next slot to pop
+    alignas(64) std::atomic< size_t > tail_; // next slot to push
+
+    static size_t round_up( size_t n ) {
+        size_t size = 2;
+        while ( size < n )
+            size <<= 1;
+        return size;
+    }
+
+public:
+    spsc_queue( size_t capacity ) : mask_( round_up( capacity ) - 1 )
+                                  , data_( std::make_unique< T[] >( mask_ + 1 ) )
+                                  , head_( 0 )
+                                  , tail_( 0 ) {
+    }
+
+    spsc_queue( const spsc_queue& ) = delete;
+    spsc_queue& operator = ( const spsc_queue& ) = delete;
+
+    inline size_t capacity() const { return mask_ + 1; }
+
+    inline size_t size() const {
+        return tail_.load( std::memory_order_acquire ) - head_.load( std::memory_order_acquire );
+    }
+
+    inline bool empty() const { return size() == 0; }
+
+    bool push( const T& t ) {
+        const size_t tail = tail_.load( std::memory_order_relaxed );
+        if ( tail - head_.load( std::memory_order_acquire ) > mask_ )
+            return false; // full
+        data_[ tail & mask_ ] = t;
+        tail_.store( tail + 1, std::memory_order_release );
+        return true;
+    }
+
+    std::optional< T > pop() {
+        const size_t head = head_.load( std::memory_order_relaxed );
+        if ( head == tail_.load( std::memory_order_acquire ) )
+            return {};
+        T t = std::move( data_[ head & mask_ ] );
+        head_.store( head + 1, std::memory_order_release );
+        return t;
+    }
+};
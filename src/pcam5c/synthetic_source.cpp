@@ -0,0 +1,249 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "synthetic_source.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <thread>
+
+namespace {
+    frame_buffer::format
+    pattern_format( frame_buffer::format fmt, const test_pattern * pattern )
+    {
+        if ( pattern ) {
+            fmt.width = uint32_t( pattern->width() );
+            fmt.height = uint32_t( pattern->height() );
+            fmt.stride = uint32_t( std::max( size_t( fmt.stride ), pattern->line_size() ) );
+        }
+        return fmt;
+    }
+}
+
+synthetic_source::~synthetic_source()
+{
+    for ( auto& b: buffers_ ) {
+        ::munmap( b.data, format_.frame_size );
+        ::close( b.fd );
+    }
+}
+
+synthetic_source::synthetic_source( const frame_buffer::format& fmt
+                                    , double fps ) : format_( fmt )
+                                                   , period_( std::chrono::duration_cast< std::chrono::steady_clock::duration >(
+                                                                  std::chrono::duration< double >( 1.0 / ( fps > 0 ? fps : 30.0 ) ) ) )
+                                                   , due_( std::chrono::steady_clock::now() )
+                                                   , seq_( 0 )
+                                                   , dropped_( 0 )
+                                                   , next_( 0 )
+                                                   , ber_( 0 )
+                                                   , injected_( 0 )
+{
+    if ( format_.stride == 0 )
+        format_.stride = format_.width * format_.bytes_per_pixel;
+    format_.frame_size = format_.stride * format_.height;
+    if ( format_.buffer_count == 0 )
+        format_.buffer_count = 4;
+    format_.max_buffers = format_.buffer_count;
+    format_.flags = frame_buffer::coherent;
+
+    if ( format_.frame_size == 0 )
+        return;
+
+    for ( size_t i = 0; i < format_.buffer_count; ++i ) {
+        int fd = ::memfd_create( "synthetic_source", MFD_CLOEXEC | MFD_ALLOW_SEALING );
+        if ( fd < 0 ) {
+            ::perror( "synthetic_source::memfd_create" );
+            break;
+        }
+        if ( ::ftruncate( fd, format_.frame_size ) < 0
+             || ::fcntl( fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL ) < 0 ) {
+            ::perror( "synthetic_source::ftruncate" );
+            ::close( fd );
+            break;
+        }
+        void * p = ::mmap( nullptr, format_.frame_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0 );
+        if ( p == MAP_FAILED ) {
+            ::perror( "synthetic_source::mmap" );
+            ::close( fd );
+            break;
+        }
+        buffers_.emplace_back( buffer{ fd, reinterpret_cast< uint8_t * >( p ) } );
+    }
+    if ( buffers_.size() != format_.buffer_count ) {
+        for ( auto& b: buffers_ ) {
+            ::munmap( b.data, format_.frame_size );
+            ::close( b.fd );
+        }
+        buffers_.clear();
+        return;
+    }
+    busy_ = std::make_unique< std::atomic< bool >[] >( buffers_.size() );
+    for ( size_t i = 0; i < buffers_.size(); ++i )
+        busy_[ i ] = false;
+
+    ramp_.resize( format_.stride + 256 );
+    for ( size_t i = 0; i < ramp_.size(); ++i )
+        ramp_[ i ] = uint8_t( i );
+}
+
+synthetic_source::synthetic_source( const frame_buffer::format& fmt
+                                    , std::shared_ptr< const test_pattern > pattern
+                                    , double fps ) : synthetic_source( pattern_format( fmt, pattern.get() ), fps )
+{
+    pattern_ = std::move( pattern );
+}
+
+size_t
+synthetic_source::size() const
+{
+    return buffers_.size();
+}
+
+const uint8_t *
+synthetic_source::data( size_t index )
+{
+    return index < buffers_.size() ? buffers_[ index ].data : nullptr;
+}
+
+size_t
+synthetic_source::length( size_t index ) const
+{
+    return index < buffers_.size() ? format_.frame_size : 0;
+}
+
+frame_buffer::format
+synthetic_source::format() const
+{
+    return format_;
+}
+
+void
+synthetic_source::render( uint8_t * p, uint64_t seq ) const
+{
+    if ( pattern_ ) {
+        pattern_->render( p, format_.stride, seq );
+        return;
+    }
+    for ( size_t y = 0; y < format_.height; ++y )
+        std::memcpy( p + y * format_.stride, ramp_.data() + ( ( y + seq ) & 0xff ), format_.stride );
+    if ( format_.frame_size >= sizeof( seq ) ) {
+        for ( size_t i = 0; i < sizeof( seq ); ++i )
+            p[ i ] = uint8_t( seq >> ( 8 * i ) );
+    }
+}
+
+void
+synthetic_source::inject( double ber, uint64_t seed )
+{
+    ber_ = ber > 0 && ber < 1 ? ber : 0;
+    rng_.seed( seed );
+}
+
+void
+synthetic_source::corrupt( uint8_t * p )
+{
+    // gaps between flipped bits are geometric, so flips are independent at rate ber_
+    const size_t line = pattern_ ? pattern_->line_size() : format_.stride;
+    const uint64_t bits = uint64_t( line ) * format_.height * 8;
+    std::geometric_distribution< uint64_t > gap( ber_ );
+    for ( uint64_t bit = gap( rng_ ); bit < bits; bit += gap( rng_ ) + 1 ) {
+        const uint64_t byte = bit / 8;
+        p[ byte / line * format_.stride + byte % line ] ^= uint8_t( 1 << ( bit % 8 ) );
+        ++injected_;
+    }
+}
+
+int
+synthetic_source::next( frame& f, std::chrono::milliseconds timeout )
+{
+    if ( buffers_.empty() )
+        return -1;
+
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    for ( ;; ) {
+        if ( due_ > deadline ) {
+            std::this_thread::sleep_until( deadline );
+            return 0;
+        }
+        const auto tick = due_;
+        std::this_thread::sleep_until( tick );
+        due_ = tick + period_;
+        ++seq_;
+
+        // fell behind (consumer stalled the caller): the missed periods are lost frames
+        auto late = std::chrono::steady_clock::now() - tick;
+        if ( late >= period_ ) {
+            auto missed = uint64_t( late / period_ );
+            seq_ += missed;
+            dropped_ += uint32_t( missed );
+            due_ += period_ * missed;
+        }
+
+        size_t index = buffers_.size();
+        for ( size_t i = 0; i < buffers_.size(); ++i ) {
+            size_t k = ( next_ + i ) % buffers_.size();
+            if ( ! busy_[ k ].load( std::memory_order_acquire ) ) {
+                index = k;
+                break;
+            }
+        }
+        if ( index == buffers_.size() ) {
+            ++dropped_; // every buffer is held
+            continue;
+        }
+        next_ = ( index + 1 ) % buffers_.size();
+        busy_[ index ].store( true, std::memory_order_relaxed );
+        render( buffers_[ index ].data, seq_ );
+        if ( ber_ > 0 )
+            corrupt( buffers_[ index ].data );
+
+        timespec ts;
+        ::clock_gettime( CLOCK_MONOTONIC, &ts );
+        f = frame{ seq_, uint32_t( index ), int64_t( ts.tv_sec ) * 1000000000 + ts.tv_nsec, dropped_, -1, 0 };
+        dropped_ = 0;
+        return 1;
+    }
+}
+
+void
+synthetic_source::release( size_t index )
+{
+    if ( index < buffers_.size() )
+        busy_[ index ].store( false, std::memory_order_release );
+}
+
+int
+synthetic_source::export_fd( size_t index ) const
+{
+    if ( index >= buffers_.size() )
+        return -1;
+    int fd = ::fcntl( buffers_[ index ].fd, F_DUPFD_CLOEXEC, 0 );
+    if ( fd < 0 )
+        ::perror( "synthetic_source::export_fd" );
+    return fd;
+}
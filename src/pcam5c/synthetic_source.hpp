@@ -0,0 +1,88 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "frame_source.hpp"
+#include "test_pattern.hpp"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <vector>
+
+// Host-side frame_source: memfd-backed buffers filled with a moving ramp at a
+// fixed rate, so the capture pipeline and pcam5cd run without the board.
+// The first eight bytes of every frame carry its sequence number (little endian)
+// and each row y holds bytes ( x + y + seq ) & 0xff, which lets a reader check
+// what it got.  A buffer still held by a consumer is never written; when all are
+// held the frame is counted as dropped.
+// Given a test_pattern, frames are that pattern instead, bit for bit and without
+// the sequence stamp; the stride grows to the pattern's line size if needed.
+
+class synthetic_source : public frame_source {
+public:
+    ~synthetic_source();
+    synthetic_source( const frame_buffer::format&, double fps = 30.0 );
+    synthetic_source( const frame_buffer::format&, std::shared_ptr< const test_pattern >, double fps = 30.0 );
+
+    synthetic_source( const synthetic_source& ) = delete;
+    synthetic_source& operator = ( const synthetic_source& ) = delete;
+
+    inline explicit operator bool () const { return ! buffers_.empty(); }
+    inline const test_pattern * pattern() const { return pattern_.get(); }
+
+    // flips line bits of the frames that follow at 'ber' (bit error rate), for comparator tests
+    void inject( double ber, uint64_t seed = 5640 );
+    inline uint64_t injected() const { return injected_; }
+
+    size_t size() const override;
+    const uint8_t * data( size_t index ) override;
+    size_t length( size_t index ) const override;
+    frame_buffer::format format() const override;
+    int next( frame&, std::chrono::milliseconds timeout ) override;
+    void release( size_t index ) override;
+    int export_fd( size_t index ) const override; // memfd, sealed against resizing
+
+private:
+    void render( uint8_t *, uint64_t seq ) const;
+    void corrupt( uint8_t * );
+
+    struct buffer {
+        int fd;
+        uint8_t * data;
+    };
+    frame_buffer::format format_;
+    std::chrono::steady_clock::duration period_;
+    std::chrono::steady_clock::time_point due_;
+    std::vector< buffer > buffers_;
+    std::unique_ptr< std::atomic< bool >[] > busy_;
+    std::vector< uint8_t > ramp_;
+    std::shared_ptr< const test_pattern > pattern_;
+    uint64_t seq_;
+    uint32_t dropped_;
+    size_t next_;
+    double ber_;
+    uint64_t injected_;
+    std::mt19937_64 rng_;
+};
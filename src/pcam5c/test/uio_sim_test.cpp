@@ -0,0 +1,162 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "csi2rx.hpp"
+#include "d_phyrx.hpp"
+#include "rx_init.hpp"
+#include "uio_sim.hpp"
+#include <unistd.h>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+// CSI2 RX, MIPI D-PHY RX and the --init sequence against the simulated
+// register windows; exits non-zero on the first failed check
+
+namespace {
+
+    size_t failures = 0;
+
+    void check( bool ok, const std::string& what ) {
+        if ( ! ok ) {
+            std::cerr << "FAIL: " << what << std::endl;
+            ++failures;
+        }
+    }
+
+    void
+    test_uio_sim()
+    {
+        uio_sim sim( 0x20 );
+        check( bool( sim ), "memfd window" );
+        check( sim.poke( 0x04, 0x12345678 ) && sim.peek( 0x04 ) == 0x12345678u, "poke/peek" );
+        check( ! sim.peek( 0x20 ) && ! sim.poke( 0x1e, 0 ), "access past the window" );
+
+        sim.self_clearing( 0x00, 0x01, 2 );
+        sim.write( 0x00, 0x03 );
+        check( sim.read( 0x00 ) == 0x03u && sim.read( 0x00 ) == 0x03u, "SRST held for 2 reads" );
+        check( sim.read( 0x00 ) == 0x02u, "SRST clears, other bits kept" );
+        sim.write( 0x00, 0x02 );
+        check( sim.read( 0x00 ) == 0x02u, "writing 0 does not arm the reset" );
+
+        sim.poke( 0x08, 0xfffe00aa );
+        sim.counter( 0x08, 16, 16, 1 );
+        check( sim.read( 0x08 ) == 0xfffe00aau && sim.peek( 0x08 ) == 0xffff00aau, "counter advances after the read" );
+        sim.read( 0x08 );
+        check( sim.peek( 0x08 ) == 0x000000aau, "counter wraps inside its field" );
+
+        uint32_t regs[ 4 ];
+        const size_t reads = sim.reads();
+        check( sim.read( regs, 4, 0x00 ) && sim.reads() == reads + 4, "bulk read counted per word" );
+        check( regs[ 2 ] == 0x000000aau && sim.peek( 0x08 ) == 0x000100aau, "bulk read runs the hooks" );
+    }
+
+    void
+    test_file_backed()
+    {
+        char path[] = "/tmp/uio_sim_test.XXXXXX";
+        int fd = ::mkstemp( path );
+        check( fd >= 0, "mkstemp" );
+        if ( fd < 0 )
+            return;
+        ::close( fd );
+        {
+            uio_sim sim( path, 0x40 );
+            check( bool( sim ) && sim.write( 0x3c, 0xa5a5a5a5 ), "file window write" );
+        }
+        {
+            uio_sim sim( path, 0x40 );
+            check( sim.peek( 0x3c ) == 0xa5a5a5a5u, "file window keeps its registers" );
+        }
+        ::unlink( path );
+    }
+
+    void
+    test_csi2rx()
+    {
+        auto sim = csi2rx::simulator( 3 );
+        csi2rx csi2( sim );
+        check( csi2.simulated(), "csi2rx simulated" );
+        check( csi2( 0x04 ) == 0x03u, "csi2rx 4 active lanes" );
+        check( csi2( 0x60 ).value_or( 0 ) >> 16 == 1080, "csi2rx VC0 line count" );
+
+        const auto first = csi2( 0x10 ).value_or( 0 ) >> 16;
+        const auto second = csi2( 0x10 ).value_or( 0 ) >> 16;
+        check( second == first + 1, "csi2rx packet count advances per read" );
+
+        csi2( 0x00, 0x01 );
+        check( csi2.wait_clear( 0x00, 0x01, 100 ) == size_t( 4 ), "csi2rx SRST clears after 3 reads" );
+    }
+
+    void
+    test_d_phyrx()
+    {
+        auto sim = d_phyrx::simulator( 5 );
+        d_phyrx dphy( sim );
+        check( dphy( 0x18 ) == 0x08u, "d_phyrx CL_STATUS init done" );
+        for ( uint32_t lane = 0; lane < 4; ++lane ) {
+            const uint32_t addr = 0x1c + lane * 4;
+            const auto a = dphy( addr ), b = dphy( addr );
+            check( a && b && ( *a & 0xffff ) == 0x48 && ( *b >> 16 ) == ( *a >> 16 ) + 1
+                   , "d_phyrx DL" + std::to_string( lane + 1 ) + "_STATUS counter" );
+        }
+        dphy( 0x00, 0x01 );
+        check( dphy.wait_clear( 0x00, 0x01, 3 ) == std::nullopt, "d_phyrx SRST still set within the bound" );
+        check( dphy.wait_clear( 0x00, 0x01, 100 ).has_value(), "d_phyrx SRST clears" );
+    }
+
+    void
+    test_init()
+    {
+        auto csi2_sim = csi2rx::simulator( 3 );
+        auto dphy_sim = d_phyrx::simulator( 7 );
+        csi2rx csi2( csi2_sim );
+        d_phyrx dphy( dphy_sim );
+
+        const size_t writes = csi2_sim->writes();
+        auto result = rx_init::run( csi2, dphy );
+        check( bool( result ), "init succeeds" );
+        check( result.csi2_reads == size_t( 4 ) && result.dphy_reads == size_t( 8 ), "init polls until both resets clear" );
+        check( csi2_sim->peek( 0x00 ) == uint32_t( rx_init::control_enable )
+               && dphy_sim->peek( 0x00 ) == uint32_t( rx_init::control_enable ), "init leaves both cores enabled" );
+        check( csi2_sim->writes() == writes + 2, "init writes CONTROL twice" );
+
+        d_phyrx stuck( d_phyrx::simulator( 1000 ) );
+        auto timeout = rx_init::run( csi2, stuck, 100 );
+        check( ! timeout && timeout.csi2_reads && ! timeout.dphy_reads, "init reports a reset that never clears" );
+    }
+}
+
+int
+main()
+{
+    test_uio_sim();
+    test_file_backed();
+    test_csi2rx();
+    test_d_phyrx();
+    test_init();
+    if ( failures )
+        std::cerr << failures << " check(s) failed" << std::endl;
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,258 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "test_pattern.hpp"
+#include "raw10.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+    // bit 2: R, bit 1: G, bit 0: B
+    constexpr uint8_t bar_colors[ 8 ] = { 7, 6, 3, 2, 5, 4, 1, 0 };
+
+    inline uint8_t sat8( int v ) { return uint8_t( v < 0 ? 0 : v > 255 ? 255 : v ); }
+
+}
+
+test_pattern::test_pattern( size_t width
+                            , size_t height
+                            , layout format
+                            , uint8_t control ) : width_( width )
+                                                , height_( height )
+                                                , layout_( format )
+                                                , control_( control )
+{
+    const size_t line = line_size();
+    frame_.resize( line * height_ );
+    white_.resize( line * 2 );
+
+    std::vector< uint16_t > r( width_ ), g( width_ ), b( width_ );
+    std::fill( r.begin(), r.end(), 1023 );
+    std::fill( g.begin(), g.end(), 1023 );
+    std::fill( b.begin(), b.end(), 1023 );
+    encode( white_.data(), r.data(), g.data(), b.data(), 0 );
+    encode( white_.data() + line, r.data(), g.data(), b.data(), 1 );
+
+    const uint8_t mode = control_ & 0x03;
+    const size_t bar = std::max< size_t >( 1, width_ / 8 );
+    const size_t edge = std::max< size_t >( 2, height_ / 8 & ~size_t( 1 ) );
+
+    for ( size_t y = 0; y < height_; ++y ) {
+        for ( size_t x = 0; x < width_; ++x ) {
+            uint8_t color = 0;
+            uint16_t level = 1023;
+            if ( ! ( control_ & enable ) || mode == black || mode == random_data ) {
+                color = 0;
+            } else if ( mode == square ) {
+                const size_t k = x / edge + y / edge;
+                color = ( control_ & square_bw ) ? ( k & 1 ? 0 : 7 ) : bar_colors[ k % 8 ];
+            } else {
+                const size_t k = std::min< size_t >( 7, x / bar );
+                color = bar_colors[ k ];
+                switch ( control_ & bar_vertical_2 ) {
+                case bar_vertical_1:
+                    level = uint16_t( 1023 - y * 1023 / std::max< size_t >( 1, height_ - 1 ) );
+                    break;
+                case bar_horizontal: {
+                    const size_t span = ( k == 7 ? width_ - 7 * bar : bar );
+                    level = uint16_t( 1023 - ( x - k * bar ) * 1023 / std::max< size_t >( 1, span - 1 ) );
+                    break; }
+                case bar_vertical_2:
+                    level = uint16_t( y * 1023 / std::max< size_t >( 1, height_ - 1 ) );
+                    break;
+                }
+            }
+            r[ x ] = color & 4 ? level : 0;
+            g[ x ] = color & 2 ? level : 0;
+            b[ x ] = color & 1 ? level : 0;
+        }
+        encode( frame_.data() + y * line, r.data(), g.data(), b.data(), y );
+    }
+}
+
+size_t
+test_pattern::line_size( layout format, size_t width )
+{
+    switch ( format ) {
+    case raw10: return raw10::packed_size( width );
+    case rgb24: return width * 3;
+    case y8: return width;
+    default: break;
+    }
+    return width * 2;
+}
+
+std::optional< test_pattern::layout >
+test_pattern::parse_layout( const std::string& name )
+{
+    static const std::pair< const char *, layout > names[] = {
+        { "raw10", raw10 }, { "raw16", raw16 }, { "yuyv", yuyv }, { "uyvy", uyvy }
+        , { "rgb565le", rgb565le }, { "rgb565be", rgb565be }, { "rgb24", rgb24 }, { "y8", y8 }
+    };
+    for ( const auto& n: names ) {
+        if ( name == n.first )
+            return n.second;
+    }
+    return {};
+}
+
+std::optional< uint8_t >
+test_pattern::parse( const std::string& arg )
+{
+    if ( arg.compare( 0, 2, "0x" ) == 0 ) {
+        char * end = nullptr;
+        auto value = std::strtoul( arg.c_str(), &end, 16 );
+        if ( *end || value > 0xff )
+            return {};
+        return uint8_t( value );
+    }
+    static const std::pair< const char *, uint8_t > names[] = {
+        { "bar", enable | bar_standard | color_bar }
+        , { "bar-vertical", enable | bar_vertical_1 | color_bar }
+        , { "bar-horizontal", enable | bar_horizontal | color_bar }
+        , { "bar-vertical2", enable | bar_vertical_2 | color_bar }
+        , { "square", enable | square }
+        , { "square-bw", enable | square_bw | square }
+        , { "random", enable | random_data }
+        , { "black", enable | black }
+    };
+    const auto plus = arg.find( '+' );
+    const auto name = arg.substr( 0, plus );
+    uint8_t extra = 0;
+    if ( plus != std::string::npos ) {
+        if ( arg.substr( plus + 1 ) != "rolling" )
+            return {};
+        extra = rolling;
+    }
+    for ( const auto& n: names ) {
+        if ( name == n.first )
+            return uint8_t( n.second | extra );
+    }
+    return {};
+}
+
+bool
+test_pattern::animated() const
+{
+    return ( control_ & enable ) && ( ( control_ & rolling ) || ( control_ & 0x03 ) == random_data );
+}
+
+void
+test_pattern::encode( uint8_t * d, const uint16_t * r, const uint16_t * g, const uint16_t * b, size_t y ) const
+{
+    switch ( layout_ ) {
+    case raw10:
+    case raw16: {
+        // BGBG on even lines, GRGR on odd ones
+        std::vector< uint16_t > line( width_ );
+        for ( size_t x = 0; x < width_; ++x )
+            line[ x ] = y & 1 ? ( x & 1 ? r[ x ] : g[ x ] ) : ( x & 1 ? g[ x ] : b[ x ] );
+        if ( layout_ == raw10 ) {
+            raw10::pack( line.data(), d, width_ );
+        } else {
+            for ( size_t x = 0; x < width_; ++x ) {
+                d[ 2 * x ] = uint8_t( line[ x ] );
+                d[ 2 * x + 1 ] = uint8_t( line[ x ] >> 8 );
+            }
+        }
+        break; }
+    case yuyv:
+    case uyvy: {
+        const size_t yo = layout_ == yuyv ? 0 : 1, co = 1 - yo;
+        for ( size_t x = 0; x + 1 < width_; x += 2 ) {
+            const int r0 = r[ x ] >> 2, g0 = g[ x ] >> 2, b0 = b[ x ] >> 2;
+            const int r1 = r[ x + 1 ] >> 2, g1 = g[ x + 1 ] >> 2, b1 = b[ x + 1 ] >> 2;
+            const int rm = ( r0 + r1 + 1 ) >> 1, gm = ( g0 + g1 + 1 ) >> 1, bm = ( b0 + b1 + 1 ) >> 1;
+            uint8_t * p = d + 2 * x;
+            p[ yo ] = uint8_t( ( 77 * r0 + 150 * g0 + 29 * b0 + 128 ) >> 8 );
+            p[ co ] = sat8( ( ( -43 * rm - 85 * gm + 128 * bm + 128 ) >> 8 ) + 128 );
+            p[ yo + 2 ] = uint8_t( ( 77 * r1 + 150 * g1 + 29 * b1 + 128 ) >> 8 );
+            p[ co + 2 ] = sat8( ( ( 128 * rm - 107 * gm - 21 * bm + 128 ) >> 8 ) + 128 );
+        }
+        break; }
+    case rgb565le:
+    case rgb565be:
+        for ( size_t x = 0; x < width_; ++x ) {
+            const uint16_t v = uint16_t( ( r[ x ] >> 5 ) << 11 | ( g[ x ] >> 4 ) << 5 | b[ x ] >> 5 );
+            d[ 2 * x + ( layout_ == rgb565le ? 0 : 1 ) ] = uint8_t( v );
+            d[ 2 * x + ( layout_ == rgb565le ? 1 : 0 ) ] = uint8_t( v >> 8 );
+        }
+        break;
+    case rgb24:
+        for ( size_t x = 0; x < width_; ++x ) {
+            d[ 3 * x ] = uint8_t( r[ x ] >> 2 );
+            d[ 3 * x + 1 ] = uint8_t( g[ x ] >> 2 );
+            d[ 3 * x + 2 ] = uint8_t( b[ x ] >> 2 );
+        }
+        break;
+    case y8:
+        for ( size_t x = 0; x < width_; ++x )
+            d[ x ] = uint8_t( ( 77 * ( r[ x ] >> 2 ) + 150 * ( g[ x ] >> 2 ) + 29 * ( b[ x ] >> 2 ) + 128 ) >> 8 );
+        break;
+    }
+}
+
+void
+test_pattern::random( uint8_t * dst, size_t stride, uint64_t seq ) const
+{
+    // xorshift64*, one generator per frame; every line byte of the frame is random
+    uint64_t s = seq * 0x9e3779b97f4a7c15ull + 0x503d;
+    s = s ? s : 1;
+    const size_t line = line_size();
+    for ( size_t y = 0; y < height_; ++y ) {
+        uint8_t * d = dst + y * stride;
+        for ( size_t x = 0; x < line; x += 8 ) {
+            s ^= s >> 12;
+            s ^= s << 25;
+            s ^= s >> 27;
+            const uint64_t v = s * 0x2545f4914f6cdd1dull;
+            std::memcpy( d + x, &v, std::min< size_t >( 8, line - x ) );
+        }
+    }
+}
+
+void
+test_pattern::render( uint8_t * dst, size_t stride, uint64_t seq ) const
+{
+    const size_t line = line_size();
+    if ( ( control_ & enable ) && ( control_ & 0x03 ) == random_data ) {
+        random( dst, stride, seq );
+    } else if ( stride == line ) {
+        std::memcpy( dst, frame_.data(), frame_.size() );
+    } else {
+        for ( size_t y = 0; y < height_; ++y )
+            std::memcpy( dst + y * stride, frame_.data() + y * line, line );
+    }
+
+    if ( ( control_ & enable ) && ( control_ & rolling ) && height_ >= 2 ) {
+        const size_t band = std::max< size_t >( 2, height_ / 16 & ~size_t( 1 ) );
+        const size_t top = seq * 8 % height_ & ~size_t( 1 );
+        for ( size_t i = 0; i < band; ++i ) {
+            const size_t y = ( top + i ) % height_;
+            std::memcpy( dst + y * stride, white_.data() + ( y & 1 ) * line, line );
+        }
+    }
+}
@@ -0,0 +1,111 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Host rendition of the OV5640 pre-ISP test patterns, PRE ISP TEST SETTING 1
+// (0x503d):
+//
+//   [7]    enable
+//   [6]    rolling bar
+//   [5]    transparent (there is no image to blend with here, ignored)
+//   [4]    black/white squares (with [1:0]=10)
+//   [3:2]  00 standard eight bars, 01 gradual vertical 1, 10 gradual horizontal, 11 gradual vertical 2
+//   [1:0]  00 color bar, 01 random data, 10 square, 11 black
+//
+// Patterns are defined on 10-bit RGB: bars white, yellow, cyan, green, magenta,
+// red, blue, black over width/8 columns each (the last one takes the remainder);
+// gradual bars fade 1023..0 top to bottom (vertical 1), across each bar
+// (horizontal) or bottom to top (vertical 2); squares of height/8 lines (even)
+// cycle through the bar colors; the rolling bar is a white band of height/16
+// lines moving down 8 lines a frame; random data is xorshift64* seeded with the
+// frame sequence.  Lines are then encoded the way the output format stage
+// would deliver them: BGGR for RAW (0x4300=0x00, 0x501f=0x03), BT.601 full range
+// for YUV 4:2:2 (chroma of the pair average, as demosaic::yuyv), truncated for
+// RGB565.  The result is deterministic to the bit, so a rendered frame doubles
+// as the reference a received one is compared against.
+
+class test_pattern {
+public:
+    enum layout {
+        raw10         // MIPI packed BGGR, 4 pixels in 5 bytes
+        , raw16       // BGGR, 10-bit samples in uint16_t (little endian)
+        , yuyv        // 0x4300=0x30
+        , uyvy        // 0x4300=0x3f
+        , rgb565le    // 0x4300=0x6f
+        , rgb565be    // 0x4300=0x61
+        , rgb24
+        , y8          // 0x4300=0x10
+    };
+
+    static constexpr uint8_t enable = 0x80;
+    static constexpr uint8_t rolling = 0x40;
+    static constexpr uint8_t transparent = 0x20;
+    static constexpr uint8_t square_bw = 0x10;
+    static constexpr uint8_t bar_standard = 0x00;
+    static constexpr uint8_t bar_vertical_1 = 0x04;
+    static constexpr uint8_t bar_horizontal = 0x08;
+    static constexpr uint8_t bar_vertical_2 = 0x0c;
+    static constexpr uint8_t color_bar = 0x00;
+    static constexpr uint8_t random_data = 0x01;
+    static constexpr uint8_t square = 0x02;
+    static constexpr uint8_t black = 0x03;
+
+    // width multiple of 4 (raw10) or 2, height even
+    test_pattern( size_t width, size_t height, layout, uint8_t control = enable );
+
+    static size_t line_size( layout, size_t width );
+    static std::optional< layout > parse_layout( const std::string& );
+
+    // bar, bar-vertical, bar-horizontal, bar-vertical2, square, square-bw, random,
+    // black, optionally suffixed '+rolling', or a register value (0x80)
+    static std::optional< uint8_t > parse( const std::string& );
+
+    inline size_t width() const { return width_; }
+    inline size_t height() const { return height_; }
+    inline layout format() const { return layout_; }
+    inline uint8_t control() const { return control_; }
+    inline size_t line_size() const { return line_size( layout_, width_ ); }
+
+    // frames differ by sequence number (rolling bar, random data)
+    bool animated() const;
+
+    // frame 'seq' into 'dst'; stride >= line_size(), padding is left alone
+    void render( uint8_t * dst, size_t stride, uint64_t seq ) const;
+
+private:
+    void encode( uint8_t * dst, const uint16_t * r, const uint16_t * g, const uint16_t * b, size_t y ) const;
+    void random( uint8_t * dst, size_t stride, uint64_t seq ) const;
+
+    size_t width_, height_;
+    layout layout_;
+    uint8_t control_;
+    std::vector< uint8_t > frame_; // static part, line_size() stride
+    std::vector< uint8_t > white_; // one even and one odd line of the rolling bar
+};
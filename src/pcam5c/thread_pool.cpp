@@ -0,0 +1,101 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "thread_pool.hpp"
+#include <algorithm>
+
+thread_pool::thread_pool( size_t threads ) : task_( nullptr )
+                                           , tasks_( 0 )
+                                           , generation_( 0 )
+                                           , busy_( 0 )
+                                           , stop_( false )
+                                           , next_( 0 )
+{
+    if ( threads == 0 )
+        threads = std::max( 1u, std::thread::hardware_concurrency() );
+    for ( size_t i = 1; i < threads; ++i )
+        workers_.emplace_back( [this, i]{ work( i ); } );
+}
+
+thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard< std::mutex > lock( mutex_ );
+        stop_ = true;
+    }
+    start_.notify_all();
+    for ( auto& t: workers_ )
+        t.join();
+}
+
+void
+thread_pool::drain( size_t worker )
+{
+    size_t task;
+    while ( ( task = next_.fetch_add( 1, std::memory_order_relaxed ) ) < tasks_ )
+        ( *task_ )( task, worker );
+}
+
+void
+thread_pool::work( size_t worker )
+{
+    uint64_t seen = 0;
+    for ( ;; ) {
+        {
+            std::unique_lock< std::mutex > lock( mutex_ );
+            start_.wait( lock, [&]{ return stop_ || generation_ != seen; } );
+            if ( stop_ )
+                return;
+            seen = generation_;
+        }
+        drain( worker );
+        {
+            std::lock_guard< std::mutex > lock( mutex_ );
+            if ( --busy_ == 0 )
+                done_.notify_one();
+        }
+    }
+}
+
+void
+thread_pool::run( size_t tasks, const task_t& f )
+{
+    if ( workers_.empty() || tasks <= 1 ) {
+        for ( size_t i = 0; i < tasks; ++i )
+            f( i, 0 );
+        return;
+    }
+    {
+        std::lock_guard< std::mutex > lock( mutex_ );
+        task_ = &f;
+        tasks_ = tasks;
+        next_.store( 0, std::memory_order_relaxed );
+        busy_ = workers_.size();
+        ++generation_;
+    }
+    start_.notify_all();
+    drain( 0 );
+    std::unique_lock< std::mutex > lock( mutex_ );
+    done_.wait( lock, [&]{ return busy_ == 0; } );
+    task_ = nullptr;
+}
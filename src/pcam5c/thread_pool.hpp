@@ -0,0 +1,67 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fork-join workers for per-frame kernels (demosaic, statistics, ...): run()
+// hands out task indices (row tiles) to the workers and the calling thread,
+// and returns when every task is done.  One run() at a time.
+
+class thread_pool {
+public:
+    typedef std::function< void( size_t task, size_t worker ) > task_t;
+
+    // 'threads' includes the caller; 0 is one per CPU
+    thread_pool( size_t threads = 0 );
+    ~thread_pool();
+
+    thread_pool( const thread_pool& ) = delete;
+    thread_pool& operator = ( const thread_pool& ) = delete;
+
+    inline size_t size() const { return workers_.size() + 1; } // worker indices are [0, size())
+
+    void run( size_t tasks, const task_t& );
+
+private:
+    void work( size_t worker );
+    void drain( size_t worker );
+
+    std::vector< std::thread > workers_;
+    std::mutex mutex_;
+    std::condition_variable start_, done_;
+    const task_t * task_;
+    size_t tasks_;
+    uint64_t generation_;
+    size_t busy_;
+    bool stop_;
+    std::atomic< size_t > next_;
+};
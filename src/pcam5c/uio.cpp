@@ -23,6 +23,10 @@
  */
 
 #include "uio.hpp"
+#include "uio_sim.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <array>
 #include <cstdint>
 #include <fstream>
 #include <iostream>
@@ -30,69 +34,82 @@
 
 uio::~uio()
 {
+    if ( fd_ >= 0 )
+        ::close( fd_ );
 }
 
 uio::uio( const std::string& device ) : path_( device )
+                                      , fd_( ::open( device.c_str(), O_RDWR | O_CLOEXEC ) )
+{
+    if ( fd_ < 0 )
+        fd_ = ::open( device.c_str(), O_RDONLY | O_CLOEXEC );
+}
+
+uio::uio( std::shared_ptr< uio_sim > sim ) : path_( sim ? sim->path() : std::string() )
+                                           , fd_( -1 )
+                                           , sim_( sim )
 {
 }
 
 void
 uio::dump() const
 {
-    std::ifstream is( path_, std::ios::binary );
-    if ( is ) {
-        std::array< uint32_t, 16 > regs;
-        if ( is.read( reinterpret_cast< char * >(regs.data()), regs.size() * sizeof( uint32_t ) ) ) {
-            size_t i(0);
-            for ( const auto& reg: regs ) {
-                if ( ( i % 4 ) == 0 )
-                    std::cout << boost::format( "\n%04x: " ) % (i * sizeof(uint32_t));
-                std::cout << boost::format( "\t0x%08x" ) % reg;
-                ++i;
-            }
-            std::cout << std::endl;
+    std::array< uint32_t, 16 > regs;
+    if ( read( regs.data(), regs.size(), 0 ) ) {
+        size_t i(0);
+        for ( const auto& reg: regs ) {
+            if ( ( i % 4 ) == 0 )
+                std::cout << boost::format( "\n%04x: " ) % (i * sizeof(uint32_t));
+            std::cout << boost::format( "\t0x%08x" ) % reg;
+            ++i;
         }
+        std::cout << std::endl;
     }
 }
 
 std::optional< uint32_t >
 uio::read( uint32_t addr ) const
 {
-    std::ifstream is( path_, std::ios::binary );
-    if ( is ) {
-        is.seekg( addr / sizeof(uint32_t ) );
-        uint32_t data;
-        if ( is.read( reinterpret_cast< char * >(&data), sizeof( data ) ) ) {
-            return data;
-        }
-    }
+    if ( sim_ )
+        return sim_->read( addr );
+
+    uint32_t data;
+    if ( fd_ >= 0 && ::pread( fd_, &data, sizeof( data ), addr ) == sizeof( data ) )
+        return data;
     return {};
 }
 
 bool
 uio::read( uint32_t * data, size_t counts, uint32_t addr ) const
 {
-    std::ifstream is( path_, std::ios::binary );
-    if ( is ) {
-        is.seekg( addr / sizeof(uint32_t ) );
-        if ( is.read( reinterpret_cast< char * >( data ), sizeof( data ) * counts ) ) {
-            return true;
-        }
-    }
-    return false;
+    if ( sim_ )
+        return sim_->read( data, counts, addr );
+
+    const ssize_t size = counts * sizeof( uint32_t );
+    return fd_ >= 0 && ::pread( fd_, data, size, addr ) == size;
 }
 
 bool
 uio::write( uint32_t addr, uint32_t value ) const
 {
-    std::ofstream os( path_, std::ios::binary );
-    if ( os ) {
-        os.seekp( addr / sizeof(uint32_t ) );
-        if ( os.write( reinterpret_cast< char * >(&value), sizeof( value ) ) ) {
-            return true;
+    if ( sim_ )
+        return sim_->write( addr, value );
+
+    return fd_ >= 0 && ::pwrite( fd_, &value, sizeof( value ), addr ) == sizeof( value );
+}
+
+std::optional< size_t >
+uio::wait_clear( uint32_t addr, uint32_t mask, size_t max_reads ) const
+{
+    for ( size_t i = 1; i <= max_reads; ++i ) {
+        if ( auto value = read( addr ) ) {
+            if ( ( *value & mask ) == 0 )
+                return i;
+        } else {
+            return {};
         }
     }
-    return false;
+    return {};
 }
 
 // static
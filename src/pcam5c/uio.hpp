@@ -26,18 +26,30 @@
 
 #include <cstdint>
 #include <fstream>
+#include <memory>
 #include <optional>
 #include <boost/json.hpp>
 
+class uio_sim;
+
 class uio {
     std::string path_;
+    int fd_;
+    std::shared_ptr< uio_sim > sim_;
+    uio( const uio& ) = delete;
+    uio& operator = ( const uio& ) = delete;
 public:
     ~uio();
     uio( const std::string& device );
+    uio( std::shared_ptr< uio_sim > sim ); // simulated register window
+    inline const std::string& path() const { return path_; }
+    inline bool simulated() const { return bool( sim_ ); }
     void dump() const;
     std::optional< uint32_t > read( uint32_t addr ) const;
     bool read( uint32_t *, size_t counts, uint32_t addr = 0 ) const;
     bool write( uint32_t addr, uint32_t value ) const;
+    // poll until (reg & mask) == 0; returns number of reads taken, or empty on timeout
+    std::optional< size_t > wait_clear( uint32_t addr, uint32_t mask, size_t max_reads = 1000 ) const;
 
     inline bool operator()( uint32_t addr, uint32_t value ) const { return write( addr, value ); }
     inline std::optional< uint32_t > operator()( uint32_t addr ) const { return read( addr ); }
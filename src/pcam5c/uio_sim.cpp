@@ -0,0 +1,172 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "uio_sim.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <iostream>
+
+uio_sim::~uio_sim()
+{
+    if ( fd_ >= 0 )
+        ::close( fd_ );
+}
+
+uio_sim::uio_sim( size_t size ) : fd_( ::memfd_create( "uio_sim", MFD_CLOEXEC ) )
+                                , size_( size )
+                                , reads_( 0 )
+                                , writes_( 0 )
+{
+    if ( fd_ < 0 ) {
+        ::perror( "uio_sim::memfd_create" );
+    } else if ( ::ftruncate( fd_, size_ ) < 0 ) {
+        ::perror( "uio_sim::ftruncate" );
+    }
+}
+
+uio_sim::uio_sim( const std::string& file, size_t size ) : fd_( ::open( file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644 ) )
+                                                         , size_( size )
+                                                         , reads_( 0 )
+                                                         , writes_( 0 )
+{
+    struct stat st;
+    if ( fd_ < 0 ) {
+        ::perror( "uio_sim::open" );
+    } else if ( ::fstat( fd_, &st ) == 0 && size_t( st.st_size ) < size_ ) {
+        if ( ::ftruncate( fd_, size_ ) < 0 )
+            ::perror( "uio_sim::ftruncate" );
+    }
+}
+
+std::string
+uio_sim::path() const
+{
+    return "/proc/self/fd/" + std::to_string( fd_ );
+}
+
+std::optional< uint32_t >
+uio_sim::peek( uint32_t addr ) const
+{
+    uint32_t value;
+    if ( addr + sizeof( value ) <= size_
+         && ::pread( fd_, &value, sizeof( value ), addr ) == sizeof( value ) )
+        return value;
+    return {};
+}
+
+bool
+uio_sim::poke( uint32_t addr, uint32_t value )
+{
+    return addr + sizeof( value ) <= size_
+        && ::pwrite( fd_, &value, sizeof( value ), addr ) == sizeof( value );
+}
+
+std::optional< uint32_t >
+uio_sim::read( uint32_t addr )
+{
+    if ( auto value = peek( addr ) ) {
+        ++reads_;
+        auto it = read_hooks_.find( addr );
+        if ( it != read_hooks_.end() ) {
+            for ( auto& hook: it->second )
+                hook( *this, addr, *value );
+        }
+        return value;
+    }
+    return {};
+}
+
+bool
+uio_sim::read( uint32_t * data, size_t counts, uint32_t addr )
+{
+    const size_t size = counts * sizeof( uint32_t );
+    if ( addr + size > size_ || ::pread( fd_, data, size, addr ) != ssize_t( size ) )
+        return false;
+    reads_ += counts;
+    for ( auto it = read_hooks_.lower_bound( addr ); it != read_hooks_.end() && it->first < addr + size; ++it ) {
+        if ( ( it->first - addr ) % sizeof( uint32_t ) == 0 ) {
+            for ( auto& hook: it->second )
+                hook( *this, it->first, data[ ( it->first - addr ) / sizeof( uint32_t ) ] );
+        }
+    }
+    return true;
+}
+
+bool
+uio_sim::write( uint32_t addr, uint32_t value )
+{
+    if ( poke( addr, value ) ) {
+        ++writes_;
+        auto it = write_hooks_.find( addr );
+        if ( it != write_hooks_.end() ) {
+            for ( auto& hook: it->second )
+                hook( *this, addr, value );
+        }
+        return true;
+    }
+    return false;
+}
+
+void
+uio_sim::on_read( uint32_t addr, read_hook_t hook )
+{
+    read_hooks_[ addr ].emplace_back( std::move( hook ) );
+}
+
+void
+uio_sim::on_write( uint32_t addr, write_hook_t hook )
+{
+    write_hooks_[ addr ].emplace_back( std::move( hook ) );
+}
+
+void
+uio_sim::self_clearing( uint32_t addr, uint32_t mask, size_t nreads )
+{
+    auto remain = std::make_shared< size_t >( 0 );
+    on_write( addr, [=]( uio_sim&, uint32_t, uint32_t value ){
+        if ( value & mask )
+            *remain = nreads;
+    });
+    on_read( addr, [=]( uio_sim& sim, uint32_t addr, uint32_t& ){
+        if ( *remain && --(*remain) == 0 ) {
+            if ( auto current = sim.peek( addr ) )
+                sim.poke( addr, *current & ~mask );
+        }
+    });
+}
+
+void
+uio_sim::counter( uint32_t addr, uint32_t lsb, uint32_t width, uint32_t step )
+{
+    const uint32_t mask = ( width >= 32 ? 0xffffffff : ( ( 1u << width ) - 1 ) ) << lsb;
+    on_read( addr, [=]( uio_sim& sim, uint32_t addr, uint32_t& ){
+        if ( auto current = sim.peek( addr ) ) {
+            uint32_t next = ( ( ( *current & mask ) >> lsb ) + step ) << lsb;
+            sim.poke( addr, ( *current & ~mask ) | ( next & mask ) );
+        }
+    });
+}
@@ -0,0 +1,85 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Simulated register window for uio devices (csi2rx, d_phyrx, ...).
+// Registers live in a memfd (or a plain file) so that the window can also be
+// inspected from outside the process through /proc/<pid>/fd/<fd>.
+// Side effects are attached per register address and run on every read/write
+// issued through this object.
+
+class uio_sim {
+public:
+    typedef std::function< void( uio_sim&, uint32_t addr, uint32_t& value ) > read_hook_t;
+    typedef std::function< void( uio_sim&, uint32_t addr, uint32_t value ) > write_hook_t;
+
+    ~uio_sim();
+    uio_sim( size_t size = 0x100 );                          // memfd backed
+    uio_sim( const std::string& file, size_t size = 0x100 ); // plain file backed
+
+    uio_sim( const uio_sim& ) = delete;
+    uio_sim& operator = ( const uio_sim& ) = delete;
+
+    inline operator bool () const { return fd_ >= 0; }
+    inline int fd() const { return fd_; }
+    inline size_t size() const { return size_; }
+    std::string path() const;
+
+    // raw access, no side effects
+    std::optional< uint32_t > peek( uint32_t addr ) const;
+    bool poke( uint32_t addr, uint32_t value );
+
+    // register access as seen from the driver, side effects applied
+    std::optional< uint32_t > read( uint32_t addr );
+    bool read( uint32_t * data, size_t counts, uint32_t addr = 0 );
+    bool write( uint32_t addr, uint32_t value );
+
+    void on_read( uint32_t addr, read_hook_t );
+    void on_write( uint32_t addr, write_hook_t );
+
+    // bits in 'mask' written as 1 read back as 1 for 'nreads' reads, then clear (e.g. SRST)
+    void self_clearing( uint32_t addr, uint32_t mask, size_t nreads );
+    // field [lsb + width - 1 : lsb] advances by 'step' on every read (e.g. lane packet counters)
+    void counter( uint32_t addr, uint32_t lsb, uint32_t width, uint32_t step = 1 );
+
+    inline size_t reads() const  { return reads_; }
+    inline size_t writes() const { return writes_; }
+
+private:
+    int fd_;
+    size_t size_;
+    size_t reads_;
+    size_t writes_;
+    std::map< uint32_t, std::vector< read_hook_t > > read_hooks_;
+    std::map< uint32_t, std::vector< write_hook_t > > write_hooks_;
+};
@@ -0,0 +1,187 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "uring.hpp"
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+    int
+    io_uring_setup( unsigned entries, io_uring_params * p )
+    {
+        return int( ::syscall( __NR_io_uring_setup, entries, p ) );
+    }
+
+    int
+    io_uring_enter( int fd, unsigned to_submit, unsigned min_complete, unsigned flags )
+    {
+        return int( ::syscall( __NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0 ) );
+    }
+
+    template< typename T > T * at( void * base, uint32_t offset ) {
+        return reinterpret_cast< T * >( reinterpret_cast< uint8_t * >( base ) + offset );
+    }
+}
+
+uring::~uring()
+{
+    if ( sqes_ )
+        ::munmap( sqes_, sqes_size_ );
+    if ( cq_ptr_ && cq_ptr_ != sq_ptr_ )
+        ::munmap( cq_ptr_, cq_size_ );
+    if ( sq_ptr_ )
+        ::munmap( sq_ptr_, sq_size_ );
+    if ( fd_ >= 0 )
+        ::close( fd_ );
+}
+
+uring::uring( unsigned entries ) : fd_( -1 )
+                                 , sq_ptr_( nullptr ), sq_size_( 0 )
+                                 , cq_ptr_( nullptr ), cq_size_( 0 )
+                                 , sqes_( nullptr ), sqes_size_( 0 )
+                                 , sq_head_( nullptr ), sq_tail_( nullptr ), sq_mask_( nullptr ), sq_array_( nullptr )
+                                 , sq_entries_( 0 )
+                                 , cq_head_( nullptr ), cq_tail_( nullptr ), cq_mask_( nullptr )
+                                 , cqes_( nullptr )
+                                 , queued_( 0 )
+{
+    io_uring_params p;
+    std::memset( &p, 0, sizeof( p ) );
+    int fd = io_uring_setup( entries, &p );
+    if ( fd < 0 )
+        return; // caller falls back to synchronous writes
+
+    sq_size_ = p.sq_off.array + p.sq_entries * sizeof( unsigned );
+    cq_size_ = p.cq_off.cqes + p.cq_entries * sizeof( io_uring_cqe );
+    if ( p.features & IORING_FEAT_SINGLE_MMAP )
+        sq_size_ = cq_size_ = std::max( sq_size_, cq_size_ );
+
+    sq_ptr_ = ::mmap( nullptr, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING );
+    if ( sq_ptr_ == MAP_FAILED ) {
+        ::perror( "uring::mmap sq" );
+        sq_ptr_ = nullptr;
+        ::close( fd );
+        return;
+    }
+    if ( p.features & IORING_FEAT_SINGLE_MMAP ) {
+        cq_ptr_ = sq_ptr_;
+    } else {
+        cq_ptr_ = ::mmap( nullptr, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING );
+        if ( cq_ptr_ == MAP_FAILED ) {
+            ::perror( "uring::mmap cq" );
+            cq_ptr_ = nullptr;
+            ::close( fd );
+            return;
+        }
+    }
+    sqes_size_ = p.sq_entries * sizeof( io_uring_sqe );
+    sqes_ = ::mmap( nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES );
+    if ( sqes_ == MAP_FAILED ) {
+        ::perror( "uring::mmap sqes" );
+        sqes_ = nullptr;
+        ::close( fd );
+        return;
+    }
+
+    sq_head_ = at< unsigned >( sq_ptr_, p.sq_off.head );
+    sq_tail_ = at< unsigned >( sq_ptr_, p.sq_off.tail );
+    sq_mask_ = at< unsigned >( sq_ptr_, p.sq_off.ring_mask );
+    sq_array_ = at< unsigned >( sq_ptr_, p.sq_off.array );
+    sq_entries_ = p.sq_entries;
+    cq_head_ = at< unsigned >( cq_ptr_, p.cq_off.head );
+    cq_tail_ = at< unsigned >( cq_ptr_, p.cq_off.tail );
+    cq_mask_ = at< unsigned >( cq_ptr_, p.cq_off.ring_mask );
+    cqes_ = at< void >( cq_ptr_, p.cq_off.cqes );
+    fd_ = fd;
+}
+
+bool
+uring::writev( int fd, const iovec * iov, unsigned count, uint64_t offset, uint64_t user_data )
+{
+    if ( fd_ < 0 )
+        return false;
+    const unsigned head = __atomic_load_n( sq_head_, __ATOMIC_ACQUIRE );
+    const unsigned tail = *sq_tail_;
+    if ( tail - head >= sq_entries_ )
+        return false;
+
+    const unsigned index = tail & *sq_mask_;
+    auto sqe = reinterpret_cast< io_uring_sqe * >( sqes_ ) + index;
+    std::memset( sqe, 0, sizeof( *sqe ) );
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->addr = reinterpret_cast< uintptr_t >( iov );
+    sqe->len = count;
+    sqe->user_data = user_data;
+    sq_array_[ index ] = index;
+    __atomic_store_n( sq_tail_, tail + 1, __ATOMIC_RELEASE );
+    ++queued_;
+    return true;
+}
+
+int
+uring::submit( unsigned wait_nr )
+{
+    if ( fd_ < 0 )
+        return -EBADF;
+    int rc;
+    while ( ( rc = io_uring_enter( fd_, queued_, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0 ) ) < 0 && errno == EINTR )
+        ;
+    if ( rc < 0 )
+        return -errno;
+    queued_ -= std::min( unsigned( rc ), queued_ );
+    return rc;
+}
+
+std::optional< uring::completion >
+uring::peek()
+{
+    if ( fd_ < 0 )
+        return {};
+    const unsigned head = *cq_head_;
+    if ( head == __atomic_load_n( cq_tail_, __ATOMIC_ACQUIRE ) )
+        return {};
+    auto cqe = reinterpret_cast< const io_uring_cqe * >( cqes_ ) + ( head & *cq_mask_ );
+    completion c{ cqe->user_data, cqe->res };
+    __atomic_store_n( cq_head_, head + 1, __ATOMIC_RELEASE );
+    return c;
+}
+
+std::optional< uring::completion >
+uring::wait()
+{
+    for ( ;; ) {
+        if ( auto c = peek() )
+            return c;
+        if ( submit( 1 ) < 0 )
+            return {};
+    }
+}
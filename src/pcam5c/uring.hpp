@@ -0,0 +1,81 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <sys/uio.h>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+// Minimal io_uring submission/completion queue on the raw syscalls (no liburing
+// on the target), enough to keep a few file writes in flight.  The caller owns
+// the iovecs until their completion has been reaped.
+
+class uring {
+public:
+    struct completion {
+        uint64_t user_data;
+        int32_t res;          // bytes written or -errno
+    };
+
+    ~uring();
+    uring( unsigned entries = 8 );
+
+    uring( const uring& ) = delete;
+    uring& operator = ( const uring& ) = delete;
+
+    // false if the kernel has no io_uring (ENOSYS, or disabled by sysctl)
+    inline explicit operator bool () const { return fd_ >= 0; }
+
+    // queues IORING_OP_WRITEV; false if the submission queue is full
+    bool writev( int fd, const iovec *, unsigned count, uint64_t offset, uint64_t user_data );
+
+    // submits everything queued and waits for at least 'wait_nr' completions; -errno on failure
+    int submit( unsigned wait_nr = 0 );
+
+    // next completion if there is one, without blocking
+    std::optional< completion > peek();
+
+    // submits and blocks until a completion arrives
+    std::optional< completion > wait();
+
+private:
+    int fd_;
+    void * sq_ptr_;
+    size_t sq_size_;
+    void * cq_ptr_;
+    size_t cq_size_;
+    void * sqes_;
+    size_t sqes_size_;
+    unsigned * sq_head_;
+    unsigned * sq_tail_;
+    unsigned * sq_mask_;
+    unsigned * sq_array_;
+    unsigned sq_entries_;
+    unsigned * cq_head_;
+    unsigned * cq_tail_;
+    unsigned * cq_mask_;
+    void * cqes_;
+    unsigned queued_;
+};
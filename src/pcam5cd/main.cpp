@@ -0,0 +1,167 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2021 Toshinobu Hondo
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+// pcam5cd: owns the VDMA stream (or a synthetic source) and publishes every
+// frame through frame_ring to whatever processes attach to its socket.
+
+#include "capture.hpp"
+#include "frame_ring.hpp"
+#include "jpeg_source.hpp"
+#include "recorder.hpp"
+#include "synthetic_source.hpp"
+#include <signal.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <boost/format.hpp>
+#include <boost/program_options.hpp>
+
+namespace {
+    std::atomic< bool > __stop( false );
+
+    void
+    on_signal( int )
+    {
+        __stop = true;
+    }
+}
+
+int
+main( int argc, char **argv )
+{
+    namespace po = boost::program_options;
+    po::variables_map vm;
+    po::options_description description( argv[ 0 ] );
+    {
+        description.add_options()
+            ( "help,h",        "Display this help message" )
+            ( "socket,s",      po::value< std::string >()->default_value( "/run/pcam5cd.sock" ), "attach socket" )
+            ( "vdma",          po::value< std::string >()->default_value( frame_buffer::default_device ), "VDMA cdev (format set with pcam5c --vdma-format)" )
+            ( "jpeg",          "VDMA frames are sensor JPEG (pcam5c --startup --jpeg): publish SOI..EOI only" )
+            ( "synthetic",     "publish a synthetic ramp instead of VDMA frames (host testing)" )
+            ( "format",        po::value< std::vector< uint32_t > >()->multitoken()
+              , "--synthetic <width> <height> <bytes/pixel> [buffers] (default 1920 1080 4 4)" )
+            ( "fps",           po::value< double >()->default_value( 30.0 ), "--synthetic frame rate" )
+            ( "hold",          po::value< size_t >()->default_value( 0 ), "frames kept readable (0: buffers - 2)" )
+            ( "frames,n",      po::value< size_t >()->default_value( 0 ), "exit after publishing n frames (0: until SIGINT/SIGTERM)" )
+            ( "record",        po::value< std::string >(), "also record every frame into segment files in <dir> (O_DIRECT, io_uring)" )
+            ( "segment",       po::value< size_t >()->default_value( 256 ), "--record frames per segment file" )
+            ( "report",        po::value< double >()->default_value( 0 ), "print statistics every n seconds" )
+            ;
+        po::store( po::command_line_parser( argc, argv ).options( description ).run(), vm );
+        po::notify(vm);
+    }
+
+    if ( vm.count( "help" ) ) {
+        std::cout << description;
+        return 0;
+    }
+
+    std::shared_ptr< frame_source > source;
+    if ( vm.count( "synthetic" ) ) {
+        frame_buffer::format fmt{ 1920, 1080, 4 };
+        if ( vm.count( "format" ) ) {
+            auto args = vm[ "format" ].as< std::vector< uint32_t > >();
+            if ( args.size() < 3 ) {
+                std::cerr << "--format requires <width> <height> <bytes/pixel>" << std::endl;
+                return 1;
+            }
+            fmt = frame_buffer::format{ args[ 0 ], args[ 1 ], args[ 2 ] };
+            if ( args.size() > 3 )
+                fmt.buffer_count = args[ 3 ];
+        }
+        auto synthetic = std::make_shared< synthetic_source >( fmt, vm[ "fps" ].as< double >() );
+        if ( ! *synthetic )
+            return 1;
+        source = synthetic;
+    } else {
+        auto vdma = std::make_shared< vdma_source >( vm[ "vdma" ].as< std::string >() );
+        if ( ! *vdma )
+            return 1;
+        if ( vm.count( "jpeg" ) )
+            source = std::make_shared< jpeg_source >( vdma );
+        else
+            source = vdma;
+    }
+
+    capture cap( source );
+    auto sub = cap.subscribe( capture::latest_wins );
+    frame_ring::publisher ring( *source, vm[ "socket" ].as< std::string >(), vm[ "hold" ].as< size_t >() );
+    if ( ! ring )
+        return 1;
+
+    std::unique_ptr< recorder > rec;
+    if ( vm.count( "record" ) ) {
+        recorder::options opts;
+        opts.directory = vm[ "record" ].as< std::string >();
+        opts.segment_frames = vm[ "segment" ].as< size_t >();
+        rec = std::make_unique< recorder >( source->format(), opts );
+        rec->start( cap );
+    }
+
+    struct sigaction sa = {};
+    sa.sa_handler = on_signal;
+    ::sigaction( SIGINT, &sa, nullptr );
+    ::sigaction( SIGTERM, &sa, nullptr );
+
+    auto fmt = source->format();
+    std::cout << boost::format( "pcam5cd: %s %dx%d %d bytes/pixel, %d buffers on %s" )
+        % ( vm.count( "synthetic" ) ? "synthetic" : vm[ "vdma" ].as< std::string >() )
+        % fmt.width % fmt.height % fmt.bytes_per_pixel % source->size() % vm[ "socket" ].as< std::string >() << std::endl;
+
+    const size_t nframes = vm[ "frames" ].as< size_t >();
+    const auto interval = std::chrono::duration< double >( vm[ "report" ].as< double >() );
+    auto tp = std::chrono::steady_clock::now();
+    size_t published = 0;
+
+    if ( ! cap.start() )
+        return 1;
+
+    while ( ! __stop && ( nframes == 0 || published < nframes ) ) {
+        if ( auto frame = sub->pop( std::chrono::milliseconds( 10 ) ) ) {
+            ring.publish( *frame );
+            ++published;
+        } else if ( ! cap.running() ) {
+            break;
+        }
+        ring.service( std::chrono::milliseconds( 0 ) );
+
+        if ( interval.count() > 0 && std::chrono::steady_clock::now() - tp >= interval ) {
+            tp = std::chrono::steady_clock::now();
+            ring.report( std::cout );
+        }
+    }
+
+    cap.stop();
+    cap.report( std::cout );
+    if ( auto jpeg = std::dynamic_pointer_cast< jpeg_source >( source ) )
+        jpeg->report( std::cout );
+    ring.report( std::cout );
+    if ( rec ) {
+        rec->stop();
+        rec->report( std::cout );
+    }
+    return 0;
+}